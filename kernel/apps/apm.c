@@ -8,6 +8,7 @@
 #include "../fs/vfs.h"
 #include "../core/exc.h"
 #include "../core/user.h"
+#include "../mm/memacct.h"
 #include <string.h>
  
 static apm_entry_t packages[MAX_PACKAGES];
@@ -58,6 +59,7 @@ void apm_init(void) {
     for (int i = 0; i < MAX_PACKAGES; i++) {
         packages[i].installed = false;
     }
+    memacct_static(MEM_TAG_SHELL, "apm package table", sizeof(packages));
 }
 
 apm_lang_t apm_detect_lang(const char *filename) {
@@ -7,7 +7,27 @@
 #include "../drivers/vga.h"
 #include "../drivers/pit.h"
 #include "../mm/pmm.h"
-#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/shrinker.h"
+#include "../mm/memacct.h"
+#include "../proc/scheduler.h"
+#include "../proc/timer.h"
+#include "../proc/clock.h"
+#include "../proc/syscall.h"
+#include "../proc/uproc.h"
+#include "../proc/workqueue.h"
+#include "../proc/ipc.h"
+#include "../core/mpm.h"
+#include "../sync/rwlock.h"
+#include "../sync/seqlock.h"
+#include "../sync/rcu.h"
+#include "../lib/math.h"
+#include "../cpu/smp.h"
+#include "../cpu/idt.h"
+#include "../cpu/lapic.h"
+#include "../cpu/fpu.h"
+#include "../cpu/irqflags.h"
+#include "../drivers/irq.h"
 #include "../fs/vfs.h"
 #include "../errno.h"
 
@@ -36,6 +56,19 @@ int app_write(int argc, char **argv);
 int app_stat(int argc, char **argv);
 int app_df(int argc, char **argv);
 int app_free(int argc, char **argv);
+int app_slabinfo(int argc, char **argv);
+int app_meminfo(int argc, char **argv);
+int app_schedtest(int argc, char **argv);
+int app_timers(int argc, char **argv);
+int app_cpus(int argc, char **argv);
+int app_irqstat(int argc, char **argv);
+int app_membench(int argc, char **argv);
+int app_sysbench(int argc, char **argv);
+int app_forktest(int argc, char **argv);
+int app_lockbench(int argc, char **argv);
+int app_lockstat(int argc, char **argv);
+int app_irqsoff(int argc, char **argv);
+int app_ipcbench(int argc, char **argv);
 int app_hostname(int argc, char **argv);
 int app_date(int argc, char **argv);
 int app_help(int argc, char **argv);
@@ -48,6 +81,7 @@ int app_route(int argc, char **argv);
 int app_arp(int argc, char **argv);
 int app_dmesg(int argc, char **argv);
 int app_devguide(int argc, char **argv);
+static void apps_account_memory(void);
 
 
 static builtin_app_t builtins[] = {
@@ -83,6 +117,19 @@ static builtin_app_t builtins[] = {
     {"env",      "Show environment",            app_env,      false},
     {"df",       "Disk space usage",            app_df,       false},
     {"free",     "Memory usage",                app_free,     false},
+    {"slabinfo", "Kernel heap cache usage",     app_slabinfo, false},
+    {"meminfo",  "Memory usage by subsystem",   app_meminfo,  false},
+    {"schedtest", "Preemption stress test",     app_schedtest, false},
+    {"timers",   "Clock and timer statistics",  app_timers,   false},
+    {"cpus",     "Per-CPU scheduler statistics", app_cpus,    false},
+    {"irqstat",  "Interrupt counts and routing", app_irqstat, false},
+    {"membench", "memcpy throughput per kernel", app_membench, false},
+    {"sysbench", "Null syscall latency, int 0x80 vs sysenter", app_sysbench, false},
+    {"forktest", "Copy-on-write clone: pages shared vs copied", app_forktest, false},
+    {"lockbench", "Lock contention across CPUs", app_lockbench, false},
+    {"lockstat", "Spinlock contention statistics", app_lockstat, false},
+    {"irqsoff",  "Longest interrupts-off sections", app_irqsoff, false},
+    {"ipcbench", "Message port round-trip latency", app_ipcbench, false},
     {"hexview",  "Hex dump memory/file",        app_hexdump,  false},
     {"history",  "Command history",             app_history,  false},
     
@@ -131,6 +178,7 @@ static builtin_app_t builtins[] = {
 
 void apps_init(void) {
     apm_init();
+    apps_account_memory();
 }
 
 builtin_app_t* apps_find(const char *name) {
@@ -178,7 +226,9 @@ void apps_list(void) {
     tty_puts("  System Information:\n");
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     tty_puts("    pwd, whoami, hostname, uname, uptime, date\n");
-    tty_puts("    env, df, free, hexview, history\n\n");
+    tty_puts("    env, df, free, slabinfo, meminfo, schedtest, timers\n");
+    tty_puts("    cpus, irqstat, membench, sysbench, forktest, lockbench\n");
+    tty_puts("    lockstat, irqsoff, ipcbench, hexview, history\n\n");
     
     // User Management
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -715,8 +765,7 @@ int app_date(int argc, char **argv) {
     (void)argc;
     (void)argv;
     
-    u32 ticks = (u32)pit_get_ticks();
-    u32 secs = ticks / 100;
+    u32 secs = (u32)div_u64(clock_monotonic_ns(), 1000000000);
     u32 mins = secs / 60;
     u32 hours = mins / 60;
     u32 days = hours / 24;
@@ -883,6 +932,15 @@ int app_ip(int argc, char **argv) {
     return 0;
 }
 
+// Microseconds as milliseconds with three decimals
+static void print_usec_as_ms(int us) {
+    int frac = us % 1000;
+    tty_printf("%d.", us / 1000);
+    if (frac < 100) tty_puts("0");
+    if (frac < 10) tty_puts("0");
+    tty_printf("%d", frac);
+}
+
 int app_ping(int argc, char **argv) {
     if (argc < 2) {
         tty_puts("Usage: ping <ip-address> [count]\n");
@@ -939,7 +997,7 @@ int app_ping(int argc, char **argv) {
     tty_printf("PING %s: %d data bytes\n", ip_str, 64);
     
     int sent = 0, received = 0;
-    int min_rtt = 9999, max_rtt = 0, total_rtt = 0;
+    int min_rtt = 0x7FFFFFFF, max_rtt = 0, total_rtt = 0;
     
     for (int i = 0; i < count; i++) {
         sent++;
@@ -952,7 +1010,9 @@ int app_ping(int argc, char **argv) {
             total_rtt += rtt;
             
             vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-            tty_printf("Reply from %s: bytes=64 time=%dms TTL=64\n", ip_str, rtt);
+            tty_printf("Reply from %s: bytes=64 time=", ip_str);
+            print_usec_as_ms(rtt);
+            tty_puts("ms TTL=64\n");
             vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
         } else if (rtt == -2) {
             vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -982,7 +1042,13 @@ int app_ping(int argc, char **argv) {
     
     if (received > 0) {
         int avg_rtt = total_rtt / received;
-        tty_printf("rtt min/avg/max = %d/%d/%d ms\n", min_rtt, avg_rtt, max_rtt);
+        tty_puts("rtt min/avg/max = ");
+        print_usec_as_ms(min_rtt);
+        tty_puts("/");
+        print_usec_as_ms(avg_rtt);
+        tty_puts("/");
+        print_usec_as_ms(max_rtt);
+        tty_puts(" ms\n");
     }
     
     return received > 0 ? 0 : 1;
@@ -1494,6 +1560,939 @@ int app_free(int argc, char **argv) {
     tty_printf("Mem:     %10d  %10d  %10d\n", total, used, free_mem);
     tty_printf("         %7d KB  %7d KB  %7d KB\n", total/1024, used/1024, free_mem/1024);
     
+    pmm_zero_stats_t zs;
+    pmm_zero_pool_stats(&zs);
+    tty_printf("Zero pool: %u/%u pages (low %u), hits %u, misses %u, zeroed %u\n",
+               zs.pooled, zs.high, zs.low, zs.hits, zs.misses, zs.refilled);
+    
+    u32 low, high, runs, reclaimed;
+    pmm_get_watermarks(&low, &high);
+    shrinker_get_stats(&runs, &reclaimed);
+    tty_printf("Reclaim:   below %u KB free, %u runs, %u KB returned\n",
+               low * 4, runs, reclaimed * 4);
+    
+    return 0;
+}
+
+static void slabinfo_pad(const char *s, int width) {
+    int len = (int)strlen(s);
+    tty_puts(s);
+    while (len++ < width) tty_puts(" ");
+}
+
+static void slabinfo_row(kmem_cache_t *c) {
+    slabinfo_pad(c->name, 14);
+    tty_printf("%u/%u obj  size %u  slabs %u (%u KB)  peak %u  alloc %u  free %u",
+               c->active_objects, c->total_objects, c->object_size,
+               c->slab_count, (c->slab_count << c->slab_order) * 4,
+               c->peak_objects, c->alloc_count, c->free_count);
+    if (c->alloc_failures) {
+        tty_printf("  fail %u", c->alloc_failures);
+    }
+    tty_puts("\n");
+}
+
+// Show per-cache kernel heap usage
+int app_slabinfo(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    tty_puts("cache         usage\n");
+    kmem_cache_foreach(slabinfo_row);
+    tty_printf("large kmalloc: %u KB\n", kmem_large_pages() * 4);
+    
+    return 0;
+}
+
+extern u8 kernel_end[];
+
+static void meminfo_num(u32 value, int width) {
+    char buf[12];
+    int i = 11;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value && i > 0);
+    slabinfo_pad("", width - (11 - i));
+    tty_puts(&buf[i]);
+}
+
+static void meminfo_region(const memacct_region_t *r) {
+    tty_puts("  ");
+    slabinfo_pad(memacct_tag_name(r->tag), 8);
+    slabinfo_pad(r->name, 26);
+    meminfo_num((r->bytes + 1023) / 1024, 6);
+    tty_puts(" KB\n");
+}
+
+// Show memory charged to each subsystem: static reservations and
+// dynamically allocated pages with their high-water mark
+int app_meminfo(int argc, char **argv) {
+    bool verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+    u32 static_total = 0, pages_total = 0;
+    
+    tty_puts("tag       static KB  current KB  peak KB\n");
+    for (int t = 0; t < MEM_TAG_COUNT; t++) {
+        memacct_tag_stats_t s;
+        memacct_get_stats((mem_tag_t)t, &s);
+        slabinfo_pad(memacct_tag_name((mem_tag_t)t), 8);
+        meminfo_num((s.static_bytes + 1023) / 1024, 11);
+        meminfo_num(s.pages * 4, 12);
+        meminfo_num(s.peak_pages * 4, 9);
+        tty_puts("\n");
+        static_total += s.static_bytes;
+        pages_total += s.pages;
+    }
+    slabinfo_pad("total", 8);
+    meminfo_num((static_total + 1023) / 1024, 11);
+    meminfo_num(pages_total * 4, 12);
+    tty_puts("\n\n");
+    
+    u32 image = (u32)kernel_end - 0x100000;
+    tty_printf("Kernel image: %u KB, %u KB in tagged static regions\n",
+               image / 1024, static_total / 1024);
+    tty_printf("Physical:     %u KB used of %u KB\n",
+               (pmm_get_total_memory() - pmm_get_free_memory()) / 1024,
+               pmm_get_total_memory() / 1024);
+    
+    if (verbose) {
+        tty_puts("\nStatic regions:\n");
+        memacct_foreach_region(meminfo_region);
+    } else {
+        tty_puts("(meminfo -v lists the static regions)\n");
+    }
+    return 0;
+}
+
+// Preemption stress test: two threads spin without ever yielding,
+// until they are killed
+static volatile u32 schedtest_count[2];
+
+static void schedtest_spin_a(void) {
+    while (!scheduler_killed()) schedtest_count[0]++;
+}
+
+static void schedtest_spin_b(void) {
+    while (!scheduler_killed()) schedtest_count[1]++;
+}
+
+int app_schedtest(int argc, char **argv) {
+    u32 ms = 1000;
+    if (argc > 1) {
+        ms = 0;
+        for (const char *s = argv[1]; *s >= '0' && *s <= '9'; s++) {
+            ms = ms * 10 + (*s - '0');
+        }
+        if (ms < 100) ms = 100;
+    }
+    
+    if (!irqs_enabled()) {
+        tty_puts("schedtest: interrupts are disabled\n");
+        return -1;
+    }
+    
+    schedtest_count[0] = schedtest_count[1] = 0;
+    ice_pid_t a = scheduler_create_process("spin-a", (u32)schedtest_spin_a);
+    ice_pid_t b = scheduler_create_process("spin-b", (u32)schedtest_spin_b);
+    if (!a || !b) {
+        scheduler_kill_process(a);
+        scheduler_kill_process(b);
+        tty_puts("schedtest: cannot create threads\n");
+        return -1;
+    }
+    
+    u32 sw0, pre0, sw1, pre1;
+    scheduler_get_stats(&sw0, &pre0);
+    
+    // The shell busy-waits too, so every thread only runs when the
+    // timer takes the CPU away from another one
+    tty_printf("Spinning 2 threads for %u ms...\n", ms);
+    u64 start = pit_get_ticks();
+    u32 shell_loops = 0;
+    while (pit_get_ticks() - start < ms / 10) {
+        shell_loops++;
+    }
+    
+    u32 ca = schedtest_count[0];
+    u32 cb = schedtest_count[1];
+    scheduler_kill_process(a);
+    scheduler_kill_process(b);
+    scheduler_get_stats(&sw1, &pre1);
+    
+    tty_printf("spin-a: %u loops\nspin-b: %u loops\nshell:  %u loops\n", ca, cb, shell_loops);
+    tty_printf("context switches: %u, timer preemptions: %u\n", sw1 - sw0, pre1 - pre0);
+    
+    bool ok = ca > 0 && cb > 0;
+    vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    tty_puts(ok ? "PASS: all threads made progress\n" : "FAIL: a thread was starved\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    return ok ? 0 : -1;
+}
+
+// Clock statistics; the sleep shows how quiet the timer is when idle
+int app_timers(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    u32 ms = (u32)timer_now_ms();
+    u32 irqs = pit_get_irq_count() + irq_sched_tick_count();
+    u32 secs = ms / 1000;
+    tty_printf("Uptime:           %u ms\n", ms);
+    tty_printf("Clock interrupts: %u (%u/s average)\n", irqs, secs ? irqs / secs : irqs);
+    tty_printf("Pending timers:   %u\n", timer_pending_count());
+    
+    workqueue_stats_t wq;
+    workqueue_get_stats(&wq);
+    tty_printf("Deferred work:    %u run, %u queued, %u merged, max wait %u ms\n",
+               wq.run, wq.queued, wq.merged, wq.max_latency_ms);
+    
+    rcu_stats_t rcu;
+    rcu_get_stats(&rcu);
+    tty_printf("RCU:              %u grace periods, %u/%u callbacks run, max wait %u ms\n",
+               rcu.grace_periods, rcu.callbacks_run, rcu.callbacks_queued, rcu.max_wait_ms);
+    
+    u32 before = pit_get_irq_count() + irq_sched_tick_count();
+    u32 start = (u32)timer_now_ms();
+    timer_sleep_ms(1000);
+    tty_printf("Idle 1 s sleep:   %u interrupts, woke after %u ms\n",
+               pit_get_irq_count() + irq_sched_tick_count() - before,
+               (u32)timer_now_ms() - start);
+    return 0;
+}
+
+int app_cpus(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    tty_printf("%u CPU(s) online\n", smp_cpu_count());
+    tty_puts("CPU  APIC  STATE    BUSY  READY  SWITCHES  STEALS  FPU  PID\n");
+    
+    for (u32 cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const cpu_t *c = smp_get_cpu(cpu);
+        sched_cpu_stats_t st;
+        if (!c || scheduler_get_cpu_stats(cpu, &st) != E_OK) continue;
+        
+        // Share of scheduler ticks spent outside the idle process
+        u32 total = st.busy_ticks + st.idle_ticks;
+        u32 busy = 0;
+        if (total >= 100) busy = st.busy_ticks / (total / 100);
+        else if (total) busy = st.busy_ticks * 100 / total;
+        if (busy > 100) busy = 100;
+        tty_printf("%u    %u     %s  %u%%    %u      %u       %u      %u    %u\n",
+                   cpu, c->apic_id, st.online ? "online " : "offline",
+                   busy, st.ready, st.switches, st.steals,
+                   fpu_get_trap_count(cpu), st.current);
+    }
+    return 0;
+}
+
+static u32 parse_u32(const char *s) {
+    u32 v = 0;
+    for (; *s >= '0' && *s <= '9'; s++) v = v * 10 + (*s - '0');
+    return v;
+}
+
+static const char *vector_name(u32 vec) {
+    static char buf[8];
+    if (vec == LAPIC_TIMER_VECTOR) return "ltimer";
+    if (vec == LAPIC_RESCHED_VECTOR) return "resched";
+    if (vec == 128) return "syscall";
+    if (vec >= IRQ_VECTOR_BASE && vec < IRQ_VECTOR_BASE + IRQ_LINES) {
+        u32 irq = vec - IRQ_VECTOR_BASE;
+        buf[0] = 'I'; buf[1] = 'R'; buf[2] = 'Q';
+        buf[3] = irq >= 10 ? '1' : '0' + (char)irq;
+        buf[4] = irq >= 10 ? '0' + (char)(irq - 10) : '\0';
+        buf[5] = '\0';
+        return buf;
+    }
+    return vec < 32 ? "exception" : "-";
+}
+
+// Interrupt counts per vector and CPU with the average handler cost;
+// "irqstat <irq> <cpu>" moves an IOAPIC line to another CPU
+int app_irqstat(int argc, char **argv) {
+    if (argc > 2) {
+        u32 irq = parse_u32(argv[1]);
+        u32 cpu = parse_u32(argv[2]);
+        int ret = irq < IRQ_LINES ? irq_set_affinity((u8)irq, cpu) : E_INVALID_ARG;
+        if (ret != E_OK) {
+            tty_printf("irqstat: cannot route IRQ%u to CPU %u\n", irq, cpu);
+            return -1;
+        }
+        tty_printf("IRQ%u now delivered to CPU %u\n", irq, cpu);
+        return 0;
+    }
+    
+    u32 ncpu = 0;
+    while (ncpu < SMP_MAX_CPUS && smp_get_cpu(ncpu)) ncpu++;
+    
+    tty_printf("Routing: %s\n", irq_get_mode() == IRQ_MODE_IOAPIC ? "IOAPIC" : "8259 PIC");
+    tty_puts("VEC  NAME       ");
+    for (u32 c = 0; c < ncpu; c++) tty_printf("CPU%u      ", c);
+    tty_puts("CYCLES/IRQ  ROUTE\n");
+    
+    for (u32 vec = 0; vec < 256; vec++) {
+        u32 total = 0;
+        u64 cycles = 0;
+        idt_vector_stats_t st;
+        for (u32 c = 0; c < ncpu; c++) {
+            if (idt_get_vector_stats(c, (u8)vec, &st) == E_OK) {
+                total += st.count;
+                cycles += st.cycles;
+            }
+        }
+        if (!total) continue;
+        
+        tty_printf("%u  %s  ", vec, vector_name(vec));
+        for (u32 c = 0; c < ncpu; c++) {
+            idt_get_vector_stats(c, (u8)vec, &st);
+            tty_printf("%u  ", st.count);
+        }
+        
+        // No 64-bit division here: scale both down until cycles fits
+        u32 div = total;
+        while (cycles >> 32) {
+            cycles >>= 1;
+            div = (div >> 1) ? div >> 1 : 1;
+        }
+        tty_printf("%u", (u32)cycles / div);
+        
+        irq_route_t r;
+        u32 irq = vec - IRQ_VECTOR_BASE;
+        if (vec >= IRQ_VECTOR_BASE && irq < IRQ_LINES && irq_get_route((u8)irq, &r) == E_OK) {
+            tty_printf("  GSI%u->CPU%u %s/%s%s", r.gsi, r.cpu,
+                       r.level ? "level" : "edge", r.active_low ? "low" : "high",
+                       r.enabled ? "" : " masked");
+        }
+        tty_puts("\n");
+    }
+    return 0;
+}
+
+#define MEMBENCH_ORDER 8          // 1 MiB source and destination
+
+static const u32 membench_sizes[] = {64, 4096, 1024 * 1024};
+static const u32 membench_iters[] = {4096, 256, 4};
+
+// Print the copy rate of one kernel and size in bytes/cycle
+static void membench_run(memcpy_fn_t copy, u8 *dst, const u8 *src, u32 size, u32 iters) {
+    copy(dst, src, size);
+    u64 start = cycles();
+    for (u32 i = 0; i < iters; i++) copy(dst, src, size);
+    u64 spent = cycles() - start;
+    
+    u64 bytes = (u64)size * iters * 100;
+    while (spent >> 32) {
+        spent >>= 1;
+        bytes >>= 1;
+    }
+    u32 rate = spent ? (u32)div_u64(bytes, (u32)spent) : 0;
+    tty_printf("  %u.%u%u", rate / 100, (rate / 10) % 10, rate % 10);
+}
+
+int app_membench(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    if (!clock_tsc_khz()) {
+        tty_puts("membench: no TSC\n");
+        return 1;
+    }
+    
+    u8 *src = (u8*)pmm_alloc_pages(MEMBENCH_ORDER);
+    u8 *dst = (u8*)pmm_alloc_pages(MEMBENCH_ORDER);
+    if (!src || !dst) {
+        if (src) pmm_free_pages((phys_addr_t)src, MEMBENCH_ORDER);
+        if (dst) pmm_free_pages((phys_addr_t)dst, MEMBENCH_ORDER);
+        tty_puts("membench: out of memory\n");
+        return 1;
+    }
+    memacct_charge_pages(MEM_TAG_SHELL, 2u << MEMBENCH_ORDER);
+    for (u32 i = 0; i < (PAGE_SIZE << MEMBENCH_ORDER); i++) src[i] = (u8)i;
+    
+    tty_printf("memcpy bytes/cycle (using %s)\n", string_get_variant());
+    tty_puts("KERNEL    64 B  4 KiB  1 MiB\n");
+    for (u32 v = 0; v < string_memcpy_variant_count(); v++) {
+        const memcpy_variant_t *var = string_get_memcpy_variant(v);
+        if (!var) continue;
+        tty_printf("%s", var->name);
+        slabinfo_pad(var->name, 8);
+        for (u32 i = 0; i < 3; i++) {
+            membench_run(var->copy, dst, src, membench_sizes[i], membench_iters[i]);
+        }
+        tty_puts("\n");
+    }
+    tty_puts("memcpy  ");
+    for (u32 i = 0; i < 3; i++) {
+        membench_run(memcpy, dst, src, membench_sizes[i], membench_iters[i]);
+    }
+    tty_puts("\n");
+    
+    pmm_free_pages((phys_addr_t)src, MEMBENCH_ORDER);
+    pmm_free_pages((phys_addr_t)dst, MEMBENCH_ORDER);
+    memacct_uncharge_pages(MEM_TAG_SHELL, 2u << MEMBENCH_ORDER);
+    return 0;
+}
+
+#define UB_STR(x) #x
+#define UB_XSTR(x) UB_STR(x)
+#define UB_BASE UB_XSTR(USER_BASE)
+#define UB_ADDR(label) "(" UB_BASE " + (" label " - ubench_start))"
+
+// Ring 3 program for sysbench, linked at USER_BASE. It times
+// ubench_params[0] null system calls through int 0x80 and, when
+// ubench_params[1] is set, through sysenter, then prints cycles per
+// call with SYS_WRITE.
+__asm__ (
+    ".section .rodata\n"
+    ".global ubench_start, ubench_params, ubench_end\n"
+    "ubench_start:\n"
+    "    movl " UB_ADDR("ubench_params") ", %ebx\n"
+    "    rdtsc\n"
+    "    movl %eax, " UB_ADDR("ub_t0") "\n"
+    "1:  movl $0, %eax\n"                      // SYS_NULL
+    "    int $0x80\n"
+    "    decl %ebx\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    subl " UB_ADDR("ub_t0") ", %eax\n"
+    "    movl %eax, " UB_ADDR("ub_int") "\n"
+    "    cmpl $0, " UB_ADDR("ubench_params") " + 4\n"
+    "    je ub_report\n"
+    "    movl " UB_ADDR("ubench_params") ", %ebx\n"
+    "    rdtsc\n"
+    "    movl %eax, " UB_ADDR("ub_t0") "\n"
+    "2:  movl $0, %eax\n"
+    "    movl %esp, %ecx\n"
+    "    movl $" UB_ADDR("ub_sysret") ", %edx\n"
+    "    sysenter\n"
+    "ub_sysret:\n"
+    "    decl %ebx\n"
+    "    jnz 2b\n"
+    "    rdtsc\n"
+    "    subl " UB_ADDR("ub_t0") ", %eax\n"
+    "    movl %eax, " UB_ADDR("ub_sys") "\n"
+    "ub_report:\n"
+    "    movl $" UB_ADDR("ub_msg_int") ", %ebx\n"
+    "    movl $(ub_msg_sys - ub_msg_int), %esi\n"
+    "    movl " UB_ADDR("ub_int") ", %eax\n"
+    "    call ub_print_rate\n"
+    "    cmpl $0, " UB_ADDR("ubench_params") " + 4\n"
+    "    je 3f\n"
+    "    movl $" UB_ADDR("ub_msg_sys") ", %ebx\n"
+    "    movl $(ub_msg_unit - ub_msg_sys), %esi\n"
+    "    movl " UB_ADDR("ub_sys") ", %eax\n"
+    "    call ub_print_rate\n"
+    "3:  movl $1, %eax\n"                      // SYS_EXIT
+    "    int $0x80\n"
+    // Label at EBX/ESI, then EAX / iterations in decimal, then the unit
+    "ub_print_rate:\n"
+    "    pushl %eax\n"
+    "    movl $2, %eax\n"                      // SYS_WRITE
+    "    int $0x80\n"
+    "    popl %eax\n"
+    "    xorl %edx, %edx\n"
+    "    divl " UB_ADDR("ubench_params") "\n"
+    "    movl $" UB_ADDR("ub_digits_end") ", %edi\n"
+    "    movl $10, %ecx\n"
+    "4:  xorl %edx, %edx\n"
+    "    divl %ecx\n"
+    "    addb $0x30, %dl\n"
+    "    decl %edi\n"
+    "    movb %dl, (%edi)\n"
+    "    testl %eax, %eax\n"
+    "    jnz 4b\n"
+    "    movl %edi, %ebx\n"
+    "    movl $" UB_ADDR("ub_digits_end") ", %esi\n"
+    "    subl %edi, %esi\n"
+    "    movl $2, %eax\n"
+    "    int $0x80\n"
+    "    movl $" UB_ADDR("ub_msg_unit") ", %ebx\n"
+    "    movl $(ub_msg_end - ub_msg_unit), %esi\n"
+    "    movl $2, %eax\n"
+    "    int $0x80\n"
+    "    ret\n"
+    "ub_msg_int:  .ascii \"int 0x80: \"\n"
+    "ub_msg_sys:  .ascii \"sysenter: \"\n"
+    "ub_msg_unit: .ascii \" cycles/call\\n\"\n"
+    "ub_msg_end:\n"
+    "ub_digits:   .fill 12, 1, 0\n"
+    "ub_digits_end:\n"
+    ".align 4\n"
+    "ub_t0:       .long 0\n"
+    "ub_int:      .long 0\n"
+    "ub_sys:      .long 0\n"
+    "ubench_params: .long 0, 0\n"
+    "ubench_end:\n"
+    ".previous\n"
+);
+
+extern const u8 ubench_start[];
+extern const u8 ubench_params[];
+extern const u8 ubench_end[];
+
+#define SYSBENCH_IMAGE_MAX 512
+
+// Null system call latency from ring 3 on both entry paths
+int app_sysbench(int argc, char **argv) {
+    u32 iters = argc > 1 ? parse_u32(argv[1]) : 100000;
+    if (iters == 0) iters = 1;
+    if (iters > 10000000) iters = 10000000;
+    
+    u8 image[SYSBENCH_IMAGE_MAX];
+    u32 size = (u32)(ubench_end - ubench_start);
+    if (size > sizeof(image)) return 1;
+    memcpy(image, ubench_start, size);
+    u32 *params = (u32*)(image + (ubench_params - ubench_start));
+    params[0] = iters;
+    params[1] = syscall_has_sysenter();
+    
+    ice_pid_t pid = uproc_spawn("sysbench", image, size);
+    if (!pid) {
+        tty_puts("sysbench: cannot start a user process\n");
+        return 1;
+    }
+    
+    tty_printf("%u null system calls per path from ring 3\n", iters);
+    if (scheduler_wait_exit(pid) != E_OK) return 1;
+    if (!syscall_has_sysenter()) tty_puts("sysenter: not supported by this CPU\n");
+    return 0;
+}
+
+#define UF_ADDR(label) "(" UB_BASE " + (" label " - ufork_start))"
+
+// Ring 3 program for forktest. It forks once; the child writes one word
+// to each of the first ufork_params[1] pages at ufork_params[0] and
+// exits, the parent waits for it and exits.
+__asm__ (
+    ".section .rodata\n"
+    ".global ufork_start, ufork_params, ufork_end\n"
+    "ufork_start:\n"
+    "    movl $6, %eax\n"                      // SYS_FORK
+    "    int $0x80\n"
+    "    testl %eax, %eax\n"
+    "    jz uf_child\n"
+    "    js uf_exit\n"
+    "    movl %eax, %ebx\n"
+    "    movl $7, %eax\n"                      // SYS_WAIT
+    "    int $0x80\n"
+    "    jmp uf_exit\n"
+    "uf_child:\n"
+    "    movl " UF_ADDR("ufork_params") ", %edi\n"
+    "    movl " UF_ADDR("ufork_params") " + 4, %ecx\n"
+    "    testl %ecx, %ecx\n"
+    "    jz uf_exit\n"
+    "1:  movl %ecx, (%edi)\n"
+    "    addl $4096, %edi\n"
+    "    decl %ecx\n"
+    "    jnz 1b\n"
+    "uf_exit:\n"
+    "    movl $1, %eax\n"                      // SYS_EXIT
+    "    int $0x80\n"
+    ".align 4\n"
+    "ufork_params: .long 0, 0\n"
+    "ufork_end:\n"
+    ".previous\n"
+);
+
+extern const u8 ufork_start[];
+extern const u8 ufork_params[];
+extern const u8 ufork_end[];
+
+#define FORKTEST_PAGES_MAX 256
+
+// Clone a process with a data area of the given size, write to some of
+// it in the child and report how much sharing saved
+int app_forktest(int argc, char **argv) {
+    u32 pages = argc > 1 ? parse_u32(argv[1]) : 64;
+    u32 writes = argc > 2 ? parse_u32(argv[2]) : 8;
+    if (pages == 0) pages = 1;
+    if (pages > FORKTEST_PAGES_MAX) pages = FORKTEST_PAGES_MAX;
+    if (writes > pages) writes = pages;
+    
+    // Code in the first page, the data area after it
+    u32 size = (1 + pages) * PAGE_SIZE;
+    u8 *image = (u8*)kmalloc(size);
+    if (!image) {
+        tty_puts("forktest: out of memory\n");
+        return 1;
+    }
+    memset(image, 0, size);
+    memcpy(image, ufork_start, (u32)(ufork_end - ufork_start));
+    u32 *params = (u32*)(image + (ufork_params - ufork_start));
+    params[0] = USER_BASE + PAGE_SIZE;
+    params[1] = writes;
+    
+    uproc_stats_t before, after;
+    uproc_get_stats(&before);
+    ice_pid_t pid = uproc_spawn("forktest", image, size);
+    kfree(image);
+    if (!pid) {
+        tty_puts("forktest: cannot start a user process\n");
+        return 1;
+    }
+    if (scheduler_wait_exit(pid) != E_OK) return 1;
+    uproc_get_stats(&after);
+    
+    u32 clones = after.clones - before.clones;
+    if (!clones) {
+        tty_puts("forktest: clone failed\n");
+        return 1;
+    }
+    u32 shared = after.pages_shared - before.pages_shared;
+    u32 copied = after.pages_copied - before.pages_copied;
+    tty_printf("Clone shared %u pages, copied %u on write (%u faults)\n",
+               shared, copied, after.cow_faults - before.cow_faults);
+    tty_printf("Saved %u KiB against a full copy\n", (shared - copied) * (PAGE_SIZE / 1024));
+    return 0;
+}
+
+// lockbench: every CPU hammers one lock around a two-word update. The
+// test-and-set lock is the old spinlock_t, kept here as the baseline.
+typedef enum {
+    LB_TAS,
+    LB_TICKET,
+    LB_RW_READ,
+    LB_RW_WRITE,
+    LB_SEQ_READ,
+    LB_KINDS
+} lockbench_kind_t;
+
+static const char *lockbench_names[LB_KINDS] = {
+    "tas", "ticket", "rw-read", "rw-write", "seq-read"
+};
+
+static struct {
+    lockbench_kind_t kind;
+    u32 iters;
+    volatile u32 ready;
+    volatile u32 go;
+    volatile u32 done;
+    volatile u32 tas;
+    spinlock_t ticket;
+    rwlock_t rw;
+    seqlock_t seq;
+    volatile u32 a, b;      // Must always be seen equal
+    volatile u32 torn;      // Reads that saw them differ
+    u64 finish[SMP_MAX_CPUS];
+} lb;
+
+static void lb_read(void) {
+    if (lb.a != lb.b) lb.torn++;
+}
+
+static void lb_write(void) {
+    lb.a++;
+    lb.b++;
+}
+
+static void lockbench_worker(void *arg) {
+    u32 id = (u32)arg;
+    __atomic_add_fetch(&lb.ready, 1, __ATOMIC_SEQ_CST);
+    while (!lb.go) scheduler_yield();
+    
+    for (u32 i = 0; i < lb.iters; i++) {
+        u32 flags;
+        switch (lb.kind) {
+            case LB_TAS:
+                flags = irq_save();
+                while (__sync_lock_test_and_set(&lb.tas, 1)) {
+                    while (lb.tas) __asm__ volatile ("pause");
+                }
+                lb_write();
+                __sync_lock_release(&lb.tas);
+                irq_restore(flags);
+                break;
+            case LB_TICKET:
+                spinlock_acquire(&lb.ticket);
+                lb_write();
+                spinlock_release(&lb.ticket);
+                break;
+            case LB_RW_READ:
+                flags = read_lock_irqsave(&lb.rw);
+                lb_read();
+                read_unlock_irqrestore(&lb.rw, flags);
+                break;
+            case LB_RW_WRITE:
+                flags = write_lock_irqsave(&lb.rw);
+                lb_write();
+                write_unlock_irqrestore(&lb.rw, flags);
+                break;
+            default:
+                // One writer, everyone else reads without a lock
+                if (id == 0) {
+                    write_seqlock(&lb.seq);
+                    lb_write();
+                    write_sequnlock(&lb.seq);
+                } else {
+                    u32 seq, a, b;
+                    do {
+                        seq = read_seqbegin(&lb.seq);
+                        a = lb.a;
+                        b = lb.b;
+                    } while (read_seqretry(&lb.seq, seq));
+                    if (a != b) lb.torn++;
+                }
+                break;
+        }
+    }
+    
+    lb.finish[id] = cycles();
+    __atomic_add_fetch(&lb.done, 1, __ATOMIC_SEQ_CST);
+}
+
+// Run one lock kind on threads workers; false if they could not start
+static bool lockbench_run(lockbench_kind_t kind, u32 threads, u32 iters) {
+    lb.kind = kind;
+    lb.iters = iters;
+    lb.ready = lb.go = lb.done = 0;
+    lb.tas = 0;
+    lb.a = lb.b = lb.torn = 0;
+    spinlock_init(&lb.ticket);
+    rwlock_init(&lb.rw);
+    seqlock_init(&lb.seq);
+    
+    for (u32 i = 0; i < threads; i++) {
+        if (!scheduler_create_kthread("lockbench", lockbench_worker, (void*)i)) {
+            lb.iters = 0;
+            lb.go = 1;
+            while (lb.done < i) timer_sleep_ms(1);
+            return false;
+        }
+    }
+    while (lb.ready < threads) timer_sleep_ms(1);
+    
+    u64 start = cycles();
+    lb.go = 1;
+    while (lb.done < threads) timer_sleep_ms(1);
+    
+    u64 first = lb.finish[0], last = lb.finish[0];
+    for (u32 i = 1; i < threads; i++) {
+        if (lb.finish[i] < first) first = lb.finish[i];
+        if (lb.finish[i] > last) last = lb.finish[i];
+    }
+    
+    // Spread: how early the first thread finished, as a share of the run.
+    // Near 0 when the lock is handed round fairly.
+    u64 run = last - start, gap = last - first;
+    u64 per_op = div_u64(clock_cycles_to_ns(run), threads * iters);
+    while (run >> 32) {
+        run >>= 1;
+        gap >>= 1;
+    }
+    u32 spread = run ? (u32)div_u64(gap * 100, (u32)run) : 0;
+    u32 expect = kind == LB_SEQ_READ ? iters : kind == LB_RW_READ ? 0 : threads * iters;
+    
+    slabinfo_pad(lockbench_names[kind], 10);
+    tty_printf("%u ns/op   spread %u%%", (u32)per_op, spread);
+    if (lb.a != expect || lb.torn) tty_printf("   FAILED (%u/%u, %u torn)", lb.a, expect, lb.torn);
+    tty_puts("\n");
+    return true;
+}
+
+int app_lockbench(int argc, char **argv) {
+    u32 threads = smp_cpu_count();
+    u32 iters = argc > 1 ? parse_u32(argv[1]) : 100000;
+    if (argc > 2) threads = parse_u32(argv[2]);
+    if (iters == 0) iters = 1;
+    if (iters > 1000000) iters = 1000000;
+    if (threads == 0) threads = 1;
+    if (threads > SMP_MAX_CPUS) threads = SMP_MAX_CPUS;
+    
+    if (!clock_tsc_khz()) {
+        tty_puts("lockbench: needs a TSC\n");
+        return 1;
+    }
+    
+    tty_printf("%u threads on %u CPU(s), %u iterations each\n",
+               threads, smp_cpu_count(), iters);
+    for (u32 kind = 0; kind < LB_KINDS; kind++) {
+        if (!lockbench_run((lockbench_kind_t)kind, threads, iters)) {
+            tty_puts("lockbench: cannot start worker threads\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Per-lock statistics, worst total wait first. Needs make LOCKSTAT=1.
+int app_lockstat(int argc, char **argv) {
+#ifdef CONFIG_LOCKSTAT
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        lockstat_reset();
+        tty_puts("lockstat: counters cleared\n");
+        return 0;
+    }
+    
+    u32 count = lockstat_class_count();
+    u8 order[LOCKSTAT_MAX_CLASSES];
+    u64 wait[LOCKSTAT_MAX_CLASSES];
+    lockstat_class_t c;
+    for (u32 i = 0; i < count; i++) {
+        lockstat_get(i, &c);
+        order[i] = (u8)i;
+        wait[i] = c.spin_cycles;
+    }
+    
+    // Insertion sort on total wait, descending
+    for (u32 i = 1; i < count; i++) {
+        u8 idx = order[i];
+        u32 j = i;
+        while (j > 0 && wait[order[j - 1]] < wait[idx]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = idx;
+    }
+    
+    tty_puts("LOCK              ACQUIRED  CONTENDED  WAIT us  MAX WAIT ns  MAX HOLD ns\n");
+    for (u32 i = 0; i < count; i++) {
+        if (!lockstat_get(order[i], &c) || !c.acquisitions) continue;
+        slabinfo_pad(c.name, 18);
+        tty_printf("%u  %u  %u  %u  %u\n", c.acquisitions, c.contended,
+                   (u32)div_u64(clock_cycles_to_ns(c.spin_cycles), 1000),
+                   (u32)clock_cycles_to_ns(c.max_spin), (u32)clock_cycles_to_ns(c.max_hold));
+        if (c.max_spin_site) tty_printf("    longest wait at %s\n", c.max_spin_site);
+        if (c.max_hold_site) tty_printf("    longest hold from %s\n", c.max_hold_site);
+    }
+    return 0;
+#else
+    (void)argc;
+    (void)argv;
+    tty_puts("lockstat: kernel built without LOCKSTAT=1\n");
+    return 1;
+#endif
+}
+
+// Worst interrupts-off sections since boot or the last reset, also
+// written to COM1. Needs make IRQTRACE=1.
+int app_irqsoff(int argc, char **argv) {
+#ifdef CONFIG_IRQSOFF_TRACE
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        irqtrace_reset();
+        tty_puts("irqsoff: table cleared\n");
+        return 0;
+    }
+    
+    irqtrace_entry_t list[IRQTRACE_WORST];
+    u32 n = irqtrace_get(list, IRQTRACE_WORST);
+    if (!n) {
+        tty_puts("irqsoff: nothing recorded yet\n");
+        return 0;
+    }
+    
+    tty_puts(" #  CPU  OFF ns\n");
+    for (u32 i = 0; i < n; i++) {
+        tty_printf("%u  %u  %u\n", i, list[i].cpu, (u32)clock_cycles_to_ns(list[i].cycles));
+        tty_printf("    off %s @ 0x%x\n", list[i].off_file, list[i].off_ip);
+        tty_printf("    on  %s @ 0x%x\n", list[i].on_file, list[i].on_ip);
+    }
+    irqtrace_dump_serial();
+    return 0;
+#else
+    (void)argc;
+    (void)argv;
+    tty_puts("irqsoff: kernel built without IRQTRACE=1\n");
+    return 1;
+#endif
+}
+
+#define IB_OP_ECHO 1
+#define IB_OP_EXIT 2
+
+static ipc_port_t ib_port;
+
+// Replies at once; any pages go back to the caller with the reply
+static void ib_server(void *arg) {
+    (void)arg;
+    for (;;) {
+        ipc_call_t *call = ipc_receive(&ib_port);
+        bool stop = call->msg->op == IB_OP_EXIT;
+        call->msg->status = E_OK;
+        ipc_reply(call);
+        if (stop) return;
+    }
+}
+
+// Cycles per round trip through ib_port, page attached if non-zero
+static u64 ib_round_trips(u32 iters, phys_addr_t page) {
+    ipc_msg_t m;
+    u64 start = cycles();
+    for (u32 i = 0; i < iters; i++) {
+        m.op = IB_OP_ECHO;
+        m.npages = 0;
+        if (page) ipc_attach_page(&m, page);
+        ipc_call(&ib_port, &m);
+    }
+    return div_u64(cycles() - start, iters);
+}
+
+// Round trips to a private echo thread, inline and carrying a page,
+// against copying that page both ways and a real manager request
+int app_ipcbench(int argc, char **argv) {
+    u32 iters = argc > 1 ? parse_u32(argv[1]) : 10000;
+    if (iters == 0) iters = 1;
+    if (iters > 1000000) iters = 1000000;
+    
+    if (!clock_tsc_khz()) {
+        tty_puts("ipcbench: no TSC\n");
+        return 1;
+    }
+    if (!waitqueue_can_sleep()) {
+        tty_puts("ipcbench: caller cannot sleep\n");
+        return 1;
+    }
+    
+    phys_addr_t page = pmm_alloc_page();
+    phys_addr_t copy = pmm_alloc_page();
+    if (!page || !copy) {
+        if (page) pmm_free_page(page);
+        if (copy) pmm_free_page(copy);
+        tty_puts("ipcbench: out of memory\n");
+        return 1;
+    }
+    
+    ipc_port_init(&ib_port, "ipcbench");
+    ice_pid_t pid = scheduler_create_kthread("ipcbench", ib_server, 0);
+    if (!pid) {
+        pmm_free_page(page);
+        pmm_free_page(copy);
+        tty_puts("ipcbench: cannot start the echo thread\n");
+        return 1;
+    }
+    scheduler_set_priority(pid, SCHED_PRIO_DEFAULT - 2);
+    
+    u64 inline_cycles = ib_round_trips(iters, 0);
+    u64 page_cycles = ib_round_trips(iters, page);
+    
+    u64 start = cycles();
+    for (u32 i = 0; i < iters; i++) {
+        memcpy((void*)copy, (const void*)page, PAGE_SIZE);
+        memcpy((void*)page, (const void*)copy, PAGE_SIZE);
+    }
+    u64 copy_cycles = div_u64(cycles() - start, iters);
+    
+    start = cycles();
+    for (u32 i = 0; i < iters; i++) {
+        ipc_msg_t m = {.op = MPM_OP_UPTIME};
+        mpm_request(&m);
+    }
+    u64 mpm_cycles = div_u64(cycles() - start, iters);
+    
+    ipc_msg_t stop = {.op = IB_OP_EXIT};
+    ipc_call(&ib_port, &stop);
+    // The next run reinitialises ib_port, so the server must be gone
+    scheduler_wait_exit(pid);
+    pmm_free_page(page);
+    pmm_free_page(copy);
+    
+    tty_printf("%u round trips each, ns per round trip:\n", iters);
+    tty_printf("  inline message       %u\n", (u32)clock_cycles_to_ns(inline_cycles));
+    tty_printf("  moving one page      %u\n", (u32)clock_cycles_to_ns(page_cycles));
+    tty_printf("  copying it instead   %u  (4 KiB each way, no IPC)\n",
+               (u32)clock_cycles_to_ns(copy_cycles));
+    tty_printf("  mpm uptime request   %u\n", (u32)clock_cycles_to_ns(mpm_cycles));
     return 0;
 }
 
@@ -1775,7 +2774,7 @@ int app_help(int argc, char **argv) {
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     tty_puts("System Commands:\n");
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-    tty_puts("  whoami, hostname, uname, uptime, date, env, df, free, clear, history\n\n");
+    tty_puts("  whoami, hostname, uname, uptime, date, env, df, free, slabinfo, meminfo, clear, history\n\n");
     
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     tty_puts("User Commands:\n");
@@ -2161,3 +3160,10 @@ int app_dmesg(int argc, char **argv) {
     tty_puts("\n");
     return 0;
 }
+
+// Shell buffers live in .bss; register them with the accounting layer
+static void apps_account_memory(void) {
+    memacct_static(MEM_TAG_SHELL, "iced editor buffer", sizeof(iced_buffer));
+    memacct_static(MEM_TAG_SHELL, "shell history", sizeof(history_buffer));
+    memacct_static(MEM_TAG_SHELL, "dmesg log", sizeof(dmesg_buffer));
+}
@@ -58,6 +58,19 @@ int app_date(int argc, char **argv);
 int app_env(int argc, char **argv);
 int app_df(int argc, char **argv);
 int app_free(int argc, char **argv);
+int app_slabinfo(int argc, char **argv);
+int app_meminfo(int argc, char **argv);
+int app_schedtest(int argc, char **argv);
+int app_timers(int argc, char **argv);
+int app_cpus(int argc, char **argv);
+int app_irqstat(int argc, char **argv);
+int app_membench(int argc, char **argv);
+int app_sysbench(int argc, char **argv);
+int app_forktest(int argc, char **argv);
+int app_lockbench(int argc, char **argv);
+int app_lockstat(int argc, char **argv);
+int app_irqsoff(int argc, char **argv);
+int app_ipcbench(int argc, char **argv);
 int app_hexdump(int argc, char **argv);
 int app_history(int argc, char **argv);
 
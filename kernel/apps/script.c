@@ -10,6 +10,8 @@
 #include "../tty/tty.h"
 #include "../fs/vfs.h"
 #include "../drivers/vga.h"
+#include "../mm/pmm.h"
+#include "../mm/memacct.h"
 #include <string.h>
 static bool str_starts_with(const char *str, const char *prefix) {
     size_t len = strlen(prefix);
@@ -475,6 +477,8 @@ int script_init_context(script_context_t *ctx, const char *filename) {
     return 0;
 }
 
+#define SCRIPT_MAX_SIZE 16384   // 16KB max script size
+
 int script_run_file(const char *filename) {
     if (!vfs_is_mounted()) {
         tty_puts("Script error: No filesystem mounted\n");
@@ -502,14 +506,21 @@ int script_run_file(const char *filename) {
         return -1;
     }
     
-    // Read file contents
-    static char script_buffer[16384]; // 16KB max script size
+    // Read file contents; the buffer is only held while the script runs
+    u32 buf_order = pmm_size_to_order(SCRIPT_MAX_SIZE);
+    char *script_buffer = (char*)pmm_alloc_pages(buf_order);
+    if (!script_buffer) {
+        vfs_close(f);
+        tty_puts("Script error: Out of memory\n");
+        return -1;
+    }
+    memacct_charge_pages(MEM_TAG_SCRIPT, 1u << buf_order);
     int total = 0;
     int n;
     
-    while ((n = vfs_read(f, script_buffer + total, sizeof(script_buffer) - total - 1)) > 0) {
+    while ((n = vfs_read(f, script_buffer + total, SCRIPT_MAX_SIZE - total - 1)) > 0) {
         total += n;
-        if (total >= (int)sizeof(script_buffer) - 1) break;
+        if (total >= SCRIPT_MAX_SIZE - 1) break;
     }
     script_buffer[total] = 0;
     
@@ -529,6 +540,7 @@ int script_run_file(const char *filename) {
     
     // Execute based on type
     int result = 0;
+    bool supported = true;
     switch (ctx.type) {
         case SCRIPT_SHELL:
         case SCRIPT_ICE:
@@ -551,9 +563,14 @@ int script_run_file(const char *filename) {
             break;
         default:
             tty_puts("Unsupported language\n");
-            return -1;
+            supported = false;
+            break;
     }
     
+    pmm_free_pages((phys_addr_t)script_buffer, buf_order);
+    memacct_uncharge_pages(MEM_TAG_SCRIPT, 1u << buf_order);
+    if (!supported) return -1;
+    
     tty_puts("---\n");
     if (ctx.error_count > 0) {
         vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
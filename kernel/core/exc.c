@@ -2,11 +2,16 @@
 
 #include "exc.h"
 #include "../drivers/vga.h"
+#include "../mm/slab.h"
+#include "../sync/spinlock.h"
+#include "../errno.h"
 
- 
-static exc_entry_t registry[MAX_EXECUTABLES];
+// Entries are built off to the side and published whole; lookups run
+// under RCU and writers serialise on exc_lock
+static exc_entry_t *registry[MAX_EXECUTABLES];
 static int registry_count = 0;
 static exec_id_t next_exec_id = 1;
+static spinlock_t exc_lock;
 
  
 static void str_copy(char *dest, const char *src, int max) {
@@ -18,10 +23,9 @@ static void str_copy(char *dest, const char *src, int max) {
 }
 
 void exc_init(void) {
-     
+    spinlock_init_named(&exc_lock, "exc");
     for (int i = 0; i < MAX_EXECUTABLES; i++) {
-        registry[i].valid = false;
-        registry[i].id = 0;
+        registry[i] = 0;
     }
     
     registry_count = 0;
@@ -33,45 +37,68 @@ void exc_init(void) {
 }
 
 exec_id_t exc_register(const char *path, const char *name, u8 flags) {
-    if (registry_count >= MAX_EXECUTABLES) {
+    exc_entry_t *entry = (exc_entry_t*)kmalloc(sizeof(exc_entry_t));
+    if (!entry) {
         return 0;
     }
+    str_copy(entry->path, path, sizeof(entry->path));
+    str_copy(entry->name, name, sizeof(entry->name));
+    entry->type = EXC_TYPE_NATIVE;
+    entry->flags = flags;
+    entry->valid = true;
+    entry->entry_point = 0;
+    entry->load_addr = 0;
     
-     
+    spinlock_acquire(&exc_lock);
     int slot = -1;
     for (int i = 0; i < MAX_EXECUTABLES; i++) {
-        if (!registry[i].valid) {
+        if (!registry[i]) {
             slot = i;
             break;
         }
     }
     
     if (slot < 0) {
+        spinlock_release(&exc_lock);
+        kfree(entry);
         return 0;
     }
     
-     
-    exc_entry_t *entry = &registry[slot];
     entry->id = next_exec_id++;
-    str_copy(entry->path, path, sizeof(entry->path));
-    str_copy(entry->name, name, sizeof(entry->name));
-    entry->type = EXC_TYPE_NATIVE;
-    entry->flags = flags;
-    entry->valid = true;
-    entry->entry_point = 0;
-    entry->load_addr = 0;
-    
+    rcu_assign_pointer(registry[slot], entry);
     registry_count++;
+    exec_id_t id = entry->id;
+    spinlock_release(&exc_lock);
     
-    return entry->id;
+    return id;
 }
 
-exc_entry_t* exc_find(exec_id_t id) {
+static void free_entry_rcu(rcu_head_t *head) {
+    kfree((u8*)head - __builtin_offsetof(exc_entry_t, rcu));
+}
+
+int exc_unregister(exec_id_t id) {
+    spinlock_acquire(&exc_lock);
     for (int i = 0; i < MAX_EXECUTABLES; i++) {
-        if (registry[i].valid && registry[i].id == id) {
-            return &registry[i];
+        exc_entry_t *entry = registry[i];
+        if (entry && entry->id == id) {
+            rcu_assign_pointer(registry[i], (exc_entry_t*)0);
+            registry_count--;
+            spinlock_release(&exc_lock);
+            call_rcu(&entry->rcu, free_entry_rcu);
+            return E_OK;
         }
     }
+    spinlock_release(&exc_lock);
+    return E_NOT_FOUND;
+}
+
+// Under rcu_read_lock: the entry may be freed once the section ends
+static exc_entry_t *find_entry(exec_id_t id) {
+    for (int i = 0; i < MAX_EXECUTABLES; i++) {
+        exc_entry_t *entry = rcu_dereference(registry[i]);
+        if (entry && entry->id == id) return entry;
+    }
     return 0;
 }
 
@@ -80,27 +107,20 @@ int exc_get_count(void) {
 }
 
 void exc_list(void (*callback)(exc_entry_t *entry)) {
+    rcu_read_lock();
     for (int i = 0; i < MAX_EXECUTABLES; i++) {
-        if (registry[i].valid) {
-             
-            if (!(registry[i].flags & EXC_FLAG_HIDDEN)) {
-                callback(&registry[i]);
-            }
+        exc_entry_t *entry = rcu_dereference(registry[i]);
+        if (entry && !(entry->flags & EXC_FLAG_HIDDEN)) {
+            callback(entry);
         }
     }
+    rcu_read_unlock();
 }
 
 u32 exc_load(exec_id_t id) {
-    exc_entry_t *entry = exc_find(id);
-    if (!entry) {
-        return 0;
-    }
-    
-     
-     
-    
-     
-     
-    
-    return entry->entry_point;
+    rcu_read_lock();
+    exc_entry_t *entry = find_entry(id);
+    u32 entry_point = entry ? entry->entry_point : 0;
+    rcu_read_unlock();
+    return entry_point;
 }
@@ -4,6 +4,7 @@
 #define ICE_EXC_H
 
 #include "../types.h"
+#include "../sync/rcu.h"
 
  
 #define EXC_MAGIC 0x43584549
@@ -50,6 +51,7 @@ typedef struct {
     bool valid;
     u32 entry_point;
     u32 load_addr;
+    rcu_head_t rcu;
 } exc_entry_t;
 
  
@@ -61,13 +63,14 @@ void exc_init(void);
  
 exec_id_t exc_register(const char *path, const char *name, u8 flags);
 
- 
-exc_entry_t* exc_find(exec_id_t id);
+// Unpublish an executable; its entry is freed after a grace period
+int exc_unregister(exec_id_t id);
 
  
 int exc_get_count(void);
 
  
+// Runs callback inside an RCU read-side section: it must not sleep
 void exc_list(void (*callback)(exc_entry_t *entry));
 
  
@@ -11,6 +11,10 @@
 #include "../drivers/pit.h"
 #include "../drivers/keyboard.h"
 #include "../mm/pmm.h"
+#include "../mm/memacct.h"
+#include "../proc/scheduler.h"
+#include "../proc/ipc.h"
+#include "../errno.h"
 #include "../apps/apps.h"
 #include "../net/net.h"
 #include "../gui/gui.h"
@@ -29,6 +33,13 @@ static ice_pid_t next_pid = 1;
  
 static u64 boot_ticks = 0;
 
+// pm and gpm requests go to this thread. It runs above the shell so a
+// caller never waits behind other work of its own priority.
+#define MPM_SERVER_PRIORITY (SCHED_PRIO_DEFAULT - 2)
+
+static ipc_port_t mpm_port;
+static ice_pid_t server_pid = 0;
+
  
 static int strcmp(const char *s1, const char *s2) {
     while (*s1 && *s1 == *s2) {
@@ -125,8 +136,123 @@ static void cmd_help(void) {
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
 }
 
+static const char *sched_state_names[] = {
+    "FREE", "READY", "RUNNING", "BLOCKED", "ZOMBIE"
+};
+
+// Destination of scheduler_list_processes while serving MPM_OP_LIST
+static mpm_task_info_t *list_out;
+static u32 list_count;
+
+static void list_task(pcb_t *p) {
+    if (list_count >= PAGE_SIZE / sizeof(mpm_task_info_t)) return;
+    mpm_task_info_t *t = &list_out[list_count++];
+    t->pid = p->pid;
+    t->priority = p->priority;
+    t->timeslice = p->timeslice;
+    t->state = p->state;
+    int i;
+    for (i = 0; i < (int)sizeof(t->name) - 1 && p->name[i]; i++) t->name[i] = p->name[i];
+    t->name[i] = '\0';
+}
+
+static void mpm_serve(ipc_msg_t *m) {
+    // No request carries pages; the reply starts without any
+    ipc_release_pages(m);
+    m->status = E_OK;
+    switch (m->op) {
+        case MPM_OP_LIST: {
+            phys_addr_t page = pmm_alloc_page();
+            if (!page) {
+                m->status = E_NO_MEM;
+                break;
+            }
+            list_out = (mpm_task_info_t*)page;
+            list_count = 0;
+            scheduler_list_processes(list_task);
+            m->arg[0] = list_count;
+            ipc_attach_page(m, page);
+            break;
+        }
+        case MPM_OP_KILL: {
+            ice_pid_t pid = m->arg[0];
+            pcb_t *self = scheduler_get_current();
+            if (self && self->pid == pid) {
+                // Would exit before replying
+                m->status = E_BUSY;
+            } else if (!scheduler_process_exists(pid)) {
+                m->status = E_NOT_FOUND;
+            } else {
+                scheduler_kill_process(pid);
+            }
+            break;
+        }
+        case MPM_OP_PRIO:
+            m->status = scheduler_set_priority(m->arg[0], m->arg[1]);
+            break;
+        case MPM_OP_SLICE:
+            m->status = scheduler_set_timeslice(m->arg[0], m->arg[1]);
+            break;
+        case MPM_OP_UPTIME:
+            m->arg[0] = mpm_get_uptime();
+            break;
+        case MPM_OP_MEM:
+            m->arg[0] = pmm_get_total_memory();
+            m->arg[1] = pmm_get_free_memory();
+            break;
+        default:
+            m->status = E_INVALID_ARG;
+            break;
+    }
+}
+
+static void mpm_server(void *arg) {
+    (void)arg;
+    for (;;) {
+        ipc_call_t *call = ipc_receive(&mpm_port);
+        mpm_serve(call->msg);
+        ipc_reply(call);
+    }
+}
+
+int mpm_request(ipc_msg_t *msg) {
+    if (!server_pid || ipc_call(&mpm_port, msg) != E_OK) {
+        mpm_serve(msg);
+    }
+    return msg->status;
+}
+
+ipc_port_t *mpm_get_port(void) {
+    return &mpm_port;
+}
+
+static int pm_request(u32 op, int pid, int value) {
+    ipc_msg_t m = {.op = op, .arg = {(u32)pid, (u32)value}};
+    return mpm_request(&m);
+}
+
+static void pm_report(int err, const char *what, int pid) {
+    if (err == E_OK) tty_printf("Process %d: %s updated.\n", pid, what);
+    else if (err == E_NOT_FOUND) tty_printf("No such process: %d\n", pid);
+    else tty_printf("Invalid %s.\n", what);
+}
+
 static void cmd_pm(int argc, char **argv) {
     if (argc < 2) {
+        if (scheduler_get_process_count() > 0) {
+            ipc_msg_t m = {.op = MPM_OP_LIST};
+            if (mpm_request(&m) == E_OK) {
+                const mpm_task_info_t *t = (const mpm_task_info_t*)ipc_page(&m, 0);
+                tty_puts("PID\tPRIO\tSLICE\tSTATE\tNAME\n");
+                for (u32 i = 0; i < m.arg[0]; i++) {
+                    tty_printf("%d\t%u\t%u\t%s\t%s\n", t[i].pid, t[i].priority,
+                               t[i].timeslice, sched_state_names[t[i].state], t[i].name);
+                }
+                ipc_release_pages(&m);
+            }
+            if (process_count == 0) return;
+            tty_puts("\n");
+        }
         if (process_count == 0) {
             tty_puts("No running processes.\n");
             return;
@@ -157,7 +283,26 @@ static void cmd_pm(int argc, char **argv) {
             return;
         }
         int pid = atoi(argv[2]);
-        tty_printf("Process %d terminated.\n", pid);
+        int err = pm_request(MPM_OP_KILL, pid, 0);
+        if (err == E_OK) tty_printf("Process %d killed.\n", pid);
+        else if (err == E_NOT_FOUND) tty_printf("No such process: %d\n", pid);
+        else tty_printf("Process %d cannot be killed.\n", pid);
+    }
+    else if (strcmp(argv[1], "prio") == 0) {
+        if (argc < 4) {
+            tty_printf("Usage: pm prio <pid> <0-%d>  (0 runs first)\n", SCHED_PRIO_LEVELS - 1);
+            return;
+        }
+        int pid = atoi(argv[2]);
+        pm_report(pm_request(MPM_OP_PRIO, pid, atoi(argv[3])), "priority", pid);
+    }
+    else if (strcmp(argv[1], "slice") == 0) {
+        if (argc < 4) {
+            tty_printf("Usage: pm slice <pid> <1-%d ticks>\n", SCHED_SLICE_MAX);
+            return;
+        }
+        int pid = atoi(argv[2]);
+        pm_report(pm_request(MPM_OP_SLICE, pid, atoi(argv[3])), "timeslice", pid);
     }
     else if (strcmp(argv[1], "rp") == 0) {
         if (argc < 3) {
@@ -191,16 +336,19 @@ static void cmd_gpm(int argc, char **argv) {
         tty_puts("\nMPM (Main Process Manager) Kernel\n");
     }
     else if (strcmp(argv[1], "uptime") == 0) {
-        u32 ticks = (u32)(pit_get_ticks() - boot_ticks);
-        u32 secs = ticks / 100;
+        ipc_msg_t m = {.op = MPM_OP_UPTIME};
+        mpm_request(&m);
+        u32 secs = m.arg[0];
         u32 mins = secs / 60;
         u32 hours = mins / 60;
         
         tty_printf("Uptime: %d:%02d:%02d\n", hours, mins % 60, secs % 60);
     }
     else if (strcmp(argv[1], "mem") == 0) {
-        u32 total = pmm_get_total_memory();
-        u32 free = pmm_get_free_memory();
+        ipc_msg_t m = {.op = MPM_OP_MEM};
+        mpm_request(&m);
+        u32 total = m.arg[0];
+        u32 free = m.arg[1];
         u32 used = total - free;
         
         tty_puts("Memory Information:\n");
@@ -248,6 +396,11 @@ void mpm_init(void) {
     boot_ticks = pit_get_ticks();
     process_count = 0;
     next_pid = 1;
+    memacct_static(MEM_TAG_SCHED, "mpm process table", sizeof(process_table));
+    
+    ipc_port_init(&mpm_port, "mpm");
+    server_pid = scheduler_create_kthread("mpmd", mpm_server, 0);
+    if (server_pid) scheduler_set_priority(server_pid, MPM_SERVER_PRIORITY);
     
      
     user_init();
@@ -4,6 +4,7 @@
 #define ICE_MPM_H
 
 #include "../types.h"
+#include "../proc/ipc.h"
 
  
 typedef enum {
@@ -33,9 +34,35 @@ typedef enum {
     MPM_ERR_INVALID_STATE,
 } mpm_error_t;
 
+// Requests served by the manager thread on its port. Replies carry a
+// status, and results in arg[] unless noted.
+typedef enum {
+    MPM_OP_LIST = 1,        // Page of mpm_task_info_t, count in arg[0]
+    MPM_OP_KILL,            // arg[0] = pid
+    MPM_OP_PRIO,            // arg[0] = pid, arg[1] = priority
+    MPM_OP_SLICE,           // arg[0] = pid, arg[1] = ticks
+    MPM_OP_UPTIME,          // arg[0] = seconds
+    MPM_OP_MEM,             // arg[0] = total, arg[1] = free bytes
+} mpm_op_t;
+
+typedef struct {
+    ice_pid_t pid;
+    u32 priority;
+    u32 timeslice;
+    u32 state;
+    char name[32];
+} mpm_task_info_t;
+
  
 void mpm_init(void);
 
+// Send a request to the manager thread and wait for the reply in msg.
+// Served in place when the caller cannot sleep or the thread is not up.
+// The caller owns any pages in the reply.
+int mpm_request(ipc_msg_t *msg);
+
+ipc_port_t *mpm_get_port(void);
+
  
 void mpm_shell(void);
 
@@ -0,0 +1,171 @@
+/*
+ * ICE ACPI table discovery
+ *
+ * Only as much as SMP and interrupt routing need: the RSDP, the RSDT
+ * and the MADT. Tables are read in place through the identity map.
+ */
+
+#include "acpi.h"
+
+#define EBDA_SEGMENT_PTR 0x40E
+#define BIOS_ROM_START   0xE0000
+#define BIOS_ROM_END     0x100000
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_OVERRIDE 5
+
+#define MADT_PCAT_COMPAT    0x01
+#define MADT_CPU_ENABLED    0x01
+
+typedef struct __attribute__((packed)) {
+    char signature[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_addr;
+} acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) {
+    char signature[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} acpi_header_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_header_t header;
+    u32 lapic_addr;
+    u32 flags;
+} acpi_madt_header_t;
+
+static const acpi_header_t *rsdt = 0;
+static acpi_madt_t madt;
+static bool madt_found = false;
+
+static bool checksum_ok(const void *p, u32 len) {
+    const u8 *b = (const u8*)p;
+    u8 sum = 0;
+    for (u32 i = 0; i < len; i++) sum += b[i];
+    return sum == 0;
+}
+
+static bool sig_eq(const char *a, const char *b, u32 n) {
+    for (u32 i = 0; i < n; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or
+// in the BIOS ROM area
+static const acpi_rsdp_t* scan_rsdp(u32 start, u32 end) {
+    for (u32 addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        const acpi_rsdp_t *rsdp = (const acpi_rsdp_t*)addr;
+        if (sig_eq(rsdp->signature, "RSD PTR ", 8) &&
+            checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static const acpi_rsdp_t* find_rsdp(void) {
+    // BIOS data area word, read with asm: GCC treats constant addresses
+    // this low as null pointer dereferences
+    u32 seg;
+    __asm__ volatile ("movzwl %c1, %0" : "=r"(seg) : "i"(EBDA_SEGMENT_PTR));
+    u32 ebda = seg << 4;
+    const acpi_rsdp_t *rsdp = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) rsdp = scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp) rsdp = scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    return rsdp;
+}
+
+static const acpi_header_t* find_table(const acpi_header_t *root, const char *sig) {
+    u32 entries = (root->length - sizeof(acpi_header_t)) / 4;
+    const u32 *ptrs = (const u32*)(root + 1);
+
+    for (u32 i = 0; i < entries; i++) {
+        const acpi_header_t *t = (const acpi_header_t*)ptrs[i];
+        if (t && sig_eq(t->signature, sig, 4) && checksum_ok(t, t->length)) {
+            return t;
+        }
+    }
+    return 0;
+}
+
+static void parse_madt(const acpi_madt_header_t *m) {
+    madt.lapic_base = m->lapic_addr;
+    madt.pcat_compat = (m->flags & MADT_PCAT_COMPAT) != 0;
+
+    const u8 *p = (const u8*)(m + 1);
+    const u8 *end = (const u8*)m + m->header.length;
+
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+        case MADT_LAPIC:
+            // processor uid, apic id, flags
+            if ((*(const u32*)(p + 4) & MADT_CPU_ENABLED) &&
+                madt.cpu_count < ACPI_MAX_CPUS) {
+                madt.cpu_apic_ids[madt.cpu_count++] = p[3];
+            }
+            break;
+        case MADT_IOAPIC:
+            if (madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t *io = &madt.ioapics[madt.ioapic_count++];
+                io->id = p[2];
+                io->addr = *(const u32*)(p + 4);
+                io->gsi_base = *(const u32*)(p + 8);
+            }
+            break;
+        case MADT_OVERRIDE:
+            if (madt.override_count < ACPI_MAX_OVERRIDES) {
+                acpi_override_t *o = &madt.overrides[madt.override_count++];
+                o->irq = p[3];
+                o->gsi = *(const u32*)(p + 4);
+                o->flags = *(const u16*)(p + 8);
+            }
+            break;
+        case MADT_LAPIC_OVERRIDE:
+            // 64-bit address; only usable when it fits the identity map
+            if (*(const u32*)(p + 8) == 0) madt.lapic_base = *(const u32*)(p + 4);
+            break;
+        }
+        p += p[1];
+    }
+}
+
+bool acpi_init(void) {
+    if (rsdt) return true;
+
+    const acpi_rsdp_t *rsdp = find_rsdp();
+    if (!rsdp || !rsdp->rsdt_addr) return false;
+
+    const acpi_header_t *t = (const acpi_header_t*)rsdp->rsdt_addr;
+    if (!sig_eq(t->signature, "RSDT", 4) || !checksum_ok(t, t->length)) {
+        return false;
+    }
+    rsdt = t;
+
+    const acpi_header_t *apic = find_table(rsdt, "APIC");
+    if (apic) {
+        parse_madt((const acpi_madt_header_t*)apic);
+        madt_found = true;
+    }
+    return true;
+}
+
+const acpi_madt_t* acpi_get_madt(void) {
+    return madt_found ? &madt : 0;
+}
+
+const void* acpi_find_table(const char *sig) {
+    return rsdt ? find_table(rsdt, sig) : 0;
+}
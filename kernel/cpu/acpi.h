@@ -0,0 +1,49 @@
+#ifndef ICE_ACPI_H
+#define ICE_ACPI_H
+
+#include "../types.h"
+
+#define ACPI_MAX_CPUS      16
+#define ACPI_MAX_IOAPICS   4
+#define ACPI_MAX_OVERRIDES 16
+
+// MPS INTI flags of an interrupt source override
+#define ACPI_IRQ_POLARITY_MASK 0x03
+#define ACPI_IRQ_ACTIVE_LOW    0x03
+#define ACPI_IRQ_TRIGGER_MASK  0x0C
+#define ACPI_IRQ_LEVEL         0x0C
+
+typedef struct {
+    u8 id;
+    u32 addr;
+    u32 gsi_base;
+} acpi_ioapic_t;
+
+typedef struct {
+    u8 irq;              // ISA IRQ
+    u32 gsi;             // Global system interrupt it is wired to
+    u16 flags;
+} acpi_override_t;
+
+// Interrupt topology from the MADT ("APIC" table)
+typedef struct {
+    u32 lapic_base;
+    bool pcat_compat;    // Legacy 8259 pair present
+    u32 cpu_count;
+    u8 cpu_apic_ids[ACPI_MAX_CPUS];   // Enabled CPUs, in table order
+    u32 ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    u32 override_count;
+    acpi_override_t overrides[ACPI_MAX_OVERRIDES];
+} acpi_madt_t;
+
+// Find the RSDP and RSDT and parse the MADT. Returns false without ACPI.
+bool acpi_init(void);
+
+// Parsed MADT, or 0 when acpi_init found none
+const acpi_madt_t* acpi_get_madt(void);
+
+// Checksummed RSDT table with a 4-character signature, or 0
+const void* acpi_find_table(const char *sig);
+
+#endif
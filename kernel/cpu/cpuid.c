@@ -0,0 +1,72 @@
+/*
+ * ICE CPU feature detection
+ */
+
+#include "cpuid.h"
+
+static cpu_info_t cpu_info;
+static bool cpu_info_valid = false;
+
+void cpuid_init(void) {
+    u32 a, b, c, d;
+    
+    for (int i = 0; i < CPUID_WORDS; i++) {
+        cpu_info.words[i] = 0;
+    }
+    
+    cpuid(0, 0, &a, &b, &c, &d);
+    cpu_info.max_leaf = a;
+    u32 regs[3] = { b, d, c };
+    for (int i = 0; i < 12; i++) {
+        cpu_info.vendor[i] = (char)(regs[i / 4] >> ((i % 4) * 8));
+    }
+    cpu_info.vendor[12] = '\0';
+    
+    if (cpu_info.max_leaf >= 1) {
+        cpuid(1, 0, &a, &b, &c, &d);
+        cpu_info.words[CPUID_WORD_1_EDX] = d;
+        cpu_info.words[CPUID_WORD_1_ECX] = c;
+        
+        cpu_info.stepping = a & 0xF;
+        cpu_info.model = (a >> 4) & 0xF;
+        cpu_info.family = (a >> 8) & 0xF;
+        if (cpu_info.family == 0xF) {
+            cpu_info.family += (a >> 20) & 0xFF;
+        }
+        if (cpu_info.family >= 6) {
+            cpu_info.model |= ((a >> 16) & 0xF) << 4;
+        }
+    }
+    
+    if (cpu_info.max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        cpu_info.words[CPUID_WORD_7_EBX] = b;
+    }
+    
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    cpu_info.max_ext_leaf = a;
+    if (cpu_info.max_ext_leaf >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &d);
+        cpu_info.words[CPUID_WORD_87_EDX] = d;
+    }
+    
+    cpu_info.phys_bits = 32;
+    if (cpu_info.max_ext_leaf >= 0x80000008) {
+        cpuid(0x80000008, 0, &a, &b, &c, &d);
+        cpu_info.phys_bits = a & 0xFF;
+    } else if (cpu_info.words[CPUID_WORD_1_EDX] & (1u << 6)) {
+        cpu_info.phys_bits = 36;   // PAE without the extended leaf
+    }
+    
+    cpu_info_valid = true;
+}
+
+bool cpu_has(u32 feature) {
+    if (!cpu_info_valid) cpuid_init();
+    return (cpu_info.words[feature >> 5] >> (feature & 31)) & 1;
+}
+
+const cpu_info_t* cpu_get_info(void) {
+    if (!cpu_info_valid) cpuid_init();
+    return &cpu_info;
+}
@@ -0,0 +1,64 @@
+#ifndef ICE_CPUID_H
+#define ICE_CPUID_H
+
+#include "../types.h"
+
+// Feature flags, encoded as (register word << 5) | bit
+#define CPUID_WORD_1_EDX   0
+#define CPUID_WORD_1_ECX   1
+#define CPUID_WORD_7_EBX   2
+#define CPUID_WORD_87_EDX  3
+#define CPUID_WORDS        4
+
+#define CPU_FEATURE(word, bit) (((word) << 5) | (bit))
+
+#define CPU_FEATURE_FPU    CPU_FEATURE(CPUID_WORD_1_EDX, 0)
+#define CPU_FEATURE_PSE    CPU_FEATURE(CPUID_WORD_1_EDX, 3)
+#define CPU_FEATURE_TSC    CPU_FEATURE(CPUID_WORD_1_EDX, 4)
+#define CPU_FEATURE_MSR    CPU_FEATURE(CPUID_WORD_1_EDX, 5)
+#define CPU_FEATURE_APIC   CPU_FEATURE(CPUID_WORD_1_EDX, 9)
+#define CPU_FEATURE_SEP    CPU_FEATURE(CPUID_WORD_1_EDX, 11)
+#define CPU_FEATURE_MTRR   CPU_FEATURE(CPUID_WORD_1_EDX, 12)
+#define CPU_FEATURE_PGE    CPU_FEATURE(CPUID_WORD_1_EDX, 13)
+#define CPU_FEATURE_PAT    CPU_FEATURE(CPUID_WORD_1_EDX, 16)
+#define CPU_FEATURE_MMX    CPU_FEATURE(CPUID_WORD_1_EDX, 23)
+#define CPU_FEATURE_FXSR   CPU_FEATURE(CPUID_WORD_1_EDX, 24)
+#define CPU_FEATURE_SSE    CPU_FEATURE(CPUID_WORD_1_EDX, 25)
+#define CPU_FEATURE_SSE2   CPU_FEATURE(CPUID_WORD_1_EDX, 26)
+#define CPU_FEATURE_HTT    CPU_FEATURE(CPUID_WORD_1_EDX, 28)
+#define CPU_FEATURE_SSE3   CPU_FEATURE(CPUID_WORD_1_ECX, 0)
+#define CPU_FEATURE_SSSE3  CPU_FEATURE(CPUID_WORD_1_ECX, 9)
+#define CPU_FEATURE_SSE41  CPU_FEATURE(CPUID_WORD_1_ECX, 19)
+#define CPU_FEATURE_SSE42  CPU_FEATURE(CPUID_WORD_1_ECX, 20)
+#define CPU_FEATURE_X2APIC CPU_FEATURE(CPUID_WORD_1_ECX, 21)
+#define CPU_FEATURE_TSC_DEADLINE CPU_FEATURE(CPUID_WORD_1_ECX, 24)
+#define CPU_FEATURE_XSAVE  CPU_FEATURE(CPUID_WORD_1_ECX, 26)
+#define CPU_FEATURE_AVX    CPU_FEATURE(CPUID_WORD_1_ECX, 28)
+#define CPU_FEATURE_ERMS   CPU_FEATURE(CPUID_WORD_7_EBX, 9)
+#define CPU_FEATURE_INVTSC CPU_FEATURE(CPUID_WORD_87_EDX, 8)
+
+typedef struct {
+    char vendor[13];
+    u32 max_leaf;
+    u32 max_ext_leaf;
+    u32 family;
+    u32 model;
+    u32 stepping;
+    u32 phys_bits;       // Physical address width
+    u32 words[CPUID_WORDS];
+} cpu_info_t;
+
+static inline void cpuid(u32 leaf, u32 subleaf, u32 *a, u32 *b, u32 *c, u32 *d) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                      : "a"(leaf), "c"(subleaf));
+}
+
+// Probe the boot CPU once; later queries read the cached result
+void cpuid_init(void);
+
+bool cpu_has(u32 feature);
+
+const cpu_info_t* cpu_get_info(void);
+
+#endif
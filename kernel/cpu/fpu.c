@@ -0,0 +1,156 @@
+/*
+ * ICE FPU/SSE context management
+ *
+ * Lazy: a switch saves the outgoing registers only if that process
+ * used them during its slice, and no process gets its state loaded
+ * until its first FPU instruction raises #NM. Processes that never
+ * touch the FPU cost one CR0.TS write per switch.
+ */
+
+#include "fpu.h"
+#include "cpuid.h"
+#include "idt.h"
+#include "smp.h"
+#include "irqflags.h"
+#include "../proc/scheduler.h"
+
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_TS (1u << 3)
+#define CR0_NE (1u << 5)
+
+#define CR4_OSFXSR     (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+#define MXCSR_DEFAULT  0x1F80     // All exceptions masked, round to nearest
+
+#define NM_VECTOR 7
+
+static bool enabled = false;
+
+// Process whose state is live in this CPU's registers (TS clear)
+static pcb_t *owner[SMP_MAX_CPUS];
+static u32 traps[SMP_MAX_CPUS];
+
+// Clean state loaded on a process's first FPU instruction
+static u8 init_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static inline u32 read_cr0(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(u32 v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline u32 read_cr4(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(u32 v) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline void clts(void) {
+    __asm__ volatile ("clts" : : : "memory");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(u8 *area) {
+    __asm__ volatile ("fxsave (%0)" : : "r"(area) : "memory");
+}
+
+static inline void fxrstor(const u8 *area) {
+    __asm__ volatile ("fxrstor (%0)" : : "r"(area) : "memory");
+}
+
+// The PCB is not 16-byte aligned, so its area carries slack
+static inline u8 *state_of(pcb_t *proc) {
+    return (u8*)(((u32)proc->fpu_area + 15) & ~15u);
+}
+
+static void nm_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    u32 cpu = smp_cpu_id();
+    clts();
+    traps[cpu]++;
+
+    pcb_t *cur = scheduler_get_current();
+    if (!cur) {
+        fxrstor(init_state);
+        return;
+    }
+    if (cur->fpu_used) {
+        fxrstor(state_of(cur));
+    } else {
+        fxrstor(init_state);
+        cur->fpu_used = true;
+    }
+    owner[cpu] = cur;
+}
+
+void fpu_init(void) {
+    if (!cpu_has(CPU_FEATURE_FXSR) || !cpu_has(CPU_FEATURE_SSE)) return;
+
+    u32 cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+    u32 mxcsr = MXCSR_DEFAULT;
+    __asm__ volatile ("fninit; ldmxcsr %0" : : "m"(mxcsr));
+
+    if (!enabled) {
+        fxsave(init_state);
+        idt_register_handler(NM_VECTOR, nm_handler);
+        enabled = true;
+    }
+    stts();
+}
+
+bool fpu_sse_enabled(void) {
+    return enabled;
+}
+
+void fpu_switch(void) {
+    if (!enabled) return;
+    u32 cpu = smp_cpu_id();
+    if (owner[cpu]) {
+        fxsave(state_of(owner[cpu]));
+        owner[cpu] = 0;
+        stts();
+    }
+}
+
+u32 kernel_fpu_begin(void) {
+    u32 flags = irq_save_raw();
+    if (flags & EFLAGS_IF) trace_irqs_off_caller();
+    if (!enabled) return flags;
+
+    u32 cpu = smp_cpu_id();
+    clts();
+    if (owner[cpu]) {
+        fxsave(state_of(owner[cpu]));
+        owner[cpu] = 0;
+    }
+    return flags;
+}
+
+void kernel_fpu_end(u32 flags) {
+    // The registers now hold kernel values: the next user reloads
+    if (enabled) stts();
+    if (flags & EFLAGS_IF) trace_irqs_on_caller();
+    irq_restore_raw(flags);
+}
+
+u32 fpu_get_trap_count(u32 cpu) {
+    return cpu < SMP_MAX_CPUS ? traps[cpu] : 0;
+}
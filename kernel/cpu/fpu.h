@@ -0,0 +1,31 @@
+#ifndef ICE_FPU_H
+#define ICE_FPU_H
+
+#include "../types.h"
+
+// FXSAVE image plus slack to align it to 16 bytes inside a PCB
+#define FPU_STATE_SIZE 512
+#define FPU_AREA_SIZE  (FPU_STATE_SIZE + 16)
+
+// Enable x87/SSE on the calling CPU with CR0.TS set, so the first FPU
+// instruction of each process traps (#NM) and loads its state. The
+// boot CPU also installs the #NM handler.
+void fpu_init(void);
+
+// FXSAVE and SSE are in use (false on CPUs without them)
+bool fpu_sse_enabled(void);
+
+// Context switch hook: save the outgoing process's registers if it
+// used the FPU this slice, and set TS again. Interrupts off.
+void fpu_switch(void);
+
+// SIMD inside the kernel. Kernel code is built without SSE, so XMM
+// registers may only be touched between these calls. Interrupts are
+// off in between; keep regions short and do not nest them.
+u32 kernel_fpu_begin(void);
+void kernel_fpu_end(u32 flags);
+
+// #NM traps taken on a CPU (state loads)
+u32 fpu_get_trap_count(u32 cpu);
+
+#endif
@@ -1,10 +1,14 @@
  
 
 #include "gdt.h"
+#include "smp.h"
 
  
  
-static gdt_entry_t gdt_entries[6] = {
+// Five flat segments, then one TSS per CPU
+#define GDT_ENTRIES (5 + SMP_MAX_CPUS)
+
+static gdt_entry_t gdt_entries[GDT_ENTRIES] = {
     {0, 0, 0, 0, 0, 0},       
     {0xFFFF, 0, 0, 0x9A, 0xCF, 0},  
     {0xFFFF, 0, 0, 0x92, 0xCF, 0},  
@@ -13,7 +17,7 @@ static gdt_entry_t gdt_entries[6] = {
     {0, 0, 0, 0, 0, 0}        
 };
 static gdt_ptr_t   gdt_ptr = {0, 0};
-static tss_t       tss_entry = {0};
+static tss_t       tss_entries[SMP_MAX_CPUS];
 
  
 static void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran) {
@@ -29,7 +33,7 @@ static void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran) {
 }
 
 void gdt_init(void) {
-    gdt_ptr.limit = (sizeof(gdt_entry_t) * 6) - 1;
+    gdt_ptr.limit = (sizeof(gdt_entry_t) * GDT_ENTRIES) - 1;
     gdt_ptr.base  = (u32)&gdt_entries;
 
      
@@ -53,18 +57,17 @@ void gdt_init(void) {
 
      
      
-    for (u32 i = 0; i < sizeof(tss_entry); i++) {
-        ((u8*)&tss_entry)[i] = 0;
+    for (u32 i = 0; i < sizeof(tss_entries); i++) {
+        ((u8*)tss_entries)[i] = 0;
+    }
+    for (u32 cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        tss_entries[cpu].ss0 = 0x10;   
+        tss_entries[cpu].esp0 = 0;
+        tss_entries[cpu].iomap_base = sizeof(tss_t);
     }
-    tss_entry.ss0 = 0x10;   
-    tss_entry.esp0 = 0;
-    
-     
-    u32 tss_base = (u32)&tss_entry;
-    u32 tss_limit = sizeof(tss_entry);
     
      
-    gdt_set_gate(5, tss_base, tss_limit, 0x89, 0x00);
+    gdt_set_gate(5, (u32)&tss_entries[0], sizeof(tss_t), 0x89, 0x00);
 
      
     gdt_flush((u32)&gdt_ptr);
@@ -73,6 +76,20 @@ void gdt_init(void) {
     tss_flush();
 }
 
+void gdt_init_cpu(u32 cpu) {
+    if (cpu == 0 || cpu >= SMP_MAX_CPUS) return;
+    
+    gdt_set_gate(5 + cpu, (u32)&tss_entries[cpu], sizeof(tss_t), 0x89, 0x00);
+    gdt_flush((u32)&gdt_ptr);
+    
+    u16 sel = GDT_TSS + 8 * cpu;
+    __asm__ volatile ("ltr %0" : : "r"(sel));
+}
+
 void gdt_set_kernel_stack(u32 stack) {
-    tss_entry.esp0 = stack;
+    tss_entries[smp_cpu_id()].esp0 = stack;
+}
+
+u32 gdt_kernel_stack_slot(u32 cpu) {
+    return (u32)&tss_entries[cpu].esp0;
 }
@@ -62,9 +62,16 @@ typedef struct __attribute__((packed)) {
  
 void gdt_init(void);
 
+// Load the shared GDT on an AP and its own TSS at GDT_TSS + 8 * cpu
+void gdt_init_cpu(u32 cpu);
+
  
+// Ring 0 stack for the calling CPU's TSS
 void gdt_set_kernel_stack(u32 stack);
 
+// Address of a CPU's TSS esp0 field; sysenter loads its stack from it
+u32 gdt_kernel_stack_slot(u32 cpu);
+
  
 extern void gdt_flush(u32 gdt_ptr);
 
@@ -2,8 +2,15 @@
 
 #include "idt.h"
 #include "gdt.h"
-#include "../drivers/pic.h"
+#include "../drivers/irq.h"
 #include "../drivers/vga.h"
+#include "../proc/scheduler.h"
+#include "../proc/clock.h"
+#include "lapic.h"
+#include "smp.h"
+#include "cpuid.h"
+#include "irqflags.h"
+#include "../errno.h"
 
  
 static idt_entry_t idt[256];
@@ -12,6 +19,26 @@ static idt_ptr_t idt_ptr;
  
 static interrupt_handler_t handlers[256] = {0};
 
+// Per-CPU so counting needs no lock
+static idt_vector_stats_t vector_stats[SMP_MAX_CPUS][256];
+static bool have_tsc = false;
+
+// Run the handler of a vector, counting it and its cost in TSC cycles
+static void dispatch(interrupt_frame_t *frame) {
+    idt_vector_stats_t *st = &vector_stats[smp_cpu_id()][frame->int_no & 0xFF];
+    st->count++;
+    
+    interrupt_handler_t handler = handlers[frame->int_no & 0xFF];
+    if (!handler) return;
+    if (have_tsc) {
+        u64 start = cycles();
+        handler(frame);
+        st->cycles += cycles() - start;
+    } else {
+        handler(frame);
+    }
+}
+
  
 static const char *exception_messages[] = {
     "Division By Zero",
@@ -105,9 +132,15 @@ extern void irq15(void);
  
 extern void isr128(void);
 
+// Local APIC vectors, also in isr.asm
+extern void lapic_timer_stub(void);
+extern void lapic_resched_stub(void);
+extern void lapic_spurious_stub(void);
+
 void idt_init(void) {
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base = (u32)&idt;
+    have_tsc = cpu_has(CPU_FEATURE_TSC);
     
      
     for (int i = 0; i < 256; i++) {
@@ -169,7 +202,15 @@ void idt_init(void) {
      
     idt_set_gate(128, (u32)isr128, GDT_KERNEL_CODE, 0xEE);
     
+    idt_set_gate(LAPIC_TIMER_VECTOR, (u32)lapic_timer_stub, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(LAPIC_RESCHED_VECTOR, (u32)lapic_resched_stub, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (u32)lapic_spurious_stub, GDT_KERNEL_CODE, 0x8E);
+    
      
+    idt_load();
+}
+
+void idt_load(void) {
     __asm__ volatile ("lidt %0" : : "m"(idt_ptr));
 }
 
@@ -178,9 +219,27 @@ void idt_register_handler(u8 n, interrupt_handler_t handler) {
 }
 
  
+// Gates clear IF on entry; the iret sets it again if it was on before
 void isr_handler(interrupt_frame_t *frame) {
+    if (frame->eflags & EFLAGS_IF) trace_irqs_off();
     if (handlers[frame->int_no]) {
-        handlers[frame->int_no](frame);
+        dispatch(frame);
+    } else {
+        idt_default_exception(frame);
+    }
+    // On its way back to ring 3 a process holds nothing in the kernel,
+    // so this is where a kill takes effect
+    if ((frame->cs & 3) && scheduler_killed()) scheduler_exit();
+    if (frame->eflags & EFLAGS_IF) trace_irqs_on();
+}
+
+void idt_default_exception(interrupt_frame_t *frame) {
+    if (frame->int_no < 32 && (frame->cs & 3)) {
+        // A fault in ring 3 only takes down its process
+        pcb_t *self = scheduler_get_current();
+        vga_printf("\n[%s:%u] %s at 0x%x, killed\n", self ? self->name : "?",
+                   self ? self->pid : 0, exception_messages[frame->int_no], frame->eip);
+        scheduler_exit();
     } else if (frame->int_no < 32) {
          
         vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
@@ -196,10 +255,19 @@ void isr_handler(interrupt_frame_t *frame) {
 
  
 void irq_handler(interrupt_frame_t *frame) {
-     
-    if (handlers[frame->int_no]) {
-        handlers[frame->int_no](frame);
-    }
+    if (frame->eflags & EFLAGS_IF) trace_irqs_off();
+    dispatch(frame);
     
-    pic_send_eoi(frame->int_no - 32);
+    // Acknowledge before switching: the next context may run for a whole
+    // timeslice before this frame is unwound
+    irq_eoi(frame->int_no);
+    scheduler_preempt();
+    if ((frame->cs & 3) && scheduler_killed()) scheduler_exit();
+    if (frame->eflags & EFLAGS_IF) trace_irqs_on();
+}
+
+int idt_get_vector_stats(u32 cpu, u8 vector, idt_vector_stats_t *stats) {
+    if (cpu >= SMP_MAX_CPUS || !stats) return E_INVALID_ARG;
+    *stats = vector_stats[cpu][vector];
+    return E_OK;
 }
@@ -34,7 +34,22 @@ typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
  
 void idt_init(void);
 
+// Load the IDT built by idt_init on the calling CPU (used by APs)
+void idt_load(void);
+
  
 void idt_register_handler(u8 n, interrupt_handler_t handler);
 
+// What an exception without a handler does: kill the process if it came
+// from ring 3, panic otherwise. For handlers that only resolve some faults.
+void idt_default_exception(interrupt_frame_t *frame);
+
+typedef struct {
+    u32 count;           // Interrupts taken
+    u64 cycles;          // TSC cycles spent in the handler
+} idt_vector_stats_t;
+
+// Counters of one vector on one CPU. E_INVALID_ARG for a bad CPU.
+int idt_get_vector_stats(u32 cpu, u8 vector, idt_vector_stats_t *stats);
+
 #endif  
@@ -0,0 +1,52 @@
+#ifndef ICE_IRQFLAGS_H
+#define ICE_IRQFLAGS_H
+
+#include "../types.h"
+#include "irqtrace.h"
+
+// Interrupt flag helpers shared by the whole kernel. irq_save() turns
+// interrupts off and returns the EFLAGS from before; irq_restore() turns
+// them back on only if that value had them on, so sections nest. Both
+// report to the interrupts-off tracer as the calling file. The _raw
+// forms do not, for wrappers that report their own caller and for the
+// tracer itself.
+
+#define EFLAGS_IF 0x200
+
+static inline u32 irq_flags(void) {
+    u32 flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline bool irqs_enabled(void) {
+    return (irq_flags() & EFLAGS_IF) != 0;
+}
+
+static inline u32 irq_save_raw(void) {
+    u32 flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore_raw(u32 flags) {
+    if (flags & EFLAGS_IF) __asm__ volatile ("sti" : : : "memory");
+}
+
+// Always inlined so the tracer sees the caller's address
+static inline __attribute__((always_inline)) u32 irq_save_from(const char *file) {
+    u32 flags = irq_save_raw();
+    if (flags & EFLAGS_IF) trace_irqs_off_from(file);
+    return flags;
+}
+
+static inline __attribute__((always_inline)) void irq_restore_from(u32 flags,
+                                                                   const char *file) {
+    if (flags & EFLAGS_IF) trace_irqs_on_from(file);
+    irq_restore_raw(flags);
+}
+
+#define irq_save()         irq_save_from(__FILE__)
+#define irq_restore(flags) irq_restore_from((flags), __FILE__)
+
+#endif
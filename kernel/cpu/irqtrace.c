@@ -0,0 +1,127 @@
+/*
+ * ICE interrupts-off tracer
+ *
+ * Each CPU remembers when and where it last disabled interrupts; the
+ * matching enable closes the section and offers it to a global table
+ * of the worst ones. Everything here runs with interrupts off, so the
+ * table only needs protection against other CPUs.
+ */
+
+#include "irqtrace.h"
+#include "irqflags.h"
+
+#ifdef CONFIG_IRQSOFF_TRACE
+
+#include "smp.h"
+#include "../proc/clock.h"
+#include "../drivers/serial.h"
+
+typedef struct {
+    u64 since;
+    u32 ip;
+    const char *file;
+    bool open;
+} irqtrace_cpu_t;
+
+static irqtrace_cpu_t cpus[SMP_MAX_CPUS];
+static irqtrace_entry_t worst[IRQTRACE_WORST];
+static u32 worst_count = 0;
+static volatile u32 worst_lock = 0;
+static bool serial_ready = false;
+
+static inline void lock(void) {
+    while (__sync_lock_test_and_set(&worst_lock, 1)) {
+        __asm__ volatile ("pause" ::: "memory");
+    }
+}
+
+static inline void unlock(void) {
+    __sync_lock_release(&worst_lock);
+}
+
+void irqtrace_off_ip(const char *file, u32 ip) {
+    irqtrace_cpu_t *c = &cpus[smp_cpu_id()];
+    // An open section here was ended by an untraced enable (iret,
+    // sysexit); it is dropped rather than reported too long
+    c->since = cycles();
+    c->ip = ip;
+    c->file = file;
+    c->open = true;
+}
+
+void irqtrace_on_ip(const char *file, u32 ip) {
+    u32 cpu = smp_cpu_id();
+    irqtrace_cpu_t *c = &cpus[cpu];
+    if (!c->open) return;
+    c->open = false;
+
+    u64 len = cycles() - c->since;
+    if (worst_count == IRQTRACE_WORST && len <= worst[IRQTRACE_WORST - 1].cycles) return;
+
+    lock();
+    u32 i;
+    if (worst_count < IRQTRACE_WORST) {
+        i = worst_count++;
+    } else if (len > worst[IRQTRACE_WORST - 1].cycles) {
+        i = IRQTRACE_WORST - 1;
+    } else {
+        unlock();
+        return;
+    }
+    for (; i > 0 && worst[i - 1].cycles < len; i--) worst[i] = worst[i - 1];
+    worst[i] = (irqtrace_entry_t){
+        .cycles = len,
+        .off_ip = c->ip,
+        .on_ip = ip,
+        .off_file = c->file,
+        .on_file = file,
+        .cpu = cpu,
+    };
+    unlock();
+}
+
+void __attribute__((noinline)) irqtrace_off(const char *file) {
+    irqtrace_off_ip(file, (u32)__builtin_return_address(0));
+}
+
+void __attribute__((noinline)) irqtrace_on(const char *file) {
+    irqtrace_on_ip(file, (u32)__builtin_return_address(0));
+}
+
+u32 irqtrace_get(irqtrace_entry_t *out, u32 max) {
+    u32 flags = irq_save_raw();
+    lock();
+    u32 n = worst_count < max ? worst_count : max;
+    for (u32 i = 0; i < n; i++) out[i] = worst[i];
+    unlock();
+    irq_restore_raw(flags);
+    return n;
+}
+
+void irqtrace_reset(void) {
+    u32 flags = irq_save_raw();
+    lock();
+    worst_count = 0;
+    for (u32 i = 0; i < IRQTRACE_WORST; i++) worst[i].cycles = 0;
+    unlock();
+    irq_restore_raw(flags);
+}
+
+void irqtrace_dump_serial(void) {
+    if (!serial_ready) {
+        serial_init();
+        serial_ready = true;
+    }
+
+    irqtrace_entry_t list[IRQTRACE_WORST];
+    u32 n = irqtrace_get(list, IRQTRACE_WORST);
+    serial_printf("irqsoff: %u worst sections\n", n);
+    for (u32 i = 0; i < n; i++) {
+        serial_printf("%2u cpu%u %u ns  off %s@%x  on %s@%x\n", i,
+                      list[i].cpu, (u32)clock_cycles_to_ns(list[i].cycles),
+                      list[i].off_file, list[i].off_ip,
+                      list[i].on_file, list[i].on_ip);
+    }
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef ICE_IRQTRACE_H
+#define ICE_IRQTRACE_H
+
+#include "../types.h"
+
+// Interrupts-off latency tracer (make IRQTRACE=1). The irq_save /
+// irq_restore helpers (cpu/irqflags.h), spinlocks and interrupt entry report every
+// transition of EFLAGS.IF; each CPU times its interrupts-off sections
+// with the TSC and the longest IRQTRACE_WORST are kept together with
+// where interrupts went off and came back on. Without IRQTRACE the
+// hooks compile to nothing.
+#define IRQTRACE_WORST 16
+
+#ifdef CONFIG_IRQSOFF_TRACE
+
+typedef struct {
+    u64 cycles;
+    u32 off_ip;             // Code address that disabled interrupts
+    u32 on_ip;              // And the one that enabled them again
+    const char *off_file;
+    const char *on_file;
+    u32 cpu;
+} irqtrace_entry_t;
+
+// Called right after interrupts went off / right before they go back
+// on. Out of line, so their return address is the call site.
+void irqtrace_off(const char *file);
+void irqtrace_on(const char *file);
+
+// Same, for wrappers that report their caller's address instead
+void irqtrace_off_ip(const char *file, u32 ip);
+void irqtrace_on_ip(const char *file, u32 ip);
+
+#define trace_irqs_off() irqtrace_off(__FILE__)
+#define trace_irqs_on()  irqtrace_on(__FILE__)
+#define trace_irqs_off_caller() \
+    irqtrace_off_ip(__FILE__, (u32)__builtin_return_address(0))
+#define trace_irqs_on_caller() \
+    irqtrace_on_ip(__FILE__, (u32)__builtin_return_address(0))
+// For inline helpers that pass their caller's file along
+#define trace_irqs_off_from(file) irqtrace_off(file)
+#define trace_irqs_on_from(file)  irqtrace_on(file)
+
+// Worst sections, longest first. Returns how many were copied.
+u32 irqtrace_get(irqtrace_entry_t *out, u32 max);
+
+void irqtrace_reset(void);
+
+// Print the table on COM1
+void irqtrace_dump_serial(void);
+
+#else
+
+#define trace_irqs_off()        ((void)0)
+#define trace_irqs_on()         ((void)0)
+#define trace_irqs_off_caller() ((void)0)
+#define trace_irqs_on_caller()  ((void)0)
+#define trace_irqs_off_from(file) ((void)(file))
+#define trace_irqs_on_from(file)  ((void)(file))
+
+#endif
+
+#endif
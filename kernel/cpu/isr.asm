@@ -92,8 +92,29 @@ isr128:
     jmp isr_common_stub
 
 
+; Local APIC vectors (lapic.h) take the same path as the PIC IRQs
+global lapic_timer_stub
+lapic_timer_stub:
+    push dword 0
+    push dword 0xF0
+    jmp irq_common_stub
+
+global lapic_resched_stub
+lapic_resched_stub:
+    push dword 0
+    push dword 0xF1
+    jmp irq_common_stub
+
+; Spurious interrupts take no EOI
+global lapic_spurious_stub
+lapic_spurious_stub:
+    iret
+
+
 isr_common_stub:
-    
+    ; The interrupted code may have DF set (memmove, or ring 3); the C
+    ; string functions need it clear. iret restores the old value.
+    cld
     pusha
     
     
@@ -133,6 +154,7 @@ isr_common_stub:
 
 
 irq_common_stub:
+    cld
     pusha
     
     mov ax, ds
@@ -0,0 +1,149 @@
+/*
+ * ICE local APIC
+ *
+ * xAPIC mode only, through the identity-mapped (uncached) register page.
+ * Device interrupts still arrive through the PIC, which the boot CPU
+ * receives in virtual wire mode over LINT0; the APIC adds the per-CPU
+ * timer and inter-processor interrupts.
+ */
+
+#include "lapic.h"
+#include "cpuid.h"
+#include "msr.h"
+#include "../drivers/pit.h"
+#include "irqflags.h"
+
+#define MSR_APIC_BASE       0x1B
+#define APIC_BASE_BSP       (1u << 8)
+#define APIC_BASE_ENABLE    (1u << 11)
+#define APIC_BASE_MASK      0xFFFFF000
+
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_TIMER_ONESHOT 0x00000
+#define LAPIC_DELIVER_NMI   0x00400
+#define LAPIC_DELIVER_EXTINT 0x00700
+#define LAPIC_DIVIDE_16     0x3
+
+#define ICR_FIXED           0x00000
+#define ICR_INIT            0x00500
+#define ICR_STARTUP         0x00600
+#define ICR_PENDING         0x01000
+#define ICR_ASSERT          0x04000
+
+#define CALIBRATE_MS        10
+
+static volatile u32 *lapic = 0;
+static u32 ticks_per_ms = 0;
+
+static inline u32 lapic_read(u32 reg) {
+    return lapic[reg >> 2];
+}
+
+static inline void lapic_write(u32 reg, u32 value) {
+    lapic[reg >> 2] = value;
+}
+
+bool lapic_init(u32 base) {
+    if (!cpu_has(CPU_FEATURE_APIC) || !cpu_has(CPU_FEATURE_MSR)) return false;
+
+    u64 msr = rdmsr(MSR_APIC_BASE);
+    if (!base) base = (u32)msr & APIC_BASE_MASK;
+    wrmsr(MSR_APIC_BASE, (msr & ~(u64)APIC_BASE_MASK) | base | APIC_BASE_ENABLE);
+    lapic = (volatile u32*)base;
+
+    // Virtual wire: LINT0 carries the PIC to the boot CPU, LINT1 the NMI.
+    // Nothing is wired to the APs.
+    if (msr & APIC_BASE_BSP) {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_DELIVER_EXTINT);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_DELIVER_NMI);
+    } else {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    return true;
+}
+
+void lapic_mask_lint0(void) {
+    if (lapic) lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+}
+
+bool lapic_available(void) {
+    return lapic != 0;
+}
+
+u32 lapic_id(void) {
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void) {
+    if (lapic) lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_icr(u32 apic_id, u32 low) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+void lapic_send_ipi(u32 apic_id, u8 vector) {
+    if (!lapic) return;
+
+    // The ICR is two writes; keep an interrupt from sending in between
+    u32 flags = irq_save();
+    lapic_icr(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+    irq_restore(flags);
+}
+
+void lapic_send_init(u32 apic_id) {
+    lapic_icr(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(u32 apic_id, u32 trampoline) {
+    lapic_icr(apic_id, ICR_STARTUP | ICR_ASSERT | ((trampoline >> 12) & 0xFF));
+}
+
+void lapic_timer_calibrate(void) {
+    if (!lapic) return;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    pit_delay_us(CALIBRATE_MS * 1000);
+    u32 left = lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    ticks_per_ms = (0xFFFFFFFF - left) / CALIBRATE_MS;
+}
+
+void lapic_timer_oneshot(u32 ms) {
+    if (!lapic || !ticks_per_ms) return;
+
+    u32 count = ticks_per_ms * ms;
+    if (ms && count == 0) count = 1;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    // A zero initial count stops the timer
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
@@ -0,0 +1,43 @@
+#ifndef ICE_LAPIC_H
+#define ICE_LAPIC_H
+
+#include "../types.h"
+
+// Vectors above the PIC range; irq_handler sends these a LAPIC EOI
+#define LAPIC_TIMER_VECTOR    0xF0
+#define LAPIC_RESCHED_VECTOR  0xF1
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+#define LAPIC_DEFAULT_BASE    0xFEE00000
+
+// Scheduler tick rate of the timer on a CPU with processes waiting
+#define LAPIC_TICK_HZ         100
+#define LAPIC_TICK_MS         (1000 / LAPIC_TICK_HZ)
+
+// Enable the calling CPU's local APIC at base (0 for the MSR value).
+// Returns false when the CPU has none.
+bool lapic_init(u32 base);
+
+bool lapic_available(void);
+
+// Drop the PIC virtual wire on LINT0, once the IOAPIC delivers IRQs
+void lapic_mask_lint0(void);
+
+u32 lapic_id(void);
+
+void lapic_eoi(void);
+
+// Fixed-vector IPI to one APIC id
+void lapic_send_ipi(u32 apic_id, u8 vector);
+
+// AP startup sequence (INIT, then STARTUP with the trampoline page)
+void lapic_send_init(u32 apic_id);
+void lapic_send_startup(u32 apic_id, u32 trampoline);
+
+// Measure the timer against the PIT. Run once, on the boot CPU.
+void lapic_timer_calibrate(void);
+
+// One timer interrupt on the calling CPU after ms; 0 stops the timer
+void lapic_timer_oneshot(u32 ms);
+
+#endif
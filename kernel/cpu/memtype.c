@@ -0,0 +1,168 @@
+/*
+ * ICE memory type control (PAT / MTRR)
+ */
+
+#include "memtype.h"
+#include "cpuid.h"
+#include "msr.h"
+#include "../mm/paging.h"
+#include "irqflags.h"
+#include "smp.h"
+
+#define PAT_UC       0x00
+#define PAT_WC       0x01
+#define PAT_WT       0x04
+#define PAT_WB       0x06
+#define PAT_UC_MINUS 0x07
+
+#define MTRR_TYPE_WC       0x01
+#define MTRRCAP_WC         (1u << 10)
+#define MTRR_DEF_ENABLE    (1u << 11)
+#define MTRR_MASK_VALID    (1u << 11)
+
+#define CR0_NW (1u << 29)
+#define CR0_CD (1u << 30)
+
+static bool pat_wc = false;
+static int wc_mtrr = -1;          // Variable range we own, -1 if none
+static u64 wc_base = 0;           // What it holds, replayed on each AP
+static u64 wc_mask = 0;
+
+static inline u32 read_cr0(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(u32 v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline void wbinvd(void) {
+    __asm__ volatile ("wbinvd" : : : "memory");
+}
+
+static void mtrr_update(int reg, u64 base, u64 mask);
+
+void memtype_init(void) {
+    // Every CPU must have the same MTRRs (SDM 11.11.8); an AP starts
+    // with the firmware's
+    if (wc_mtrr >= 0) mtrr_update(wc_mtrr, wc_base, wc_mask);
+    
+    if (!cpu_has(CPU_FEATURE_PAT) || !cpu_has(CPU_FEATURE_MSR)) return;
+    
+    // Power-on layout is WB, WT, UC-, UC repeated; only slot 1 (PWT)
+    // changes so PCD and PCD|PWT keep their usual meaning
+    u64 pat = ((u64)PAT_WB)       | ((u64)PAT_WC << 8)  |
+              ((u64)PAT_UC_MINUS << 16) | ((u64)PAT_UC << 24) |
+              ((u64)PAT_WB << 32) | ((u64)PAT_WT << 40) |
+              ((u64)PAT_UC_MINUS << 48) | ((u64)PAT_UC << 56);
+    
+    u32 flags = irq_save();
+    wbinvd();
+    wrmsr(MSR_PAT, pat);
+    wbinvd();
+    irq_restore(flags);
+    
+    pat_wc = true;
+}
+
+// SDM 11.11.7.2: caches off and flushed while the MTRRs change
+static void mtrr_update(int reg, u64 base, u64 mask) {
+    u32 flags = irq_save();
+    u32 cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    paging_flush_tlb_all();
+    
+    u64 def = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def & ~(u64)MTRR_DEF_ENABLE);
+    wrmsr(MSR_MTRR_PHYSBASE(reg), base);
+    wrmsr(MSR_MTRR_PHYSMASK(reg), mask);
+    wbinvd();
+    paging_flush_tlb_all();
+    wrmsr(MSR_MTRR_DEF_TYPE, def);
+    
+    write_cr0(cr0);
+    irq_restore(flags);
+}
+
+// MTRRs only change while the boot CPU runs alone: there is no way to
+// update the other CPUs in step, so once they are up the range we own
+// stays as it is. A UC mapping in the page tables still overrides it.
+static bool mtrr_frozen(void) {
+    return smp_cpu_count() > 1;
+}
+
+static void mtrr_release(void) {
+    if (wc_mtrr < 0 || mtrr_frozen()) return;
+    mtrr_update(wc_mtrr, 0, 0);
+    wc_mtrr = -1;
+}
+
+static bool mtrr_set_wc(phys_addr_t base, u32 size) {
+    if (!cpu_has(CPU_FEATURE_MTRR) || !cpu_has(CPU_FEATURE_MSR)) return false;
+    if (size < 0x1000 || (size & (size - 1)) || (base & (size - 1))) return false;
+    
+    u64 cap = rdmsr(MSR_MTRRCAP);
+    if (!(cap & MTRRCAP_WC)) return false;
+    
+    int reg = wc_mtrr;
+    if (reg < 0) {
+        u32 count = (u32)cap & 0xFF;
+        for (u32 i = 0; i < count; i++) {
+            if (!(rdmsr(MSR_MTRR_PHYSMASK(i)) & MTRR_MASK_VALID)) {
+                reg = (int)i;
+                break;
+            }
+        }
+        if (reg < 0) return false;
+    }
+    
+    u64 addr_mask = (1ULL << cpu_get_info()->phys_bits) - 1;
+    u64 mask = (~((u64)size - 1) & addr_mask & ~0xFFFULL) | MTRR_MASK_VALID;
+    u64 value = (u64)base | MTRR_TYPE_WC;
+    if (reg == wc_mtrr && wc_base == value && wc_mask == mask) return true;
+    if (mtrr_frozen()) return false;
+    
+    mtrr_update(reg, value, mask);
+    wc_mtrr = reg;
+    wc_base = value;
+    wc_mask = mask;
+    return true;
+}
+
+memtype_method_t memtype_set_range(phys_addr_t base, u32 size, memtype_t type) {
+    bool paged = paging_enabled();
+    
+    if (type == MEMTYPE_UC) {
+        mtrr_release();
+        if (paged) {
+            paging_set_cache(base, size, PAGE_PCD | PAGE_PWT);
+            return MEMTYPE_VIA_PAT;
+        }
+        return MEMTYPE_VIA_NONE;
+    }
+    
+    if (pat_wc && paged) {
+        mtrr_release();
+        paging_set_cache(base, size, PAGE_PWT);
+        return MEMTYPE_VIA_PAT;
+    }
+    
+    if (mtrr_set_wc(base, size)) {
+        // Plain UC in the page tables would override the MTRR, UC- does not
+        if (paged) paging_set_cache(base, size, PAGE_PCD);
+        return MEMTYPE_VIA_MTRR;
+    }
+    
+    return MEMTYPE_VIA_NONE;
+}
+
+const char* memtype_method_name(memtype_method_t method) {
+    switch (method) {
+        case MEMTYPE_VIA_PAT:  return "PAT";
+        case MEMTYPE_VIA_MTRR: return "MTRR";
+        default:               return "none";
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef ICE_MEMTYPE_H
+#define ICE_MEMTYPE_H
+
+#include "../types.h"
+
+typedef enum {
+    MEMTYPE_UC = 0,      // Uncached, strongly ordered (MMIO registers)
+    MEMTYPE_WC           // Write-combining (framebuffers)
+} memtype_t;
+
+typedef enum {
+    MEMTYPE_VIA_NONE = 0,
+    MEMTYPE_VIA_PAT,     // Page attributes, PAT slot 1 reprogrammed to WC
+    MEMTYPE_VIA_MTRR     // Variable-range MTRR, pages left UC-
+} memtype_method_t;
+
+// Reprogram PAT so PWT-only mappings become write-combining. Must run
+// before paging_init while nothing uses that combination yet, and again
+// on each AP since PAT is per CPU; an AP also copies the boot CPU's
+// write-combining MTRR.
+void memtype_init(void);
+
+// Set the memory type of an identity-mapped physical range. PAT is
+// preferred; without it a variable MTRR is used, which needs a
+// power-of-two sized, naturally aligned range and can only be set up
+// before the APs are started.
+memtype_method_t memtype_set_range(phys_addr_t base, u32 size, memtype_t type);
+
+const char* memtype_method_name(memtype_method_t method);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * ICE SMP bring-up
+ *
+ * The boot CPU reads the CPU list from the ACPI MADT and starts each AP
+ * with INIT / STARTUP IPIs at a real-mode trampoline copied to
+ * SMP_TRAMPOLINE_ADDR. The trampoline enters protected mode with a
+ * temporary flat GDT, turns on paging with the boot CPU's CR3/CR4 and
+ * calls ap_main on its own stack. APs are started one at a time since
+ * they share the trampoline's parameter block.
+ */
+
+#include "smp.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "idt.h"
+#include "memtype.h"
+#include "fpu.h"
+#include "../drivers/pit.h"
+#include "../drivers/irq.h"
+#include "../mm/pmm.h"
+#include "../mm/memacct.h"
+#include "../proc/scheduler.h"
+#include "../proc/syscall.h"
+
+#define SMP_INIT_DELAY_US    10000
+#define SMP_SIPI_DELAY_US    200
+#define SMP_ONLINE_TIMEOUT_MS 100
+
+// Read by the trampoline at smp_trampoline_params, in this order
+typedef struct __attribute__((packed)) {
+    u32 cr4;
+    u32 cr3;                 // 0: stay unpaged
+    u32 stack;
+    u32 cpu;
+    u32 entry;               // void entry(u32 cpu)
+} trampoline_params_t;
+
+// Real-mode entry of the APs (trampoline.asm), copied below 1 MiB
+extern const u8 smp_trampoline[];
+extern const u8 smp_trampoline_params[];
+extern const u8 smp_trampoline_end[];
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static u32 cpu_slots = 1;        // Entries of cpus[] in use
+static u32 cpus_online = 1;
+
+static inline u32 read_cr3(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline u32 read_cr4(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static void resched_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    scheduler_request_resched();
+    // Sent by irq_sched_tick_wake when this CPU's tick was stopped
+    irq_sched_tick_update();
+}
+
+static void ap_main(u32 cpu) {
+    const acpi_madt_t *madt = acpi_get_madt();
+
+    gdt_init_cpu(cpu);
+    idt_load();
+    memtype_init();
+    fpu_init();
+    syscall_init_cpu();
+    lapic_init(madt->lapic_base);
+    scheduler_init_cpu(cpu);
+
+    cpus[cpu].online = true;
+    __atomic_add_fetch(&cpus_online, 1, __ATOMIC_SEQ_CST);
+
+    // This boot context is now the CPU's idle process
+    scheduler_idle();
+}
+
+static bool start_ap(u32 cpu, trampoline_params_t *params) {
+    phys_addr_t stack = pmm_alloc_page();
+    if (!stack) return false;
+    memacct_charge_pages(MEM_TAG_SCHED, 1);
+    cpus[cpu].stack = stack;
+
+    params->stack = stack + PAGE_SIZE;
+    params->cpu = cpu;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    u32 apic_id = cpus[cpu].apic_id;
+    lapic_send_init(apic_id);
+    pit_delay_us(SMP_INIT_DELAY_US);
+
+    // Second STARTUP only if the first was missed (Intel MP spec B.4)
+    for (int i = 0; i < 2 && !cpus[cpu].online; i++) {
+        lapic_send_startup(apic_id, SMP_TRAMPOLINE_ADDR);
+        pit_delay_us(SMP_SIPI_DELAY_US);
+    }
+
+    for (u32 ms = 0; ms < SMP_ONLINE_TIMEOUT_MS && !cpus[cpu].online; ms++) {
+        pit_delay_us(1000);
+    }
+
+    // A late AP may still come up on this stack, so it is never freed
+    return cpus[cpu].online;
+}
+
+void smp_init(void) {
+    cpus[0].id = 0;
+    cpus[0].online = true;
+    cpus[0].stack = 0;
+
+    // irq_init has enabled and calibrated the boot CPU's local APIC
+    const acpi_madt_t *madt = acpi_get_madt();
+    if (!madt || !lapic_available()) return;
+    cpus[0].apic_id = lapic_id();
+    if (madt->cpu_count < 2) return;
+
+    idt_register_handler(LAPIC_RESCHED_VECTOR, resched_handler);
+
+    u32 size = (u32)(smp_trampoline_end - smp_trampoline);
+    u8 *dst = (u8*)SMP_TRAMPOLINE_ADDR;
+    for (u32 i = 0; i < size; i++) {
+        dst[i] = smp_trampoline[i];
+    }
+
+    trampoline_params_t *params = (trampoline_params_t*)
+        (SMP_TRAMPOLINE_ADDR + (u32)(smp_trampoline_params - smp_trampoline));
+    params->cr4 = read_cr4();
+    params->cr3 = read_cr3();
+    params->entry = (u32)ap_main;
+
+    for (u32 i = 0; i < madt->cpu_count && cpu_slots < SMP_MAX_CPUS; i++) {
+        u32 apic_id = madt->cpu_apic_ids[i];
+        if (apic_id == cpus[0].apic_id) continue;
+
+        u32 cpu = cpu_slots++;
+        cpus[cpu].id = cpu;
+        cpus[cpu].apic_id = apic_id;
+        cpus[cpu].online = false;
+        // A CPU that fails to start keeps its slot, offline
+        start_ap(cpu, params);
+    }
+}
+
+u32 smp_cpu_count(void) {
+    return cpus_online;
+}
+
+const cpu_t* smp_get_cpu(u32 cpu) {
+    return cpu < cpu_slots ? &cpus[cpu] : 0;
+}
+
+void smp_send_resched(u32 cpu) {
+    if (cpu >= cpu_slots || cpu == smp_cpu_id()) return;
+    lapic_send_ipi(cpus[cpu].apic_id, LAPIC_RESCHED_VECTOR);
+}
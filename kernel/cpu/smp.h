@@ -0,0 +1,40 @@
+#ifndef ICE_SMP_H
+#define ICE_SMP_H
+
+#include "../types.h"
+#include "gdt.h"
+
+#define SMP_MAX_CPUS 8
+
+// Physical page the AP startup code is copied to (SIPI vector 0x08).
+// trampoline.asm is assembled for this address as TRAMP_BASE.
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+typedef struct {
+    u32 id;                  // Index into the CPU table; 0 is the boot CPU
+    u32 apic_id;
+    volatile bool online;
+    u32 stack;               // Boot stack page of an AP, 0 on the BSP
+} cpu_t;
+
+// Start every application processor listed in the ACPI MADT. Leaves the
+// system uniprocessor when there is no MADT or local APIC.
+void smp_init(void);
+
+// CPUs online
+u32 smp_cpu_count(void);
+
+const cpu_t* smp_get_cpu(u32 cpu);
+
+// Ask a CPU to reschedule. A no-op for the calling CPU.
+void smp_send_resched(u32 cpu);
+
+// Each CPU loads its own TSS (GDT_TSS + 8 * cpu), so the task register
+// identifies the CPU without touching the APIC or a segment register
+static inline u32 smp_cpu_id(void) {
+    u16 tr;
+    __asm__ volatile ("str %0" : "=r"(tr));
+    return tr > GDT_TSS ? (u32)(tr - GDT_TSS) >> 3 : 0;
+}
+
+#endif
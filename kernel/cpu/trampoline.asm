@@ -0,0 +1,84 @@
+; ICE AP startup trampoline
+;
+; smp_init copies this block to SMP_TRAMPOLINE_ADDR and points the
+; STARTUP IPI at it. An AP starts here in real mode, loads a temporary
+; flat GDT, enters protected mode, turns on paging with the boot CPU's
+; CR3/CR4 and calls ap_main on its own stack. Every address used is
+; TRAMP_BASE plus an offset from smp_trampoline, with DS = 0, so only
+; the copy is ever executed.
+
+; Must match SMP_TRAMPOLINE_ADDR in smp.h
+TRAMP_BASE equ 0x8000
+
+%define TRAMP(label) (TRAMP_BASE + ((label) - smp_trampoline))
+
+; Offsets into trampoline_params_t (smp.c)
+PARAM_CR4   equ 0
+PARAM_CR3   equ 4          ; 0: stay unpaged
+PARAM_STACK equ 8
+PARAM_CPU   equ 12
+PARAM_ENTRY equ 16         ; void entry(u32 cpu)
+
+global smp_trampoline
+global smp_trampoline_params
+global smp_trampoline_end
+
+section .rodata
+
+BITS 16
+
+smp_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [TRAMP(tramp_gdtr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(tramp_pm)
+
+BITS 32
+
+tramp_pm:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, [TRAMP(smp_trampoline_params) + PARAM_CR4]
+    mov cr4, eax
+    mov eax, [TRAMP(smp_trampoline_params) + PARAM_CR3]
+    test eax, eax
+    jz .no_paging
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000      ; PG | WP
+    mov cr0, eax
+.no_paging:
+
+    mov esp, [TRAMP(smp_trampoline_params) + PARAM_STACK]
+    push dword [TRAMP(smp_trampoline_params) + PARAM_CPU]
+    mov eax, [TRAMP(smp_trampoline_params) + PARAM_ENTRY]
+    call eax
+
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 8, db 0
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF   ; 0x08: flat code
+    dq 0x00CF92000000FFFF   ; 0x10: flat data
+tramp_gdtr:
+    dw 23
+    dd TRAMP(tramp_gdt)
+
+align 4, db 0
+smp_trampoline_params:
+    times 5 dd 0
+smp_trampoline_end:
@@ -3,6 +3,9 @@
 #include "ata.h"
 #include "vga.h"
 #include "pit.h"
+#include "irq.h"
+#include "../cpu/idt.h"
+#include "../sync/mutex.h"
 
  
 static inline void outb(u16 port, u8 value) {
@@ -26,8 +29,50 @@ static inline void outsl(u16 port, const void *addr, u32 count) {
  
 static bool drive_present = false;
 
- 
+// Processes sleeping until the drive raises IRQ14
+static waitqueue_t ata_waiters;
+
+// One command at a time; held across the sleeps below
+static mutex_t ata_lock;
+
+// Polls before going to sleep; emulated drives usually finish in this window
+#define ATA_SPIN_POLLS  256
+#define ATA_TIMEOUT_MS  1000
+
+static void ata_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    // Reading STATUS deasserts INTRQ
+    inb(ATA_PRIMARY_STATUS);
+    waitqueue_wake_all(&ata_waiters);
+}
+
+static bool ata_not_busy(void *arg) {
+    (void)arg;
+    u8 status = inb(ATA_PRIMARY_ALTSTATUS);
+    return !(status & ATA_STATUS_BSY) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+}
+
+static bool ata_drq_or_error(void *arg) {
+    (void)arg;
+    u8 status = inb(ATA_PRIMARY_ALTSTATUS);
+    return !(status & ATA_STATUS_BSY) &&
+           (status & (ATA_STATUS_DRQ | ATA_STATUS_ERR | ATA_STATUS_DF));
+}
+
+// Spin briefly, then sleep until the IRQ handler reports progress.
+// Before the scheduler can block (boot mounts the root fs with
+// interrupts off) the callers' polling loops do all the waiting.
+static void ata_sleep_until(bool (*cond)(void *arg)) {
+    for (int i = 0; i < ATA_SPIN_POLLS; i++) {
+        if (cond(0)) return;
+        __asm__ volatile("pause");
+    }
+    waitqueue_wait_until(&ata_waiters, cond, 0, ATA_TIMEOUT_MS);
+}
+
 static int ata_wait_ready(void) {
+    ata_sleep_until(ata_not_busy);
+    
     // Use iteration count to be safe even if interrupts are disabled (PIT won't update)
     // 100,000 iterations * ~1us (pause + inb) = ~100ms
     // Increase to 1,000,000 for generous timeout (~1s)
@@ -49,6 +94,8 @@ static int ata_wait_ready(void) {
 
  
 static int ata_wait_drq(void) {
+    ata_sleep_until(ata_drq_or_error);
+    
     u32 retries = 1000000;
     while (retries-- > 0) {
         u8 status = inb(ATA_PRIMARY_STATUS);
@@ -68,8 +115,14 @@ int ata_init(void) {
     for (volatile int i = 0; i < 1000; i++) {
         inb(ATA_PRIMARY_STATUS);
     }
+    // Leave nIEN clear so the drive interrupts on completion
     outb(ATA_PRIMARY_CONTROL, 0x00);   
     
+    waitqueue_init(&ata_waiters);
+    mutex_init(&ata_lock);
+    idt_register_handler(32 + ATA_PRIMARY_IRQ, ata_irq_handler);
+    irq_unmask(ATA_PRIMARY_IRQ);
+    
      
     if (ata_wait_ready() < 0) {
         drive_present = false;
@@ -114,7 +167,7 @@ int ata_init(void) {
     return 0;
 }
 
-int ata_read_sectors(u32 lba, u8 count, void *buffer) {
+static int ata_pio_read(u32 lba, u8 count, void *buffer) {
     if (!drive_present) return -1;
     if (count == 0) return 0;
     
@@ -148,7 +201,7 @@ int ata_read_sectors(u32 lba, u8 count, void *buffer) {
     return count;
 }
 
-int ata_write_sectors(u32 lba, u8 count, const void *buffer) {
+static int ata_pio_write(u32 lba, u8 count, const void *buffer) {
     if (!drive_present) return -1;
     if (count == 0) return 0;
     
@@ -186,6 +239,20 @@ int ata_write_sectors(u32 lba, u8 count, const void *buffer) {
     return count;
 }
 
+int ata_read_sectors(u32 lba, u8 count, void *buffer) {
+    mutex_lock(&ata_lock);
+    int ret = ata_pio_read(lba, count, buffer);
+    mutex_unlock(&ata_lock);
+    return ret;
+}
+
+int ata_write_sectors(u32 lba, u8 count, const void *buffer) {
+    mutex_lock(&ata_lock);
+    int ret = ata_pio_write(lba, count, buffer);
+    mutex_unlock(&ata_lock);
+    return ret;
+}
+
 bool ata_is_present(void) {
     return drive_present;
 }
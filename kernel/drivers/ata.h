@@ -16,6 +16,9 @@
 #define ATA_PRIMARY_STATUS      0x1F7
 #define ATA_PRIMARY_COMMAND     0x1F7
 #define ATA_PRIMARY_CONTROL     0x3F6
+#define ATA_PRIMARY_ALTSTATUS   0x3F6   // Read side of CONTROL; does not ack the IRQ
+
+#define ATA_PRIMARY_IRQ         14
 
  
 #define ATA_CMD_READ_PIO        0x20
@@ -0,0 +1,127 @@
+/*
+ * ICE I/O APIC driver
+ *
+ * Each IOAPIC maps its input pins, starting at gsi_base, to vectors on
+ * a local APIC. Registers are reached through an index/data window, so
+ * every access runs under ioapic_lock.
+ */
+
+#include "ioapic.h"
+#include "../sync/spinlock.h"
+#include "../cpu/irqflags.h"
+
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WIN      0x10
+
+#define IOAPIC_REG_VER  0x01
+#define IOAPIC_REDTBL(n) (0x10 + 2 * (n))
+
+#define IOAPIC_MAX      4
+
+typedef struct {
+    volatile u32 *base;
+    u8 id;
+    u32 gsi_base;
+    u32 pins;
+} ioapic_t;
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static u32 ioapic_count = 0;
+static spinlock_t ioapic_lock;
+
+static inline u32 lock_irqsave(void) {
+    u32 flags = irq_save();
+    spinlock_acquire_raw(&ioapic_lock);
+    return flags;
+}
+
+static inline void unlock_irqrestore(u32 flags) {
+    spinlock_release_raw(&ioapic_lock);
+    irq_restore(flags);
+}
+
+static u32 ioapic_read(ioapic_t *io, u32 reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(ioapic_t *io, u32 reg, u32 value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WIN / 4] = value;
+}
+
+static ioapic_t *find(u32 gsi, u32 *pin) {
+    for (u32 i = 0; i < ioapic_count; i++) {
+        ioapic_t *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->pins) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return 0;
+}
+
+bool ioapic_add(u8 id, u32 addr, u32 gsi_base) {
+    if (ioapic_count >= IOAPIC_MAX) return false;
+    if (ioapic_count == 0) spinlock_init(&ioapic_lock);
+
+    ioapic_t *io = &ioapics[ioapic_count];
+    io->base = (volatile u32*)addr;
+    io->id = id;
+    io->gsi_base = gsi_base;
+    io->pins = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+
+    for (u32 pin = 0; pin < io->pins; pin++) {
+        ioapic_write(io, IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+        ioapic_write(io, IOAPIC_REDTBL(pin) + 1, 0);
+    }
+    ioapic_count++;
+    return true;
+}
+
+bool ioapic_has_gsi(u32 gsi) {
+    u32 pin;
+    return find(gsi, &pin) != 0;
+}
+
+void ioapic_route(u32 gsi, u8 vector, u32 flags, u32 apic_id) {
+    u32 pin;
+    ioapic_t *io = find(gsi, &pin);
+    if (!io) return;
+
+    u32 irqf = lock_irqsave();
+    // Mask while the halves disagree, then write the final low word
+    ioapic_write(io, IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+    ioapic_write(io, IOAPIC_REDTBL(pin) + 1, apic_id << 24);
+    ioapic_write(io, IOAPIC_REDTBL(pin), vector | flags);
+    unlock_irqrestore(irqf);
+}
+
+static void update_low(u32 gsi, u32 clear, u32 set) {
+    u32 pin;
+    ioapic_t *io = find(gsi, &pin);
+    if (!io) return;
+
+    u32 flags = lock_irqsave();
+    u32 low = ioapic_read(io, IOAPIC_REDTBL(pin));
+    ioapic_write(io, IOAPIC_REDTBL(pin), (low & ~clear) | set);
+    unlock_irqrestore(flags);
+}
+
+void ioapic_mask(u32 gsi) {
+    update_low(gsi, 0, IOAPIC_MASKED);
+}
+
+void ioapic_unmask(u32 gsi) {
+    update_low(gsi, IOAPIC_MASKED, 0);
+}
+
+void ioapic_set_dest(u32 gsi, u32 apic_id) {
+    u32 pin;
+    ioapic_t *io = find(gsi, &pin);
+    if (!io) return;
+
+    u32 flags = lock_irqsave();
+    ioapic_write(io, IOAPIC_REDTBL(pin) + 1, apic_id << 24);
+    unlock_irqrestore(flags);
+}
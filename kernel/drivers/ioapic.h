@@ -0,0 +1,28 @@
+#ifndef ICE_IOAPIC_H
+#define ICE_IOAPIC_H
+
+#include "../types.h"
+
+// Redirection entry flags
+#define IOAPIC_ACTIVE_LOW   (1u << 13)
+#define IOAPIC_LEVEL        (1u << 15)
+#define IOAPIC_MASKED       (1u << 16)
+
+// Register an IOAPIC from the MADT and mask all of its inputs.
+// Returns false when the table is full.
+bool ioapic_add(u8 id, u32 addr, u32 gsi_base);
+
+// Whether some IOAPIC serves gsi
+bool ioapic_has_gsi(u32 gsi);
+
+// Program gsi to deliver vector to one local APIC. flags take
+// IOAPIC_ACTIVE_LOW / IOAPIC_LEVEL / IOAPIC_MASKED.
+void ioapic_route(u32 gsi, u8 vector, u32 flags, u32 apic_id);
+
+void ioapic_mask(u32 gsi);
+void ioapic_unmask(u32 gsi);
+
+// Move gsi to another local APIC, keeping its vector and flags
+void ioapic_set_dest(u32 gsi, u32 apic_id);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * ICE interrupt routing
+ *
+ * With an IOAPIC in the MADT every ISA line is redirected to vector
+ * 32 + line on the boot CPU and the 8259s are masked; the PIC remains
+ * the fallback for machines without one. Interrupt source overrides
+ * move a line to another GSI (the PIT usually sits on GSI 2) or change
+ * its trigger mode.
+ */
+
+#include "irq.h"
+#include "pic.h"
+#include "pit.h"
+#include "ioapic.h"
+#include "../cpu/acpi.h"
+#include "../cpu/lapic.h"
+#include "../cpu/idt.h"
+#include "../cpu/smp.h"
+#include "../proc/scheduler.h"
+#include "../errno.h"
+
+typedef struct {
+    u32 gsi;
+    u32 flags;           // IOAPIC_ACTIVE_LOW / IOAPIC_LEVEL
+    u32 cpu;
+    bool routed;         // An IOAPIC pin serves the line
+    bool enabled;
+} irq_line_t;
+
+static irq_line_t lines[IRQ_LINES];
+static irq_mode_t mode = IRQ_MODE_PIC;
+static u32 bsp_apic_id = 0;
+
+// The LAPIC timer runs one-shot and is only armed while the CPU has
+// processes waiting, like the PIT before it; an idle CPU gets no ticks.
+// Each CPU arms its own timer with interrupts off.
+static bool lapic_tick = false;
+static volatile bool tick_armed[SMP_MAX_CPUS];
+static u32 tick_count[SMP_MAX_CPUS];
+
+static void lapic_tick_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    u32 cpu = smp_cpu_id();
+    tick_count[cpu]++;
+    tick_armed[cpu] = false;
+    // Pairs with irq_sched_tick_wake: either it sees the timer stopped
+    // or we see what it queued
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    scheduler_tick();
+    irq_sched_tick_update();
+}
+
+void irq_sched_tick_update(void) {
+    if (!lapic_tick) return;
+    u32 cpu = smp_cpu_id();
+    if (tick_armed[cpu] || !scheduler_needs_tick()) return;
+    tick_armed[cpu] = true;
+    lapic_timer_oneshot(LAPIC_TICK_MS);
+}
+
+void irq_sched_tick_wake(u32 cpu) {
+    if (!lapic_tick || cpu >= SMP_MAX_CPUS) return;
+    if (cpu == smp_cpu_id()) {
+        irq_sched_tick_update();
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // The resched IPI arms it from the other side
+    if (!tick_armed[cpu]) smp_send_resched(cpu);
+}
+
+u32 irq_sched_tick_count(void) {
+    u32 total = 0;
+    for (u32 i = 0; i < SMP_MAX_CPUS; i++) total += tick_count[i];
+    return total;
+}
+
+// GSI and polarity/trigger of a line. ISA defaults to edge/high and PCI
+// to level/low; an MADT override replaces either.
+static void resolve(u8 irq, bool pci) {
+    irq_line_t *l = &lines[irq];
+    const acpi_madt_t *madt = acpi_get_madt();
+    u16 mps = 0;
+
+    l->gsi = irq;
+    for (u32 i = 0; madt && i < madt->override_count; i++) {
+        if (madt->overrides[i].irq == irq) {
+            l->gsi = madt->overrides[i].gsi;
+            mps = madt->overrides[i].flags;
+        }
+    }
+
+    u16 pol = mps & ACPI_IRQ_POLARITY_MASK;
+    u16 trig = mps & ACPI_IRQ_TRIGGER_MASK;
+    bool low = pol == ACPI_IRQ_ACTIVE_LOW || (pol == 0 && pci);
+    bool level = trig == ACPI_IRQ_LEVEL || (trig == 0 && pci);
+    l->flags = (low ? IOAPIC_ACTIVE_LOW : 0) | (level ? IOAPIC_LEVEL : 0);
+}
+
+static u32 line_apic_id(irq_line_t *l) {
+    const cpu_t *c = smp_get_cpu(l->cpu);
+    return l->cpu && c ? c->apic_id : bsp_apic_id;
+}
+
+void irq_init(void) {
+    pic_init();
+    for (u8 irq = 0; irq < IRQ_LINES; irq++) {
+        lines[irq].gsi = irq;
+        lines[irq].flags = 0;
+        lines[irq].cpu = 0;
+        lines[irq].routed = false;
+        lines[irq].enabled = false;
+    }
+
+    if (!acpi_init()) return;
+    const acpi_madt_t *madt = acpi_get_madt();
+    if (!madt || !lapic_init(madt->lapic_base)) return;
+
+    // The local APIC timer ticks the scheduler on every CPU; the PIT is
+    // left to fire only for timer deadlines
+    lapic_timer_calibrate();
+    idt_register_handler(LAPIC_TIMER_VECTOR, lapic_tick_handler);
+    lapic_tick = true;
+    pit_set_sched_tick(false);
+
+    u32 added = 0;
+    for (u32 i = 0; i < madt->ioapic_count; i++) {
+        const acpi_ioapic_t *io = &madt->ioapics[i];
+        if (ioapic_add(io->id, io->addr, io->gsi_base)) added++;
+    }
+    if (!added) return;
+
+    bsp_apic_id = lapic_id();
+    for (u8 irq = 0; irq < IRQ_LINES; irq++) {
+        // The cascade input carries nothing once the PIC is bypassed
+        if (irq == IRQ_CASCADE) continue;
+        resolve(irq, false);
+        irq_line_t *l = &lines[irq];
+        if (!ioapic_has_gsi(l->gsi)) continue;
+        ioapic_route(l->gsi, IRQ_VECTOR_BASE + irq, l->flags | IOAPIC_MASKED, bsp_apic_id);
+        l->routed = true;
+    }
+
+    pic_disable();
+    lapic_mask_lint0();
+    mode = IRQ_MODE_IOAPIC;
+}
+
+irq_mode_t irq_get_mode(void) {
+    return mode;
+}
+
+void irq_unmask(u8 irq) {
+    if (irq >= IRQ_LINES) return;
+    if (mode == IRQ_MODE_PIC) {
+        pic_unmask_irq(irq);
+        return;
+    }
+    irq_line_t *l = &lines[irq];
+    if (!l->routed) return;
+    l->enabled = true;
+    ioapic_unmask(l->gsi);
+}
+
+void irq_mask(u8 irq) {
+    if (irq >= IRQ_LINES) return;
+    if (mode == IRQ_MODE_PIC) {
+        pic_mask_irq(irq);
+        return;
+    }
+    irq_line_t *l = &lines[irq];
+    if (!l->routed) return;
+    l->enabled = false;
+    ioapic_mask(l->gsi);
+}
+
+void irq_unmask_pci(u8 irq) {
+    if (irq >= IRQ_LINES) return;
+    if (mode == IRQ_MODE_PIC) {
+        pic_unmask_irq(irq);
+        return;
+    }
+    irq_line_t *l = &lines[irq];
+    resolve(irq, true);
+    l->routed = ioapic_has_gsi(l->gsi);
+    if (!l->routed) return;
+    l->enabled = true;
+    ioapic_route(l->gsi, IRQ_VECTOR_BASE + irq, l->flags, line_apic_id(l));
+}
+
+void irq_eoi(u8 vector) {
+    // Lines routed through the IOAPIC, IPIs and the APIC timer are all
+    // acknowledged at the local APIC
+    if (mode == IRQ_MODE_IOAPIC || vector >= LAPIC_TIMER_VECTOR) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(vector - IRQ_VECTOR_BASE);
+    }
+}
+
+int irq_set_affinity(u8 irq, u32 cpu) {
+    if (irq >= IRQ_LINES) return E_INVALID_ARG;
+    const cpu_t *c = smp_get_cpu(cpu);
+    if (!c || !c->online) return E_INVALID_ARG;
+    if (mode == IRQ_MODE_PIC) return cpu == 0 ? E_OK : E_GENERIC;
+
+    irq_line_t *l = &lines[irq];
+    if (!l->routed) return E_INVALID_ARG;
+    l->cpu = cpu;
+    ioapic_set_dest(l->gsi, c->apic_id);
+    return E_OK;
+}
+
+int irq_get_route(u8 irq, irq_route_t *route) {
+    if (irq >= IRQ_LINES || !route) return E_INVALID_ARG;
+
+    irq_line_t *l = &lines[irq];
+    route->gsi = l->gsi;
+    route->cpu = l->cpu;
+    route->level = (l->flags & IOAPIC_LEVEL) != 0;
+    route->active_low = (l->flags & IOAPIC_ACTIVE_LOW) != 0;
+    route->enabled = mode == IRQ_MODE_PIC ? pic_irq_enabled(irq) : l->enabled;
+    return mode == IRQ_MODE_PIC || l->routed ? E_OK : E_NOT_FOUND;
+}
@@ -0,0 +1,60 @@
+#ifndef ICE_IRQ_H
+#define ICE_IRQ_H
+
+#include "../types.h"
+
+// Interrupt routing for the ISA lines 0-15, which keep vectors 32-47
+// whether they arrive through the IOAPIC or the legacy PIC.
+#define IRQ_VECTOR_BASE 32
+#define IRQ_LINES       16
+
+typedef enum {
+    IRQ_MODE_PIC = 0,    // 8259 pair, virtual wire to the boot CPU
+    IRQ_MODE_IOAPIC
+} irq_mode_t;
+
+// Set up the PIC, then switch to the IOAPIC when the MADT lists one.
+// A local APIC, when present, also takes over the scheduler tick.
+void irq_init(void);
+
+irq_mode_t irq_get_mode(void);
+
+// Enable / disable an ISA line (edge triggered unless the MADT
+// overrides it)
+void irq_unmask(u8 irq);
+void irq_mask(u8 irq);
+
+// Enable a PCI INTx line: level triggered and active low in IOAPIC mode
+// unless the MADT says otherwise
+void irq_unmask_pci(u8 irq);
+
+// Acknowledge the interrupt on vector, from irq_handler
+void irq_eoi(u8 vector);
+
+// Deliver an ISA line to another online CPU. E_INVALID_ARG for an
+// unknown line or CPU, E_GENERIC under the PIC, which only reaches CPU 0.
+int irq_set_affinity(u8 irq, u32 cpu);
+
+// Routing of one line, for irqstat: GSI and target CPU
+typedef struct {
+    u32 gsi;
+    u32 cpu;
+    bool level;
+    bool active_low;
+    bool enabled;
+} irq_route_t;
+
+int irq_get_route(u8 irq, irq_route_t *route);
+
+// Scheduler tick on the local APIC timer. It only runs on a CPU while
+// processes wait for that CPU (scheduler_needs_tick), so after queueing
+// one, wake the CPU's tick; the calling CPU's own tick is re-armed by
+// irq_sched_tick_update, with interrupts off. Both do nothing when the
+// PIT ticks the scheduler instead.
+void irq_sched_tick_update(void);
+void irq_sched_tick_wake(u32 cpu);
+
+// LAPIC timer interrupts so far, summed over CPUs
+u32 irq_sched_tick_count(void);
+
+#endif
@@ -8,7 +8,8 @@
  *   - Full scancode Set 1 translation with extended key support
  *   - Comprehensive modifier and lock key handling
  *   - LED control and typematic configuration
- *   - Interrupt-driven with polling fallback
+ *   - Interrupt-driven with polling fallback; the IRQ handler only
+ *     queues raw scancodes and decoding runs on the kernel worker
  *   - Circular buffer with overflow protection
  *   - Detailed error handling and diagnostics
  * 
@@ -21,8 +22,15 @@
 
 #include "keyboard.h"
 #include "pic.h"
+#include "irq.h"
 #include "vga.h"
 #include "../cpu/idt.h"
+#include "../mm/pmm.h"
+#include "../sync/waitqueue.h"
+#include "../proc/timer.h"
+#include "../proc/workqueue.h"
+#include "../sync/spinlock.h"
+#include "../cpu/irqflags.h"
 
 /*============================================================================
  * Port I/O Functions
@@ -47,36 +55,12 @@ static inline void io_wait(void) {
  * Interrupt Control
  *============================================================================*/
 
-static inline void cli(void) {
-    __asm__ volatile ("cli");
-}
+/* irq_save / irq_restore come from cpu/irqflags.h */
 
 static inline void sti(void) {
     __asm__ volatile ("sti");
 }
 
-static inline u32 save_flags(void) {
-    u32 flags;
-    __asm__ volatile ("pushfl; popl %0" : "=r"(flags));
-    return flags;
-}
-
-static inline void restore_flags(u32 flags) {
-    __asm__ volatile ("pushl %0; popfl" : : "r"(flags));
-}
-
-/* Save flags and disable interrupts atomically */
-static inline u32 irq_save(void) {
-    u32 flags = save_flags();
-    cli();
-    return flags;
-}
-
-/* Restore flags (re-enables interrupts if they were enabled before) */
-static inline void irq_restore(u32 flags) {
-    restore_flags(flags);
-}
-
 /*============================================================================
  * Keyboard State
  *============================================================================*/
@@ -107,12 +91,42 @@ static volatile u8 kb_buffer[KB_BUFFER_SIZE];
 static volatile u16 kb_read_idx = 0;
 static volatile u16 kb_write_idx = 0;
 
-/* Add character to buffer (called from ISR context) */
+/* Processes blocked in keyboard_getc / keyboard_wait */
+static waitqueue_t kb_waiters;
+
+/*============================================================================
+ * Raw Scancode Ring
+ *
+ * Filled with interrupts off by the IRQ handler and keyboard_poll,
+ * emptied by one decoder at a time (kb_draining) with interrupts on.
+ *============================================================================*/
+
+static volatile u8 kb_raw[KB_RAW_SIZE];
+static volatile u16 kb_raw_read = 0;
+static volatile u16 kb_raw_write = 0;
+static spinlock_t kb_raw_lock;
+static volatile u32 kb_draining = 0;
+static work_t kb_work;
+
+static void raw_put(u8 scancode) {
+    spinlock_acquire(&kb_raw_lock);
+    u16 next = (kb_raw_write + 1) & (KB_RAW_SIZE - 1);
+    if (next != kb_raw_read) {
+        kb_raw[kb_raw_write] = scancode;
+        kb_raw_write = next;
+    } else {
+        stat_overruns++;
+    }
+    spinlock_release(&kb_raw_lock);
+}
+
+/* Add character to buffer (called by the decoder) */
 static bool buffer_put(u8 c) {
     u16 next = (kb_write_idx + 1) & (KB_BUFFER_SIZE - 1);
     if (next != kb_read_idx) {
         kb_buffer[kb_write_idx] = c;
         kb_write_idx = next;
+        waitqueue_wake_all(&kb_waiters);
         return true;
     } else {
         stat_overruns++;
@@ -524,7 +538,7 @@ static bool is_printable(u8 keycode) {
 
 /**
  * Process a scancode and update state/buffers.
- * Called from interrupt context.
+ * Called by kb_drain only, so never concurrently.
  */
 static void process_scancode(u8 scancode) {
     if (scancode == SC_PAUSE_PREFIX) {
@@ -618,6 +632,24 @@ static void process_scancode(u8 scancode) {
     }
 }
 
+/**
+ * Decode every queued scancode. Runs as the keyboard's deferred work and
+ * from keyboard_poll; whoever finds the decoder busy leaves its
+ * scancodes to the current one, which rechecks the ring before leaving.
+ */
+static void kb_drain(void *arg) {
+    (void)arg;
+    do {
+        if (__sync_lock_test_and_set(&kb_draining, 1)) return;
+        while (kb_raw_read != kb_raw_write) {
+            u8 scancode = kb_raw[kb_raw_read];
+            kb_raw_read = (kb_raw_read + 1) & (KB_RAW_SIZE - 1);
+            process_scancode(scancode);
+        }
+        __sync_lock_release(&kb_draining);
+    } while (kb_raw_read != kb_raw_write);
+}
+
 /*============================================================================
  * Interrupt Handler
  *============================================================================*/
@@ -653,8 +685,8 @@ static void keyboard_irq_handler(interrupt_frame_t *frame) {
     if (status & KB_STATUS_OUTPUT_FULL) {
         /* Make sure it's keyboard data, not mouse (bit 5) */
         if (!(status & KB_STATUS_AUX_FULL)) {
-            u8 scancode = inb(KB_DATA_PORT);
-            process_scancode(scancode);
+            raw_put(inb(KB_DATA_PORT));
+            queue_work(&kb_work);
         }
     }
     
@@ -682,6 +714,10 @@ u8 keyboard_init(void) {
     
     /* Clear buffers */
     buffer_clear();
+    waitqueue_init(&kb_waiters);
+    spinlock_init(&kb_raw_lock);
+    kb_raw_read = kb_raw_write = 0;
+    work_init(&kb_work, kb_drain, 0);
     event_read_idx = 0;
     event_write_idx = 0;
     
@@ -761,7 +797,7 @@ u8 keyboard_init(void) {
     idt_register_handler(33, (void*)keyboard_irq_handler);
     
     /* Unmask keyboard IRQ */
-    pic_unmask_irq(IRQ_KEYBOARD);
+    irq_unmask(IRQ_KEYBOARD);
     
     kb_initialized = true;
     
@@ -774,18 +810,18 @@ u8 keyboard_reset(void) {
     u32 flags = irq_save();
     
     /* Disable interrupt temporarily */
-    pic_mask_irq(IRQ_KEYBOARD);
+    irq_mask(IRQ_KEYBOARD);
     
     /* Send reset command */
     if (!kb_send_cmd(KB_CMD_RESET)) {
-        pic_unmask_irq(IRQ_KEYBOARD);
+        irq_unmask(IRQ_KEYBOARD);
         irq_restore(flags);
         return KB_ERR_TIMEOUT;
     }
     
     /* Wait for self-test result */
     if (!kb_wait_output(KB_RESET_TIMEOUT)) {
-        pic_unmask_irq(IRQ_KEYBOARD);
+        irq_unmask(IRQ_KEYBOARD);
         irq_restore(flags);
         return KB_ERR_TIMEOUT;
     }
@@ -793,7 +829,7 @@ u8 keyboard_reset(void) {
     u8 response = inb(KB_DATA_PORT);
     if (response != KB_RESP_SELF_TEST_OK) {
         kb_state.last_error = KB_ERR_SELF_TEST;
-        pic_unmask_irq(IRQ_KEYBOARD);
+        irq_unmask(IRQ_KEYBOARD);
         irq_restore(flags);
         return KB_ERR_SELF_TEST;
     }
@@ -811,7 +847,7 @@ u8 keyboard_reset(void) {
     keyboard_update_leds();
     
     /* Re-enable interrupt */
-    pic_unmask_irq(IRQ_KEYBOARD);
+    irq_unmask(IRQ_KEYBOARD);
     
     irq_restore(flags);
     
@@ -820,7 +856,7 @@ u8 keyboard_reset(void) {
 
 void keyboard_shutdown(void) {
     /* Mask keyboard interrupt */
-    pic_mask_irq(IRQ_KEYBOARD);
+    irq_mask(IRQ_KEYBOARD);
     
     /* Disable scanning */
     kb_send_cmd(KB_CMD_DISABLE_SCAN);
@@ -835,6 +871,12 @@ void keyboard_shutdown(void) {
  * Basic Input Functions
  *============================================================================*/
 
+/* Wait condition; checked with interrupts off */
+static bool kb_has_input(void *arg) {
+    (void)arg;
+    return kb_read_idx != kb_write_idx;
+}
+
 u8 keyboard_getc(void) {
     u8 c;
     
@@ -851,9 +893,36 @@ u8 keyboard_getc(void) {
             return c;
         }
         
-        /* Halt until next interrupt (power efficient) */
+        if (waitqueue_can_sleep()) {
+            /* Sleep until the IRQ handler queues a key */
+            waitqueue_wait_until(&kb_waiters, kb_has_input, 0, WAIT_FOREVER);
+        } else {
+            /* No scheduler yet: pre-zero pages, then halt until next interrupt */
+            pmm_zero_pool_refill();
+            __asm__ volatile ("hlt");
+        }
+    }
+}
+
+bool keyboard_wait(u32 timeout_ms) {
+    keyboard_poll();
+    if (buffer_has_data()) {
+        return true;
+    }
+    if (waitqueue_can_sleep()) {
+        return waitqueue_wait_until(&kb_waiters, kb_has_input, 0, timeout_ms);
+    }
+    
+    /* Can't block: halt in place until input or the timeout */
+    if (!irqs_enabled()) {
+        return false;
+    }
+    u64 deadline = timer_now_ms() + timeout_ms;
+    while (!buffer_has_data() && timer_now_ms() < deadline) {
         __asm__ volatile ("hlt");
+        keyboard_poll();
     }
+    return buffer_has_data();
 }
 
 u8 keyboard_read(void) {
@@ -1105,18 +1174,16 @@ int keyboard_buffer_count(void) {
  *============================================================================*/
 
 void keyboard_poll(void) {
-    /* Check if data is available */
+    /* Status and data are read together so the IRQ cannot take the byte */
+    u32 flags = irq_save();
     u8 status = inb(KB_STATUS_PORT);
     
-    if (status & KB_STATUS_OUTPUT_FULL) {
-        /* Make sure it's keyboard data, not mouse */
-        if (!(status & KB_STATUS_AUX_FULL)) {
-            u32 flags = irq_save();
-            u8 scancode = inb(KB_DATA_PORT);
-            process_scancode(scancode);
-            irq_restore(flags);
-        }
-    }
+    /* Make sure it's keyboard data, not mouse */
+    bool have = (status & KB_STATUS_OUTPUT_FULL) && !(status & KB_STATUS_AUX_FULL);
+    if (have) raw_put(inb(KB_DATA_PORT));
+    irq_restore(flags);
+    
+    if (have) kb_drain(0);
 }
 
 /*============================================================================
@@ -371,6 +371,7 @@ typedef struct {
  *============================================================================*/
 
 #define KB_BUFFER_SIZE          256     /* Circular buffer size (power of 2) */
+#define KB_RAW_SIZE             64      /* Undecoded scancodes (power of 2) */
 #define KB_EVENT_BUFFER_SIZE    64      /* Raw event buffer size */
 
 /*============================================================================
@@ -444,6 +445,18 @@ u8 keyboard_getc(void);
  */
 u8 keyboard_read(void);
 
+/**
+ * Wait for input without consuming it.
+ * 
+ * Sleeps until a key is buffered or timeout_ms passes (WAIT_FOREVER in
+ * sync/waitqueue.h waits indefinitely). Halts in place when the caller
+ * cannot block.
+ * 
+ * @param timeout_ms    Maximum time to wait in milliseconds
+ * @return true if a key is available
+ */
+bool keyboard_wait(u32 timeout_ms);
+
 /**
  * Check if a key is available in the buffer.
  * 
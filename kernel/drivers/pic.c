@@ -83,3 +83,13 @@ void pic_unmask_irq(u8 irq) {
     value = inb(port) & ~(1 << irq);
     outb(port, value);
 }
+
+void pic_disable(void) {
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+bool pic_irq_enabled(u8 irq) {
+    if (irq < 8) return !(inb(PIC1_DATA) & (1 << irq));
+    return !(inb(PIC2_DATA) & (1 << (irq - 8)));
+}
@@ -39,4 +39,9 @@ void pic_send_eoi(u8 irq);
 void pic_mask_irq(u8 irq);
 void pic_unmask_irq(u8 irq);
 
+// Mask every line, once the IOAPIC has taken over
+void pic_disable(void);
+
+bool pic_irq_enabled(u8 irq);
+
 #endif  
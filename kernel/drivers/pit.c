@@ -1,51 +1,257 @@
 /*
  * ICE OS Programmable Interval Timer (PIT) Driver
+ *
+ * Channel 0 runs one-shot (mode 0) and is reprogrammed on every
+ * interrupt to the next timer deadline, or to the next scheduler tick
+ * when other processes are waiting for the CPU. With nothing to do it
+ * only fires when the 16-bit counter would run out (~55 ms).
+ *
+ * Channel 0 is read from every CPU, so each latch-and-read sequence
+ * runs under pit_lock. Its interrupt only reaches the boot CPU. The
+ * 64-bit tick count is published under a sequence count so readers
+ * need neither the lock nor the hardware.
  */
 
 #include "pit.h"
 #include "pic.h"
+#include "irq.h"
 #include "../cpu/idt.h"
+#include "../proc/scheduler.h"
+#include "../proc/timer.h"
+#include "../sync/spinlock.h"
+#include "../sync/seqlock.h"
+#include "../cpu/irqflags.h"
 
 static inline void outb(u16 port, u8 value) {
     __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
 }
 
+static inline u8 inb(u16 port) {
+    u8 ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+#define PIT_MODE_ONESHOT  0x30   // Channel 0, lo/hi byte, mode 0
+#define PIT_LATCH_COUNT   0x00
+#define PIT_READBACK_CH0  0xE2   // Read-back: status only, channel 0
+#define PIT_STATUS_OUTPUT 0x80
+#define PIT_MAX_COUNT     0xFFFF
+#define PIT_MAX_MS        54     // Longest whole-ms one-shot interval
+
+#define PIT_MODE_CH2_ONESHOT 0xB0 // Channel 2, lo/hi byte, mode 0
+#define PIT_PORT_B        0x61   // Bit 0: channel 2 gate, bit 5: OUT2
+#define PIT_GATE2         0x01
+#define PIT_SPEAKER       0x02
+#define PIT_OUT2          0x20
+
 static volatile u64 tick_count = 0;
+static volatile u64 ms_count = 0;
 static u32 tick_frequency = 0;
+static u32 tick_ms = 10;
+
+// Sub-unit remainders, in units of 1/PIT_FREQUENCY ms and ticks
+static u32 ms_rem = 0;
+static u32 tick_rem = 0;
+
+// Count loaded into channel 0 for the interval in progress
+static u32 programmed = 0;
+static u32 irq_count = 0;
+
+// Scheduler ticks accounted but not yet delivered to the boot CPU
+static u32 pending_ticks = 0;
+static bool sched_tick = true;
+
+static spinlock_t pit_lock;
+static seqlock_t tick_seq;     // Sequence only; pit_lock serialises writers
+
+static inline u32 pit_lock_irqsave(void) {
+    u32 flags = irq_save();
+    spinlock_acquire_raw(&pit_lock);
+    return flags;
+}
+
+static inline void pit_unlock_irqrestore(u32 flags) {
+    spinlock_release_raw(&pit_lock);
+    irq_restore(flags);
+}
+
+static void pit_program(u32 count) {
+    if (count == 0) count = 1;
+    if (count > PIT_MAX_COUNT) count = PIT_MAX_COUNT;
+    outb(PIT_COMMAND, PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+    programmed = count;
+}
+
+static u32 pit_read_count(void) {
+    outb(PIT_COMMAND, PIT_LATCH_COUNT);
+    u32 lo = inb(PIT_CHANNEL0);
+    u32 hi = inb(PIT_CHANNEL0);
+    return (hi << 8) | lo;
+}
+
+// True once the current interval has run out (IRQ pending or in progress)
+static bool pit_expired(void) {
+    outb(PIT_COMMAND, PIT_READBACK_CH0);
+    return (inb(PIT_CHANNEL0) & PIT_STATUS_OUTPUT) != 0;
+}
+
+// Input clocks elapsed in the current interval
+static u32 pit_elapsed(void) {
+    if (pit_expired()) return programmed;
+    u32 count = pit_read_count();
+    return count <= programmed ? programmed - count : 0;
+}
+
+// Advance the clocks by a number of PIT input cycles
+static void pit_account(u32 clocks) {
+    ms_rem += clocks * 1000;
+    ms_count += ms_rem / PIT_FREQUENCY;
+    ms_rem %= PIT_FREQUENCY;
+    
+    tick_rem += clocks * tick_frequency;
+    u32 ticks = tick_rem / PIT_FREQUENCY;
+    tick_rem %= PIT_FREQUENCY;
+    
+    write_seqcount_begin(&tick_seq);
+    tick_count += ticks;
+    write_seqcount_end(&tick_seq);
+    pending_ticks += ticks;
+}
+
+// Rounded up, so an interval of ms always advances ms_count by ms
+static u32 ms_to_clocks(u32 ms) {
+    return ms * (PIT_FREQUENCY / 1000) + (ms * (PIT_FREQUENCY % 1000) + 999) / 1000;
+}
+
+static void pit_program_next(void) {
+    u32 ms = timer_next_event(pit_get_ms(), PIT_MAX_MS);
+    
+    // Keep ticking while someone is waiting to be scheduled
+    if (sched_tick && scheduler_needs_tick() && ms > tick_ms) ms = tick_ms;
+    
+    u32 flags = pit_lock_irqsave();
+    // Deadlines are whole ms from ms_count; drop the part already elapsed
+    u32 clocks = ms_to_clocks(ms);
+    u32 into_ms = ms_rem / 1000;
+    clocks = clocks > into_ms ? clocks - into_ms : 1;
+    pit_program(clocks);
+    pit_unlock_irqrestore(flags);
+}
 
 // Timer interrupt handler
 static void pit_handler(interrupt_frame_t *frame) {
     (void)frame;
-    tick_count++;
+    irq_count++;
+    
+    u32 flags = pit_lock_irqsave();
+    // The counter keeps running past zero; count the overshoot too
+    u32 count = pit_read_count();
+    u32 overshoot = pit_expired() ? (0x10000 - count) & 0xFFFF : 0;
+    pit_account(programmed + overshoot);
+    u64 now = ms_count;
+    u32 ticks = sched_tick ? pending_ticks : 0;
+    pending_ticks = 0;
+    pit_unlock_irqrestore(flags);
+    
+    while (ticks--) {
+        scheduler_tick();
+    }
+    timer_run(now);
+    pit_program_next();
 }
 
 void pit_init(u32 frequency) {
     tick_frequency = frequency;
+    tick_ms = 1000 / frequency;
+    if (tick_ms == 0) tick_ms = 1;
+    spinlock_init(&pit_lock);
+    seqlock_init(&tick_seq);
     
-     
-    u32 divisor = PIT_FREQUENCY / frequency;
+    pit_program(ms_to_clocks(tick_ms));
     
      
-    outb(PIT_COMMAND, 0x36);   
+    idt_register_handler(32, pit_handler);
     
      
-    outb(PIT_CHANNEL0, divisor & 0xFF);
-    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+    irq_unmask(IRQ_TIMER);
+}
+
+void pit_wake_within(u32 ms) {
+    if (tick_frequency == 0 || !sched_tick) return;
     
-     
-    idt_register_handler(32, pit_handler);
+    u32 flags = pit_lock_irqsave();
     
-     
-    pic_unmask_irq(IRQ_TIMER);
+    // An expired interval reprograms itself from the pending interrupt
+    if (!pit_expired()) {
+        u32 count = pit_read_count();
+        u32 want = ms_to_clocks(ms);
+        if (count > want && count <= programmed) {
+            pit_account(programmed - count);
+            pit_program(want);
+        }
+    }
+    
+    pit_unlock_irqrestore(flags);
 }
 
 u64 pit_get_ticks(void) {
-    return tick_count;
+    u32 seq;
+    u64 ticks;
+    do {
+        seq = read_seqbegin(&tick_seq);
+        ticks = tick_count;
+    } while (read_seqretry(&tick_seq, seq));
+    return ticks;
 }
 
-void pit_sleep_ms(u32 ms) {
-    u64 target = tick_count + (ms * tick_frequency / 1000);
-    while (tick_count < target) {
-        __asm__ volatile ("hlt");
+u64 pit_get_ms(void) {
+    if (tick_frequency == 0) return 0;
+    
+    u32 flags = pit_lock_irqsave();
+    u64 ms = ms_count + (ms_rem + pit_elapsed() * 1000) / PIT_FREQUENCY;
+    pit_unlock_irqrestore(flags);
+    return ms;
+}
+
+void pit_set_sched_tick(bool on) {
+    sched_tick = on;
+}
+
+u32 pit_get_irq_count(void) {
+    return irq_count;
+}
+
+void pit_delay_clocks(u32 clocks) {
+    if (clocks == 0) clocks = 1;
+    if (clocks > PIT_MAX_COUNT) clocks = PIT_MAX_COUNT;
+    
+    u8 port_b = inb(PIT_PORT_B);
+    
+    // Gate low while loading, then count down once and poll OUT2
+    outb(PIT_PORT_B, (port_b & ~(PIT_GATE2 | PIT_SPEAKER)));
+    outb(PIT_COMMAND, PIT_MODE_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, clocks & 0xFF);
+    outb(PIT_CHANNEL2, (clocks >> 8) & 0xFF);
+    outb(PIT_PORT_B, (port_b & ~PIT_SPEAKER) | PIT_GATE2);
+    
+    while (!(inb(PIT_PORT_B) & PIT_OUT2)) {
+        __asm__ volatile ("pause");
     }
+    
+    outb(PIT_PORT_B, port_b);
+}
+
+void pit_delay_us(u32 us) {
+    while (us) {
+        u32 chunk = us > 50000 ? 50000 : us;
+        us -= chunk;
+        pit_delay_clocks((chunk * (PIT_FREQUENCY / 1000)) / 1000);
+    }
+}
+
+void pit_sleep_ms(u32 ms) {
+    timer_sleep_ms(ms);
 }
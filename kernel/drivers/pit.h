@@ -20,7 +20,28 @@ void pit_init(u32 frequency);
  
 u64 pit_get_ticks(void);
 
- 
+// Milliseconds since pit_init, read from the live counter
+u64 pit_get_ms(void);
+
+// Make sure the next interrupt arrives within ms milliseconds
+void pit_wake_within(u32 ms);
+
+// Whether the PIT delivers scheduler_tick(). Turned off when the local
+// APIC timer ticks the scheduler; the PIT then only serves deadlines.
+void pit_set_sched_tick(bool on);
+
+// Timer interrupts taken so far
+u32 pit_get_irq_count(void);
+
+// Busy-wait on channel 2, without interrupts. For hardware delays and
+// calibration (e.g. the SIPI sequence); at most a few hundred ms.
+void pit_delay_us(u32 us);
+
+// Busy-wait exactly clocks PIT input cycles (at most 0xFFFF, ~55 ms);
+// the reference for clock calibration
+void pit_delay_clocks(u32 clocks);
+
+// Blocks the calling process when it can; see timer_sleep_ms
 void pit_sleep_ms(u32 ms);
 
 #endif  
@@ -13,6 +13,8 @@ const char *error_string(int err) {
         case E_EXISTS: return "Already exists";
         case E_IS_DIR: return "Is a directory";
         case E_NOT_DIR: return "Not a directory";
+        case E_TIMEOUT: return "Timed out";
+        case E_KILLED: return "Killed";
         
         case E_ATA_NO_DEV: return "ATA: No device";
         case E_ATA_READ_ERR: return "ATA: Read error";
@@ -15,6 +15,8 @@
 #define E_EXISTS         -8
 #define E_IS_DIR         -9
 #define E_NOT_DIR        -10
+#define E_TIMEOUT        -11
+#define E_KILLED         -12
 
 // --- ATA / Disk Errors (100 199) ---
 #define E_ATA_NO_DEV     -100
@@ -8,7 +8,10 @@
 #include "../drivers/keyboard.h"
 #include "../drivers/pit.h"
 #include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/memacct.h"
 #include "../fs/vfs.h"
+#include <string.h>
 
 // String functions
 static int frost_strlen(const char *s) {
@@ -26,17 +29,6 @@ static int frost_strcmp(const char *a, const char *b) {
     return *a - *b;
 }
 
-static void frost_memset(void *ptr, int val, u32 size) {
-    u8 *p = ptr;
-    while (size--) *p++ = val;
-}
-
-static void frost_memcpy(void *dst, const void *src, u32 size) {
-    u8 *d = dst;
-    const u8 *s = src;
-    while (size--) *d++ = *s++;
-}
-
 // Integer to string
 static void frost_itoa(int val, char *buf) {
     if (val == 0) { buf[0] = '0'; buf[1] = 0; return; }
@@ -324,13 +316,20 @@ void frost_redraw(void) {
 
 // ============ Widget System ============
 
-static frost_widget_t widget_pool[64];
-static int widget_pool_idx = 0;
+static kmem_cache_t *widget_cache = NULL;
+static frost_widget_t *widget_list = NULL;
 
 static frost_widget_t *alloc_widget(void) {
-    if (widget_pool_idx >= 64) return NULL;
-    frost_widget_t *w = &widget_pool[widget_pool_idx++];
-    frost_memset(w, 0, sizeof(frost_widget_t));
+    if (!widget_cache) {
+        widget_cache = kmem_cache_create("frost_widget", sizeof(frost_widget_t));
+        if (!widget_cache) return NULL;
+        kmem_cache_set_tag(widget_cache, MEM_TAG_GUI);
+    }
+    frost_widget_t *w = (frost_widget_t*)kmem_cache_alloc(widget_cache);
+    if (!w) return NULL;
+    memset(w, 0, sizeof(frost_widget_t));
+    w->alloc_next = widget_list;
+    widget_list = w;
     w->flags = WIDGET_VISIBLE | WIDGET_ENABLED;
     w->fg_color = FROST_FG_PRIMARY;
     w->bg_color = FROST_BG_WIDGET;
@@ -1234,8 +1233,9 @@ void frost_init(void) {
     if (frost_initialized) return;
     
     // Clear buffers
-    frost_memset(&screen_buffer, 0, sizeof(screen_buffer));
-    frost_memset(&back_buffer, 0, sizeof(back_buffer));
+    memset(&screen_buffer, 0, sizeof(screen_buffer));
+    memset(&back_buffer, 0, sizeof(back_buffer));
+    memacct_static(MEM_TAG_GUI, "frost screen buffers", sizeof(screen_buffer) + sizeof(back_buffer));
     
     // Register built-in apps
     for (int i = 0; i < 8; i++) {
@@ -1296,8 +1296,8 @@ void frost_run(void) {
         unsigned char key = keyboard_read();
         
         if (key == 0) {
-            // No key - small delay for cursor animation
-            pit_sleep_ms(30);
+            // No key - sleep until one arrives or the cursor needs redrawing
+            keyboard_wait(30);
             continue;
         }
         
@@ -1438,6 +1438,12 @@ void frost_shutdown(void) {
     frost_running = false;
     frost_initialized = false;
     app_count = 0;
-    widget_pool_idx = 0;
+    
+    // Widgets live until shutdown; release them all at once
+    while (widget_list) {
+        frost_widget_t *w = widget_list;
+        widget_list = w->alloc_next;
+        kmem_cache_free(widget_cache, w);
+    }
 }
 
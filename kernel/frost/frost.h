@@ -85,6 +85,7 @@ typedef struct frost_widget {
     frost_callback_t on_click;
     frost_callback_t on_key;
     struct frost_widget *next;
+    struct frost_widget *alloc_next;   // All live widgets, for frost_shutdown
     void *user_data;
 } frost_widget_t;
 
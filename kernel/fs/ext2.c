@@ -17,7 +17,11 @@
 #include "blockdev.h"
 #include "../drivers/serial.h"
 #include "../errno.h"
-#include "../sync/spinlock.h"
+#include "../sync/mutex.h"
+#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/shrinker.h"
+#include "../mm/memacct.h"
 #include <string.h>
 
 
@@ -30,7 +34,7 @@
 #endif
 
 // Global filesystem state
-static spinlock_t fs_lock;
+static mutex_t fs_lock;
 static bool mounted = false;
 static u32 fs_dev_id = 0;
 static ext2_superblock_t sb;
@@ -46,40 +50,147 @@ static u8 inode_buffer[4096] __attribute__((aligned(4)));
 // Separate buffer for directory operations
 static u8 dir_buffer[4096] __attribute__((aligned(4)));
 
-// Block cache (LRU)
-#define CACHE_SIZE 16
-static u8 cache_data[CACHE_SIZE][4096] __attribute__((aligned(4)));
-static u32 cache_tags[CACHE_SIZE];
-static u32 cache_lru[CACHE_SIZE];
-static bool cache_valid[CACHE_SIZE];
+// Block cache (LRU, write-through). One page per slot; slots below
+// cache_count own a page. The limit follows a share of free memory and
+// the shrinker hands pages back under pressure.
+#define CACHE_MIN_BLOCKS  16
+#define CACHE_MAX_BLOCKS  1024
+#define CACHE_MEM_SHARE   32      // Target 1/32 of free memory
+#define CACHE_RESIZE_MISSES 64    // Re-evaluate the limit this often
+#define CACHE_HASH_SIZE   256
+static u8 *cache_data[CACHE_MAX_BLOCKS];
+static u32 cache_tags[CACHE_MAX_BLOCKS];
+static u32 cache_lru[CACHE_MAX_BLOCKS];
+static bool cache_valid[CACHE_MAX_BLOCKS];
+static i16 cache_next[CACHE_MAX_BLOCKS];
+static i16 cache_hash[CACHE_HASH_SIZE];
+static u32 cache_count = 0;
+static u32 cache_limit = CACHE_MIN_BLOCKS;
+static u32 cache_misses = 0;
 static u32 cache_access_counter = 0;
+static bool cache_shrinker_registered = false;
+
+static void cache_hash_insert(int slot) {
+    u32 h = cache_tags[slot] % CACHE_HASH_SIZE;
+    cache_next[slot] = cache_hash[h];
+    cache_hash[h] = (i16)slot;
+}
+
+static void cache_hash_remove(int slot) {
+    i16 *link = &cache_hash[cache_tags[slot] % CACHE_HASH_SIZE];
+    while (*link >= 0) {
+        if (*link == slot) {
+            *link = cache_next[slot];
+            return;
+        }
+        link = &cache_next[*link];
+    }
+}
+
+static void cache_reset(void) {
+    for (int i = 0; i < CACHE_HASH_SIZE; i++) {
+        cache_hash[i] = -1;
+    }
+    for (u32 i = 0; i < cache_count; i++) {
+        cache_valid[i] = false;
+    }
+    cache_misses = 0;
+}
+
+static void cache_update_limit(void) {
+    u32 target = pmm_get_free_memory() / PAGE_SIZE / CACHE_MEM_SHARE;
+    if (target < CACHE_MIN_BLOCKS) target = CACHE_MIN_BLOCKS;
+    if (target > CACHE_MAX_BLOCKS) target = CACHE_MAX_BLOCKS;
+    if (target > cache_limit) cache_limit = target;
+}
 
 static int get_cache_slot(u32 block) {
-    for(int i=0; i<CACHE_SIZE; i++) {
-        if (cache_valid[i] && cache_tags[i] == block) return i;
+    for (i16 i = cache_hash[block % CACHE_HASH_SIZE]; i >= 0; i = cache_next[i]) {
+        if (cache_tags[i] == block) return i;
     }
     return -1;
 }
 
-static int get_victim_slot(void) {
-    int victim = 0;
+// Least recently used slot among those holding a page
+static int cache_lru_slot(void) {
+    int victim = -1;
     u32 min_lru = 0xFFFFFFFF;
-    for(int i=0; i<CACHE_SIZE; i++) {
-        if (!cache_valid[i]) return i;
+    for (u32 i = 0; i < cache_count; i++) {
+        if (!cache_valid[i]) return (int)i;
         if (cache_lru[i] < min_lru) {
             min_lru = cache_lru[i];
-            victim = i;
+            victim = (int)i;
         }
     }
     return victim;
 }
 
+// Returns a slot with a page, or -1 if none can be had
+static int get_victim_slot(void) {
+    if (++cache_misses % CACHE_RESIZE_MISSES == 0) {
+        cache_update_limit();
+    }
+    
+    if (cache_count < cache_limit) {
+        u8 *page = (u8*)pmm_alloc_page();
+        if (page) {
+            memacct_charge_pages(MEM_TAG_FS, 1);
+            cache_data[cache_count] = page;
+            cache_valid[cache_count] = false;
+            return (int)cache_count++;
+        }
+    }
+    
+    int victim = cache_lru_slot();
+    if (victim >= 0 && cache_valid[victim]) {
+        cache_hash_remove(victim);
+        cache_valid[victim] = false;
+    }
+    return victim;
+}
+
+static u32 cache_shrink_count(void) {
+    return cache_count > CACHE_MIN_BLOCKS ? cache_count - CACHE_MIN_BLOCKS : 0;
+}
+
+// The cache is write-through, so any block can simply be dropped
+static u32 cache_shrink_scan(u32 nr_pages) {
+    if (!mutex_trylock(&fs_lock)) return 0;
+    
+    u32 freed = 0;
+    while (freed < nr_pages && cache_count > CACHE_MIN_BLOCKS) {
+        int victim = cache_lru_slot();
+        if (cache_valid[victim]) cache_hash_remove(victim);
+        u8 *page = cache_data[victim];
+        
+        // Keep slots dense: move the last one into the hole
+        u32 last = cache_count - 1;
+        if ((u32)victim != last) {
+            if (cache_valid[last]) cache_hash_remove(last);
+            cache_data[victim] = cache_data[last];
+            cache_tags[victim] = cache_tags[last];
+            cache_lru[victim] = cache_lru[last];
+            cache_valid[victim] = cache_valid[last];
+            if (cache_valid[victim]) cache_hash_insert(victim);
+        }
+        cache_count--;
+        
+        pmm_free_page((phys_addr_t)page);
+        freed++;
+    }
+    cache_limit = cache_count > CACHE_MIN_BLOCKS ? cache_count : CACHE_MIN_BLOCKS;
+    memacct_uncharge_pages(MEM_TAG_FS, freed);
+    
+    mutex_unlock(&fs_lock);
+    return freed;
+}
+
 // Cached values for block operations (avoid repeated lookups)
 static u32 cached_dev_block_size = 0;
 static u32 cached_dev_blocks_per_fs_block = 0;
 
-#define MAX_OPEN_FILES 32
-static ext2_file_t open_files[MAX_OPEN_FILES];
+// Open file handles are slab-allocated, no fixed limit
+static kmem_cache_t *file_cache = NULL;
 
 // Maximum number of block groups we cache (can be increased if needed)
 #define MAX_CACHED_BGS 64
@@ -88,20 +199,18 @@ static ext2_file_t open_files[MAX_OPEN_FILES];
 static ext2_bg_desc_t bg_cache[MAX_CACHED_BGS];
 
 /**
- * Read a block from the block device (OPTIMIZED)
+ * Read a block from the block device, fs_lock held (OPTIMIZED)
  * @param block Block number (EXT2 blocks are 0-based)
  * @param buffer Destination buffer (must be at least block_size bytes)
  * @return 0 on success, negative error code on failure
  */
-static inline int read_block(u32 block, void *buffer) {
-    spinlock_acquire(&fs_lock);
+static int read_block_locked(u32 block, void *buffer) {
     cache_access_counter++;
     int slot = get_cache_slot(block);
     
     if (slot >= 0) {
         cache_lru[slot] = cache_access_counter;
         memcpy(buffer, cache_data[slot], block_size);
-        spinlock_release(&fs_lock);
         return E_OK;
     }
     
@@ -125,45 +234,47 @@ static inline int read_block(u32 block, void *buffer) {
     
     // Read into new cache slot
     slot = get_victim_slot();
+    if (slot < 0) {
+        // No memory for even one cache page: read straight through
+        int ret = blockdev_read(fs_dev_id, start_dev_block, dev_blocks_per_fs_block, buffer);
+        return ret < 0 ? E_EXT2_READ_BLOCK : E_OK;
+    }
     
-    // Release lock while doing I/O to avoid blocking others?
-    // BUT we are modifying cache_data[slot] which is shared.
-    // If we release lock here, someone else might claim the slot or read it.
-    // Ideally we lock the SLOT or use a finer grained lock. 
-    // For now, holding fs_lock during I/O is safe for consistency but bad for concurrency.
-    // Given the requirement "Protect ALL filesystem operations", we hold it.
+    // fs_lock is a mutex, so the disk can sleep on its interrupt while
+    // we hold it; the slot stays ours until the read is in
     
     // dprintf("EXT2: read_block %d -> cache slot %d\n", block, slot);
     
     int ret = blockdev_read(fs_dev_id, start_dev_block, dev_blocks_per_fs_block, cache_data[slot]);
     if (ret < 0) {
         dprintf("EXT2: read_block %d FAILED\n", block);
-        spinlock_release(&fs_lock);
         return E_EXT2_READ_BLOCK;
     }
     
     cache_valid[slot] = true;
     cache_tags[slot] = block;
     cache_lru[slot] = cache_access_counter;
+    cache_hash_insert(slot);
     
     memcpy(buffer, cache_data[slot], block_size);
-    spinlock_release(&fs_lock);
     return E_OK;
 }
 
+static int read_block(u32 block, void *buffer) {
+    mutex_lock(&fs_lock);
+    int ret = read_block_locked(block, buffer);
+    mutex_unlock(&fs_lock);
+    return ret;
+}
+
 /**
- * Write a block to the block device (OPTIMIZED)
+ * Write a block to the block device, fs_lock held (OPTIMIZED)
  * @param block Block number (EXT2 blocks are 0-based)
  * @param buffer Source buffer (must contain block_size bytes)
  * @return 0 on success, negative error code on failure
  */
-static inline int write_block(u32 block, const void *buffer) {
+static int write_block_locked(u32 block, const void *buffer) {
     // Get device block size (cached)
-    // Get device block size (cached)
-    // Safe to read cached_dev_block_size without lock as it is set once? 
-    // Better to just lock.
-    spinlock_acquire(&fs_lock);
-
     u32 dev_block_size = cached_dev_block_size;
     if (dev_block_size == 0) {
         dev_block_size = blockdev_get_block_size(fs_dev_id);
@@ -186,7 +297,6 @@ static inline int write_block(u32 block, const void *buffer) {
     int ret = blockdev_write(fs_dev_id, start_dev_block, dev_blocks_per_fs_block, buffer);
     if (ret < 0) {
         dprintf("EXT2: write_block %d FAILED\n", block);
-        spinlock_release(&fs_lock);
         return E_EXT2_WRITE_BLOCK;
     }
     
@@ -196,11 +306,17 @@ static inline int write_block(u32 block, const void *buffer) {
         memcpy(cache_data[slot], buffer, block_size);
         cache_lru[slot] = ++cache_access_counter;
     }
-    
-    spinlock_release(&fs_lock);
+
     return E_OK;
 }
 
+static int write_block(u32 block, const void *buffer) {
+    mutex_lock(&fs_lock);
+    int ret = write_block_locked(block, buffer);
+    mutex_unlock(&fs_lock);
+    return ret;
+}
+
 /**
  * Read an inode from disk
  * Uses inode_buffer to avoid conflicts with directory operations
@@ -263,15 +379,15 @@ static int read_inode(u32 inode_num, ext2_inode_t *dst) {
  * @return 0 on success, negative error code on failure
  */
 static int write_inode(u32 inode_num, const ext2_inode_t *src) {
-    spinlock_acquire(&fs_lock);
+    mutex_lock(&fs_lock);
     if (inode_num == 0 || inode_num > sb.inodes_count) {
-        spinlock_release(&fs_lock);
+        mutex_unlock(&fs_lock);
         return E_EXT2_NO_INODE;
     }
     
     u32 bg = (inode_num - 1) / sb.inodes_per_group;
     if (bg >= num_bg) {
-        spinlock_release(&fs_lock);
+        mutex_unlock(&fs_lock);
         return E_EXT2_NO_INODE;
     }
     
@@ -279,7 +395,7 @@ static int write_inode(u32 inode_num, const ext2_inode_t *src) {
     u32 table_block = bg_descs[bg].inode_table;
     
     if (table_block == 0) {
-        spinlock_release(&fs_lock);
+        mutex_unlock(&fs_lock);
         return E_EXT2_WRITE_BLOCK;
     }
     
@@ -289,8 +405,8 @@ static int write_inode(u32 inode_num, const ext2_inode_t *src) {
     u32 byte_offset = offset % block_size;
     
     // Read the block containing the inode into inode_buffer
-    if (read_block(table_block + block_offset, inode_buffer) < 0) {
-        spinlock_release(&fs_lock);
+    if (read_block_locked(table_block + block_offset, inode_buffer) < 0) {
+        mutex_unlock(&fs_lock);
         return E_EXT2_READ_BLOCK;
     }
     
@@ -300,8 +416,8 @@ static int write_inode(u32 inode_num, const ext2_inode_t *src) {
     
     // Write back to disk
     dprintf("EXT2: write_inode %d: mode=0x%04x size=%d\n", inode_num, src->mode, src->size);
-    int ret = write_block(table_block + block_offset, inode_buffer);
-    spinlock_release(&fs_lock);
+    int ret = write_block_locked(table_block + block_offset, inode_buffer);
+    mutex_unlock(&fs_lock);
     return ret;
 }
 
@@ -541,7 +657,7 @@ int ext2_init(u32 dev_id) {
     }
     
     fs_dev_id = dev_id;
-    spinlock_init(&fs_lock);
+    mutex_init(&fs_lock);
     
     // Get block device
     blockdev_t *dev = blockdev_get(dev_id);
@@ -549,6 +665,22 @@ int ext2_init(u32 dev_id) {
         return E_ATA_NO_DEV;
     }
     
+    // Block cache pages are allocated lazily, up to a share of free memory
+    cache_reset();
+    cache_update_limit();
+    if (!cache_shrinker_registered) {
+        register_shrinker(cache_shrink_count, cache_shrink_scan);
+        cache_shrinker_registered = true;
+    }
+    
+    if (!file_cache) {
+        file_cache = kmem_cache_create("ext2_file", sizeof(ext2_file_t));
+        if (!file_cache) {
+            return E_NO_MEM;
+        }
+        kmem_cache_set_tag(file_cache, MEM_TAG_FS);
+    }
+    
     // Allocate block buffer
     block_size = blockdev_get_block_size(dev_id);
     if (block_size == 0) {
@@ -560,6 +692,13 @@ int ext2_init(u32 dev_id) {
     static u8 static_block_buffer[4096];
     block_buffer = static_block_buffer;
     
+    memacct_static(MEM_TAG_FS, "ext2 block buffers",
+                   sizeof(static_block_buffer) + sizeof(inode_buffer) + sizeof(dir_buffer));
+    memacct_static(MEM_TAG_FS, "ext2 cache index",
+                   sizeof(cache_data) + sizeof(cache_tags) + sizeof(cache_lru) +
+                   sizeof(cache_valid) + sizeof(cache_next) + sizeof(cache_hash));
+    memacct_static(MEM_TAG_FS, "ext2 group descriptors", sizeof(bg_cache));
+    
     sectors_per_block = block_size / 512;
     
     // Read superblock (always at offset 1024 from start of partition)
@@ -656,28 +795,22 @@ ext2_file_t* ext2_open(const char *path) {
         return NULL;
     }
     
-    // Find free slot
-    spinlock_acquire(&fs_lock);
-    for (u32 i = 0; i < MAX_OPEN_FILES; i++) {
-        if (!open_files[i].valid) {
-            open_files[i].valid = true;
-            open_files[i].inode_num = inode_num; // FIX: Set inode_num
-            open_files[i].inode = inode;
-            open_files[i].position = 0;
-            spinlock_release(&fs_lock);
-            return &open_files[i];
-        }
+    ext2_file_t *file = (ext2_file_t*)kmem_cache_alloc(file_cache);
+    if (!file) {
+        return NULL; // Out of memory
     }
-    spinlock_release(&fs_lock);
     
-    return NULL; // No free slots
+    file->valid = true;
+    file->inode_num = inode_num;
+    file->inode = inode;
+    file->position = 0;
+    return file;
 }
 
 void ext2_close(ext2_file_t *file) {
-    if (file) {
-        spinlock_acquire(&fs_lock);
+    if (file && file->valid) {
         file->valid = false;
-        spinlock_release(&fs_lock);
+        kmem_cache_free(file_cache, file);
     }
 }
 
@@ -793,13 +926,13 @@ int ext2_read(ext2_file_t *file, void *buffer, u32 size) {
  * @return Block number, or 0 on error
  */
 static u32 ext2_alloc_block(void) {
-    spinlock_acquire(&fs_lock);
+    mutex_lock(&fs_lock);
     for (u32 i = 0; i < num_bg; i++) {
         if (bg_descs[i].free_blocks_count > 0) {
             u32 bitmap_block = bg_descs[i].block_bitmap;
             if (bitmap_block == 0) continue;
             
-            if (read_block(bitmap_block, block_buffer) < 0) continue;
+            if (read_block_locked(bitmap_block, block_buffer) < 0) continue;
             
             u32 bits_per_block = block_size * 8;
             for (u32 bit = 0; bit < bits_per_block; bit++) {
@@ -810,7 +943,7 @@ static u32 ext2_alloc_block(void) {
                     // Found free bit
                     block_buffer[byte] |= (1 << bit_in_byte);
                     
-                    if (write_block(bitmap_block, block_buffer) < 0) continue;
+                    if (write_block_locked(bitmap_block, block_buffer) < 0) continue;
                     
                     bg_descs[i].free_blocks_count--;
                     sb.free_blocks_count--;
@@ -819,31 +952,31 @@ static u32 ext2_alloc_block(void) {
                     
                     // Update descriptors
                     u32 bg_loc = (block_size == 1024) ? 2 : 1;
-                    if (read_block(bg_loc, block_buffer) < 0) {
-                        spinlock_release(&fs_lock);
+                    if (read_block_locked(bg_loc, block_buffer) < 0) {
+                        mutex_unlock(&fs_lock);
                         return 0;
                     }
                     
                     // Update cache in buffer
                     // Note: bg_descs points to bg_cache which we updated above
                     memcpy(block_buffer, bg_descs, num_bg * sizeof(ext2_bg_desc_t));
-                    write_block(bg_loc, block_buffer);
+                    write_block_locked(bg_loc, block_buffer);
                     
                     // Update superblock
                     u32 sb_block = (block_size == 1024) ? 1 : 0;
                     u32 sb_offset = (block_size == 1024) ? 0 : 1024;
-                    if (read_block(sb_block, block_buffer) >= 0) {
+                    if (read_block_locked(sb_block, block_buffer) >= 0) {
                          memcpy(block_buffer + sb_offset, &sb, sizeof(ext2_superblock_t));
-                         write_block(sb_block, block_buffer);
+                         write_block_locked(sb_block, block_buffer);
                     }
                     
-                    spinlock_release(&fs_lock);
+                    mutex_unlock(&fs_lock);
                     return block_num;
                 }
             }
         }
     }
-    spinlock_release(&fs_lock);
+    mutex_unlock(&fs_lock);
     return 0;
 }
 
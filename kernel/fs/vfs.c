@@ -9,6 +9,7 @@
 #include "ext4.h"
 #include "blockdev.h"
 #include "../errno.h"
+#include "../mm/memacct.h"
 
 static bool vfs_initialized = false;
 static bool vfs_mounted = false;
@@ -39,6 +40,7 @@ int vfs_init(void) {
     for (u32 i = 0; i < MAX_VFS_FILES; i++) {
         vfs_files[i].valid = false;
     }
+    memacct_static(MEM_TAG_FS, "vfs file table", sizeof(vfs_files));
     
     vfs_initialized = true;
     return E_OK;
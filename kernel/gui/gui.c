@@ -15,6 +15,7 @@
 #include "../apps/apps.h"
 #include "../apps/script.h"
 #include "../fs/vfs.h"
+#include "../mm/memacct.h"
 
 // GUI state
 static gui_mode_t current_mode = GUI_MODE_TEXT;
@@ -69,6 +70,19 @@ static void strcpy_gui(char *dst, const char *src) {
     while ((*dst++ = *src++));
 }
 
+static char *utoa_gui(u32 val, char *buf) {
+    char tmp[12];
+    int i = 0;
+    do {
+        tmp[i++] = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    char *p = buf;
+    while (i) *p++ = tmp[--i];
+    *p = 0;
+    return p;
+}
+
 static int strcmp_gui(const char *a, const char *b) {
     while (*a && *a == *b) { a++; b++; }
     return *a - *b;
@@ -292,6 +306,11 @@ int gui_init(void) {
     
     // Initialize app list
     init_app_list();
+    memacct_static(MEM_TAG_GUI, "gui windows and icons",
+                   sizeof(windows) + sizeof(icons) + sizeof(app_list));
+    
+    // Probe the linear framebuffer and map it write-combining
+    vesa_init(0, 0, 0);
     
     // Initialize mouse
     mouse_init();
@@ -689,12 +708,33 @@ static void run_sysinfo(void) {
     draw_text_at(15, 13, "Total:      See 'free' command", VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
     draw_text_at(15, 14, "Free:       See 'free' command", VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
     
-    draw_text_at(13, 16, "Press ESC or click [X] to close", VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
+    draw_text_at(13, 19, "Press ESC or click [X] to close", VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
     
     // Taskbar
     fill_text_area(0, 24, 80, 1, VGA_COLOR_WHITE, TG_TASKBAR_BG);
     draw_text_at(1, 24, "[ICE]", VGA_COLOR_WHITE, TG_TASKBAR_BG);
     
+    // Framebuffer write bandwidth, uncached vs write-combining
+    draw_text_at(13, 16, "Framebuffer:", VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GREY);
+    draw_text_at(15, 17, "Measuring...", VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
+    
+    vesa_fb_bench_t bench;
+    char line[64];
+    if (vesa_benchmark_framebuffer(&bench)) {
+        char *p = line;
+        strcpy_gui(p, "UC "); p += 3;
+        p = utoa_gui(bench.uc_mbps, p);
+        strcpy_gui(p, " MB/s -> WC "); p += 12;
+        p = utoa_gui(bench.wc_mbps, p);
+        strcpy_gui(p, " MB/s ("); p += 7;
+        strcpy_gui(p, bench.method); p += strlen_gui(bench.method);
+        strcpy_gui(p, ")");
+    } else {
+        strcpy_gui(line, "No linear framebuffer found");
+    }
+    fill_text_area(15, 17, 50, 1, VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GREY);
+    draw_text_at(15, 17, line, VGA_COLOR_DARK_GREY, VGA_COLOR_LIGHT_GREY);
+    
     show_cursor();
     
     while (1) {
@@ -7,6 +7,32 @@
 
 #include "vesa.h"
 #include "../drivers/vga.h"
+#include "../drivers/pit.h"
+#include "../cpu/memtype.h"
+#include "../cpu/irqflags.h"
+#include "../mm/pmm.h"
+#include "../mm/memacct.h"
+#include <string.h>
+
+#define VESA_LFB_BASE 0xFD000000
+
+// Bochs/QEMU VBE "DISPI" interface, used to size the video memory
+#define VBE_DISPI_IOPORT_INDEX  0x01CE
+#define VBE_DISPI_IOPORT_DATA   0x01CF
+#define VBE_DISPI_INDEX_ID      0x0
+#define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0xA
+#define VBE_DISPI_ID0           0xB0C0
+#define VBE_DISPI_ID5           0xB0C5
+
+static inline void outw(u16 port, u16 value) {
+    __asm__ volatile ("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline u16 inw(u16 port) {
+    u16 ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
 
 // Simple 8x8 bitmap font
 static const u8 font_8x8[128][8] = {
@@ -159,25 +185,14 @@ static u32 screen_width = 0;
 static u32 screen_height = 0;
 static u32 screen_bpp = 0;
 static u32 screen_pitch = 0;
+static u32 framebuffer_size = 0;
+static bool framebuffer_present = false;
+static memtype_method_t framebuffer_memtype = MEMTYPE_VIA_NONE;
 
 // Double buffering
 static u32 *back_buffer = NULL;
 static bool double_buffering = false;
 
-// Simple memory operations
-static void *memset_gui(void *s, int c, u32 n) {
-    u8 *p = (u8*)s;
-    while (n--) *p++ = (u8)c;
-    return s;
-}
-
-static void *memcpy_gui(void *dest, const void *src, u32 n) {
-    u8 *d = (u8*)dest;
-    const u8 *s = (const u8*)src;
-    while (n--) *d++ = *s++;
-    return dest;
-}
-
 int vesa_init(u32 width, u32 height, u32 bpp) {
     // In a real implementation, we would:
     // 1. Query VBE modes using BIOS interrupts (before protected mode)
@@ -189,13 +204,30 @@ int vesa_init(u32 width, u32 height, u32 bpp) {
     // or similar and passed the info to us
     
     // Default fallback framebuffer address (typical VESA LFB)
-    framebuffer = (u32*)0xFD000000;  // Common VESA LFB address
+    framebuffer = (u32*)VESA_LFB_BASE;  // Common VESA LFB address
     
     screen_width = width ? width : 800;
     screen_height = height ? height : 600;
     screen_bpp = bpp ? bpp : 32;
     screen_pitch = screen_width * (screen_bpp / 8);
     
+    // Only the Bochs/QEMU adapter tells us how much VRAM sits behind the LFB
+    outw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_ID);
+    u16 id = inw(VBE_DISPI_IOPORT_DATA);
+    if (id >= VBE_DISPI_ID0 && id <= VBE_DISPI_ID5) {
+        outw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_VIDEO_MEMORY_64K);
+        framebuffer_size = (u32)inw(VBE_DISPI_IOPORT_DATA) * 0x10000;
+        framebuffer_present = framebuffer_size != 0;
+    }
+    if (!framebuffer_size) {
+        framebuffer_size = screen_pitch * screen_height;
+    }
+    
+    // The LFB is only ever written, so let the CPU combine the stores
+    if (framebuffer_present) {
+        framebuffer_memtype = memtype_set_range(VESA_LFB_BASE, framebuffer_size, MEMTYPE_WC);
+    }
+    
     // For simplicity, we'll use text mode as fallback
     // Real VESA requires BIOS calls before entering protected mode
     vesa_active = false;
@@ -353,7 +385,9 @@ void vesa_draw_string_transparent(u32 x, u32 y, const char *str, u32 fg) {
 void vesa_swap_buffers(void) {
     if (!vesa_active || !double_buffering || !back_buffer) return;
     
-    memcpy_gui(framebuffer, back_buffer, screen_width * screen_height * 4);
+    // Large enough for memcpy's streaming stores, which suit the
+    // write-combining framebuffer
+    memcpy(framebuffer, back_buffer, screen_width * screen_height * 4);
 }
 
 void vesa_copy_region(u32 src_x, u32 src_y, u32 dst_x, u32 dst_y, u32 w, u32 h) {
@@ -367,6 +401,68 @@ void vesa_copy_region(u32 src_x, u32 src_y, u32 dst_x, u32 dst_y, u32 w, u32 h)
     }
 }
 
+#define BENCH_SRC_WORDS 4096    // 16 KiB source block
+#define BENCH_SRC_ORDER 2
+#define BENCH_WINDOW    0x100000
+#define BENCH_TICKS     20
+
+// KiB copied per second from RAM into the last MiB of VRAM
+static u32 bench_copy_rate(volatile u32 *window, const u32 *bench_src) {
+    u32 kb = 0;
+    u32 offset = 0;
+    
+    // Start on a tick boundary
+    u64 start = pit_get_ticks();
+    while (pit_get_ticks() == start);
+    start = pit_get_ticks();
+    
+    while (pit_get_ticks() - start < BENCH_TICKS) {
+        volatile u32 *dst = window + offset;
+        for (u32 i = 0; i < BENCH_SRC_WORDS; i++) {
+            dst[i] = bench_src[i];
+        }
+        kb += BENCH_SRC_WORDS * 4 / 1024;
+        offset = (offset + BENCH_SRC_WORDS) % (BENCH_WINDOW / 4);
+    }
+    
+    u32 ticks = (u32)(pit_get_ticks() - start);
+    return kb * 100 / ticks;
+}
+
+bool vesa_benchmark_framebuffer(vesa_fb_bench_t *result) {
+    result->available = false;
+    result->uc_mbps = 0;
+    result->wc_mbps = 0;
+    result->method = memtype_method_name(framebuffer_memtype);
+    
+    if (!framebuffer_present || framebuffer_size < 2 * BENCH_WINDOW || !irqs_enabled()) {
+        return false;
+    }
+    
+    // Source block only lives for the duration of the run
+    u32 *bench_src = (u32*)pmm_alloc_pages(BENCH_SRC_ORDER);
+    if (!bench_src) return false;
+    memacct_charge_pages(MEM_TAG_GUI, 1u << BENCH_SRC_ORDER);
+    for (u32 i = 0; i < BENCH_SRC_WORDS; i++) {
+        bench_src[i] = i * 0x01010101;
+    }
+    
+    // Scratch area well past anything a visible mode uses
+    volatile u32 *window = (volatile u32*)(VESA_LFB_BASE + framebuffer_size - BENCH_WINDOW);
+    
+    memtype_set_range(VESA_LFB_BASE, framebuffer_size, MEMTYPE_UC);
+    result->uc_mbps = bench_copy_rate(window, bench_src) / 1024;
+    
+    framebuffer_memtype = memtype_set_range(VESA_LFB_BASE, framebuffer_size, MEMTYPE_WC);
+    result->method = memtype_method_name(framebuffer_memtype);
+    result->wc_mbps = bench_copy_rate(window, bench_src) / 1024;
+    
+    pmm_free_pages((phys_addr_t)bench_src, BENCH_SRC_ORDER);
+    memacct_uncharge_pages(MEM_TAG_GUI, 1u << BENCH_SRC_ORDER);
+    result->available = true;
+    return true;
+}
+
 void vesa_fallback_text_mode(void) {
     // Reset to VGA text mode
     vesa_active = false;
@@ -99,5 +99,17 @@ void vesa_copy_region(u32 src_x, u32 src_y, u32 dst_x, u32 dst_y, u32 w, u32 h);
 // Fallback for text mode (when VESA unavailable)
 void vesa_fallback_text_mode(void);
 
+// Framebuffer write bandwidth, uncached vs write-combining
+typedef struct {
+    bool available;      // Linear framebuffer found
+    u32 uc_mbps;         // MB/s with the LFB mapped uncached
+    u32 wc_mbps;         // MB/s with write-combining enabled
+    const char *method;  // "PAT", "MTRR" or "none"
+} vesa_fb_bench_t;
+
+// Measures both memory types on a scratch area past the visible screen
+// and leaves the framebuffer write-combining. Needs interrupts enabled.
+bool vesa_benchmark_framebuffer(vesa_fb_bench_t *result);
+
 #endif // ICE_VESA_H
 
@@ -4,10 +4,24 @@
 #include "drivers/vga.h"
 #include "cpu/gdt.h"
 #include "cpu/idt.h"
-#include "drivers/pic.h"
+#include "cpu/fpu.h"
+#include "lib/string.h"
+#include "drivers/irq.h"
 #include "drivers/pit.h"
 #include "drivers/keyboard.h"
 #include "mm/pmm.h"
+#include "mm/slab.h"
+#include "mm/paging.h"
+#include "proc/scheduler.h"
+#include "proc/timer.h"
+#include "proc/clock.h"
+#include "proc/syscall.h"
+#include "proc/uproc.h"
+#include "proc/workqueue.h"
+#include "sync/rcu.h"
+#include "cpu/cpuid.h"
+#include "cpu/memtype.h"
+#include "cpu/smp.h"
 #include "tty/tty.h"
 
  
@@ -26,6 +40,8 @@ void kernel_main(uint32_t magic, void *mboot_info) {
     }
     
      
+    cpuid_init();
+    
     vga_puts("[BOOT] Loading GDT... ");
     gdt_init();
     vga_puts("OK\n");
@@ -36,20 +52,68 @@ void kernel_main(uint32_t magic, void *mboot_info) {
     vga_puts("OK\n");
     
      
-    vga_puts("[BOOT] Initializing PIC... ");
-    pic_init();
-    vga_puts("OK\n");
+    vga_puts("[BOOT] Enabling FPU/SSE... ");
+    fpu_init();
+    vga_puts(fpu_sse_enabled() ? "OK (lazy FXSAVE)\n" : "SKIPPED (no FXSR/SSE)\n");
+    string_init();
+    
+    vga_puts("[BOOT] Enabling system calls... ");
+    syscall_init();
+    uproc_init();
+    vga_puts(syscall_has_sysenter() ? "OK (sysenter, int 0x80)\n" : "OK (int 0x80)\n");
+    vga_printf("[BOOT] Memory copy: %s\n", string_get_variant());
+    
+     
+    vga_puts("[BOOT] Initializing interrupt routing... ");
+    irq_init();
+    vga_puts(irq_get_mode() == IRQ_MODE_IOAPIC ? "OK (IOAPIC)\n" : "OK (PIC)\n");
     
      
     vga_puts("[BOOT] Initializing memory... ");
     pmm_init(mboot_info);
     vga_puts("OK\n");
     
+    vga_puts("[BOOT] Memory self-test... ");
+    if (pmm_self_test()) {
+        vga_puts("OK\n");
+    } else {
+        vga_puts("FAILED\n");
+    }
+    
+     
+    vga_puts("[BOOT] Initializing kernel heap... ");
+    kmem_init();
+    scheduler_init();
+    vga_puts("OK\n");
+    
+    vga_puts("[BOOT] Enabling paging (4 MiB PSE)... ");
+    memtype_init();
+    if (paging_init()) {
+        vga_puts("OK\n");
+    } else {
+        vga_puts("SKIPPED (no PSE)\n");
+    }
+    
      
     vga_puts("[BOOT] Initializing timer... ");
+    timer_init();
     pit_init(100);   
     vga_puts("OK\n");
     
+    vga_puts("[BOOT] Calibrating TSC... ");
+    clock_init();
+    if (clock_tsc_khz()) {
+        vga_printf("%u kHz via %s, drift %d ppm\n", clock_tsc_khz(),
+                   clock_reference_name(), clock_drift_ppm());
+    } else {
+        vga_puts("no TSC, using PIT\n");
+    }
+    
+    vga_puts("[BOOT] Starting kernel worker... ");
+    workqueue_init();
+    vga_puts(workqueue_worker_pid() ? "OK\n" : "FAILED\n");
+    rcu_init();
+    
      
     vga_puts("[BOOT] Initializing keyboard... ");
     keyboard_init();
@@ -88,6 +152,10 @@ void kernel_main(uint32_t magic, void *mboot_info) {
     __asm__ volatile ("sti");
     vga_puts("OK\n");
     
+    vga_puts("[BOOT] Starting application processors... ");
+    smp_init();
+    vga_printf("%u CPU(s) online\n", smp_cpu_count());
+    
     vga_puts("\n");
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts("MPM Kernel ready.\n");
@@ -0,0 +1,32 @@
+#ifndef ICE_MATH_H
+#define ICE_MATH_H
+
+#include "../types.h"
+
+// 64-bit by 32-bit division without libgcc: two divl steps, the second
+// one safe because its high word (the first remainder) is below d.
+static inline u64 div_u64_rem(u64 n, u32 d, u32 *rem) {
+    u32 hi = (u32)(n >> 32);
+    u32 lo = (u32)n;
+    u32 q_hi = hi / d;
+    u32 r = hi % d;
+    u32 q_lo;
+    __asm__ ("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    if (rem) *rem = r;
+    return ((u64)q_hi << 32) | q_lo;
+}
+
+static inline u64 div_u64(u64 n, u32 d) {
+    return div_u64_rem(n, d, 0);
+}
+
+// (a * b) >> shift for a 64-bit a and 32-bit b, keeping the 96-bit
+// intermediate; shift is at most 32
+static inline u64 mul_u64_u32_shr(u64 a, u32 b, u32 shift) {
+    u64 lo = (u64)(u32)a * b;
+    u64 hi = (u64)(u32)(a >> 32) * b;
+    if (shift == 0) return lo + (hi << 32);
+    return (lo >> shift) + (hi << (32 - shift));
+}
+
+#endif
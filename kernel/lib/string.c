@@ -1,50 +1,157 @@
 #include "string.h"
+#include "../cpu/cpuid.h"
+#include "../cpu/fpu.h"
 
-void *memcpy(void *dest, const void *src, size_t n) {
-    u8 *d = (u8 *)dest;
-    const u8 *s = (const u8 *)src;
+/*
+ * memcpy/memset/memmove pick a kernel at run time: string_init looks at
+ * CPUID once the FPU is set up. Before that (and on any 386-class CPU)
+ * rep movsd/stosd is used, which needs nothing.
+ */
+
+// Above this size, copies bypass the cache with SSE2 streaming stores
+#define NT_THRESHOLD   (256 * 1024)
+// Bytes per interrupts-off FPU region of a streaming copy
+#define NT_CHUNK       4096
+
+static bool use_erms = false;
+static bool use_nt = false;
+
+static inline void rep_movsb(void *d, const void *s, size_t n) {
+    __asm__ volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static void *copy_movsd(void *dest, const void *src, size_t n) {
+    void *d = dest;
+    size_t words = n >> 2;
+    __asm__ volatile ("rep movsl" : "+D"(d), "+S"(src), "+c"(words) : : "memory");
+    rep_movsb(d, src, n & 3);
+    return dest;
+}
+
+static void *copy_erms(void *dest, const void *src, size_t n) {
+    rep_movsb(dest, src, n);
+    return dest;
+}
+
+static void *copy_sse2_nt(void *dest, const void *src, size_t n) {
+    u8 *d = (u8*)dest;
+    const u8 *s = (const u8*)src;
+    
+    size_t head = (16 - ((u32)d & 15)) & 15;
+    if (head > n) head = n;
+    rep_movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
     
-    // Optimization for word-aligned copies
-    if (n >= 4 && ((u32)d & 3) == 0 && ((u32)s & 3) == 0) {
-        u32 *d32 = (u32 *)dest;
-        const u32 *s32 = (const u32 *)src;
-        size_t n32 = n / 4;
-        
-        while (n32--) {
-            *d32++ = *s32++;
+    while (n >= 64) {
+        size_t chunk = n < NT_CHUNK ? n & ~(size_t)63 : NT_CHUNK;
+        u32 flags = kernel_fpu_begin();
+        for (size_t i = 0; i < chunk; i += 64) {
+            __asm__ volatile (
+                "movdqu   (%1), %%xmm0\n"
+                "movdqu 16(%1), %%xmm1\n"
+                "movdqu 32(%1), %%xmm2\n"
+                "movdqu 48(%1), %%xmm3\n"
+                "movntdq %%xmm0,   (%0)\n"
+                "movntdq %%xmm1, 16(%0)\n"
+                "movntdq %%xmm2, 32(%0)\n"
+                "movntdq %%xmm3, 48(%0)\n"
+                : : "r"(d + i), "r"(s + i) : "memory");
         }
-        
-        d = (u8 *)d32;
-        s = (u8 *)s32;
-        n %= 4;
+        __asm__ volatile ("sfence" : : : "memory");
+        kernel_fpu_end(flags);
+        d += chunk;
+        s += chunk;
+        n -= chunk;
     }
     
-    while (n--) {
-        *d++ = *s++;
-    }
+    rep_movsb(d, s, n);
     return dest;
 }
 
-void *memset(void *s, int c, size_t n) {
-    u8 *p = (u8 *)s;
+static void set_stosd(void *s, int c, size_t n) {
+    u32 c32 = (u8)c * 0x01010101u;
+    size_t words = n >> 2;
+    size_t rest = n & 3;
+    __asm__ volatile ("rep stosl" : "+D"(s), "+c"(words) : "a"(c32) : "memory");
+    __asm__ volatile ("rep stosb" : "+D"(s), "+c"(rest) : "a"(c32) : "memory");
+}
+
+static void set_erms(void *s, int c, size_t n) {
+    __asm__ volatile ("rep stosb" : "+D"(s), "+c"(n) : "a"(c) : "memory");
+}
+
+static void set_sse2_nt(void *s, int c, size_t n) {
+    u8 *p = (u8*)s;
+    u32 c32 = (u8)c * 0x01010101u;
+    
+    size_t head = (16 - ((u32)p & 15)) & 15;
+    if (head > n) head = n;
+    set_erms(p, c, head);
+    p += head;
+    n -= head;
     
-    // Optimization for word-aligned sets
-    if (n >= 4 && ((u32)p & 3) == 0) {
-        u32 c32 = c | (c << 8) | (c << 16) | (c << 24);
-        u32 *p32 = (u32 *)s;
-        size_t n32 = n / 4;
-        
-        while (n32--) {
-            *p32++ = c32;
+    while (n >= 64) {
+        size_t chunk = n < NT_CHUNK ? n & ~(size_t)63 : NT_CHUNK;
+        u32 flags = kernel_fpu_begin();
+        __asm__ volatile ("movd %0, %%xmm0\n"
+                          "pshufd $0, %%xmm0, %%xmm0" : : "r"(c32));
+        for (size_t i = 0; i < chunk; i += 64) {
+            __asm__ volatile (
+                "movntdq %%xmm0,   (%0)\n"
+                "movntdq %%xmm0, 16(%0)\n"
+                "movntdq %%xmm0, 32(%0)\n"
+                "movntdq %%xmm0, 48(%0)\n"
+                : : "r"(p + i) : "memory");
         }
-        
-        p = (u8 *)p32;
-        n %= 4;
+        __asm__ volatile ("sfence" : : : "memory");
+        kernel_fpu_end(flags);
+        p += chunk;
+        n -= chunk;
     }
     
-    while (n--) {
-        *p++ = (u8)c;
-    }
+    set_erms(p, c, n);
+}
+
+static const memcpy_variant_t variants[] = {
+    {"movsd",    copy_movsd,   0},
+    {"erms",     copy_erms,    CPU_FEATURE_ERMS},
+    {"sse2-nt",  copy_sse2_nt, CPU_FEATURE_SSE2},
+};
+
+void string_init(void) {
+    use_erms = cpu_has(CPU_FEATURE_ERMS);
+    use_nt = cpu_has(CPU_FEATURE_SSE2) && fpu_sse_enabled();
+}
+
+const char* string_get_variant(void) {
+    if (use_erms) return use_nt ? "erms, sse2-nt above 256 KiB" : "erms";
+    return use_nt ? "movsd, sse2-nt above 256 KiB" : "movsd";
+}
+
+u32 string_memcpy_variant_count(void) {
+    return sizeof(variants) / sizeof(variants[0]);
+}
+
+const memcpy_variant_t* string_get_memcpy_variant(u32 index) {
+    if (index >= string_memcpy_variant_count()) return NULL;
+    const memcpy_variant_t *v = &variants[index];
+    if (v->feature && !cpu_has(v->feature)) return NULL;
+    if (v->copy == copy_sse2_nt && !fpu_sse_enabled()) return NULL;
+    return v;
+}
+
+void *memcpy(void *dest, const void *src, size_t n) {
+    if (use_nt && n >= NT_THRESHOLD) return copy_sse2_nt(dest, src, n);
+    if (use_erms) return copy_erms(dest, src, n);
+    return copy_movsd(dest, src, n);
+}
+
+void *memset(void *s, int c, size_t n) {
+    if (use_nt && n >= NT_THRESHOLD) set_sse2_nt(s, c, n);
+    else if (use_erms) set_erms(s, c, n);
+    else set_stosd(s, c, n);
     return s;
 }
 
@@ -52,16 +159,25 @@ void *memmove(void *dest, const void *src, size_t n) {
     u8 *d = (u8 *)dest;
     const u8 *s = (const u8 *)src;
 
-    if (d < s) {
-        while (n--) {
-            *d++ = *s++;
-        }
-    } else {
-        d += n;
-        s += n;
-        while (n--) {
-            *--d = *--s;
-        }
+    // Forward copies are safe unless dest starts inside src
+    if (d <= s || d >= s + n) return memcpy(dest, src, n);
+
+    // Backwards: the odd tail bytes first, then whole words from the top
+    size_t tail = n & 3;
+    while (tail--) {
+        n--;
+        d[n] = s[n];
+    }
+    size_t words = n >> 2;
+    if (words) {
+        void *dw = d + n - 4;
+        const void *sw = s + n - 4;
+        // An interrupt in here sees DF set, but every kernel entry stub
+        // clears it and iret puts it back
+        __asm__ volatile ("std\n"
+                          "rep movsl\n"
+                          "cld"
+                          : "+D"(dw), "+S"(sw), "+c"(words) : : "memory");
     }
     return dest;
 }
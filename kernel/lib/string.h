@@ -4,6 +4,25 @@
 #include "../types.h"
 #include <stddef.h>
 
+typedef void *(*memcpy_fn_t)(void *dest, const void *src, size_t n);
+
+typedef struct {
+    const char *name;
+    memcpy_fn_t copy;
+    u32 feature;         // CPUID feature it needs, 0 for none
+} memcpy_variant_t;
+
+// Choose the memcpy/memset kernels for this CPU. Run after fpu_init.
+void string_init(void);
+
+// Kernels in use, for the boot log
+const char* string_get_variant(void);
+
+// Individual copy kernels, for benchmarks. NULL when this CPU cannot
+// run the one at index.
+u32 string_memcpy_variant_count(void);
+const memcpy_variant_t* string_get_memcpy_variant(u32 index);
+
 // Memory manipulation
 void *memcpy(void *dest, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
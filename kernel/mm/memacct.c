@@ -0,0 +1,81 @@
+/*
+ * ICE per-subsystem memory accounting
+ *
+ * Static reservations are registered once by the owning subsystem's
+ * init function; dynamic page allocations are charged and uncharged
+ * by whoever takes pages from pmm on behalf of a subsystem.
+ */
+
+#include "memacct.h"
+#include "../sync/spinlock.h"
+
+static memacct_tag_stats_t tag_stats[MEM_TAG_COUNT];
+static memacct_region_t regions[MEMACCT_MAX_REGIONS];
+static u32 region_count = 0;
+static spinlock_t acct_lock; // Zeroed .bss is unlocked, usable before any init
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    "mm", "fs", "net", "gui", "sched", "script", "tty", "shell"
+};
+
+void memacct_static(mem_tag_t tag, const char *name, u32 bytes) {
+    if (tag >= MEM_TAG_COUNT || !name) return;
+    
+    spinlock_acquire(&acct_lock);
+    for (u32 i = 0; i < region_count; i++) {
+        if (regions[i].name == name) {
+            spinlock_release(&acct_lock);
+            return;
+        }
+    }
+    if (region_count < MEMACCT_MAX_REGIONS) {
+        regions[region_count].name = name;
+        regions[region_count].bytes = bytes;
+        regions[region_count].tag = tag;
+        region_count++;
+    }
+    // Totals stay right even when the region table is full
+    tag_stats[tag].static_bytes += bytes;
+    spinlock_release(&acct_lock);
+}
+
+void memacct_charge_pages(mem_tag_t tag, u32 pages) {
+    if (tag >= MEM_TAG_COUNT || pages == 0) return;
+    
+    spinlock_acquire(&acct_lock);
+    memacct_tag_stats_t *s = &tag_stats[tag];
+    s->pages += pages;
+    s->charges++;
+    if (s->pages > s->peak_pages) s->peak_pages = s->pages;
+    spinlock_release(&acct_lock);
+}
+
+void memacct_uncharge_pages(mem_tag_t tag, u32 pages) {
+    if (tag >= MEM_TAG_COUNT) return;
+    
+    spinlock_acquire(&acct_lock);
+    memacct_tag_stats_t *s = &tag_stats[tag];
+    s->pages = (pages > s->pages) ? 0 : s->pages - pages;
+    spinlock_release(&acct_lock);
+}
+
+const char* memacct_tag_name(mem_tag_t tag) {
+    return (tag < MEM_TAG_COUNT) ? tag_names[tag] : "?";
+}
+
+void memacct_get_stats(mem_tag_t tag, memacct_tag_stats_t *out) {
+    if (!out) return;
+    if (tag >= MEM_TAG_COUNT) {
+        out->static_bytes = out->pages = out->peak_pages = out->charges = 0;
+        return;
+    }
+    spinlock_acquire(&acct_lock);
+    *out = tag_stats[tag];
+    spinlock_release(&acct_lock);
+}
+
+void memacct_foreach_region(void (*callback)(const memacct_region_t *region)) {
+    for (u32 i = 0; i < region_count; i++) {
+        callback(&regions[i]);
+    }
+}
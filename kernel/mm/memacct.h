@@ -0,0 +1,48 @@
+#ifndef ICE_MEMACCT_H
+#define ICE_MEMACCT_H
+
+#include "../types.h"
+
+// Owner tags for memory accounting, one per subsystem
+typedef enum {
+    MEM_TAG_MM = 0,     // Allocator metadata, kmalloc, page tables
+    MEM_TAG_FS,
+    MEM_TAG_NET,
+    MEM_TAG_GUI,
+    MEM_TAG_SCHED,
+    MEM_TAG_SCRIPT,
+    MEM_TAG_TTY,
+    MEM_TAG_SHELL,
+    MEM_TAG_COUNT
+} mem_tag_t;
+
+#define MEMACCT_MAX_REGIONS 48
+
+typedef struct {
+    u32 static_bytes;   // Registered static reservations (.bss/.data)
+    u32 pages;          // Dynamic pages currently charged
+    u32 peak_pages;     // High-water mark of pages
+    u32 charges;
+} memacct_tag_stats_t;
+
+typedef struct {
+    const char *name;
+    u32 bytes;
+    mem_tag_t tag;
+} memacct_region_t;
+
+// Record a static buffer. Keyed by name pointer, so calling it again
+// from a re-run init function does not count the region twice.
+void memacct_static(mem_tag_t tag, const char *name, u32 bytes);
+
+// Charge / uncharge dynamically allocated pages to a tag
+void memacct_charge_pages(mem_tag_t tag, u32 pages);
+void memacct_uncharge_pages(mem_tag_t tag, u32 pages);
+
+const char* memacct_tag_name(mem_tag_t tag);
+void memacct_get_stats(mem_tag_t tag, memacct_tag_stats_t *out);
+
+// Walk registered static regions
+void memacct_foreach_region(void (*callback)(const memacct_region_t *region));
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ * ICE Paging - identity-mapped kernel address space
+ *
+ * The kernel directory maps all 4 GiB one-to-one with 4 MiB PSE pages,
+ * so physical addresses stay directly usable everywhere. Page tables
+ * are only created when a 4 KiB mapping is requested inside a large
+ * page, which splits that one entry.
+ */
+
+#include "paging.h"
+#include "pmm.h"
+#include "memacct.h"
+#include "../cpu/cpuid.h"
+#include "../sync/spinlock.h"
+#include "../errno.h"
+#include <string.h>
+
+#define CR0_WP  (1u << 16)
+#define CR0_PG  (1u << 31)
+#define CR4_PSE (1u << 4)
+#define CR4_PGE (1u << 7)
+
+#define PDE_INDEX(v) ((v) >> 22)
+#define PTE_INDEX(v) (((v) >> 12) & 0x3FF)
+
+static u32 kernel_pd[1024] __attribute__((aligned(4096)));
+static bool paging_on = false;
+static spinlock_t paging_lock;
+static paging_stats_t stats;
+
+static inline u32 read_cr0(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(u32 v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline u32 read_cr4(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(u32 v) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline u32 read_cr3(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+// Each CPU has its own CR3, so the loaded directory is read back from it
+static inline u32 current_pd(void) {
+    return read_cr3() & PAGE_FRAME_MASK;
+}
+
+static inline void write_cr3(u32 v) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline void invlpg(u32 addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+bool paging_init(void) {
+    if (paging_on) return true;
+    if (!cpu_has(CPU_FEATURE_PSE)) return false;
+    
+    spinlock_init(&paging_lock);
+    memacct_static(MEM_TAG_MM, "kernel page directory", sizeof(kernel_pd));
+    
+    bool pge = cpu_has(CPU_FEATURE_PGE);
+    u32 ram_pdes = (pmm_get_highest_page() + 1023) / 1024;
+    
+    for (u32 i = 0; i < 1024; i++) {
+        u32 pde = (i << 22) | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE;
+        if (i < ram_pdes) {
+            if (pge) pde |= PAGE_GLOBAL;
+        } else {
+            // Nothing but device memory lives above RAM
+            pde |= PAGE_PCD | PAGE_PWT;
+        }
+        kernel_pd[i] = pde;
+    }
+    
+    write_cr4(read_cr4() | CR4_PSE);
+    write_cr3((u32)kernel_pd);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+    
+    // Global pages are enabled only once paging is on
+    if (pge) write_cr4(read_cr4() | CR4_PGE);
+    
+    paging_on = true;
+    return true;
+}
+
+bool paging_enabled(void) {
+    return paging_on;
+}
+
+u32 paging_kernel_directory(void) {
+    return (u32)kernel_pd;
+}
+
+u32 paging_create_directory(void) {
+    if (!paging_on) return 0;
+    
+    u32 *pd = (u32*)pmm_alloc_page();
+    if (!pd) return 0;
+    memacct_charge_pages(MEM_TAG_MM, 1);
+    
+    spinlock_acquire(&paging_lock);
+    for (int i = 0; i < 1024; i++) {
+        pd[i] = kernel_pd[i];
+    }
+    spinlock_release(&paging_lock);
+    
+    return (u32)pd;
+}
+
+void paging_destroy_directory(u32 pd) {
+    if (!pd || pd == (u32)kernel_pd) return;
+    
+    u32 *dir = (u32*)pd;
+    u32 pages = 1;
+    for (int i = 0; i < 1024; i++) {
+        u32 pde = dir[i];
+        // Tables shared with the kernel directory are not ours to free
+        if ((pde & PAGE_PRESENT) && !(pde & PAGE_LARGE) && pde != kernel_pd[i]) {
+            pmm_free_page(pde & PAGE_FRAME_MASK);
+            pages++;
+        }
+    }
+    
+    if (current_pd() == pd) paging_switch(0);
+    pmm_free_page(pd);
+    memacct_uncharge_pages(MEM_TAG_MM, pages);
+}
+
+void paging_switch(u32 pd) {
+    if (!paging_on) return;
+    if (!pd) pd = (u32)kernel_pd;
+    
+    if (pd == current_pd()) {
+        stats.cr3_skips++;
+        return;
+    }
+    
+    stats.cr3_loads++;
+    write_cr3(pd);
+}
+
+// Page table for virt, splitting a large page or creating an empty
+// table as required. A PAGE_USER mapping opens the whole table to ring
+// 3; its other entries stay closed by their own PTEs. Called with
+// paging_lock held.
+static u32 *get_table(u32 *dir, virt_addr_t virt, u32 flags) {
+    u32 idx = PDE_INDEX(virt);
+    u32 pde = dir[idx];
+    
+    if ((pde & PAGE_PRESENT) && !(pde & PAGE_LARGE)) {
+        // The CPU checks U/S in the PDE as well as the PTE
+        if ((flags & PAGE_USER) && !(pde & PAGE_USER)) {
+            dir[idx] = pde | PAGE_USER;
+            if ((u32)dir == current_pd()) invlpg(virt);
+        }
+        return (u32*)(pde & PAGE_FRAME_MASK);
+    }
+    
+    u32 *table = (u32*)pmm_alloc_zeroed_page();
+    if (!table) return 0;
+    stats.tables++;
+    memacct_charge_pages(MEM_TAG_MM, 1);
+    
+    u32 table_flags = PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+    
+    if (pde & PAGE_PRESENT) {
+        // Replicate the 4 MiB mapping with identical attributes
+        u32 base = pde & PAGE_LARGE_MASK;
+        u32 attr = pde & (PAGE_WRITE | PAGE_USER | PAGE_PWT | PAGE_PCD | PAGE_GLOBAL);
+        if (pde & PAGE_PDE_PAT) attr |= PAGE_PTE_PAT;
+        for (u32 i = 0; i < 1024; i++) {
+            table[i] = (base + i * PAGE_SIZE) | attr | PAGE_PRESENT;
+        }
+        table_flags |= pde & PAGE_USER;
+        stats.splits++;
+    }
+    
+    dir[idx] = (u32)table | table_flags;
+    if ((u32)dir == current_pd()) invlpg(virt & PAGE_LARGE_MASK);
+    return table;
+}
+
+int paging_map_page(u32 pd, virt_addr_t virt, phys_addr_t phys, u32 flags) {
+    if (!paging_on) return E_GENERIC;
+    if (!pd) pd = (u32)kernel_pd;
+    
+    spinlock_acquire(&paging_lock);
+    u32 *table = get_table((u32*)pd, virt, flags);
+    if (!table) {
+        spinlock_release(&paging_lock);
+        return E_NO_MEM;
+    }
+    
+    table[PTE_INDEX(virt)] = (phys & PAGE_FRAME_MASK) | (flags & 0xFFF) | PAGE_PRESENT;
+    if (pd == current_pd()) invlpg(virt);
+    spinlock_release(&paging_lock);
+    return E_OK;
+}
+
+int paging_unmap_page(u32 pd, virt_addr_t virt) {
+    if (!paging_on) return E_GENERIC;
+    if (!pd) pd = (u32)kernel_pd;
+    
+    spinlock_acquire(&paging_lock);
+    u32 *dir = (u32*)pd;
+    if (!(dir[PDE_INDEX(virt)] & PAGE_PRESENT)) {
+        spinlock_release(&paging_lock);
+        return E_OK;
+    }
+    
+    u32 *table = get_table(dir, virt, 0);
+    if (!table) {
+        spinlock_release(&paging_lock);
+        return E_NO_MEM;
+    }
+    
+    table[PTE_INDEX(virt)] = 0;
+    if (pd == current_pd()) invlpg(virt);
+    spinlock_release(&paging_lock);
+    return E_OK;
+}
+
+int paging_set_cache(virt_addr_t virt, u32 size, u32 cache_bits) {
+    if (!paging_on) return E_GENERIC;
+    
+    cache_bits &= PAGE_CACHE_MASK;
+    u64 end = (u64)virt + size;
+    u64 addr = virt & PAGE_FRAME_MASK;
+    
+    spinlock_acquire(&paging_lock);
+    while (addr < end) {
+        u32 v = (u32)addr;
+        u32 *pde = &kernel_pd[PDE_INDEX(v)];
+        
+        if (!(*pde & PAGE_PRESENT)) {
+            addr = (addr & PAGE_LARGE_MASK) + PAGE_LARGE_SIZE;
+            continue;
+        }
+        
+        // A large page only partly inside the range has to be split
+        if ((*pde & PAGE_LARGE) &&
+            ((v & ~PAGE_LARGE_MASK) || addr + PAGE_LARGE_SIZE > end)) {
+            if (!get_table(kernel_pd, v, 0)) {
+                spinlock_release(&paging_lock);
+                return E_NO_MEM;
+            }
+        }
+        
+        if (*pde & PAGE_LARGE) {
+            *pde = (*pde & ~PAGE_CACHE_MASK) | cache_bits;
+            invlpg(v);
+            addr += PAGE_LARGE_SIZE;
+        } else {
+            u32 *pte = &((u32*)(*pde & PAGE_FRAME_MASK))[PTE_INDEX(v)];
+            if (*pte & PAGE_PRESENT) {
+                *pte = (*pte & ~PAGE_CACHE_MASK) | cache_bits;
+                invlpg(v);
+            }
+            addr += PAGE_SIZE;
+        }
+    }
+    spinlock_release(&paging_lock);
+    return E_OK;
+}
+
+void paging_flush_tlb_all(void) {
+    if (!paging_on) return;
+    
+    u32 cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        // Toggling PGE drops global entries as well
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(current_pd());
+    }
+}
+
+// 4 KiB PTE for virt, 0 if virt is unmapped or inside a large page.
+// Called with paging_lock held.
+static u32 *find_pte(u32 *dir, virt_addr_t virt) {
+    u32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) return 0;
+    return &((u32*)(pde & PAGE_FRAME_MASK))[PTE_INDEX(virt)];
+}
+
+int paging_cow_share(u32 src, u32 dst, virt_addr_t start, virt_addr_t end) {
+    if (!paging_on || !src || !dst || src == dst) return E_INVALID_ARG;
+    
+    int shared = 0;
+    spinlock_acquire(&paging_lock);
+    for (u32 va = start & PAGE_FRAME_MASK; va < end; va += PAGE_SIZE) {
+        u32 *spte = find_pte((u32*)src, va);
+        if (!spte || !(*spte & PAGE_PRESENT)) continue;
+        
+        u32 *dtable = get_table((u32*)dst, va, *spte & PAGE_USER);
+        if (!dtable || !pmm_page_ref(*spte & PAGE_FRAME_MASK)) {
+            shared = E_NO_MEM;
+            break;
+        }
+        
+        if (*spte & PAGE_WRITE) *spte = (*spte & ~PAGE_WRITE) | PAGE_COW;
+        dtable[PTE_INDEX(va)] = *spte & ~(PAGE_ACCESSED | PAGE_DIRTY);
+        shared++;
+    }
+    if (shared > 0) stats.cow_shared += shared;
+    
+    // src lost write access to every page it shared
+    if (src == current_pd()) write_cr3(src);
+    spinlock_release(&paging_lock);
+    return shared;
+}
+
+int paging_cow_fault(u32 pd, virt_addr_t virt, bool *copied) {
+    *copied = false;
+    if (!paging_on || !pd) return E_NOT_FOUND;
+    
+    spinlock_acquire(&paging_lock);
+    u32 *pte = find_pte((u32*)pd, virt);
+    // Without U/S in the PDE the write would fault again however the PTE
+    // is fixed up; let the caller kill the process instead
+    if (!pte || !(((u32*)pd)[PDE_INDEX(virt)] & PAGE_USER) ||
+        (*pte & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW)) {
+        spinlock_release(&paging_lock);
+        return E_NOT_FOUND;
+    }
+    
+    phys_addr_t old = *pte & PAGE_FRAME_MASK;
+    u32 flags = (*pte & 0xFFF & ~PAGE_COW) | PAGE_WRITE;
+    
+    // Sharers only ever drop out, so a count of one stays one
+    if (pmm_page_refcount(old) > 1) {
+        phys_addr_t page = pmm_alloc_page();
+        if (!page) {
+            spinlock_release(&paging_lock);
+            return E_NO_MEM;
+        }
+        memcpy((void*)page, (const void*)old, PAGE_SIZE);
+        // The other sharers may have let go meanwhile
+        *copied = !pmm_page_unref(old);
+        old = page;
+        stats.cow_copied++;
+    } else {
+        stats.cow_reused++;
+    }
+    
+    *pte = old | flags;
+    if (pd == current_pd()) invlpg(virt);
+    spinlock_release(&paging_lock);
+    return E_OK;
+}
+
+phys_addr_t paging_get_phys(u32 pd, virt_addr_t virt) {
+    if (!paging_on) return virt;
+    if (!pd) pd = (u32)kernel_pd;
+    
+    u32 pde = ((u32*)pd)[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT)) return 0;
+    if (pde & PAGE_LARGE) {
+        return (pde & PAGE_LARGE_MASK) | (virt & ~PAGE_LARGE_MASK);
+    }
+    
+    u32 pte = ((u32*)(pde & PAGE_FRAME_MASK))[PTE_INDEX(virt)];
+    if (!(pte & PAGE_PRESENT)) return 0;
+    return (pte & PAGE_FRAME_MASK) | (virt & 0xFFF);
+}
+
+void paging_get_stats(paging_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,85 @@
+#ifndef ICE_PAGING_H
+#define ICE_PAGING_H
+
+#include "../types.h"
+
+// Page directory / table entry bits
+#define PAGE_PRESENT   0x001
+#define PAGE_WRITE     0x002
+#define PAGE_USER      0x004
+#define PAGE_PWT       0x008
+#define PAGE_PCD       0x010
+#define PAGE_ACCESSED  0x020
+#define PAGE_DIRTY     0x040
+#define PAGE_LARGE     0x080    // PDE only: 4 MiB page (PSE)
+#define PAGE_PTE_PAT   0x080    // PTE only: PAT index bit 2
+#define PAGE_GLOBAL    0x100
+#define PAGE_COW       0x200    // PTE only, software: read-only until copied
+#define PAGE_PDE_PAT   0x1000   // 4 MiB PDE only: PAT index bit 2
+
+#define PAGE_LARGE_SIZE 0x400000
+#define PAGE_FRAME_MASK 0xFFFFF000
+#define PAGE_LARGE_MASK 0xFFC00000
+
+typedef struct {
+    u32 cr3_loads;       // Address space changes
+    u32 cr3_skips;       // Switches that kept the current CR3
+    u32 splits;          // 4 MiB mappings split into page tables
+    u32 tables;          // Page tables allocated
+    u32 cow_shared;      // Pages mapped copy-on-write by paging_cow_share
+    u32 cow_copied;      // Write faults that copied a shared page
+    u32 cow_reused;      // Write faults on the last sharer, no copy needed
+} paging_stats_t;
+
+// Identity-map all 4 GiB with 4 MiB pages and turn paging on. RAM is
+// cached and global, everything above RAM is uncached for MMIO.
+// Returns false (and leaves paging off) when the CPU lacks PSE.
+bool paging_init(void);
+
+bool paging_enabled(void);
+
+// Physical address of the shared kernel page directory
+u32 paging_kernel_directory(void);
+
+// New page directory holding a copy of the kernel mappings. Kernel
+// mappings changed after this point are not propagated, so MMIO and
+// other kernel-wide mappings should be set up at boot.
+u32 paging_create_directory(void);
+
+// Free a directory from paging_create_directory and its private tables
+void paging_destroy_directory(u32 pd);
+
+// Load CR3 only if pd differs from the active directory (0 = kernel)
+void paging_switch(u32 pd);
+
+// Map one 4 KiB page, splitting a covering 4 MiB mapping if needed
+int paging_map_page(u32 pd, virt_addr_t virt, phys_addr_t phys, u32 flags);
+
+int paging_unmap_page(u32 pd, virt_addr_t virt);
+
+// Cache-control bits of every kernel mapping in [virt, virt + size)
+#define PAGE_CACHE_MASK (PAGE_PWT | PAGE_PCD)
+int paging_set_cache(virt_addr_t virt, u32 size, u32 cache_bits);
+
+// Flush every TLB entry, global ones included
+void paging_flush_tlb_all(void);
+
+// Share the 4 KiB pages of src in [start, end) with dst. Writable pages
+// become read-only + PAGE_COW in both, so whichever side writes first
+// gets its own copy. Returns the number of pages shared or an error;
+// dst keeps whatever was mapped before a failure.
+int paging_cow_share(u32 src, u32 dst, virt_addr_t start, virt_addr_t end);
+
+// Resolve a write fault on a PAGE_COW page of pd: copy the frame, or
+// take it over if no one else maps it any more. *copied is set when the
+// fault left one more frame in use.
+// E_NOT_FOUND if virt is not a copy-on-write page, or ring 3 cannot
+// reach it through the page directory.
+int paging_cow_fault(u32 pd, virt_addr_t virt, bool *copied);
+
+// Physical address behind virt, or 0 if unmapped
+phys_addr_t paging_get_phys(u32 pd, virt_addr_t virt);
+
+void paging_get_stats(paging_stats_t *stats);
+
+#endif
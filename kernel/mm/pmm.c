@@ -3,9 +3,14 @@
 #include "pmm.h"
 #include "../drivers/vga.h"
 #include "../sync/spinlock.h"
+#include "../lib/string.h"
+#include "shrinker.h"
+#include "memacct.h"
 
 static spinlock_t pmm_lock;
 
+extern u8 kernel_end[];
+
 
  
 typedef struct {
@@ -34,11 +39,35 @@ typedef struct __attribute__((packed)) {
 #define MBOOT_FLAG_MEM      (1 << 0)
 
  
-#define MAX_PAGES (256 * 1024)   
+#define MAX_PAGES (1024 * 1024)   // 4 GiB, everything a 32-bit multiboot map can describe
 static u8 page_bitmap[MAX_PAGES / 8];
 
+// Extra references of frames shared copy-on-write, one byte per frame
+// below highest_page; 0 means a single owner. Carved out of RAM at init
+// so small machines do not pay for 4 GiB worth of counters.
+static u8 *page_refs = 0;
+#define PAGE_REFS_MAX 0xFF
+
 static u32 total_pages = 0;
-static u32 used_pages = 0;
+static u32 free_pages = 0;
+static u32 highest_page = 0;
+
+// Below low_watermark free pages the shrinkers are asked to bring free
+// memory back up to high_watermark
+static u32 low_watermark = 0;
+static u32 high_watermark = 0;
+
+// Pre-zeroed pages, refilled from the idle loop once the pool drops
+// below the low watermark and topped up to the high one. Pool pages are
+// allocated as far as the buddy index is concerned but still count as
+// free memory and are handed back through a shrinker.
+static phys_addr_t zero_pool[PMM_ZERO_POOL_HIGH];
+static u32 zero_pool_count = 0;
+static bool zero_pool_refilling = false;
+static bool zero_pool_ready = false;
+static u32 zero_hits = 0;
+static u32 zero_misses = 0;
+static u32 zero_refilled = 0;
 
  
 static inline void bitmap_set(u32 page) {
@@ -53,44 +82,215 @@ static inline bool bitmap_test(u32 page) {
     return page_bitmap[page / 8] & (1 << (page % 8));
 }
 
+// Per-order free index. Bit n of level 0 is set when block n of that
+// order (pages n << order ..) is a free buddy block. Every level above
+// holds one bit per non-zero word of the level below, up to a single
+// top word, so finding the lowest free block is one bsf per level and
+// free pages themselves are never touched.
+#define INDEX_LEVELS 4
+#define INDEX_POOL_WORDS (MAX_PAGES / 16 + MAX_PAGES / 256 + 4 * (PMM_MAX_ORDER + 1))
+
+typedef struct {
+    u32 *level[INDEX_LEVELS];
+    u32 depth;
+    u32 count;
+} free_index_t;
+
+static u32 index_pool[INDEX_POOL_WORDS];
+static free_index_t free_index[PMM_MAX_ORDER + 1];
+
+static void index_setup(void) {
+    u32 used = 0;
+    for (u32 order = 0; order <= PMM_MAX_ORDER; order++) {
+        free_index_t *ix = &free_index[order];
+        u32 bits = MAX_PAGES >> order;
+        ix->depth = 0;
+        ix->count = 0;
+        for (;;) {
+            u32 words = (bits + 31) / 32;
+            ix->level[ix->depth++] = &index_pool[used];
+            used += words;
+            if (words == 1) break;
+            bits = words;
+        }
+    }
+    for (u32 i = 0; i < used; i++) {
+        index_pool[i] = 0;
+    }
+}
+
+static inline bool index_test(u32 order, u32 n) {
+    return free_index[order].level[0][n / 32] & (1u << (n % 32));
+}
+
+static void index_set(u32 order, u32 n) {
+    free_index_t *ix = &free_index[order];
+    ix->count++;
+    for (u32 l = 0; l < ix->depth; l++) {
+        u32 was = ix->level[l][n / 32];
+        ix->level[l][n / 32] = was | (1u << (n % 32));
+        if (was) break;
+        n /= 32;
+    }
+}
+
+static void index_clear(u32 order, u32 n) {
+    free_index_t *ix = &free_index[order];
+    ix->count--;
+    for (u32 l = 0; l < ix->depth; l++) {
+        ix->level[l][n / 32] &= ~(1u << (n % 32));
+        if (ix->level[l][n / 32]) break;
+        n /= 32;
+    }
+}
+
+// Lowest free block of this order; caller checks count first
+static u32 index_first(u32 order) {
+    free_index_t *ix = &free_index[order];
+    u32 n = 0;
+    for (int l = (int)ix->depth - 1; l >= 0; l--) {
+        n = n * 32 + (u32)__builtin_ctz(ix->level[l][n]);
+    }
+    return n;
+}
+
+static inline void buddy_insert(u32 page, u32 order) {
+    index_set(order, page >> order);
+}
+
+static inline void buddy_remove(u32 page, u32 order) {
+    index_clear(order, page >> order);
+}
+
+// A buddy can only be merged if it is the head of a free block of the
+// same order; interior pages of larger free blocks never reach this test.
+static inline bool buddy_is_free(u32 page, u32 order) {
+    return page + (1u << order) <= MAX_PAGES && index_test(order, page >> order);
+}
+
+// Build the index from the bitmap, splitting each free run into the
+// largest naturally aligned blocks that fit
+static void buddy_seed(void) {
+    u32 page = 0;
+    while (page < MAX_PAGES) {
+        if (page_bitmap[page / 8] == 0xFF && (page % 8) == 0) {
+            page += 8;
+            continue;
+        }
+        if (bitmap_test(page)) {
+            page++;
+            continue;
+        }
+        
+        u32 end = page;
+        while (end < MAX_PAGES && !bitmap_test(end)) end++;
+        
+        while (page < end) {
+            u32 order = PMM_MAX_ORDER;
+            while ((page & ((1u << order) - 1)) || page + (1u << order) > end) {
+                order--;
+            }
+            buddy_insert(page, order);
+            page += 1u << order;
+        }
+    }
+}
+
  
 static void mark_range_used(phys_addr_t start, u32 size) {
     u32 start_page = start / PAGE_SIZE;
-    u32 end_page = (start + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    u32 end_page = (u32)(((u64)start + size + PAGE_SIZE - 1) >> 12);
     
     for (u32 p = start_page; p < end_page && p < MAX_PAGES; p++) {
         if (!bitmap_test(p)) {
             bitmap_set(p);
-            used_pages++;
+            free_pages--;
         }
     }
 }
 
  
-static void mark_range_free(phys_addr_t start, u32 size) {
-    u32 start_page = start / PAGE_SIZE;
-    u32 end_page = (start + size) / PAGE_SIZE;
-    
+static void mark_pages_free(u32 start_page, u32 end_page) {
+    if (end_page > MAX_PAGES) end_page = MAX_PAGES;
+    if (end_page > highest_page) highest_page = end_page;
     for (u32 p = start_page; p < end_page && p < MAX_PAGES; p++) {
         if (bitmap_test(p)) {
             bitmap_clear(p);
-            used_pages--;
+            free_pages++;
+            total_pages++;
         }
-        total_pages++;
     }
 }
 
+static u32 alloc_locked(u32 order) {
+    // Smallest non-empty order at or above the requested one
+    u32 k = order;
+    while (k <= PMM_MAX_ORDER && !free_index[k].count) k++;
+    if (k > PMM_MAX_ORDER) return 0;
+    
+    u32 page = index_first(k) << k;
+    buddy_remove(page, k);
+    
+    // Split down, returning the upper halves to the index
+    while (k > order) {
+        k--;
+        buddy_insert(page + (1u << k), k);
+    }
+    
+    for (u32 p = page; p < page + (1u << order); p++) {
+        bitmap_set(p);
+    }
+    free_pages -= 1u << order;
+    return page * PAGE_SIZE;
+}
+
+static void free_locked(u32 page, u32 order) {
+    for (u32 p = page; p < page + (1u << order); p++) {
+        bitmap_clear(p);
+        if (page_refs && p < highest_page) page_refs[p] = 0;
+    }
+    free_pages += 1u << order;
+    
+    // Coalesce with free buddies as far up as possible
+    while (order < PMM_MAX_ORDER) {
+        u32 buddy = page ^ (1u << order);
+        if (!buddy_is_free(buddy, order)) break;
+        buddy_remove(buddy, order);
+        page &= ~(1u << order);
+        order++;
+    }
+    buddy_insert(page, order);
+}
+
+static u32 zero_pool_count_fn(void) {
+    return zero_pool_count;
+}
+
+static u32 zero_pool_scan_fn(u32 nr_pages) {
+    u32 freed = 0;
+    spinlock_acquire(&pmm_lock);
+    while (freed < nr_pages && zero_pool_count) {
+        free_locked(zero_pool[--zero_pool_count] / PAGE_SIZE, 0);
+        freed++;
+    }
+    zero_pool_refilling = false;
+    spinlock_release(&pmm_lock);
+    return freed;
+}
+
 void pmm_init(void *mboot_info) {
     multiboot_info_t *mbi = (multiboot_info_t*)mboot_info;
     
     spinlock_init(&pmm_lock);
+    index_setup();
     
     // Initialize bitmap
     for (u32 i = 0; i < sizeof(page_bitmap); i++) {
         page_bitmap[i] = 0xFF;
     }
-    used_pages = MAX_PAGES;
+    free_pages = 0;
     total_pages = 0;
+    highest_page = 0;
     
      
     if (mbi->flags & MBOOT_FLAG_MMAP) {
@@ -98,88 +298,277 @@ void pmm_init(void *mboot_info) {
         u32 end = mbi->mmap_addr + mbi->mmap_length;
         
         while ((u32)entry < end) {
-            if (entry->type == MMAP_TYPE_AVAILABLE) {
-                u32 addr = (u32)entry->addr;
-                u32 len = (u32)entry->len;
-                mark_range_free(addr, len);
+            if (entry->type == MMAP_TYPE_AVAILABLE && entry->addr < 0x100000000ULL) {
+                // Whole pages only, clipped to the 4 GiB we can address
+                u64 first = (entry->addr + PAGE_SIZE - 1) >> 12;
+                u64 last = (entry->addr + entry->len) >> 12;
+                if (last > MAX_PAGES) last = MAX_PAGES;
+                if (last > first) {
+                    mark_pages_free((u32)first, (u32)last);
+                }
             }
             entry = (mboot_mmap_entry_t*)((u32)entry + entry->size + 4);
         }
     } else if (mbi->flags & MBOOT_FLAG_MEM) {
          
         u32 upper_kb = mbi->mem_upper;
-        mark_range_free(0x100000, upper_kb * 1024);
+        mark_pages_free(0x100000 / PAGE_SIZE, 0x100000 / PAGE_SIZE + upper_kb / 4);
     }
     
      
     mark_range_used(0, 0x100000);
     
      
-    mark_range_used(0x100000, 0x100000);
+    mark_range_used(0x100000, (u32)kernel_end - 0x100000);
+    
+    buddy_seed();
+    
+    page_refs = (u8*)alloc_locked(pmm_size_to_order(highest_page));
+    if (page_refs) {
+        memset(page_refs, 0, highest_page);
+        memacct_static(MEM_TAG_MM, "pmm page refcounts", highest_page);
+    }
+    
+    // Keep roughly 1/64 of memory in reserve, within sane bounds
+    low_watermark = free_pages / 64;
+    if (low_watermark < 64) low_watermark = 64;
+    if (low_watermark > 4096) low_watermark = 4096;
+    high_watermark = low_watermark * 2;
+    
+    zero_pool_count = 0;
+    zero_pool_refilling = true;
+    if (!zero_pool_ready) {
+        register_shrinker(zero_pool_count_fn, zero_pool_scan_fn);
+    }
+    memacct_static(MEM_TAG_MM, "pmm page bitmap", sizeof(page_bitmap));
+    memacct_static(MEM_TAG_MM, "pmm free index", sizeof(index_pool) + sizeof(free_index));
+    memacct_static(MEM_TAG_MM, "pmm zero pool", sizeof(zero_pool));
+    zero_pool_ready = true;
 }
 
-static u32 last_alloc_index = 256;
-
-phys_addr_t pmm_alloc_page(void) {
+phys_addr_t pmm_alloc_pages(u32 order) {
+    if (order > PMM_MAX_ORDER) return 0;
+    
     spinlock_acquire(&pmm_lock);
+    phys_addr_t addr = alloc_locked(order);
+    u32 free_now = free_pages;
+    spinlock_release(&pmm_lock);
     
-    u32 start_index = last_alloc_index;
-    u32 i = start_index;
-    
-    // Quick check: if last_alloc_index is free (shouldn't happen often if we update it), take it
-    // Otherwise scan
-    
-    // Optimized search: 32 bits at a time
-    // We need to handle the case where i is not 32-bit aligned, but for simplicity
-    // let's just do linear search if we are in the middle of a word, or just align 'i'.
-    // Since we want to be fast, let's try to align 'i' first.
-    
-    // Scan loop
-    do {
-        // optimize: check 32 bits at once if aligned
-        if ((i & 31) == 0 && i + 32 < MAX_PAGES) {
-            u32 *ptr = (u32*)&page_bitmap[i / 8];
-            if (*ptr == 0xFFFFFFFF) {
-                i += 32;
-                if (i >= MAX_PAGES) i = 256; // wrap around
-                continue;
-            }
-        }
-        
-        if (!bitmap_test(i)) {
-            // Found free page
-            bitmap_set(i);
-            used_pages++;
-            last_alloc_index = i + 1;
-            if (last_alloc_index >= MAX_PAGES) last_alloc_index = 256;
-            
-            spinlock_release(&pmm_lock);
-            return i * PAGE_SIZE;
-        }
-        
-        i++;
-        if (i >= MAX_PAGES) i = 256; // wrap around
-        
-    } while (i != start_index);
+    // Shrinkers run without pmm_lock since they free pages themselves
+    if (!addr) {
+        u32 want = 1u << order;
+        if (free_now < high_watermark) want += high_watermark - free_now;
+        shrink_memory(want);
+        spinlock_acquire(&pmm_lock);
+        addr = alloc_locked(order);
+        spinlock_release(&pmm_lock);
+    } else if (free_now < low_watermark) {
+        shrink_memory(high_watermark - free_now);
+    }
+    
+    return addr;
+}
 
+void pmm_free_pages(phys_addr_t addr, u32 order) {
+    u32 page = addr / PAGE_SIZE;
+    
+    if (order > PMM_MAX_ORDER || (page & ((1u << order) - 1))) return;
+    if (page + (1u << order) > MAX_PAGES) return;
+    
+    spinlock_acquire(&pmm_lock);
+    
+    // Refuse double frees; the bitmap is authoritative
+    if (bitmap_test(page)) {
+        free_locked(page, order);
+    }
+    
     spinlock_release(&pmm_lock);
-    return 0;   
+}
+
+phys_addr_t pmm_alloc_page(void) {
+    return pmm_alloc_pages(0);
 }
 
 void pmm_free_page(phys_addr_t addr) {
+    pmm_free_pages(addr, 0);
+}
+
+bool pmm_page_ref(phys_addr_t addr) {
+    u32 page = addr / PAGE_SIZE;
+    if (!page_refs || page >= highest_page) return false;
+    
     spinlock_acquire(&pmm_lock);
+    bool ok = bitmap_test(page) && page_refs[page] < PAGE_REFS_MAX;
+    if (ok) page_refs[page]++;
+    spinlock_release(&pmm_lock);
+    return ok;
+}
+
+bool pmm_page_unref(phys_addr_t addr) {
     u32 page = addr / PAGE_SIZE;
-    if (page < MAX_PAGES && bitmap_test(page)) {
-        bitmap_clear(page);
-        used_pages--;
+    if (page >= MAX_PAGES) return false;
+    
+    spinlock_acquire(&pmm_lock);
+    bool freed = false;
+    if (page_refs && page < highest_page && page_refs[page]) {
+        page_refs[page]--;
+    } else if (bitmap_test(page)) {
+        free_locked(page, 0);
+        freed = true;
     }
     spinlock_release(&pmm_lock);
+    return freed;
+}
+
+u32 pmm_page_refcount(phys_addr_t addr) {
+    u32 page = addr / PAGE_SIZE;
+    if (page >= MAX_PAGES || !bitmap_test(page)) return 0;
+    if (!page_refs || page >= highest_page) return 1;
+    return 1 + page_refs[page];
+}
+
+u32 pmm_size_to_order(u32 size) {
+    u32 order = 0;
+    while (order < PMM_MAX_ORDER && ((u32)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
 }
 
 u32 pmm_get_total_memory(void) {
     return total_pages * PAGE_SIZE;
 }
 
+void pmm_get_watermarks(u32 *low, u32 *high) {
+    *low = low_watermark;
+    *high = high_watermark;
+}
+
+u32 pmm_get_highest_page(void) {
+    return highest_page;
+}
+
 u32 pmm_get_free_memory(void) {
-    return (total_pages > used_pages) ? (total_pages - used_pages) * PAGE_SIZE : 0;
+    return (free_pages + zero_pool_count) * PAGE_SIZE;
+}
+
+phys_addr_t pmm_alloc_zeroed_page(void) {
+    spinlock_acquire(&pmm_lock);
+    if (zero_pool_count) {
+        phys_addr_t page = zero_pool[--zero_pool_count];
+        zero_hits++;
+        if (zero_pool_count < PMM_ZERO_POOL_LOW) {
+            zero_pool_refilling = true;
+        }
+        spinlock_release(&pmm_lock);
+        return page;
+    }
+    zero_misses++;
+    zero_pool_refilling = true;
+    spinlock_release(&pmm_lock);
+    
+    phys_addr_t page = pmm_alloc_page();
+    if (page) {
+        memset((void*)page, 0, PAGE_SIZE);
+    }
+    return page;
+}
+
+void pmm_zero_pool_refill(void) {
+    if (!zero_pool_ready || !zero_pool_refilling) return;
+    
+    for (u32 i = 0; i < PMM_ZERO_POOL_BATCH; i++) {
+        // Never push free memory toward the reclaim watermark
+        if (free_pages <= high_watermark + PMM_ZERO_POOL_HIGH) {
+            zero_pool_refilling = false;
+            return;
+        }
+        
+        phys_addr_t page = pmm_alloc_page();
+        if (!page) return;
+        
+        // Zeroed with the lock dropped so interrupts stay serviceable
+        memset((void*)page, 0, PAGE_SIZE);
+        
+        spinlock_acquire(&pmm_lock);
+        if (zero_pool_count < PMM_ZERO_POOL_HIGH) {
+            zero_pool[zero_pool_count++] = page;
+            zero_refilled++;
+            page = 0;
+        }
+        if (zero_pool_count >= PMM_ZERO_POOL_HIGH) {
+            zero_pool_refilling = false;
+        }
+        bool done = !zero_pool_refilling;
+        spinlock_release(&pmm_lock);
+        
+        if (page) pmm_free_page(page);
+        if (done) return;
+    }
+}
+
+void pmm_zero_pool_stats(pmm_zero_stats_t *stats) {
+    spinlock_acquire(&pmm_lock);
+    stats->pooled = zero_pool_count;
+    stats->low = PMM_ZERO_POOL_LOW;
+    stats->high = PMM_ZERO_POOL_HIGH;
+    stats->hits = zero_hits;
+    stats->misses = zero_misses;
+    stats->refilled = zero_refilled;
+    spinlock_release(&pmm_lock);
+}
+
+static inline u64 rdtsc(void) {
+    u32 lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+// Allocate every free frame one at a time, then free them all again,
+// recording the slowest single call of each. The allocated frames are
+// chained through their first word so no extra memory is needed.
+bool pmm_self_test(void) {
+    u32 before_free = free_pages;
+    u32 before_blocks[PMM_MAX_ORDER + 1];
+    for (u32 k = 0; k <= PMM_MAX_ORDER; k++) {
+        before_blocks[k] = free_index[k].count;
+    }
+    
+    u32 count = 0;
+    u32 worst_alloc = 0;
+    u32 worst_free = 0;
+    phys_addr_t head = 0;
+    
+    for (;;) {
+        u64 t0 = rdtsc();
+        phys_addr_t page = pmm_alloc_page();
+        u32 dt = (u32)(rdtsc() - t0);
+        if (!page) break;
+        if (dt > worst_alloc) worst_alloc = dt;
+        
+        *(phys_addr_t*)page = head;
+        head = page;
+        count++;
+    }
+    
+    bool ok = (count == before_free && free_pages == 0);
+    
+    while (head) {
+        phys_addr_t next = *(phys_addr_t*)head;
+        u64 t0 = rdtsc();
+        pmm_free_page(head);
+        u32 dt = (u32)(rdtsc() - t0);
+        if (dt > worst_free) worst_free = dt;
+        head = next;
+    }
+    
+    // Full coalescing must give back exactly the boot-time layout
+    if (free_pages != before_free) ok = false;
+    for (u32 k = 0; k <= PMM_MAX_ORDER; k++) {
+        if (free_index[k].count != before_blocks[k]) ok = false;
+    }
+    
+    vga_printf("%u frames, worst alloc %u cycles, worst free %u cycles ",
+               count, worst_alloc, worst_free);
+    return ok;
 }
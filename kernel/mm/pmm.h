@@ -1,5 +1,3 @@
- 
-
 #ifndef ICE_PMM_H
 #define ICE_PMM_H
 
@@ -8,6 +6,23 @@
  
 #define PAGE_SIZE 4096
 
+// Largest buddy block is 2^PMM_MAX_ORDER pages (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// Pre-zeroed page pool watermarks (pages) and pages zeroed per idle call
+#define PMM_ZERO_POOL_LOW   16
+#define PMM_ZERO_POOL_HIGH  64
+#define PMM_ZERO_POOL_BATCH 4
+
+typedef struct {
+    u32 pooled;
+    u32 low;
+    u32 high;
+    u32 hits;
+    u32 misses;
+    u32 refilled;
+} pmm_zero_stats_t;
+
  
 void pmm_init(void *mboot_info);
 
@@ -17,8 +32,49 @@ phys_addr_t pmm_alloc_page(void);
  
 void pmm_free_page(phys_addr_t addr);
 
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Returns 0 when no block of that order can be found.
+phys_addr_t pmm_alloc_pages(u32 order);
+
+// Free a block returned by pmm_alloc_pages. The order must match.
+void pmm_free_pages(phys_addr_t addr, u32 order);
+
+// Frames shared between address spaces. An allocated frame has one
+// reference; pmm_page_ref adds one (false if the count is saturated or
+// sharing is unavailable) and pmm_page_unref drops one, freeing the
+// frame with the last and returning true then.
+bool pmm_page_ref(phys_addr_t addr);
+bool pmm_page_unref(phys_addr_t addr);
+
+// References to an allocated frame, 0 if it is free
+u32 pmm_page_refcount(phys_addr_t addr);
+
+// Smallest order whose block holds at least size bytes
+u32 pmm_size_to_order(u32 size);
+
  
 u32 pmm_get_total_memory(void);
 u32 pmm_get_free_memory(void);
 
+// Free-page thresholds (in pages) that drive the shrinkers
+void pmm_get_watermarks(u32 *low, u32 *high);
+
+// One past the highest usable RAM frame reported by the bootloader
+u32 pmm_get_highest_page(void);
+
+// Allocate a page that is guaranteed to be zero filled. Served from the
+// pre-zeroed pool when possible, otherwise zeroed inline.
+phys_addr_t pmm_alloc_zeroed_page(void);
+
+// Idle hook: zero a few pages into the pool if it is below its low
+// watermark. Call with interrupts enabled right before hlt.
+void pmm_zero_pool_refill(void);
+
+void pmm_zero_pool_stats(pmm_zero_stats_t *stats);
+
+// Boot self-test: allocate and free every frame, print the worst-case
+// latency of each operation. Returns false if the allocator state does
+// not come back exactly as it was.
+bool pmm_self_test(void);
+
 #endif  
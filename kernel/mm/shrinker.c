@@ -0,0 +1,74 @@
+/*
+ * ICE memory-pressure shrinkers
+ *
+ * Caches register a count/scan pair; pmm calls shrink_memory() when
+ * free memory drops below its low watermark or an allocation fails.
+ */
+
+#include "shrinker.h"
+
+static shrinker_t shrinkers[MAX_SHRINKERS];
+static volatile bool shrinking = false;
+static u32 shrink_runs = 0;
+static u32 shrink_freed = 0;
+
+int register_shrinker(shrinker_count_t count, shrinker_scan_t scan) {
+    if (!count || !scan) return -1;
+    
+    for (int i = 0; i < MAX_SHRINKERS; i++) {
+        if (!shrinkers[i].used) {
+            shrinkers[i].count = count;
+            shrinkers[i].scan = scan;
+            shrinkers[i].calls = 0;
+            shrinkers[i].freed = 0;
+            shrinkers[i].used = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void unregister_shrinker(int id) {
+    if (id >= 0 && id < MAX_SHRINKERS) {
+        shrinkers[id].used = false;
+    }
+}
+
+u32 shrink_memory(u32 nr_pages) {
+    // Freeing pages re-enters pmm; never recurse into the shrinkers.
+    // Also keeps other CPUs out, so the counters below need no lock.
+    if (nr_pages == 0) return 0;
+    if (__atomic_exchange_n(&shrinking, true, __ATOMIC_ACQUIRE)) return 0;
+    
+    u32 freed = 0;
+    bool ran = false;
+    for (int i = 0; i < MAX_SHRINKERS && freed < nr_pages; i++) {
+        shrinker_t *s = &shrinkers[i];
+        if (!s->used) continue;
+        
+        u32 avail = s->count();
+        if (avail == 0) continue;
+        
+        u32 want = nr_pages - freed;
+        if (want > avail) want = avail;
+        
+        u32 got = s->scan(want);
+        s->calls++;
+        s->freed += got;
+        freed += got;
+        ran = true;
+    }
+    
+    if (ran) {
+        shrink_runs++;
+        shrink_freed += freed;
+    }
+    
+    __atomic_store_n(&shrinking, false, __ATOMIC_RELEASE);
+    return freed;
+}
+
+void shrinker_get_stats(u32 *runs, u32 *freed) {
+    *runs = shrink_runs;
+    *freed = shrink_freed;
+}
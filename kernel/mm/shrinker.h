@@ -0,0 +1,35 @@
+#ifndef ICE_SHRINKER_H
+#define ICE_SHRINKER_H
+
+#include "../types.h"
+
+#define MAX_SHRINKERS 16
+
+// Pages the cache could give back right now
+typedef u32 (*shrinker_count_t)(void);
+
+// Free up to nr_pages pages, return how many were freed. Called from
+// allocation paths, so it must not allocate and must only try-lock:
+// the caller may already hold the cache's own lock.
+typedef u32 (*shrinker_scan_t)(u32 nr_pages);
+
+typedef struct {
+    shrinker_count_t count;
+    shrinker_scan_t scan;
+    u32 calls;
+    u32 freed;
+    bool used;
+} shrinker_t;
+
+// Returns a handle for unregister_shrinker, or -1 when the table is full.
+// Shrinkers are asked in registration order, so cheap caches go first.
+int register_shrinker(shrinker_count_t count, shrinker_scan_t scan);
+void unregister_shrinker(int id);
+
+// Ask registered caches to give back up to nr_pages pages
+u32 shrink_memory(u32 nr_pages);
+
+// Total reclaim passes and pages returned so far
+void shrinker_get_stats(u32 *runs, u32 *freed);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * ICE Kernel Heap - slab object caches and kmalloc
+ *
+ * Each slab is one naturally aligned buddy block from pmm with its
+ * header at the start, so the owning slab of an object is found by
+ * masking the object address. kmalloc size classes always use
+ * single-page slabs which lets kfree locate them without a cache
+ * pointer; requests above KMALLOC_MAX_CLASS get whole pages.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "shrinker.h"
+#include "../lib/string.h"
+
+#define SLAB_MAGIC  0x51AB0BEC
+#define LARGE_MAGIC 0x1A26EB10
+
+// Custom caches grow their slabs until at least this many objects fit
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_MAX_ORDER   3
+
+typedef struct slab {
+    u32 magic;
+    kmem_cache_t *cache;
+    struct slab *next;
+    struct slab *prev;
+    void *free_list;
+    u32 inuse;
+} slab_t;
+
+typedef struct {
+    u32 magic;
+    u32 order;
+    u32 size;
+    u32 reserved;
+} large_hdr_t;
+
+// First object sits after the header, 16-byte aligned
+#define SLAB_HDR_SIZE ((sizeof(slab_t) + 15) & ~15u)
+
+#define KMALLOC_CLASSES 7
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+static spinlock_t caches_lock;
+static u32 large_pages = 0;      // Updated atomically: no lock covers it
+static bool kmem_ready = false;
+
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+
+
+static inline u32 slab_bytes(kmem_cache_t *cache) {
+    return (u32)PAGE_SIZE << cache->slab_order;
+}
+
+static inline slab_t *slab_of(kmem_cache_t *cache, void *obj) {
+    return (slab_t*)((u32)obj & ~(slab_bytes(cache) - 1));
+}
+
+static void slab_list_add(slab_t **head, slab_t *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_del(slab_t **head, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = 0;
+}
+
+static slab_t *slab_create(kmem_cache_t *cache) {
+    slab_t *slab = (slab_t*)pmm_alloc_pages(cache->slab_order);
+    if (!slab) return 0;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->next = slab->prev = 0;
+    slab->inuse = 0;
+    slab->free_list = 0;
+
+    // Thread the free list through the objects, lowest address first
+    u8 *base = (u8*)slab + SLAB_HDR_SIZE;
+    for (int i = (int)cache->objects_per_slab - 1; i >= 0; i--) {
+        void **obj = (void**)(base + i * cache->object_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    cache->slab_count++;
+    cache->total_objects += cache->objects_per_slab;
+    memacct_charge_pages(cache->tag, 1u << cache->slab_order);
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
+    slab->magic = 0;
+    cache->slab_count--;
+    cache->total_objects -= cache->objects_per_slab;
+    memacct_uncharge_pages(cache->tag, 1u << cache->slab_order);
+    pmm_free_pages((phys_addr_t)slab, cache->slab_order);
+}
+
+static kmem_cache_t *cache_setup(const char *name, u32 size, bool single_page) {
+    spinlock_acquire(&caches_lock);
+    kmem_cache_t *cache = 0;
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (!caches[i].valid) {
+            cache = &caches[i];
+            break;
+        }
+    }
+    if (!cache) {
+        spinlock_release(&caches_lock);
+        return 0;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->valid = true;
+    cache->tag = MEM_TAG_MM;
+    spinlock_release(&caches_lock);
+
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    cache->name[KMEM_NAME_LEN - 1] = '\0';
+
+    // Room for the free-list link, 16-byte alignment for anything larger
+    if (size < sizeof(void*)) size = sizeof(void*);
+    size = (size >= 16) ? ((size + 15) & ~15u) : ((size + 7) & ~7u);
+    cache->object_size = size;
+
+    cache->slab_order = 0;
+    for (;;) {
+        cache->objects_per_slab = (slab_bytes(cache) - SLAB_HDR_SIZE) / size;
+        if (single_page || cache->slab_order == SLAB_MAX_ORDER ||
+            cache->objects_per_slab >= SLAB_MIN_OBJECTS) {
+            break;
+        }
+        cache->slab_order++;
+    }
+
+    spinlock_init_named(&cache->lock, cache->name);
+
+    if (cache->objects_per_slab == 0) {
+        cache->valid = false;
+        return 0;
+    }
+    return cache;
+}
+
+// Memory pressure: hand back the empty slab each cache keeps in reserve
+static u32 slab_shrink_count(void) {
+    u32 pages = 0;
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (caches[i].valid && caches[i].empty) {
+            pages += 1u << caches[i].slab_order;
+        }
+    }
+    return pages;
+}
+
+static u32 slab_shrink_scan(u32 nr_pages) {
+    u32 pages = 0;
+    for (int i = 0; i < KMEM_MAX_CACHES && pages < nr_pages; i++) {
+        kmem_cache_t *cache = &caches[i];
+        if (!cache->valid || !cache->empty) continue;
+
+        // The allocation that triggered reclaim may hold this lock
+        if (!spinlock_try_acquire(&cache->lock)) continue;
+        while (cache->empty) {
+            slab_t *slab = cache->empty;
+            slab_list_del(&cache->empty, slab);
+            slab_destroy(cache, slab);
+            pages += 1u << cache->slab_order;
+        }
+        spinlock_release(&cache->lock);
+    }
+    return pages;
+}
+
+void kmem_init(void) {
+    if (kmem_ready) return;
+
+    spinlock_init(&caches_lock);
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        caches[i].valid = false;
+    }
+
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = cache_setup(kmalloc_names[i], KMALLOC_MIN_CLASS << i, true);
+    }
+
+    large_pages = 0;
+    memacct_static(MEM_TAG_MM, "slab caches", sizeof(caches));
+    register_shrinker(slab_shrink_count, slab_shrink_scan);
+    kmem_ready = true;
+}
+
+kmem_cache_t* kmem_cache_create(const char *name, u32 size) {
+    if (!kmem_ready) kmem_init();
+    if (size == 0 || size > ((u32)PAGE_SIZE << SLAB_MAX_ORDER) - SLAB_HDR_SIZE) {
+        return 0;
+    }
+    return cache_setup(name, size, false);
+}
+
+void kmem_cache_set_tag(kmem_cache_t *cache, mem_tag_t tag) {
+    if (!cache || tag >= MEM_TAG_COUNT) return;
+
+    // Move pages already held so uncharges stay balanced
+    spinlock_acquire(&cache->lock);
+    u32 pages = cache->slab_count << cache->slab_order;
+    memacct_uncharge_pages(cache->tag, pages);
+    memacct_charge_pages(tag, pages);
+    cache->tag = tag;
+    spinlock_release(&cache->lock);
+}
+
+void* kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) return 0;
+
+    spinlock_acquire(&cache->lock);
+
+    slab_t *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_del(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                cache->alloc_failures++;
+                spinlock_release(&cache->lock);
+                return 0;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void **obj = (void**)slab->free_list;
+    slab->free_list = *obj;
+    slab->inuse++;
+
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->active_objects++;
+    cache->alloc_count++;
+    if (cache->active_objects > cache->peak_objects) {
+        cache->peak_objects = cache->active_objects;
+    }
+
+    spinlock_release(&cache->lock);
+    return obj;
+}
+
+void* kmem_cache_zalloc(kmem_cache_t *cache) {
+    void *obj = kmem_cache_alloc(cache);
+    if (obj) memset(obj, 0, cache->object_size);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!cache || !obj) return;
+
+    slab_t *slab = slab_of(cache, obj);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) return;
+
+    spinlock_acquire(&cache->lock);
+
+    if (slab->inuse == 0) {
+        spinlock_release(&cache->lock);
+        return;
+    }
+
+    bool was_full = (slab->inuse == cache->objects_per_slab);
+
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->inuse--;
+
+    cache->active_objects--;
+    cache->free_count++;
+
+    if (was_full) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    // Keep one empty slab around to absorb alloc/free churn
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        if (cache->empty) {
+            slab_destroy(cache, slab);
+        } else {
+            slab_list_add(&cache->empty, slab);
+        }
+    }
+
+    spinlock_release(&cache->lock);
+}
+
+u32 kmem_cache_shrink(kmem_cache_t *cache) {
+    if (!cache) return 0;
+
+    u32 pages = 0;
+    spinlock_acquire(&cache->lock);
+    while (cache->empty) {
+        slab_t *slab = cache->empty;
+        slab_list_del(&cache->empty, slab);
+        slab_destroy(cache, slab);
+        pages += 1u << cache->slab_order;
+    }
+    spinlock_release(&cache->lock);
+    return pages;
+}
+
+static void *kmalloc_large(u32 size, bool zero) {
+    u32 order = pmm_size_to_order(size + sizeof(large_hdr_t));
+    if (((u32)PAGE_SIZE << order) < size + sizeof(large_hdr_t)) return 0;
+
+    // Single pages can come pre-zeroed from the idle-filled pool
+    large_hdr_t *hdr;
+    if (zero && order == 0) {
+        hdr = (large_hdr_t*)pmm_alloc_zeroed_page();
+        zero = false;
+    } else {
+        hdr = (large_hdr_t*)pmm_alloc_pages(order);
+    }
+    if (!hdr) return 0;
+
+    hdr->magic = LARGE_MAGIC;
+    hdr->order = order;
+    hdr->size = size;
+    __atomic_add_fetch(&large_pages, 1u << order, __ATOMIC_RELAXED);
+    memacct_charge_pages(MEM_TAG_MM, 1u << order);
+    if (zero) memset(hdr + 1, 0, size);
+    return hdr + 1;
+}
+
+void* kmalloc(u32 size) {
+    if (size == 0) return 0;
+    if (!kmem_ready) kmem_init();
+
+    if (size <= KMALLOC_MAX_CLASS) {
+        int idx = 0;
+        while ((u32)(KMALLOC_MIN_CLASS << idx) < size) idx++;
+        return kmem_cache_alloc(kmalloc_caches[idx]);
+    }
+    return kmalloc_large(size, false);
+}
+
+void* kzalloc(u32 size) {
+    if (size > KMALLOC_MAX_CLASS) {
+        if (!kmem_ready) kmem_init();
+        return kmalloc_large(size, true);
+    }
+    void *ptr = kmalloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+
+    u32 page = (u32)ptr & ~((u32)PAGE_SIZE - 1);
+
+    slab_t *slab = (slab_t*)page;
+    if (slab->magic == SLAB_MAGIC) {
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    large_hdr_t *hdr = (large_hdr_t*)page;
+    if (hdr->magic == LARGE_MAGIC && (void*)(hdr + 1) == ptr) {
+        hdr->magic = 0;
+        __atomic_sub_fetch(&large_pages, 1u << hdr->order, __ATOMIC_RELAXED);
+        memacct_uncharge_pages(MEM_TAG_MM, 1u << hdr->order);
+        pmm_free_pages(page, hdr->order);
+    }
+}
+
+void kmem_cache_foreach(void (*callback)(kmem_cache_t *cache)) {
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (caches[i].valid) {
+            callback(&caches[i]);
+        }
+    }
+}
+
+u32 kmem_large_pages(void) {
+    return __atomic_load_n(&large_pages, __ATOMIC_RELAXED);
+}
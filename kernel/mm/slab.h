@@ -0,0 +1,74 @@
+#ifndef ICE_SLAB_H
+#define ICE_SLAB_H
+
+#include "../types.h"
+#include "../sync/spinlock.h"
+#include "memacct.h"
+
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_NAME_LEN   16
+
+// kmalloc size classes are 16..KMALLOC_MAX_CLASS bytes; larger requests
+// are served directly from pmm_alloc_pages
+#define KMALLOC_MIN_CLASS 16
+#define KMALLOC_MAX_CLASS 1024
+
+struct slab;
+
+
+typedef struct kmem_cache {
+    char name[KMEM_NAME_LEN];
+    u32 object_size;
+    u32 slab_order;
+    u32 objects_per_slab;
+
+    struct slab *partial;
+    struct slab *full;
+    struct slab *empty;
+
+    // Usage counters
+    u32 slab_count;
+    u32 active_objects;
+    u32 total_objects;
+    u32 peak_objects;
+    u32 alloc_count;
+    u32 free_count;
+    u32 alloc_failures;
+
+    // Slab pages are charged to this tag (MEM_TAG_MM by default)
+    mem_tag_t tag;
+
+    spinlock_t lock;
+    bool valid;
+} kmem_cache_t;
+
+
+void kmem_init(void);
+
+// Create a cache of fixed-size objects. Returns NULL when the cache
+// table is full.
+kmem_cache_t* kmem_cache_create(const char *name, u32 size);
+
+// Charge this cache's slab pages to a subsystem
+void kmem_cache_set_tag(kmem_cache_t *cache, mem_tag_t tag);
+
+void* kmem_cache_alloc(kmem_cache_t *cache);
+void* kmem_cache_zalloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Release all empty slabs of a cache back to pmm. Returns pages freed.
+u32 kmem_cache_shrink(kmem_cache_t *cache);
+
+
+void* kmalloc(u32 size);
+void* kzalloc(u32 size);
+void kfree(void *ptr);
+
+// Walk all caches (including the kmalloc size classes)
+void kmem_cache_foreach(void (*callback)(kmem_cache_t *cache));
+
+// Pages held by large (page-backed) kmalloc allocations
+u32 kmem_large_pages(void);
+
+#endif
@@ -3,7 +3,17 @@
 #include "net.h"
 #include "../drivers/vga.h"
 #include "../drivers/pit.h"
+#include "../drivers/irq.h"
+#include "../cpu/idt.h"
+#include "../proc/timer.h"
+#include "../proc/clock.h"
+#include "../lib/math.h"
+#include "../sync/waitqueue.h"
+#include "../sync/rwlock.h"
 #include "../tty/tty.h"
+#include "../mm/pmm.h"
+#include "../mm/memacct.h"
+#include <string.h>
 
 // PCI Configuration
 #define PCI_CONFIG_ADDR 0xCF8
@@ -27,6 +37,19 @@
 #define RTL_CMD_RESET   0x10
 #define RTL_CMD_RX_EN   0x08
 #define RTL_CMD_TX_EN   0x04
+#define RTL_CMD_BUFE    0x01    // RX ring empty
+
+// RTL8139 interrupt bits (IMR/ISR)
+#define RTL_INT_ROK     0x0001
+#define RTL_INT_RER     0x0002
+#define RTL_INT_TOK     0x0004
+#define RTL_INT_TER     0x0008
+#define RTL_INT_RXOVW   0x0010
+
+// TX status bits
+#define RTL_TX_TUN      0x00004000
+#define RTL_TX_TOK      0x00008000
+#define RTL_TX_TABT     0x40000000
 
 // RTL8139 Config
 #define RTL_RCR_AAP     0x01    // Accept all packets
@@ -53,14 +76,21 @@ static net_iface_t iface0 = {
 
 static net_stats_t stats = {0};
 
-// RX/TX Buffers (must be page aligned in real implementation)
+// RX/TX Buffers (physically contiguous, allocated when a NIC is found)
 #define RX_BUF_SIZE 8192
 #define TX_BUF_SIZE 4096
-static u8 rx_buffer[RX_BUF_SIZE + 16] __attribute__((aligned(4096)));
-static u8 tx_buffer[4][TX_BUF_SIZE] __attribute__((aligned(4096)));
+// WRAP mode lets the NIC run up to one frame past the end of the ring
+#define RX_BUF_ALLOC (RX_BUF_SIZE + 16 + 1536)
+static u8 *rx_buffer = 0;
+static u8 *tx_buffer[4];
 static int current_tx = 0;
 static u16 rx_index = 0;
 
+// IRQ line from PCI config space, 0 when the NIC is polled
+static u8 nic_irq = 0;
+static waitqueue_t rx_waiters;
+static waitqueue_t tx_waiters;
+
 // ARP Cache
 #define ARP_CACHE_SIZE 16
 typedef struct {
@@ -70,6 +100,7 @@ typedef struct {
     bool valid;
 } arp_entry_t;
 static arp_entry_t arp_cache[ARP_CACHE_SIZE];
+static rwlock_t arp_lock;     // Lookups share it; replies update it
 
 // Port I/O
 static inline void outb(u16 port, u8 value) {
@@ -146,6 +177,45 @@ static void rtl8139_read_mac(void) {
     }
 }
 
+static void rtl8139_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    u16 isr = inw(nic_io_base + RTL_ISR);
+    if (!isr) return;
+    
+    // Write-one-to-clear; the line stays asserted until acked
+    outw(nic_io_base + RTL_ISR, isr);
+    
+    if (isr & (RTL_INT_ROK | RTL_INT_RER | RTL_INT_RXOVW)) {
+        waitqueue_wake_all(&rx_waiters);
+    }
+    if (isr & (RTL_INT_TOK | RTL_INT_TER)) {
+        waitqueue_wake_all(&tx_waiters);
+    }
+}
+
+// Sleep on wq until cond holds. Without an IRQ, or when the caller
+// cannot block, poll cond once per millisecond instead.
+static bool rtl8139_wait(waitqueue_t *wq, bool (*cond)(void *arg), void *arg, u32 timeout_ms) {
+    if (nic_irq && waitqueue_can_sleep()) {
+        return waitqueue_wait_until(wq, cond, arg, timeout_ms);
+    }
+    for (u32 i = 0; i < timeout_ms; i++) {
+        if (cond(arg)) return true;
+        pit_sleep_ms(1);
+    }
+    return cond(arg);
+}
+
+static bool rtl8139_rx_pending(void *arg) {
+    (void)arg;
+    return !(inb(nic_io_base + RTL_CMD) & RTL_CMD_BUFE);
+}
+
+static bool rtl8139_tx_done(void *arg) {
+    u16 reg = (u16)(u32)arg;
+    return (inl(reg) & (RTL_TX_TOK | RTL_TX_TUN | RTL_TX_TABT)) != 0;
+}
+
 static int rtl8139_init(u8 bus, u8 slot) {
     // Get I/O base address from BAR0
     u32 bar0 = pci_read(bus, slot, 0, 0x10);
@@ -168,7 +238,25 @@ static int rtl8139_init(u8 bus, u8 slot) {
     // Read MAC address
     rtl8139_read_mac();
     
-    // Setup RX buffer
+    // Setup RX/TX buffers
+    if (!rx_buffer) {
+        u32 rx_order = pmm_size_to_order(RX_BUF_ALLOC);
+        u32 tx_order = pmm_size_to_order(4 * TX_BUF_SIZE);
+        u8 *rx = (u8*)pmm_alloc_pages(rx_order);
+        u8 *tx = (u8*)pmm_alloc_pages(tx_order);
+        if (!rx || !tx) {
+            // Leave rx_buffer unset so the next init tries again
+            if (rx) pmm_free_pages((phys_addr_t)rx, rx_order);
+            if (tx) pmm_free_pages((phys_addr_t)tx, tx_order);
+            vga_puts("[NET] RTL8139: Out of memory for DMA buffers\n");
+            return -1;
+        }
+        rx_buffer = rx;
+        for (int i = 0; i < 4; i++) {
+            tx_buffer[i] = tx + i * TX_BUF_SIZE;
+        }
+        memacct_charge_pages(MEM_TAG_NET, (1u << rx_order) + (1u << tx_order));
+    }
     outl(nic_io_base + RTL_RXBUF, (u32)rx_buffer);
     
     // Configure RX: accept broadcast + matching + multicast
@@ -180,8 +268,18 @@ static int rtl8139_init(u8 bus, u8 slot) {
     // Enable RX and TX
     outb(nic_io_base + RTL_CMD, RTL_CMD_RX_EN | RTL_CMD_TX_EN);
     
-    // Enable interrupts (optional - we use polling)
-    outw(nic_io_base + RTL_IMR, 0x0005);
+    // Route RX/TX completions to the wait queues. Lines 0 and 2 (the
+    // cascade) and 0xFF (unrouted) leave the driver polling.
+    u8 irq = pci_read(bus, slot, 0, 0x3C) & 0xFF;
+    waitqueue_init(&rx_waiters);
+    waitqueue_init(&tx_waiters);
+    outw(nic_io_base + RTL_ISR, 0xFFFF);
+    if (irq > 0 && irq < 16 && irq != 2) {
+        nic_irq = irq;
+        idt_register_handler(32 + irq, rtl8139_irq_handler);
+        irq_unmask_pci(irq);
+    }
+    outw(nic_io_base + RTL_IMR, RTL_INT_ROK | RTL_INT_RER | RTL_INT_TOK | RTL_INT_TER);
     
     vga_printf("[NET] RTL8139 initialized at I/O 0x%X\n", nic_io_base);
     vga_printf("[NET] MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
@@ -319,28 +417,16 @@ static inline u32 htonl(u32 x) {
 static inline u16 ntohs(u16 x) { return htons(x); }
 static inline u32 ntohl(u32 x) { return htonl(x); }
 
-// Memory copy
-static void memcpy_net(void *dst, const void *src, u32 len) {
-    u8 *d = dst;
-    const u8 *s = src;
-    while (len--) *d++ = *s++;
-}
-
-static void memset_net(void *dst, u8 val, u32 len) {
-    u8 *d = dst;
-    while (len--) *d++ = val;
-}
-
 // Send raw Ethernet frame
 static int rtl8139_send(const void *data, u32 len) {
     if (!nic_initialized || len > TX_BUF_SIZE) return -1;
     
     // Copy to TX buffer
-    memcpy_net(tx_buffer[current_tx], data, len);
+    memcpy(tx_buffer[current_tx], data, len);
     
     // Pad to minimum 60 bytes
     if (len < 60) {
-        memset_net(tx_buffer[current_tx] + len, 0, 60 - len);
+        memset(tx_buffer[current_tx] + len, 0, 60 - len);
         len = 60;
     }
     
@@ -349,23 +435,19 @@ static int rtl8139_send(const void *data, u32 len) {
     outl(nic_io_base + RTL_TXSTATUS0 + (current_tx * 4), len);
     
     // Wait for transmission (with timeout)
-    for (int i = 0; i < 1000; i++) {
-        u32 status = inl(nic_io_base + RTL_TXSTATUS0 + (current_tx * 4));
-        if (status & 0x8000) { // TOK - Transmit OK
-            stats.tx_packets++;
-            stats.tx_bytes += len;
-            current_tx = (current_tx + 1) % 4;
-            return len;
-        }
-        if (status & 0x4000) { // TUN - Transmit FIFO underrun
-            stats.tx_errors++;
-            current_tx = (current_tx + 1) % 4;
-            return -1;
-        }
-        pit_sleep_ms(1);
-    }
+    u16 status_reg = nic_io_base + RTL_TXSTATUS0 + (current_tx * 4);
+    rtl8139_wait(&tx_waiters, rtl8139_tx_done, (void*)(u32)status_reg, 1000);
     
+    u32 status = inl(status_reg);
     current_tx = (current_tx + 1) % 4;
+    if (status & RTL_TX_TOK) {
+        stats.tx_packets++;
+        stats.tx_bytes += len;
+        return len;
+    }
+    if (status & (RTL_TX_TUN | RTL_TX_TABT)) {
+        stats.tx_errors++;
+    }
     return -1;
 }
 
@@ -375,7 +457,7 @@ static int rtl8139_recv(void *buffer, u32 maxlen) {
     
     // Check if any packet received
     u8 cmd = inb(nic_io_base + RTL_CMD);
-    if (cmd & 0x01) { // Buffer empty
+    if (cmd & RTL_CMD_BUFE) {
         return 0;
     }
     
@@ -395,7 +477,7 @@ static int rtl8139_recv(void *buffer, u32 maxlen) {
     }
     
     // Copy packet data (skip 4-byte header)
-    memcpy_net(buffer, rx_buffer + rx_index + 4, length - 4);
+    memcpy(buffer, rx_buffer + rx_index + 4, length - 4);
     
     // Update RX index
     rx_index = (rx_index + length + 4 + 3) & ~3;
@@ -410,6 +492,8 @@ static int rtl8139_recv(void *buffer, u32 maxlen) {
 
 // ARP Functions
 static void arp_cache_add(ipv4_addr_t ip, mac_addr_t *mac) {
+    u32 flags = write_lock_irqsave(&arp_lock);
+    
     // Find empty or matching slot
     int slot = -1;
     for (int i = 0; i < ARP_CACHE_SIZE; i++) {
@@ -426,19 +510,24 @@ static void arp_cache_add(ipv4_addr_t ip, mac_addr_t *mac) {
     if (slot < 0) slot = 0; // Overwrite first entry if full
     
     arp_cache[slot].ip = ip;
-    memcpy_net(&arp_cache[slot].mac, mac, 6);
+    memcpy(&arp_cache[slot].mac, mac, 6);
     arp_cache[slot].timestamp = (u32)pit_get_ticks();
     arp_cache[slot].valid = true;
+    write_unlock_irqrestore(&arp_lock, flags);
 }
 
 static bool arp_cache_lookup(ipv4_addr_t ip, mac_addr_t *mac) {
+    bool found = false;
+    u32 flags = read_lock_irqsave(&arp_lock);
     for (int i = 0; i < ARP_CACHE_SIZE; i++) {
         if (arp_cache[i].valid && arp_cache[i].ip == ip) {
-            memcpy_net(mac, &arp_cache[i].mac, 6);
-            return true;
+            memcpy(mac, &arp_cache[i].mac, 6);
+            found = true;
+            break;
         }
     }
-    return false;
+    read_unlock_irqrestore(&arp_lock, flags);
+    return found;
 }
 
 static int arp_send_request(ipv4_addr_t target_ip) {
@@ -447,8 +536,8 @@ static int arp_send_request(ipv4_addr_t target_ip) {
     arp_packet_t *arp = (arp_packet_t*)(frame + sizeof(eth_header_t));
     
     // Broadcast destination
-    memset_net(eth->dst_mac, 0xFF, 6);
-    memcpy_net(eth->src_mac, iface0.mac.addr, 6);
+    memset(eth->dst_mac, 0xFF, 6);
+    memcpy(eth->src_mac, iface0.mac.addr, 6);
     eth->ethertype = htons(0x0806); // ARP
     
     // ARP request
@@ -457,9 +546,9 @@ static int arp_send_request(ipv4_addr_t target_ip) {
     arp->hw_len = 6;
     arp->proto_len = 4;
     arp->operation = htons(1);       // Request
-    memcpy_net(arp->sender_mac, iface0.mac.addr, 6);
+    memcpy(arp->sender_mac, iface0.mac.addr, 6);
     arp->sender_ip = htonl(iface0.ip);
-    memset_net(arp->target_mac, 0, 6);
+    memset(arp->target_mac, 0, 6);
     arp->target_ip = htonl(target_ip);
     
     return rtl8139_send(frame, sizeof(eth_header_t) + sizeof(arp_packet_t));
@@ -495,8 +584,8 @@ static int icmp_send_echo(ipv4_addr_t dst_ip, u16 id, u16 seq) {
     }
     
     // Ethernet header
-    memcpy_net(eth->dst_mac, dst_mac.addr, 6);
-    memcpy_net(eth->src_mac, iface0.mac.addr, 6);
+    memcpy(eth->dst_mac, dst_mac.addr, 6);
+    memcpy(eth->src_mac, iface0.mac.addr, 6);
     eth->ethertype = htons(0x0800); // IPv4
     
     // IP header
@@ -549,9 +638,11 @@ static void process_packet(u8 *data, int len) {
 // Public API Implementation
 int net_init(void) {
     // Initialize ARP cache
+    rwlock_init(&arp_lock);
     for (int i = 0; i < ARP_CACHE_SIZE; i++) {
         arp_cache[i].valid = false;
     }
+    memacct_static(MEM_TAG_NET, "arp cache", sizeof(arp_cache));
     
     // Detect and initialize NIC
     if (net_detect_and_init()) {
@@ -633,8 +724,10 @@ int net_arp_resolve(ipv4_addr_t ip, mac_addr_t *mac) {
     for (int retry = 0; retry < 3; retry++) {
         arp_send_request(ip);
         
-        // Wait for response
-        for (int i = 0; i < 100; i++) { // 1 second timeout
+        // Wait up to a second for the reply
+        u64 deadline = timer_now_ms() + 1000;
+        u64 now;
+        while ((now = timer_now_ms()) < deadline) {
             u8 buf[1600];
             int len = rtl8139_recv(buf, sizeof(buf));
             if (len > 0) {
@@ -642,8 +735,9 @@ int net_arp_resolve(ipv4_addr_t ip, mac_addr_t *mac) {
                 if (arp_cache_lookup(ip, mac)) {
                     return 0;
                 }
+                continue;
             }
-            pit_sleep_ms(10);
+            rtl8139_wait(&rx_waiters, rtl8139_rx_pending, 0, (u32)(deadline - now));
         }
     }
     
@@ -676,7 +770,8 @@ int net_ping(ipv4_addr_t dst, int timeout_ms) {
     }
     
     // Send ICMP echo request
-    u64 start_time = pit_get_ticks();
+    u64 start_time = timer_now_ms();
+    u64 start_ns = clock_monotonic_ns();
     
     if (icmp_send_echo(dst, ping_id, ping_seq) < 0) {
         return -3; // Send failed
@@ -685,7 +780,7 @@ int net_ping(ipv4_addr_t dst, int timeout_ms) {
     // Wait for response
     u8 buf[1600];
     while (1) {
-        u64 elapsed = (pit_get_ticks() - start_time) * 10; // Approx milliseconds
+        u64 elapsed = timer_now_ms() - start_time;
         if ((int)elapsed >= timeout_ms) {
             return -1; // Timeout
         }
@@ -698,13 +793,14 @@ int net_ping(ipv4_addr_t dst, int timeout_ms) {
                 if (ip->protocol == 1 && ntohl(ip->src_ip) == dst) { // ICMP from target
                     icmp_header_t *icmp = (icmp_header_t*)(buf + sizeof(eth_header_t) + sizeof(ip_header_t));
                     if (icmp->type == 0 && ntohs(icmp->id) == ping_id) { // Echo reply
-                        return (int)((pit_get_ticks() - start_time) * 10); // RTT in ms
+                        return (int)div_u64(clock_monotonic_ns() - start_ns, 1000);
                     }
                 }
             }
+            continue;
         }
         
-        pit_sleep_ms(1);
+        rtl8139_wait(&rx_waiters, rtl8139_rx_pending, 0, (u32)(timeout_ms - (int)elapsed));
     }
 }
 
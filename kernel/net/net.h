@@ -56,7 +56,7 @@ bool net_is_available(void);
  
 int net_arp_resolve(ipv4_addr_t ip, mac_addr_t *mac);
 
-// Ping a host (returns RTT in ms, negative on error)
+// Ping a host (returns RTT in microseconds, negative on error)
 int net_ping(ipv4_addr_t dst, int timeout_ms);
 
 // Get network statistics
@@ -0,0 +1,150 @@
+/*
+ * ICE clocksource
+ *
+ * The TSC is the time base; its rate is measured once at boot against
+ * a reference with a known frequency. Cycle counts become nanoseconds
+ * with a multiply and shift (ns = cycles * mult >> shift), so reading
+ * the clock needs no division.
+ */
+
+#include "clock.h"
+#include "../cpu/cpuid.h"
+#include "../cpu/acpi.h"
+#include "../cpu/irqflags.h"
+#include "../drivers/pit.h"
+#include "../lib/math.h"
+
+// Two PIT windows (~50 ms and ~10 ms): their difference cancels the
+// fixed cost of programming channel 2
+#define CAL_PIT_LONG   59659
+#define CAL_PIT_SHORT  11932
+
+#define CAL_HPET_FS    50000000000000ull   // 50 ms in femtoseconds
+
+#define HPET_CAP       0x00
+#define HPET_CONFIG    0x10
+#define HPET_COUNTER   0xF0
+#define HPET_ENABLE    0x01
+#define HPET_TABLE_ADDR 44                 // Base address in the ACPI table
+
+static bool tsc_ok = false;
+static u32 tsc_khz = 0;
+static u32 mult = 0;
+static u32 shift = 0;
+static u64 tsc_base = 0;
+static i32 drift_ppm = 0;
+static clock_ref_t reference = CLOCK_REF_NONE;
+
+static volatile u32 *hpet = 0;
+static u32 hpet_period_fs = 0;
+
+static bool hpet_init(void) {
+    const u8 *table = (const u8*)acpi_find_table("HPET");
+    if (!table) return false;
+
+    // 64-bit address; only usable inside the identity map
+    u32 addr = *(const u32*)(table + HPET_TABLE_ADDR);
+    if (!addr || *(const u32*)(table + HPET_TABLE_ADDR + 4)) return false;
+
+    hpet = (volatile u32*)addr;
+    hpet_period_fs = hpet[HPET_CAP / 4 + 1];
+    if (hpet_period_fs == 0 || hpet_period_fs > 100000000) {
+        hpet = 0;
+        return false;
+    }
+    hpet[HPET_CONFIG / 4] |= HPET_ENABLE;
+    return true;
+}
+
+static u64 pit_window_ns(u32 clocks) {
+    return div_u64((u64)clocks * 1000000000u, PIT_FREQUENCY);
+}
+
+// TSC cycles across one reference interval, and its length in ns
+static void measure(u64 *tsc_delta, u64 *ref_ns) {
+    if (hpet) {
+        u32 target = (u32)div_u64(CAL_HPET_FS, hpet_period_fs);
+        u32 c0 = hpet[HPET_COUNTER / 4];
+        u64 t0 = cycles();
+        u32 c1;
+        while ((c1 = hpet[HPET_COUNTER / 4]) - c0 < target) {
+            __asm__ volatile ("pause");
+        }
+        *tsc_delta = cycles() - t0;
+        *ref_ns = div_u64((u64)(c1 - c0) * hpet_period_fs, 1000000);
+        return;
+    }
+
+    u64 t0 = cycles();
+    pit_delay_clocks(CAL_PIT_SHORT);
+    u64 t1 = cycles();
+    pit_delay_clocks(CAL_PIT_LONG);
+    u64 t2 = cycles();
+
+    u64 short_cycles = t1 - t0;
+    u64 long_cycles = t2 - t1;
+    *tsc_delta = long_cycles > short_cycles ? long_cycles - short_cycles : long_cycles;
+    *ref_ns = pit_window_ns(CAL_PIT_LONG) - pit_window_ns(CAL_PIT_SHORT);
+}
+
+void clock_init(void) {
+    if (!cpu_has(CPU_FEATURE_TSC)) return;
+
+    acpi_init();
+    reference = hpet_init() ? CLOCK_REF_HPET : CLOCK_REF_PIT;
+
+    u32 flags = irq_save_raw();
+
+    u64 delta, ref_ns;
+    measure(&delta, &ref_ns);
+    // cycles per ms = kHz
+    tsc_khz = (u32)div_u64(delta * 1000000, (u32)ref_ns);
+
+    // Largest shift whose multiplier still fits 32 bits
+    shift = 32;
+    while (shift > 0 && (div_u64((u64)1000000 << shift, tsc_khz) >> 32)) {
+        shift--;
+    }
+    mult = (u32)div_u64((u64)1000000 << shift, tsc_khz);
+
+    // A second interval checked against the calibrated clock
+    measure(&delta, &ref_ns);
+    i32 err = (i32)(clock_cycles_to_ns(delta) - ref_ns);
+    if (err > 2000000) err = 2000000;
+    if (err < -2000000) err = -2000000;
+    drift_ppm = err * 1000 / (i32)((u32)ref_ns / 1000);
+
+    tsc_base = cycles();
+    tsc_ok = true;
+
+    irq_restore_raw(flags);
+}
+
+u64 clock_cycles_to_ns(u64 delta) {
+    return mul_u64_u32_shr(delta, mult, shift);
+}
+
+u64 clock_monotonic_ns(void) {
+    if (!tsc_ok) return pit_get_ms() * 1000000;
+    return clock_cycles_to_ns(cycles() - tsc_base);
+}
+
+u32 clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+clock_ref_t clock_reference(void) {
+    return reference;
+}
+
+const char* clock_reference_name(void) {
+    switch (reference) {
+    case CLOCK_REF_HPET: return "HPET";
+    case CLOCK_REF_PIT:  return "PIT";
+    default:             return "none";
+    }
+}
+
+i32 clock_drift_ppm(void) {
+    return drift_ppm;
+}
@@ -0,0 +1,38 @@
+#ifndef ICE_CLOCK_H
+#define ICE_CLOCK_H
+
+#include "../types.h"
+
+typedef enum {
+    CLOCK_REF_NONE = 0,      // No TSC: time comes from the PIT alone
+    CLOCK_REF_PIT,
+    CLOCK_REF_HPET
+} clock_ref_t;
+
+// Raw time stamp counter, for timing code paths. Convert differences
+// with clock_cycles_to_ns. Needs a TSC (clock_tsc_khz() != 0).
+static inline u64 cycles(void) {
+    u32 lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+// Calibrate the TSC against the HPET when ACPI lists one, else against
+// PIT channel 2. Busy-waits ~150 ms; run once on the boot CPU.
+void clock_init(void);
+
+// Nanoseconds since clock_init. Millisecond resolution without a TSC.
+u64 clock_monotonic_ns(void);
+
+u64 clock_cycles_to_ns(u64 delta);
+
+// Calibrated TSC frequency, 0 without a TSC
+u32 clock_tsc_khz(void);
+
+clock_ref_t clock_reference(void);
+const char* clock_reference_name(void);
+
+// Error of the calibrated clock over a second reference interval
+i32 clock_drift_ppm(void);
+
+#endif
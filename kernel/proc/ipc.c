@@ -0,0 +1,77 @@
+/*
+ * ICE message ports
+ *
+ * A port is a FIFO of calls and a wait queue for its server. All state
+ * is guarded by the wait queue lock, which also orders each check of
+ * a wait condition against its wakeup.
+ */
+
+#include "ipc.h"
+#include "../errno.h"
+
+void ipc_port_init(ipc_port_t *port, const char *name) {
+    port->name = name;
+    port->head = 0;
+    port->tail = 0;
+    waitqueue_init(&port->recv_wait);
+    port->calls = 0;
+    port->pages_moved = 0;
+}
+
+int ipc_call(ipc_port_t *port, ipc_msg_t *msg) {
+    if (!waitqueue_can_sleep()) return E_BUSY;
+
+    ipc_call_t call;
+    call.msg = msg;
+    call.next = 0;
+    waitqueue_init(&call.reply_wait);
+    call.done = false;
+
+    u32 flags = waitqueue_lock();
+    if (port->tail) port->tail->next = &call; else port->head = &call;
+    port->tail = &call;
+    port->calls++;
+    port->pages_moved += msg->npages;
+    waitqueue_wake_one_locked(&port->recv_wait);
+
+    // Not killable: the server may be using our message, so a kill
+    // takes effect only once the reply is in
+    while (!call.done) {
+        waitqueue_wait(&call.reply_wait, WAIT_FOREVER);
+    }
+    port->pages_moved += msg->npages;
+    waitqueue_unlock(flags);
+    return E_OK;
+}
+
+ipc_call_t *ipc_receive(ipc_port_t *port) {
+    u32 flags = waitqueue_lock();
+    while (!port->head) {
+        waitqueue_wait(&port->recv_wait, WAIT_FOREVER);
+    }
+    ipc_call_t *call = port->head;
+    port->head = call->next;
+    if (!port->head) port->tail = 0;
+    waitqueue_unlock(flags);
+    return call;
+}
+
+void ipc_reply(ipc_call_t *call) {
+    u32 flags = waitqueue_lock();
+    call->done = true;
+    waitqueue_wake_one_locked(&call->reply_wait);
+    waitqueue_unlock(flags);
+}
+
+int ipc_attach_page(ipc_msg_t *msg, phys_addr_t page) {
+    if (msg->npages >= IPC_MAX_PAGES) return E_NO_MEM;
+    msg->pages[msg->npages++] = page;
+    return E_OK;
+}
+
+void ipc_release_pages(ipc_msg_t *msg) {
+    for (u32 i = 0; i < msg->npages; i++) {
+        pmm_free_page(msg->pages[i]);
+    }
+    msg->npages = 0;
+}
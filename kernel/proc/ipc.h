@@ -0,0 +1,73 @@
+#ifndef ICE_IPC_H
+#define ICE_IPC_H
+
+#include "../types.h"
+#include "../mm/pmm.h"
+#include "../sync/waitqueue.h"
+
+// Message ports: synchronous calls between kernel threads. The caller
+// sleeps until the server replies, and the server reads the request and
+// writes the reply in the caller's own message, so nothing is copied.
+// Small payloads travel inline; larger ones as whole pages, whose
+// ownership moves with the message.
+//
+//     client                          server
+//     ipc_msg_t m = {.op = OP_X};     ipc_call_t *c = ipc_receive(&port);
+//     ipc_call(&port, &m);            c->msg->status = ...;
+//     use m.status, m.data            ipc_reply(c);
+
+#define IPC_INLINE_MAX 48      // Bytes of data carried in the message
+#define IPC_MAX_PAGES  4       // Pages moved with one message
+
+typedef struct {
+    u32 op;                    // Request code, defined by the port's server
+    int status;                // Reply: E_OK or an error code
+    u32 arg[3];
+    u32 len;                   // Bytes of data used
+    u8 data[IPC_INLINE_MAX];
+    u32 npages;
+    phys_addr_t pages[IPC_MAX_PAGES];
+} ipc_msg_t;
+
+// A call in flight. Lives on the caller's stack until ipc_reply.
+typedef struct ipc_call {
+    ipc_msg_t *msg;
+    struct ipc_call *next;
+    waitqueue_t reply_wait;
+    bool done;
+} ipc_call_t;
+
+typedef struct {
+    const char *name;
+    ipc_call_t *head;          // Calls not yet received, oldest first
+    ipc_call_t *tail;
+    waitqueue_t recv_wait;
+    u32 calls;
+    u32 pages_moved;           // Counted each way
+} ipc_port_t;
+
+void ipc_port_init(ipc_port_t *port, const char *name);
+
+// Send msg and sleep until the server replies into it, even if the
+// caller is killed meanwhile. E_BUSY when the caller cannot sleep (early
+// boot); the port is then not touched.
+int ipc_call(ipc_port_t *port, ipc_msg_t *msg);
+
+// Sleep until a call arrives and take it
+ipc_call_t *ipc_receive(ipc_port_t *port);
+
+// Hand the reply back and wake the caller. The call and its message
+// belong to the caller again and must not be touched afterwards.
+void ipc_reply(ipc_call_t *call);
+
+// Move a page with msg; whoever receives the message owns it
+int ipc_attach_page(ipc_msg_t *msg, phys_addr_t page);
+
+// Free the pages a message carries
+void ipc_release_pages(ipc_msg_t *msg);
+
+static inline void *ipc_page(const ipc_msg_t *msg, u32 i) {
+    return (void*)msg->pages[i];
+}
+
+#endif
@@ -3,17 +3,86 @@
 #include "scheduler.h"
 #include "../drivers/vga.h"
 #include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/paging.h"
+#include "../mm/memacct.h"
+#include "../drivers/pit.h"
+#include "../drivers/irq.h"
+#include "../cpu/smp.h"
+#include "../cpu/gdt.h"
+#include "uproc.h"
+#include "../sync/spinlock.h"
+#include "../errno.h"
+#include "../cpu/irqflags.h"
 
  
-static pcb_t process_table[MAX_PROCESSES];
+// NULL slot = free; PCBs themselves come from pcb_cache. Slots and the
+// PID hash are written under sched_lock and published with
+// rcu_assign_pointer, so lookups and listings take no lock.
+static pcb_t *process_table[MAX_PROCESSES];
+static kmem_cache_t *pcb_cache = 0;
 static ice_pid_t next_pid = 1;
-static int current_process = -1;
 static int process_count = 0;
 
- 
-#define DEFAULT_TIMESLICE 10
+// Per-CPU scheduling state. One FIFO per priority; bit n of
+// ready_bitmap set = queue n non-empty.
+typedef struct {
+    pcb_t *run_head[SCHED_PRIO_LEVELS];
+    pcb_t *run_tail[SCHED_PRIO_LEVELS];
+    u32 ready_bitmap;
+    u32 nr_ready;
+    
+    pcb_t *current;
+    pcb_t *idle;             // Runs when nothing else can; never queued
+    
+    // Set by the timer tick, acted on once the IRQ has been acknowledged
+    volatile bool need_resched;
+    bool online;
+    
+    u32 switches;
+    u32 preemptions;
+    u32 steals;
+    u32 busy_ticks;
+    u32 idle_ticks;
+} run_queue_t;
+
+static run_queue_t run_queues[SMP_MAX_CPUS];
+
+// Guards the process table, PID hash and every run queue. Held across
+// a context switch: the switching context takes it, the one switched
+// to drops it (sched_start for a process running for the first time).
+static spinlock_t sched_lock;
+
+static pcb_t *pid_hash[SCHED_PID_HASH_SIZE];
+
+#define PID_HASH(pid) ((u32)(pid) & (SCHED_PID_HASH_SIZE - 1))
+
+// Exited processes still own their stack until another one frees it
+static pcb_t *zombies = 0;
+
+// A newly runnable process needs a preemption tick this soon
+#define SCHED_TICK_MS 10
+
+static inline u32 sched_lock_irqsave(void) {
+    u32 flags = irq_save();
+    spinlock_acquire_raw(&sched_lock);
+    return flags;
+}
+
+static inline void sched_unlock_irqrestore(u32 flags) {
+    spinlock_release_raw(&sched_lock);
+    irq_restore(flags);
+}
+
+// Interrupts must be off so the caller cannot migrate
+static inline run_queue_t *this_rq(void) {
+    return &run_queues[smp_cpu_id()];
+}
+
+static inline bool is_idle(pcb_t *proc) {
+    return proc == run_queues[proc->cpu].idle;
+}
 
- 
 static void strncpy_s(char *dest, const char *src, int n) {
     int i;
     for (i = 0; i < n - 1 && src[i]; i++) {
@@ -22,52 +91,312 @@ static void strncpy_s(char *dest, const char *src, int n) {
     dest[i] = '\0';
 }
 
+static void rq_enqueue(run_queue_t *rq, pcb_t *proc) {
+    u32 prio = proc->priority;
+    proc->cpu = (u32)(rq - run_queues);
+    proc->rq_next = 0;
+    proc->rq_prev = rq->run_tail[prio];
+    if (rq->run_tail[prio]) rq->run_tail[prio]->rq_next = proc;
+    else rq->run_head[prio] = proc;
+    rq->run_tail[prio] = proc;
+    rq->ready_bitmap |= 1u << prio;
+    rq->nr_ready++;
+}
+
+static void rq_dequeue(pcb_t *proc) {
+    run_queue_t *rq = &run_queues[proc->cpu];
+    u32 prio = proc->priority;
+    if (proc->rq_prev) proc->rq_prev->rq_next = proc->rq_next;
+    else rq->run_head[prio] = proc->rq_next;
+    if (proc->rq_next) proc->rq_next->rq_prev = proc->rq_prev;
+    else rq->run_tail[prio] = proc->rq_prev;
+    proc->rq_next = proc->rq_prev = 0;
+    if (!rq->run_head[prio]) rq->ready_bitmap &= ~(1u << prio);
+    rq->nr_ready--;
+}
+
+// Busiest other online queue, or NULL if every other queue is empty
+static run_queue_t *busiest_rq(run_queue_t *self) {
+    run_queue_t *best = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        run_queue_t *rq = &run_queues[i];
+        if (rq == self || !rq->online || !rq->nr_ready) continue;
+        if (!best || rq->nr_ready > best->nr_ready) best = rq;
+    }
+    return best;
+}
+
+// Highest priority ready process of this CPU. With an empty queue the
+// best process of the busiest other CPU is stolen; the idle process
+// runs only when there is nothing to steal either.
+static pcb_t *rq_pick(run_queue_t *rq) {
+    if (rq->ready_bitmap) {
+        return rq->run_head[__builtin_ctz(rq->ready_bitmap)];
+    }
+    
+    run_queue_t *victim = busiest_rq(rq);
+    if (!victim) return rq->idle;
+    
+    pcb_t *proc = victim->run_head[__builtin_ctz(victim->ready_bitmap)];
+    rq_dequeue(proc);
+    rq_enqueue(rq, proc);
+    rq->steals++;
+    return proc;
+}
+
+// Queue a runnable process on its last CPU, or on an idle one when that
+// CPU is busy, and make the chosen CPU reschedule if it should switch
+static void rq_place(pcb_t *proc) {
+    run_queue_t *rq = &run_queues[proc->cpu];
+    if (!rq->online) rq = &run_queues[0];
+    
+    if (rq->current != rq->idle || rq->nr_ready) {
+        for (int i = 0; i < SMP_MAX_CPUS; i++) {
+            run_queue_t *other = &run_queues[i];
+            if (other->online && other->idle && other->current == other->idle &&
+                !other->nr_ready) {
+                rq = other;
+                break;
+            }
+        }
+    }
+    rq_enqueue(rq, proc);
+    
+    u32 cpu = (u32)(rq - run_queues);
+    pcb_t *cur = rq->current;
+    if (cur == rq->idle || (cur && proc->priority < cur->priority)) {
+        if (cpu == smp_cpu_id()) rq->need_resched = true;
+        else smp_send_resched(cpu);
+    }
+    
+    // A CPU's clock only ticks while someone is waiting for it
+    if (cpu == 0) pit_wake_within(SCHED_TICK_MS);
+    irq_sched_tick_wake(cpu);
+}
+
+static void idle_loop(void) {
+    for (;;) {
+        // Use the idle time to pre-zero pages, then halt until next interrupt
+        pmm_zero_pool_refill();
+        rcu_kick();
+        trace_irqs_on();
+        __asm__ volatile ("sti; hlt");
+    }
+}
+
+void scheduler_idle(void) {
+    idle_loop();
+    for (;;) { }
+}
+
+static void hash_insert(pcb_t *proc) {
+    u32 h = PID_HASH(proc->pid);
+    proc->hash_next = pid_hash[h];
+    rcu_assign_pointer(pid_hash[h], proc);
+}
+
+static void hash_remove(pcb_t *proc) {
+    pcb_t **link = &pid_hash[PID_HASH(proc->pid)];
+    while (*link) {
+        if (*link == proc) {
+            // proc keeps its own link for readers still walking past it
+            rcu_assign_pointer(*link, proc->hash_next);
+            return;
+        }
+        link = &(*link)->hash_next;
+    }
+}
+
+// Under sched_lock or rcu_read_lock
+static pcb_t *hash_lookup(ice_pid_t pid) {
+    for (pcb_t *p = rcu_dereference(pid_hash[PID_HASH(pid)]); p; p = rcu_dereference(p->hash_next)) {
+        if (p->pid == pid) return p;
+    }
+    return 0;
+}
+
 void scheduler_init(void) {
      
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].state = PROC_STATE_FREE;
-        process_table[i].pid = 0;
+        process_table[i] = 0;
+    }
+    for (int c = 0; c < SMP_MAX_CPUS; c++) {
+        run_queue_t *rq = &run_queues[c];
+        for (int i = 0; i < SCHED_PRIO_LEVELS; i++) {
+            rq->run_head[i] = rq->run_tail[i] = 0;
+        }
+        rq->ready_bitmap = 0;
+        rq->nr_ready = 0;
+        rq->current = rq->idle = 0;
+        rq->need_resched = false;
+        rq->online = false;
+        rq->switches = rq->preemptions = rq->steals = 0;
+        rq->busy_ticks = rq->idle_ticks = 0;
     }
+    for (int i = 0; i < SCHED_PID_HASH_SIZE; i++) {
+        pid_hash[i] = 0;
+    }
+    spinlock_init(&sched_lock);
+    
+    if (!pcb_cache) {
+        pcb_cache = kmem_cache_create("pcb", sizeof(pcb_t));
+        kmem_cache_set_tag(pcb_cache, MEM_TAG_SCHED);
+    }
+    memacct_static(MEM_TAG_SCHED, "scheduler process table", sizeof(process_table));
+    memacct_static(MEM_TAG_SCHED, "scheduler run queues", sizeof(run_queues));
     
     next_pid = 1;
-    current_process = -1;
     process_count = 0;
+    zombies = 0;
+    
+    run_queue_t *rq = &run_queues[0];
+    rq->online = true;
+    
+    // Adopt the boot thread so it can be preempted and resumed like any
+    // other process; it keeps the boot stack and the kernel directory
+    pcb_t *boot = (pcb_t*)kmem_cache_zalloc(pcb_cache);
+    if (boot) {
+        boot->pid = next_pid++;
+        boot->exec_id = boot->pid;
+        boot->state = SCHED_STATE_RUNNING;
+        strncpy_s(boot->name, "kernel", sizeof(boot->name));
+        boot->timeslice = SCHED_SLICE_DEFAULT;
+        boot->ticks_remaining = SCHED_SLICE_DEFAULT;
+        boot->priority = SCHED_PRIO_DEFAULT;
+        rcu_assign_pointer(process_table[0], boot);
+        process_count = 1;
+        hash_insert(boot);
+        rq->current = boot;
+    }
+    
+    ice_pid_t idle_pid = scheduler_create_process("idle", (u32)idle_loop);
+    u32 flags = sched_lock_irqsave();
+    pcb_t *idle_proc = idle_pid ? hash_lookup(idle_pid) : 0;
+    if (idle_proc) {
+        rq_dequeue(idle_proc);
+        idle_proc->priority = SCHED_PRIO_LEVELS - 1;
+        rq->idle = idle_proc;
+    }
+    sched_unlock_irqrestore(flags);
 }
 
-ice_pid_t scheduler_create_process(const char *name, u32 entry_point) {
-     
-    int slot = -1;
+void scheduler_init_cpu(u32 cpu) {
+    if (cpu == 0 || cpu >= SMP_MAX_CPUS) return;
+    
+    pcb_t *idle_proc = (pcb_t*)kmem_cache_zalloc(pcb_cache);
+    if (!idle_proc) return;
+    
+    idle_proc->state = SCHED_STATE_RUNNING;
+    strncpy_s(idle_proc->name, "idle", sizeof(idle_proc->name));
+    idle_proc->name[4] = '0' + (char)cpu;
+    idle_proc->name[5] = '\0';
+    idle_proc->timeslice = SCHED_SLICE_DEFAULT;
+    idle_proc->ticks_remaining = SCHED_SLICE_DEFAULT;
+    idle_proc->priority = SCHED_PRIO_LEVELS - 1;
+    idle_proc->cpu = cpu;
+    
+    spinlock_acquire_raw(&sched_lock);
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROC_STATE_FREE) {
-            slot = i;
+        if (!process_table[i]) {
+            rcu_assign_pointer(process_table[i], idle_proc);
+            process_count++;
             break;
         }
     }
+    idle_proc->pid = next_pid++;
+    idle_proc->exec_id = idle_proc->pid;
+    hash_insert(idle_proc);
     
-    if (slot < 0) {
-        return 0;   
+    run_queue_t *rq = &run_queues[cpu];
+    rq->idle = idle_proc;
+    rq->current = idle_proc;
+    rq->online = true;
+    spinlock_release_raw(&sched_lock);
+}
+
+static void free_pcb_rcu(rcu_head_t *head) {
+    kmem_cache_free(pcb_cache, (pcb_t*)((u8*)head - __builtin_offsetof(pcb_t, rcu)));
+}
+
+// Release everything a process owns. It must not be queued and must
+// not be the one whose stack we are running on. The PCB itself outlives
+// any lockless lookup that found it.
+static void free_process(pcb_t *proc) {
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        if (process_table[i] == proc) {
+            rcu_assign_pointer(process_table[i], (pcb_t*)0);
+            break;
+        }
     }
+    process_count--;
     
-    pcb_t *proc = &process_table[slot];
+    if (proc->kernel_stack) {
+        pmm_free_page(proc->kernel_stack);
+        memacct_uncharge_pages(MEM_TAG_SCHED, 1);
+    }
+    if (proc->user_stack) uproc_release(proc->context.cr3);
+    paging_destroy_directory(proc->context.cr3);
+    call_rcu(&proc->rcu, free_pcb_rcu);
+}
+
+static void reap_zombies(void) {
+    pcb_t **link = &zombies;
+    while (*link) {
+        pcb_t *proc = *link;
+        bool running = false;
+        for (int i = 0; i < SMP_MAX_CPUS; i++) {
+            if (run_queues[i].current == proc) running = true;
+        }
+        if (running) {
+            link = &proc->rq_next;
+            continue;
+        }
+        *link = proc->rq_next;
+        free_process(proc);
+    }
+}
+
+// First code a new process runs, entered from process_switch_context
+// with the scheduler lock still held and interrupts off. Returns into
+// the entry point, which returns into scheduler_exit.
+static void sched_start(void) {
+    spinlock_release_raw(&sched_lock);
+    __asm__ volatile ("sti");
+}
+
+// Takes over pd (0 for the kernel directory), also on failure
+static ice_pid_t create_process(const char *name, u32 entry_point, u32 arg, u32 pd,
+                                u32 user_entry, u32 user_stack) {
+    pcb_t *proc = (pcb_t*)kmem_cache_zalloc(pcb_cache);
+    if (!proc) {
+        if (user_stack) uproc_release(pd);
+        paging_destroy_directory(pd);
+        return 0;
+    }
     
      
-    proc->pid = next_pid++;
-    proc->exec_id = proc->pid;   
-    proc->state = PROC_STATE_READY;
+    proc->state = SCHED_STATE_READY;
     strncpy_s(proc->name, name, sizeof(proc->name));
     
     // Allocate kernel stack
-    proc->kernel_stack = pmm_alloc_page();
+    proc->kernel_stack = pmm_alloc_zeroed_page();
     if (!proc->kernel_stack) {
+        kmem_cache_free(pcb_cache, proc);
+        if (user_stack) uproc_release(pd);
+        paging_destroy_directory(pd);
         return 0;   
     }
+    memacct_charge_pages(MEM_TAG_SCHED, 1);
     
     // Initialize context on the stack
-    // Stack grows down: EIP, EFLAGS, Segs(4), Regs(8)
+    // Stack grows down: arg, exit, entry, start, EFLAGS, Segs(4), Regs(8)
     u32 *stack = (u32*)(proc->kernel_stack + PAGE_SIZE);
     
-    *(--stack) = entry_point;    // Return address (EIP)
-    *(--stack) = 0x202;          // EFLAGS (IF | reserved)
+    *(--stack) = arg;            // First argument of the entry function
+    *(--stack) = (u32)scheduler_exit; // Entry function returns here
+    *(--stack) = entry_point;    // sched_start returns here
+    *(--stack) = (u32)sched_start; // Return address (EIP)
+    *(--stack) = 0x002;          // EFLAGS (reserved; IF off until sched_start)
     
     *(--stack) = 0x10;           // GS
     *(--stack) = 0x10;           // FS
@@ -85,122 +414,392 @@ ice_pid_t scheduler_create_process(const char *name, u32 entry_point) {
     
     proc->saved_esp = (u32)stack;
     
+    // Kernel threads run on the kernel directory, so switching between
+    // them never reloads CR3; only user processes bring their own
+    proc->context.cr3 = pd;
+    proc->user_entry = user_entry;
+    proc->user_stack = user_stack;
+    
     // Legacy support: keep struct updated if anyone uses it
     proc->context.eip = entry_point;
     proc->context.esp = proc->saved_esp;
     
     proc->memory_used = PAGE_SIZE;
     proc->tty_id = 0;
-    proc->timeslice = DEFAULT_TIMESLICE;
-    proc->ticks_remaining = DEFAULT_TIMESLICE;
+    proc->timeslice = SCHED_SLICE_DEFAULT;
+    proc->ticks_remaining = SCHED_SLICE_DEFAULT;
+    proc->priority = SCHED_PRIO_DEFAULT;
     
+    u32 flags = sched_lock_irqsave();
+    int slot = -1;
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        if (!process_table[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        sched_unlock_irqrestore(flags);
+        if (user_stack) uproc_release(proc->context.cr3);
+        paging_destroy_directory(proc->context.cr3);
+        pmm_free_page(proc->kernel_stack);
+        memacct_uncharge_pages(MEM_TAG_SCHED, 1);
+        kmem_cache_free(pcb_cache, proc);
+        return 0;
+    }
+    
+    proc->pid = next_pid++;
+    proc->exec_id = proc->pid;   
+    proc->cpu = smp_cpu_id();
+    rcu_assign_pointer(process_table[slot], proc);
     process_count++;
+    hash_insert(proc);
+    rq_place(proc);
+    ice_pid_t pid = proc->pid;
+    sched_unlock_irqrestore(flags);
     
-    return proc->pid;
+    return pid;
+}
+
+ice_pid_t scheduler_create_process(const char *name, u32 entry_point) {
+    return create_process(name, entry_point, 0, 0, 0, 0);
+}
+
+ice_pid_t scheduler_create_kthread(const char *name, void (*fn)(void *arg), void *arg) {
+    return create_process(name, (u32)fn, (u32)arg, 0, 0, 0);
+}
+
+ice_pid_t scheduler_create_user_process(const char *name, void (*entry)(void *arg),
+                                        void *arg, u32 pd,
+                                        u32 user_entry, u32 user_stack) {
+    return create_process(name, (u32)entry, (u32)arg, pd, user_entry, user_stack);
+}
+
+extern void process_switch_context(u32 *old_esp_ptr, u32 new_esp);
+
+// Switch this CPU to the next process. Called and returns with the
+// scheduler lock held and interrupts off, possibly on another CPU.
+static void schedule_locked(void) {
+    run_queue_t *rq = this_rq();
+    if (zombies) reap_zombies();
+    
+    pcb_t *prev = rq->current;
+    
+    // A running process goes to the back of its priority's queue, so
+    // equal priorities round-robin and higher ones always win
+    if (prev && prev->state == SCHED_STATE_RUNNING) {
+        prev->state = SCHED_STATE_READY;
+        if (prev != rq->idle) rq_enqueue(rq, prev);
+    }
+    
+    pcb_t *next = rq_pick(rq);
+    if (!next) {
+        // No idle process yet (early boot): keep running
+        if (prev && prev->state == SCHED_STATE_READY) prev->state = SCHED_STATE_RUNNING;
+        return;
+    }
+    if (next != rq->idle) rq_dequeue(next);
+    next->state = SCHED_STATE_RUNNING;
+    next->ticks_remaining = next->timeslice;
+    
+    if (next == prev) {
+        return;
+    }
+    rq->current = next;
+    rq->switches++;
+    fpu_switch();
+    
+    // Traps and sysenter from ring 3 land on the process's own stack
+    if (next->kernel_stack) gdt_set_kernel_stack(next->kernel_stack + PAGE_SIZE);
+    
+    // CR3 is only reloaded when the address space really changes
+    paging_switch(next->context.cr3);
+    
+    // Perform actual context switch. Interrupts stay off across it; the
+    // saved EFLAGS of the next context decide when they come back on.
+    if (prev) {
+        process_switch_context(&prev->saved_esp, next->saved_esp);
+    } else {
+         // First switch, special case: just dummy old pointer
+        u32 dummy;
+        process_switch_context(&dummy, next->saved_esp);
+    }
+}
+
+// scheduler_wake with sched_lock held
+static void wake_locked(pcb_t *proc) {
+    if (proc->state != SCHED_STATE_BLOCKED) return;
+    if (run_queues[proc->cpu].current == proc) {
+        // Woken before it got to switch away
+        proc->state = SCHED_STATE_RUNNING;
+    } else {
+        proc->state = SCHED_STATE_READY;
+        rq_place(proc);
+    }
 }
 
 void scheduler_kill_process(ice_pid_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == pid && process_table[i].state != PROC_STATE_FREE) {
-             
-            if (process_table[i].kernel_stack) {
-                pmm_free_page(process_table[i].kernel_stack);
-            }
-            
-            process_table[i].state = PROC_STATE_FREE;
-            process_table[i].pid = 0;
-            process_count--;
-            
-             
-            if (i == current_process) {
-                current_process = -1;
-            }
-            
-            return;
-        }
+    u32 flags = sched_lock_irqsave();
+    pcb_t *proc = hash_lookup(pid);
+    if (!proc || !proc->kernel_stack || is_idle(proc)) {
+        // Unknown, or the boot thread which has nothing to free
+        sched_unlock_irqrestore(flags);
+        return;
+    }
+    
+    if (proc == this_rq()->current) {
+        sched_unlock_irqrestore(flags);
+        scheduler_exit();
+        return;
+    }
+    
+    proc->kill_pending = true;
+    if (proc->state == SCHED_STATE_BLOCKED && proc->wait_killable) {
+        wake_locked(proc);
+    } else if (proc->state == SCHED_STATE_RUNNING) {
+        // Into the kernel soon, in case it is running in ring 3
+        smp_send_resched(proc->cpu);
     }
+    sched_unlock_irqrestore(flags);
+}
+
+int scheduler_wait_exit(ice_pid_t pid) {
+    u32 flags = waitqueue_lock();
+    rcu_read_lock();
+    pcb_t *proc = hash_lookup(pid);
+    // Not yet exiting, so it cannot be freed while we hold the lock
+    if (proc && proc->exiting) proc = 0;
+    rcu_read_unlock();
+    
+    int ret = E_OK;
+    if (proc && proc != this_rq()->current) {
+        // Only the exit wakes this queue, and proc may be freed by the time
+        // we run again: do not look at it after the wait
+        ret = waitqueue_wait_killable(&proc->exit_wait, WAIT_FOREVER);
+    }
+    waitqueue_unlock(flags);
+    return ret;
+}
+
+bool scheduler_killed(void) {
+    u32 flags = irq_save();
+    pcb_t *cur = this_rq()->current;
+    bool killed = cur && cur->kill_pending;
+    irq_restore(flags);
+    return killed;
+}
+
+void scheduler_exit(void) {
+    pcb_t *proc = scheduler_get_current();
+    if (!proc || !proc->kernel_stack) return;
+    
+    // Waiters look at the PCB only under waitqueue_lock and before this
+    // point, so it may be freed once they are woken
+    u32 flags = waitqueue_lock();
+    proc->exiting = true;
+    while (waitqueue_wake_one_locked(&proc->exit_wait)) { }
+    waitqueue_unlock(flags);
+    
+    flags = sched_lock_irqsave();
+    proc->state = SCHED_STATE_ZOMBIE;
+    hash_remove(proc);
+    proc->rq_next = zombies;
+    zombies = proc;
+    
+    // Never returns: a zombie is not requeued
+    schedule_locked();
+    sched_unlock_irqrestore(flags);
 }
 
 void scheduler_tick(void) {
-    if (current_process < 0) return;
+    rcu_kick();
+    
+    run_queue_t *rq = this_rq();
+    pcb_t *proc = rq->current;
+    if (!proc) return;
     
-    pcb_t *proc = &process_table[current_process];
-    if (proc->state == PROC_STATE_RUNNING) {
-        proc->ticks_remaining--;
+    if (proc == rq->idle) {
+        rq->idle_ticks++;
+        // Work queued here (the IPI may have been missed) or to steal
+        if (rq->nr_ready || busiest_rq(rq)) rq->need_resched = true;
+        return;
+    }
+    
+    rq->busy_ticks++;
+    if (proc->state == SCHED_STATE_RUNNING) {
+        if (proc->ticks_remaining) proc->ticks_remaining--;
         
         if (proc->ticks_remaining == 0) {
-             
-            proc->state = PROC_STATE_READY;
             proc->ticks_remaining = proc->timeslice;
-            scheduler_yield();
+            rq->need_resched = true;
         }
     }
 }
 
-extern void process_switch_context(u32 *old_esp_ptr, u32 new_esp);
+bool scheduler_needs_tick(void) {
+    return this_rq()->ready_bitmap != 0;
+}
+
+bool scheduler_can_block(void) {
+    u32 flags = irq_save();
+    run_queue_t *rq = this_rq();
+    pcb_t *cur = rq->current;
+    bool can = rq->idle && cur && cur != rq->idle;
+    irq_restore(flags);
+    return can;
+}
+
+bool scheduler_prepare_block(bool killable) {
+    if (!scheduler_can_block()) return false;
+    
+    u32 flags = sched_lock_irqsave();
+    pcb_t *cur = this_rq()->current;
+    // A kill that came in earlier found nothing to wake
+    bool ok = !(killable && cur->kill_pending);
+    if (ok) {
+        cur->state = SCHED_STATE_BLOCKED;
+        cur->wait_killable = killable;
+    }
+    sched_unlock_irqrestore(flags);
+    return ok;
+}
+
+void scheduler_block(void) {
+    u32 flags = sched_lock_irqsave();
+    // Still blocked unless a wakeup arrived since scheduler_prepare_block
+    if (this_rq()->current->state == SCHED_STATE_BLOCKED) {
+        schedule_locked();
+    }
+    sched_unlock_irqrestore(flags);
+}
+
+void scheduler_wake(pcb_t *proc) {
+    if (!proc) return;
+    
+    u32 flags = sched_lock_irqsave();
+    wake_locked(proc);
+    sched_unlock_irqrestore(flags);
+}
+
+void scheduler_request_resched(void) {
+    this_rq()->need_resched = true;
+}
+
+void scheduler_preempt(void) {
+    // Not inside an RCU read-side section; need_resched stays set and
+    // the next interrupt after it ends switches
+    if (rcu_read_lock_held()) return;
+    
+    run_queue_t *rq = this_rq();
+    if (!rq->need_resched) return;
+    rq->need_resched = false;
+    rq->preemptions++;
+    scheduler_yield();
+}
 
 void scheduler_yield(void) {
     if (process_count == 0) return;
     
-    // Round robin scheduling
-    int start = (current_process + 1) % MAX_PROCESSES;
-    int i = start;
-    int next_process = -1;
-    
-    do {
-        if (process_table[i].state == PROC_STATE_READY) {
-            next_process = i;
-            break;
-        }
-        i = (i + 1) % MAX_PROCESSES;
-    } while (i != start);
-    
-    if (next_process >= 0) {
-        // Switch required
-        int prev_process = current_process;
-        pcb_t *prev = prev_process >= 0 ? &process_table[prev_process] : 0;
-        pcb_t *next = &process_table[next_process];
-        
-        if (prev && prev->state == PROC_STATE_RUNNING) {
-            prev->state = PROC_STATE_READY;
-        }
-        
-        next->state = PROC_STATE_RUNNING;
-        current_process = next_process;
-        
-        // Perform actual context switch
-        if (prev) {
-            process_switch_context(&prev->saved_esp, next->saved_esp);
-        } else {
-             // First switch, special case: just dummy old pointer
-            u32 dummy;
-            process_switch_context(&dummy, next->saved_esp);
-        }
-    }
+    u32 flags = sched_lock_irqsave();
+    schedule_locked();
+    sched_unlock_irqrestore(flags);
 }
 
 pcb_t* scheduler_get_current(void) {
-    if (current_process < 0) return 0;
-    return &process_table[current_process];
+    u32 flags = irq_save();
+    pcb_t *cur = this_rq()->current;
+    irq_restore(flags);
+    return cur;
 }
 
-pcb_t* scheduler_get_process(ice_pid_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == pid && process_table[i].state != PROC_STATE_FREE) {
-            return &process_table[i];
-        }
+bool scheduler_process_exists(ice_pid_t pid) {
+    rcu_read_lock();
+    bool found = hash_lookup(pid) != 0;
+    rcu_read_unlock();
+    return found;
+}
+
+int scheduler_set_priority(ice_pid_t pid, u32 priority) {
+    if (priority >= SCHED_PRIO_LEVELS) return E_INVALID_ARG;
+    
+    u32 flags = sched_lock_irqsave();
+    pcb_t *proc = hash_lookup(pid);
+    if (!proc) {
+        sched_unlock_irqrestore(flags);
+        return E_NOT_FOUND;
     }
-    return 0;
+    if (is_idle(proc)) {
+        sched_unlock_irqrestore(flags);
+        return E_INVALID_ARG;
+    }
+    
+    // Requeue so the process lands on its new level
+    if (proc->state == SCHED_STATE_READY) {
+        run_queue_t *rq = &run_queues[proc->cpu];
+        rq_dequeue(proc);
+        proc->priority = priority;
+        rq_enqueue(rq, proc);
+    } else {
+        proc->priority = priority;
+    }
+    sched_unlock_irqrestore(flags);
+    return E_OK;
+}
+
+int scheduler_set_timeslice(ice_pid_t pid, u32 ticks) {
+    if (ticks == 0 || ticks > SCHED_SLICE_MAX) return E_INVALID_ARG;
+    
+    u32 flags = sched_lock_irqsave();
+    pcb_t *proc = hash_lookup(pid);
+    if (!proc) {
+        sched_unlock_irqrestore(flags);
+        return E_NOT_FOUND;
+    }
+    
+    proc->timeslice = ticks;
+    if (proc->ticks_remaining > ticks) proc->ticks_remaining = ticks;
+    sched_unlock_irqrestore(flags);
+    return E_OK;
 }
 
 int scheduler_get_process_count(void) {
     return process_count;
 }
 
+void scheduler_get_stats(u32 *switches, u32 *preemptions) {
+    u32 sw = 0, pre = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        sw += run_queues[i].switches;
+        pre += run_queues[i].preemptions;
+    }
+    if (switches) *switches = sw;
+    if (preemptions) *preemptions = pre;
+}
+
+int scheduler_get_cpu_stats(u32 cpu, sched_cpu_stats_t *stats) {
+    if (cpu >= SMP_MAX_CPUS || !stats) return E_INVALID_ARG;
+    
+    u32 flags = sched_lock_irqsave();
+    run_queue_t *rq = &run_queues[cpu];
+    stats->online = rq->online;
+    stats->current = rq->current ? rq->current->pid : 0;
+    stats->ready = rq->nr_ready;
+    stats->busy_ticks = rq->busy_ticks;
+    stats->idle_ticks = rq->idle_ticks;
+    stats->switches = rq->switches;
+    stats->preemptions = rq->preemptions;
+    stats->steals = rq->steals;
+    sched_unlock_irqrestore(flags);
+    return E_OK;
+}
+
 void scheduler_list_processes(void (*callback)(pcb_t *proc)) {
+    rcu_read_lock();
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state != PROC_STATE_FREE) {
-            callback(&process_table[i]);
+        pcb_t *proc = rcu_dereference(process_table[i]);
+        if (proc) {
+            callback(proc);
         }
     }
+    rcu_read_unlock();
 }
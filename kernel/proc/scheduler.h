@@ -4,17 +4,29 @@
 #define ICE_SCHEDULER_H
 
 #include "../types.h"
+#include "../cpu/fpu.h"
+#include "../sync/rcu.h"
+#include "../sync/waitqueue.h"
 
  
 #define MAX_PROCESSES 64
 
+// Priority 0 runs first; each level has its own FIFO run queue
+#define SCHED_PRIO_LEVELS   32
+#define SCHED_PRIO_DEFAULT  16
+#define SCHED_PID_HASH_SIZE 64
+
+#define SCHED_SLICE_DEFAULT 10
+#define SCHED_SLICE_MAX     1000
+
  
+// Prefixed SCHED_ so this header can be used next to core/mpm.h
 typedef enum {
-    PROC_STATE_FREE = 0,
-    PROC_STATE_READY,
-    PROC_STATE_RUNNING,
-    PROC_STATE_BLOCKED,
-    PROC_STATE_ZOMBIE
+    SCHED_STATE_FREE = 0,
+    SCHED_STATE_READY,
+    SCHED_STATE_RUNNING,
+    SCHED_STATE_BLOCKED,
+    SCHED_STATE_ZOMBIE
 } sched_state_t;
 
  
@@ -24,11 +36,11 @@ typedef struct {
     u32 ebx, edx, ecx, eax;  // Pushed by pusha
     u32 eip;                 // Instruction pointer
     u32 eflags;              // Flags
-    u32 cr3;                 // CR3 (PDBR) - kept for future paging support
+    u32 cr3;                 // Page directory (0 = kernel directory)
 } cpu_context_t;
 
  
-typedef struct {
+typedef struct pcb {
     ice_pid_t pid;
     exec_id_t exec_id;
     sched_state_t state;
@@ -39,8 +51,13 @@ typedef struct {
     
     u32 saved_esp;
     
+    // FXSAVE image, valid once fpu_used (see cpu/fpu.c)
+    u8 fpu_area[FPU_AREA_SIZE];
+    bool fpu_used;
+    
     u32 kernel_stack;
-    u32 user_stack;
+    u32 user_stack;          // Initial ring 3 ESP; 0 for kernel threads
+    u32 user_entry;
     
      
     u32 memory_used;
@@ -51,6 +68,30 @@ typedef struct {
      
     u32 timeslice;
     u32 ticks_remaining;
+    u32 priority;
+    
+    // Run queue the process is on, or last ran on
+    u32 cpu;
+    
+    // Killed: exits at its next safe point (scheduler_kill_process)
+    bool kill_pending;
+    
+    // Blocked in a wait that a kill may end early
+    bool wait_killable;
+    
+    // Set, and exit_wait woken, under waitqueue_lock once the process
+    // has started to exit (scheduler_wait_exit)
+    bool exiting;
+    waitqueue_t exit_wait;
+    
+    // Run queue links (valid while READY) and PID hash chain
+    struct pcb *rq_next;
+    struct pcb *rq_prev;
+    struct pcb *hash_next;
+    
+    // Lookups run under RCU: the PCB is freed a grace period after it
+    // leaves the table and hash
+    rcu_head_t rcu;
 } pcb_t;
 
  
@@ -59,20 +100,82 @@ void scheduler_init(void);
  
 ice_pid_t scheduler_create_process(const char *name, u32 entry_point);
 
- 
+// Kernel thread running fn(arg); it exits when fn returns
+ice_pid_t scheduler_create_kthread(const char *name, void (*fn)(void *arg), void *arg);
+
+// Process that starts in the kernel at entry(arg), which drops to ring
+// 3 at user_entry with user_stack (see proc/uproc.c). Takes over pd,
+// including on failure.
+ice_pid_t scheduler_create_user_process(const char *name, void (*entry)(void *arg),
+                                        void *arg, u32 pd,
+                                        u32 user_entry, u32 user_stack);
+
+// Kill a process. Only the caller itself exits at once; any other
+// process may be inside the kernel holding a mutex or with wait entries
+// and timers linked from its stack, so it exits by itself at its next
+// safe point: on its way back to ring 3, or when a killable wait fails
+// with E_KILLED and the kernel code that waited unwinds and returns.
+// Uninterruptible sleeps (mutexes, driver I/O) finish first.
 void scheduler_kill_process(ice_pid_t pid);
 
- 
+// Whether the calling process has been killed. Kernel threads that
+// never sleep killably check it where they hold nothing, and return.
+bool scheduler_killed(void);
+
+// Sleep until process pid has exited. Returns E_OK once it has (or if
+// there was no such process), E_KILLED if the caller was killed first,
+// and E_TIMEOUT when the caller cannot sleep.
+int scheduler_wait_exit(ice_pid_t pid);
+
+// Terminate the calling process. Process entry functions return here.
+void scheduler_exit(void);
+
+// Timer tick: charge the running process and flag a reschedule when
+// its timeslice is used up. Called from the clock interrupt of each CPU.
 void scheduler_tick(void);
 
+// True while other processes are waiting for the calling CPU, i.e. its
+// clock (the PIT on the boot CPU, else the local APIC timer) must keep
+// delivering preemption ticks. Interrupts off.
+bool scheduler_needs_tick(void);
+
+// Whether the caller may block (there is an idle process to fall back to)
+bool scheduler_can_block(void);
+
+// Blocking is two steps so a wakeup cannot be missed: mark the caller
+// blocked, publish it to the waker (wait queue, timer), then call
+// scheduler_block(), which only sleeps if no scheduler_wake() came in
+// between. A killable sleep is also ended by a kill. prepare returns
+// false when the caller cannot block, or for a killable sleep when it
+// has already been killed.
+bool scheduler_prepare_block(bool killable);
+void scheduler_block(void);
+
+// Make a blocked process runnable, on an idle CPU if its own is busy.
+// Safe from interrupt handlers.
+void scheduler_wake(pcb_t *proc);
+
+// Flag a reschedule on this CPU (reschedule IPI)
+void scheduler_request_resched(void);
+
+// Switch if a reschedule is pending. Called by irq_handler after EOI,
+// so the timer keeps running while another context executes.
+void scheduler_preempt(void);
+
  
 void scheduler_yield(void);
 
  
 pcb_t* scheduler_get_current(void);
 
- 
-pcb_t* scheduler_get_process(ice_pid_t pid);
+// Whether pid names a live process. Only a snapshot: the process may be
+// gone, and its pid reused, by the time the caller looks at the answer.
+bool scheduler_process_exists(ice_pid_t pid);
+
+// Both return E_OK, E_NOT_FOUND or E_INVALID_ARG. A new timeslice
+// takes effect when the current one runs out.
+int scheduler_set_priority(ice_pid_t pid, u32 priority);
+int scheduler_set_timeslice(ice_pid_t pid, u32 ticks);
 
  
 int scheduler_get_process_count(void);
@@ -80,4 +183,28 @@ int scheduler_get_process_count(void);
  
 void scheduler_list_processes(void (*callback)(pcb_t *proc));
 
+// Context switches and timer preemptions so far, summed over CPUs
+void scheduler_get_stats(u32 *switches, u32 *preemptions);
+
+typedef struct {
+    bool online;
+    ice_pid_t current;       // Running process (the idle one when idle)
+    u32 ready;               // Processes waiting in this CPU's run queue
+    u32 busy_ticks;
+    u32 idle_ticks;
+    u32 switches;
+    u32 preemptions;
+    u32 steals;              // Processes pulled from other CPUs' queues
+} sched_cpu_stats_t;
+
+// Per-CPU counters; returns E_INVALID_ARG for an unknown CPU
+int scheduler_get_cpu_stats(u32 cpu, sched_cpu_stats_t *stats);
+
+// Adopt the caller (an AP's boot context) as the idle process of cpu
+// and put its run queue online. Interrupts must be off.
+void scheduler_init_cpu(u32 cpu);
+
+// Idle loop of a CPU; never returns
+void scheduler_idle(void) __attribute__((noreturn));
+
 #endif  
@@ -0,0 +1,176 @@
+/*
+ * ICE system calls
+ *
+ * Two ways in, one table. int 0x80 goes through the IDT like any other
+ * vector. sysenter skips the gate and the stack switch microcode: its
+ * MSRs point ESP at the CPU's TSS esp0 field, the stub loads the real
+ * kernel stack from there and builds the same interrupt_frame_t, and
+ * sysexit returns without an iret.
+ */
+
+#include "syscall.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "uproc.h"
+#include "../cpu/idt.h"
+#include "../cpu/gdt.h"
+#include "../cpu/msr.h"
+#include "../cpu/cpuid.h"
+#include "../cpu/smp.h"
+#include "../cpu/irqflags.h"
+#include "../tty/tty.h"
+#include "../errno.h"
+
+#define WRITE_CHUNK 128
+
+typedef u32 (*syscall_fn_t)(u32 a, u32 b, u32 c);
+
+static bool have_sysenter = false;
+
+// sysenter: ECX = user ESP, EDX = user EIP, interrupts off. The frame
+// matches isr_common_stub's so both paths share syscall_dispatch. DF is
+// whatever ring 3 left, so clear it as isr_common_stub does for int 0x80.
+__asm__ (
+    ".text\n"
+    ".align 16\n"
+    ".global sysenter_entry\n"
+    "sysenter_entry:\n"
+    "    cld\n"
+    "    movl (%esp), %esp\n"        // TSS esp0
+    "    pushl $0x23\n"              // SS
+    "    pushl %ecx\n"               // User ESP
+    "    pushl $0x202\n"             // EFLAGS
+    "    pushl $0x1B\n"              // CS
+    "    pushl %edx\n"               // EIP
+    "    pushl $0\n"
+    "    pushl $0x80\n"
+    "    pusha\n"
+    "    pushl $0x23\n"              // DS
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    pushl %esp\n"
+    "    call syscall_dispatch\n"
+    "    addl $4, %esp\n"
+    "    popl %eax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    popa\n"
+    "    movl 8(%esp), %edx\n"       // EIP
+    "    movl 20(%esp), %ecx\n"      // ESP
+    "    sti\n"                      // Takes effect after sysexit
+    "    sysexit\n"
+);
+
+extern void sysenter_entry(void);
+
+static u32 sys_null(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    return 0;
+}
+
+static u32 sys_exit(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    scheduler_exit();
+    return 0;
+}
+
+static u32 sys_write(u32 buf, u32 len, u32 c) {
+    (void)c;
+    if (!uproc_access_ok(buf, len)) return (u32)E_INVALID_ARG;
+
+    char chunk[WRITE_CHUNK + 1];
+    for (u32 done = 0; done < len; ) {
+        u32 n = len - done < WRITE_CHUNK ? len - done : WRITE_CHUNK;
+        for (u32 i = 0; i < n; i++) chunk[i] = ((const char*)buf)[done + i];
+        chunk[n] = '\0';
+        tty_puts(chunk);
+        done += n;
+    }
+    return len;
+}
+
+static u32 sys_yield(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    scheduler_yield();
+    return 0;
+}
+
+static u32 sys_getpid(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    pcb_t *self = scheduler_get_current();
+    return self ? self->pid : 0;
+}
+
+static u32 sys_sleep(u32 ms, u32 b, u32 c) {
+    (void)b; (void)c;
+    timer_sleep_ms(ms);
+    return 0;
+}
+
+static u32 sys_fork(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    ice_pid_t pid = uproc_fork();
+    return pid ? pid : (u32)E_NO_MEM;
+}
+
+static u32 sys_wait(u32 pid, u32 b, u32 c) {
+    (void)b; (void)c;
+    pcb_t *self = scheduler_get_current();
+    if (!pid || (self && self->pid == pid)) return (u32)E_INVALID_ARG;
+    return (u32)scheduler_wait_exit(pid);
+}
+
+static const syscall_fn_t syscall_table[SYS_COUNT] = {
+    [SYS_NULL]   = sys_null,
+    [SYS_EXIT]   = sys_exit,
+    [SYS_WRITE]  = sys_write,
+    [SYS_YIELD]  = sys_yield,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_SLEEP]  = sys_sleep,
+    [SYS_FORK]   = sys_fork,
+    [SYS_WAIT]   = sys_wait,
+};
+
+// Both entry paths arrive with interrupts off; calls run preemptible
+void syscall_dispatch(interrupt_frame_t *frame) {
+    u32 nr = frame->eax;
+    if (nr >= SYS_COUNT) {
+        frame->eax = (u32)E_INVALID_ARG;
+        return;
+    }
+
+    __asm__ volatile ("sti");
+    frame->eax = syscall_table[nr](frame->ebx, frame->esi, frame->edi);
+    // The call is done and holds nothing: a kill takes effect here
+    if (scheduler_killed()) scheduler_exit();
+    __asm__ volatile ("cli");
+    // Whatever the tracer saw open before the call is stale; time the
+    // way out from here
+    trace_irqs_off();
+}
+
+void syscall_init_cpu(void) {
+    if (!have_sysenter) return;
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, gdt_kernel_stack_slot(smp_cpu_id()));
+    wrmsr(MSR_SYSENTER_EIP, (u32)sysenter_entry);
+}
+
+void syscall_init(void) {
+    idt_register_handler(SYSCALL_VECTOR, syscall_dispatch);
+
+    // Pentium Pro reports SEP without implementing it
+    const cpu_info_t *info = cpu_get_info();
+    have_sysenter = cpu_has(CPU_FEATURE_SEP) && cpu_has(CPU_FEATURE_MSR) &&
+                    !(info->family == 6 && info->model < 3 && info->stepping < 3);
+    syscall_init_cpu();
+}
+
+bool syscall_has_sysenter(void) {
+    return have_sysenter;
+}
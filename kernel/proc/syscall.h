@@ -0,0 +1,31 @@
+#ifndef ICE_SYSCALL_H
+#define ICE_SYSCALL_H
+
+#include "../types.h"
+
+// System call numbers. EAX holds the number and EBX, ESI, EDI the
+// arguments on both entry paths; the result comes back in EAX.
+//
+//   int 0x80   always available
+//   sysenter   ECX = user ESP, EDX = return EIP (clobbered)
+#define SYS_NULL    0      // Does nothing; for latency measurements
+#define SYS_EXIT    1
+#define SYS_WRITE   2      // (buf, len) to the console
+#define SYS_YIELD   3
+#define SYS_GETPID  4
+#define SYS_SLEEP   5      // (ms)
+#define SYS_FORK    6      // Child PID to the parent, 0 to the child
+#define SYS_WAIT    7      // (pid) until that process has exited
+#define SYS_COUNT   8
+
+#define SYSCALL_VECTOR 0x80
+
+// Install the int 0x80 handler and set up sysenter on the boot CPU
+void syscall_init(void);
+
+// sysenter MSRs of the calling CPU (APs)
+void syscall_init_cpu(void);
+
+bool syscall_has_sysenter(void);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * ICE kernel timers - hierarchical timer wheel
+ *
+ * Level 0 has one slot per millisecond for the next 256 ms; each
+ * higher level has 64 slots covering 64 times the span of the level
+ * below. Timers sit in the lowest level that can hold them and move
+ * down (cascade) when level 0 wraps, so add, cancel and expiry are all
+ * O(1). Time comes from the PIT, which is programmed one-shot to the
+ * next slot that holds a timer. Timers expire on the boot CPU only.
+ */
+
+#include "timer.h"
+#include "scheduler.h"
+#include "../drivers/pit.h"
+#include "../sync/spinlock.h"
+#include "../cpu/irqflags.h"
+
+#define TW_L0_BITS  8
+#define TW_LN_BITS  6
+#define TW_L0_SIZE  (1 << TW_L0_BITS)
+#define TW_LN_SIZE  (1 << TW_LN_BITS)
+#define TW_LEVELS   3       // Levels above level 0
+
+// Furthest a timer can be placed; later ones are re-sorted on cascade
+#define TW_MAX_DELTA ((1ULL << (TW_L0_BITS + TW_LEVELS * TW_LN_BITS)) - 1)
+
+static ktimer_t *wheel0[TW_L0_SIZE];
+static ktimer_t *wheeln[TW_LEVELS][TW_LN_SIZE];
+
+// Next millisecond to process; every pending timer expires at or after it
+static u64 wheel_base = 0;
+static u32 pending_count = 0;
+static bool timer_ready = false;
+
+// Guards the wheel. Dropped while a callback runs, so callbacks may arm
+// and cancel timers; running_timer tells timer_cancel_sync to wait.
+static spinlock_t timer_lock;
+static ktimer_t * volatile running_timer = 0;
+
+static inline u32 timer_lock_irqsave(void) {
+    u32 flags = irq_save();
+    spinlock_acquire_raw(&timer_lock);
+    return flags;
+}
+
+static inline void timer_unlock_irqrestore(u32 flags) {
+    spinlock_release_raw(&timer_lock);
+    irq_restore(flags);
+}
+
+static void slot_add(ktimer_t **slot, ktimer_t *t) {
+    t->slot = slot;
+    t->prev = 0;
+    t->next = *slot;
+    if (*slot) (*slot)->prev = t;
+    *slot = t;
+}
+
+static ktimer_t **slot_for(ktimer_t *t) {
+    u64 expires = t->expires;
+    if (expires < wheel_base) expires = wheel_base;
+    u64 delta = expires - wheel_base;
+    
+    if (delta < TW_L0_SIZE) {
+        return &wheel0[expires & (TW_L0_SIZE - 1)];
+    }
+    if (delta > TW_MAX_DELTA) {
+        expires = wheel_base + TW_MAX_DELTA;
+        delta = TW_MAX_DELTA;
+    }
+    
+    int level = 0;
+    u32 shift = TW_L0_BITS;
+    while (level < TW_LEVELS - 1 && delta >= (1ULL << (shift + TW_LN_BITS))) {
+        level++;
+        shift += TW_LN_BITS;
+    }
+    return &wheeln[level][(expires >> shift) & (TW_LN_SIZE - 1)];
+}
+
+// Caller holds interrupts off; t must be pending
+static void timer_unlink(ktimer_t *t) {
+    if (t->prev) t->prev->next = t->next;
+    else *t->slot = t->next;
+    if (t->next) t->next->prev = t->prev;
+    t->next = t->prev = 0;
+    t->slot = 0;
+    t->pending = false;
+    pending_count--;
+}
+
+static void cascade(ktimer_t **slot) {
+    ktimer_t *t = *slot;
+    *slot = 0;
+    while (t) {
+        ktimer_t *next = t->next;
+        slot_add(slot_for(t), t);
+        t = next;
+    }
+}
+
+void timer_init(void) {
+    for (int i = 0; i < TW_L0_SIZE; i++) wheel0[i] = 0;
+    for (int l = 0; l < TW_LEVELS; l++) {
+        for (int i = 0; i < TW_LN_SIZE; i++) wheeln[l][i] = 0;
+    }
+    wheel_base = pit_get_ms();
+    pending_count = 0;
+    spinlock_init(&timer_lock);
+    timer_ready = true;
+}
+
+void timer_setup(ktimer_t *timer, timer_fn_t fn, void *arg) {
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->next = timer->prev = 0;
+    timer->slot = 0;
+    timer->pending = false;
+    timer->expires = 0;
+}
+
+void timer_add(ktimer_t *timer, u32 delay_ms) {
+    if (!timer_ready || !timer->fn) return;
+    if (delay_ms == 0) delay_ms = 1;
+    
+    u32 flags = timer_lock_irqsave();
+    if (timer->pending) timer_unlink(timer);
+    timer->expires = pit_get_ms() + delay_ms;
+    slot_add(slot_for(timer), timer);
+    timer->pending = true;
+    pending_count++;
+    spinlock_release_raw(&timer_lock);
+    
+    // The clock may be programmed past this deadline
+    pit_wake_within(delay_ms);
+    irq_restore(flags);
+}
+
+bool timer_cancel(ktimer_t *timer) {
+    u32 flags = timer_lock_irqsave();
+    bool was_pending = timer->pending;
+    if (was_pending) timer_unlink(timer);
+    timer_unlock_irqrestore(flags);
+    return was_pending;
+}
+
+bool timer_cancel_sync(ktimer_t *timer) {
+    for (;;) {
+        u32 flags = timer_lock_irqsave();
+        bool was_pending = timer->pending;
+        if (was_pending) timer_unlink(timer);
+        bool running = (running_timer == timer);
+        timer_unlock_irqrestore(flags);
+        
+        if (!running) return was_pending;
+        __asm__ volatile ("pause");
+    }
+}
+
+u64 timer_now_ms(void) {
+    return pit_get_ms();
+}
+
+void timer_run(u64 now_ms) {
+    if (!timer_ready) return;
+    
+    spinlock_acquire_raw(&timer_lock);
+    while (wheel_base <= now_ms) {
+        u32 idx = (u32)wheel_base & (TW_L0_SIZE - 1);
+        
+        // Level 0 wrapped: pull the next span down from the levels above
+        if (idx == 0) {
+            u32 shift = TW_L0_BITS;
+            for (int l = 0; l < TW_LEVELS; l++) {
+                u32 i = (u32)(wheel_base >> shift) & (TW_LN_SIZE - 1);
+                cascade(&wheeln[l][i]);
+                if (i != 0) break;
+                shift += TW_LN_BITS;
+            }
+        }
+        
+        while (wheel0[idx]) {
+            ktimer_t *t = wheel0[idx];
+            wheel0[idx] = t->next;
+            if (t->next) t->next->prev = 0;
+            t->next = t->prev = 0;
+            t->slot = 0;
+            t->pending = false;
+            pending_count--;
+            
+            running_timer = t;
+            spinlock_release_raw(&timer_lock);
+            t->fn(t->arg);
+            spinlock_acquire_raw(&timer_lock);
+            running_timer = 0;
+        }
+        wheel_base++;
+    }
+    spinlock_release_raw(&timer_lock);
+}
+
+u32 timer_next_event(u64 now_ms, u32 limit) {
+    if (!timer_ready || pending_count == 0) return limit;
+    
+    u32 flags = timer_lock_irqsave();
+    u32 next = limit;
+    u64 t = wheel_base;
+    if (t <= now_ms) {
+        next = 1;
+    } else {
+        for (u32 delay = (u32)(t - now_ms); delay < limit; delay++, t++) {
+            u32 idx = (u32)t & (TW_L0_SIZE - 1);
+            // Slots beyond a wrap are only valid after the cascade
+            if (idx == 0 || wheel0[idx]) {
+                next = delay;
+                break;
+            }
+        }
+    }
+    timer_unlock_irqrestore(flags);
+    return next;
+}
+
+u32 timer_pending_count(void) {
+    return pending_count;
+}
+
+static void sleep_wakeup(void *arg) {
+    scheduler_wake((pcb_t*)arg);
+}
+
+void timer_sleep_ms(u32 ms) {
+    if (ms == 0) return;
+    
+    pcb_t *self = scheduler_get_current();
+    if (timer_ready && irqs_enabled() && scheduler_can_block()) {
+        ktimer_t timer;
+        timer_setup(&timer, sleep_wakeup, self);
+        
+        // Publish the wakeup before sleeping so it cannot be missed.
+        // A kill ends the sleep early.
+        u32 flags = irq_save();
+        if (scheduler_prepare_block(true)) {
+            timer_add(&timer, ms);
+            scheduler_block();
+            timer_cancel_sync(&timer);
+        }
+        irq_restore(flags);
+        return;
+    }
+    
+    u64 target = pit_get_ms() + ms;
+    while (pit_get_ms() < target) {
+        __asm__ volatile ("hlt");
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef ICE_TIMER_H
+#define ICE_TIMER_H
+
+#include "../types.h"
+
+// Timer callbacks run from the timer interrupt with interrupts off
+typedef void (*timer_fn_t)(void *arg);
+
+typedef struct ktimer {
+    u64 expires;            // Absolute time in ms
+    timer_fn_t fn;
+    void *arg;
+    struct ktimer *next;
+    struct ktimer *prev;
+    struct ktimer **slot;   // Wheel slot holding the timer while pending
+    bool pending;
+} ktimer_t;
+
+void timer_init(void);
+
+void timer_setup(ktimer_t *timer, timer_fn_t fn, void *arg);
+
+// Arm (or re-arm) a timer to fire after delay_ms milliseconds
+void timer_add(ktimer_t *timer, u32 delay_ms);
+
+// Returns true if the timer was pending and will no longer fire
+bool timer_cancel(ktimer_t *timer);
+
+// As timer_cancel, and also waits for the callback if it is running on
+// another CPU. Use before freeing a timer; never while holding a lock
+// the callback takes.
+bool timer_cancel_sync(ktimer_t *timer);
+
+// Milliseconds since the timer was initialized
+u64 timer_now_ms(void);
+
+// Block the calling process for ms milliseconds, or until it is killed.
+// Falls back to halting in place when there is no other context to run
+// (early boot, IRQs off).
+void timer_sleep_ms(u32 ms);
+
+// Run expired timers up to now_ms. Called by the clock interrupt.
+void timer_run(u64 now_ms);
+
+// Milliseconds from now_ms until the wheel next needs servicing,
+// at most limit. Used to program the one-shot clock.
+u32 timer_next_event(u64 now_ms, u32 limit);
+
+u32 timer_pending_count(void);
+
+#endif
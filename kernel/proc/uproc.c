@@ -0,0 +1,229 @@
+/*
+ * ICE user processes
+ *
+ * A user process is an ordinary scheduler process whose kernel entry
+ * point drops to ring 3. Its image and stack are private pages in the
+ * user slot of its own directory; everything else stays supervisor-only.
+ * Traps and system calls come back in on the process's kernel stack.
+ *
+ * uproc_fork clones a process by sharing every user page copy-on-write;
+ * the page fault handler copies a page on the first write to it.
+ */
+
+#include "uproc.h"
+#include "scheduler.h"
+#include "../mm/paging.h"
+#include "../mm/memacct.h"
+#include "../mm/slab.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../errno.h"
+#include <string.h>
+
+#define USER_PAGE_FLAGS (PAGE_PRESENT | PAGE_WRITE | PAGE_USER)
+
+#define PF_VECTOR  14
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+
+static uproc_stats_t stats;
+
+static inline u32 read_cr2(void) {
+    u32 v;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(v));
+    return v;
+}
+
+// Kernel side of a new user process: build an iret frame for ring 3
+// and leave. The kernel stack below it is reused by the next trap.
+static void uproc_enter(void *arg) {
+    (void)arg;
+    pcb_t *self = scheduler_get_current();
+    __asm__ volatile (
+        "cli\n"
+        "movw %w2, %%ds\n"
+        "movw %w2, %%es\n"
+        "movw %w2, %%fs\n"
+        "movw %w2, %%gs\n"
+        "pushl %2\n"             // SS
+        "pushl %0\n"             // ESP
+        "pushl $0x202\n"         // EFLAGS: IF
+        "pushl %3\n"             // CS
+        "pushl %1\n"             // EIP
+        "xorl %%eax, %%eax\n"
+        "xorl %%ebx, %%ebx\n"
+        "xorl %%ecx, %%ecx\n"
+        "xorl %%edx, %%edx\n"
+        "xorl %%esi, %%esi\n"
+        "xorl %%edi, %%edi\n"
+        "xorl %%ebp, %%ebp\n"
+        "iret\n"
+        : : "m"(self->user_stack), "m"(self->user_entry),
+            "r"((u32)USER_DS), "i"(USER_CS)
+        : "memory");
+}
+
+// Map a fresh zeroed page at virt in pd
+static bool map_user_page(u32 pd, u32 virt) {
+    phys_addr_t page = pmm_alloc_zeroed_page();
+    if (!page) return false;
+    if (paging_map_page(pd, virt, page, USER_PAGE_FLAGS) != 0) {
+        pmm_free_page(page);
+        return false;
+    }
+    memacct_charge_pages(MEM_TAG_SCHED, 1);
+    return true;
+}
+
+void uproc_get_stats(uproc_stats_t *out) {
+    *out = stats;
+}
+
+// Kernel side of a clone: return to ring 3 through a copy of the
+// parent's trap frame, with EAX = 0 as fork's result in the child
+static void uproc_fork_enter(void *arg) {
+    interrupt_frame_t frame = *(interrupt_frame_t*)arg;
+    kfree(arg);
+    frame.eax = 0;
+    __asm__ volatile (
+        "cli\n"
+        "movl %0, %%esp\n"
+        "popl %%eax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%fs\n"
+        "movw %%ax, %%gs\n"
+        "popa\n"
+        "addl $8, %%esp\n"      // int_no, err_code
+        "iret\n"
+        : : "r"(&frame) : "memory");
+}
+
+// Directory with an empty user slot, 0 on failure
+static u32 new_directory(void) {
+    // The slot must not shadow RAM the kernel reaches through the identity map
+    if (!paging_enabled() || pmm_get_highest_page() >= USER_BASE / PAGE_SIZE) return 0;
+
+    u32 pd = paging_create_directory();
+    if (!pd) return 0;
+
+    // Drop the identity mapping of the slot: unmapped user addresses fault
+    for (u32 va = USER_BASE; va < USER_STACK_TOP; va += PAGE_SIZE) {
+        if (paging_unmap_page(pd, va) != 0) {
+            paging_destroy_directory(pd);
+            return 0;
+        }
+    }
+    return pd;
+}
+
+// Trap frame of the current entry from ring 3, at the top of the kernel
+// stack where both int 0x80 and sysenter build it
+static interrupt_frame_t *user_frame(pcb_t *proc) {
+    return (interrupt_frame_t*)(proc->kernel_stack + PAGE_SIZE) - 1;
+}
+
+static void page_fault(interrupt_frame_t *frame) {
+    u32 addr = read_cr2();
+    pcb_t *self = scheduler_get_current();
+
+    if ((frame->err_code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+        self && self->user_stack && addr >= USER_BASE && addr < USER_STACK_TOP) {
+        bool copied;
+        if (paging_cow_fault(self->context.cr3, addr, &copied) == E_OK) {
+            if (copied) {
+                memacct_charge_pages(MEM_TAG_SCHED, 1);
+                stats.pages_copied++;
+            }
+            stats.cow_faults++;
+            return;
+        }
+    }
+    idt_default_exception(frame);
+}
+
+void uproc_init(void) {
+    idt_register_handler(PF_VECTOR, page_fault);
+}
+
+ice_pid_t uproc_spawn(const char *name, const void *image, u32 size) {
+    if (!size || size > USER_IMAGE_MAX) return 0;
+
+    u32 pd = new_directory();
+    if (!pd) return 0;
+
+    for (u32 off = 0; off < size; off += PAGE_SIZE) {
+        if (!map_user_page(pd, USER_BASE + off)) goto fail;
+        u32 chunk = size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+        memcpy((void*)paging_get_phys(pd, USER_BASE + off), (const u8*)image + off, chunk);
+    }
+    for (u32 i = 1; i <= USER_STACK_PAGES; i++) {
+        if (!map_user_page(pd, USER_STACK_TOP - i * PAGE_SIZE)) goto fail;
+    }
+
+    return scheduler_create_user_process(name, uproc_enter, 0, pd,
+                                         USER_BASE, USER_STACK_TOP);
+
+fail:
+    uproc_release(pd);
+    paging_destroy_directory(pd);
+    return 0;
+}
+
+ice_pid_t uproc_fork(void) {
+    pcb_t *self = scheduler_get_current();
+    if (!self || !self->user_stack) return 0;
+
+    interrupt_frame_t *frame = user_frame(self);
+    interrupt_frame_t *copy = (interrupt_frame_t*)kmalloc(sizeof(*copy));
+    if (!copy) return 0;
+    *copy = *frame;
+
+    u32 pd = new_directory();
+    if (!pd) {
+        kfree(copy);
+        return 0;
+    }
+
+    int shared = paging_cow_share(self->context.cr3, pd, USER_BASE, USER_STACK_TOP);
+    if (shared < 0) {
+        uproc_release(pd);
+        paging_destroy_directory(pd);
+        kfree(copy);
+        return 0;
+    }
+
+    ice_pid_t pid = scheduler_create_user_process(self->name, uproc_fork_enter, copy, pd,
+                                                  frame->eip, frame->useresp);
+    if (!pid) {
+        kfree(copy);
+        return 0;
+    }
+    stats.clones++;
+    stats.pages_shared += shared;
+    return pid;
+}
+
+void uproc_release(u32 pd) {
+    if (!pd) return;
+    for (u32 va = USER_BASE; va < USER_STACK_TOP; va += PAGE_SIZE) {
+        phys_addr_t page = paging_get_phys(pd, va);
+        if (!page) continue;
+        // Shared pages stay with the other processes mapping them
+        if (pmm_page_unref(page & PAGE_FRAME_MASK)) {
+            memacct_uncharge_pages(MEM_TAG_SCHED, 1);
+        }
+    }
+}
+
+bool uproc_access_ok(u32 addr, u32 len) {
+    pcb_t *self = scheduler_get_current();
+    if (!self || !self->user_stack) return false;
+    if (addr < USER_BASE || addr >= USER_STACK_TOP) return false;
+    if (len > USER_STACK_TOP - addr) return false;
+
+    for (u32 va = addr & PAGE_FRAME_MASK; va < addr + len; va += PAGE_SIZE) {
+        if (!paging_get_phys(self->context.cr3, va)) return false;
+    }
+    return true;
+}
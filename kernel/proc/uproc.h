@@ -0,0 +1,49 @@
+#ifndef ICE_UPROC_H
+#define ICE_UPROC_H
+
+#include "../types.h"
+#include "../mm/pmm.h"
+
+// User processes live in one 4 MiB slot of their private directory:
+// the image from the bottom, the stack down from the top. The slot sits
+// above RAM and below the PCI hole, so it hides nothing the kernel uses.
+#define USER_BASE        0xA0000000
+#define USER_SIZE        0x400000
+#define USER_STACK_TOP   (USER_BASE + USER_SIZE)
+#define USER_STACK_PAGES 4
+#define USER_IMAGE_MAX   (USER_SIZE - USER_STACK_PAGES * PAGE_SIZE)
+
+// Ring 3 selectors (GDT_USER_CODE / GDT_USER_DATA with RPL 3)
+#define USER_CS 0x1B
+#define USER_DS 0x23
+
+typedef struct {
+    u32 clones;             // Successful uproc_fork calls
+    u32 pages_shared;       // Pages mapped into clones instead of copied
+    u32 cow_faults;         // Write faults resolved by copy-on-write
+    u32 pages_copied;       // Of those, the ones that needed a new page
+} uproc_stats_t;
+
+// Install the copy-on-write page fault handler
+void uproc_init(void);
+
+// Start a ring 3 process running a flat, position-dependent image
+// linked at USER_BASE, entered at its first byte. Returns 0 on failure.
+ice_pid_t uproc_spawn(const char *name, const void *image, u32 size);
+
+// Clone the calling user process. The child shares every user page
+// copy-on-write and resumes from the same system call with EAX = 0; its
+// FPU state starts clean. Returns the child's PID, 0 on failure.
+ice_pid_t uproc_fork(void);
+
+// Drop a directory's references to its user pages, freeing those no
+// other process maps. The scheduler calls this when a user process is
+// destroyed.
+void uproc_release(u32 pd);
+
+// Whether [addr, addr + len) is mapped user memory of the current process
+bool uproc_access_ok(u32 addr, u32 len);
+
+void uproc_get_stats(uproc_stats_t *stats);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * ICE workqueue
+ *
+ * One FIFO of work items and one kernel thread draining it. The worker
+ * runs above default priority so deferred interrupt work preempts
+ * ordinary processes as soon as it is queued, but it is still
+ * preemptible and runs with interrupts on.
+ */
+
+#include "workqueue.h"
+#include "scheduler.h"
+#include "../sync/spinlock.h"
+#include "../sync/waitqueue.h"
+
+#define WORKER_PRIORITY 4
+
+static spinlock_t wq_lock;
+static work_t *head = 0;
+static work_t *tail = 0;
+static waitqueue_t worker_wait;
+static ice_pid_t worker_pid = 0;
+
+static workqueue_stats_t stats;
+
+static bool has_work(void *arg) {
+    (void)arg;
+    return head != 0;
+}
+
+static work_t *dequeue(void) {
+    spinlock_acquire(&wq_lock);
+    work_t *work = head;
+    if (work) {
+        head = work->next;
+        if (!head) tail = 0;
+        work->next = 0;
+        work->pending = false;
+
+        u32 waited = (u32)(timer_now_ms() - work->queued_ms);
+        if (waited > stats.max_latency_ms) stats.max_latency_ms = waited;
+        stats.run++;
+    }
+    spinlock_release(&wq_lock);
+    return work;
+}
+
+static void worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        waitqueue_wait_until(&worker_wait, has_work, 0, WAIT_FOREVER);
+
+        work_t *work;
+        while ((work = dequeue()) != 0) {
+            work->fn(work->arg);
+        }
+    }
+}
+
+void work_init(work_t *work, work_fn_t fn, void *arg) {
+    work->fn = fn;
+    work->arg = arg;
+    work->next = 0;
+    work->queued_ms = 0;
+    work->pending = false;
+}
+
+bool queue_work(work_t *work) {
+    spinlock_acquire(&wq_lock);
+    if (work->pending) {
+        stats.merged++;
+        spinlock_release(&wq_lock);
+        return false;
+    }
+    work->pending = true;
+    work->next = 0;
+    work->queued_ms = timer_now_ms();
+    if (tail) tail->next = work; else head = work;
+    tail = work;
+    stats.queued++;
+    spinlock_release(&wq_lock);
+
+    waitqueue_wake_one(&worker_wait);
+    return true;
+}
+
+bool cancel_work(work_t *work) {
+    bool was_pending = false;
+
+    spinlock_acquire(&wq_lock);
+    if (work->pending) {
+        work_t *prev = 0;
+        for (work_t *w = head; w; prev = w, w = w->next) {
+            if (w != work) continue;
+            if (prev) prev->next = w->next; else head = w->next;
+            if (tail == w) tail = prev;
+            w->next = 0;
+            w->pending = false;
+            was_pending = true;
+            break;
+        }
+    }
+    spinlock_release(&wq_lock);
+    return was_pending;
+}
+
+static void delayed_work_fire(void *arg) {
+    queue_work(&((delayed_work_t*)arg)->work);
+}
+
+void delayed_work_init(delayed_work_t *dw, work_fn_t fn, void *arg) {
+    work_init(&dw->work, fn, arg);
+    timer_setup(&dw->timer, delayed_work_fire, dw);
+}
+
+bool schedule_delayed_work(delayed_work_t *dw, u32 delay_ms) {
+    if (dw->timer.pending || dw->work.pending) return false;
+    if (!delay_ms) return queue_work(&dw->work);
+    timer_add(&dw->timer, delay_ms);
+    return true;
+}
+
+bool cancel_delayed_work(delayed_work_t *dw) {
+    bool timer_was = timer_cancel(&dw->timer);
+    bool work_was = cancel_work(&dw->work);
+    return timer_was || work_was;
+}
+
+void workqueue_init(void) {
+    spinlock_init(&wq_lock);
+    waitqueue_init(&worker_wait);
+
+    worker_pid = scheduler_create_kthread("kworker", worker_main, 0);
+    if (worker_pid) scheduler_set_priority(worker_pid, WORKER_PRIORITY);
+}
+
+ice_pid_t workqueue_worker_pid(void) {
+    return worker_pid;
+}
+
+void workqueue_get_stats(workqueue_stats_t *out) {
+    spinlock_acquire(&wq_lock);
+    *out = stats;
+    spinlock_release(&wq_lock);
+}
@@ -0,0 +1,59 @@
+#ifndef ICE_WORKQUEUE_H
+#define ICE_WORKQUEUE_H
+
+#include "../types.h"
+#include "timer.h"
+
+// Deferred work. Interrupt handlers do the minimum with interrupts off
+// and queue the rest; a kernel worker thread runs it later, preemptible
+// and with interrupts on, so it may take locks, sleep and allocate.
+typedef void (*work_fn_t)(void *arg);
+
+typedef struct work {
+    work_fn_t fn;
+    void *arg;
+    struct work *next;
+    u64 queued_ms;
+    volatile bool pending;  // Queued and not yet started
+} work_t;
+
+// Work queued by a timer after a delay
+typedef struct {
+    work_t work;
+    ktimer_t timer;
+} delayed_work_t;
+
+typedef struct {
+    u32 queued;             // Accepted by queue_work
+    u32 merged;             // Rejected because already pending
+    u32 run;
+    u32 max_latency_ms;     // Longest wait from queue to start
+} workqueue_stats_t;
+
+// Start the worker thread. Work queued earlier runs once it starts.
+void workqueue_init(void);
+
+void work_init(work_t *work, work_fn_t fn, void *arg);
+
+// Queue work to run once on the worker. Returns false if it was already
+// pending, in which case the pending run covers this request too. Work
+// may be re-queued from its own function. Safe from interrupt handlers.
+bool queue_work(work_t *work);
+
+// Remove work that has not started yet. Returns true if it was pending.
+bool cancel_work(work_t *work);
+
+void delayed_work_init(delayed_work_t *dw, work_fn_t fn, void *arg);
+
+// Queue dw->work after delay_ms. Returns false if the timer is already
+// armed or the work already queued.
+bool schedule_delayed_work(delayed_work_t *dw, u32 delay_ms);
+
+// Stop the timer and dequeue the work. Returns true if either was pending.
+// A run already started is not waited for.
+bool cancel_delayed_work(delayed_work_t *dw);
+
+ice_pid_t workqueue_worker_pid(void);
+void workqueue_get_stats(workqueue_stats_t *stats);
+
+#endif
@@ -0,0 +1,86 @@
+#include "mutex.h"
+#include "../cpu/irqflags.h"
+
+void mutex_init(mutex_t *m) {
+    m->locked = 0;
+    m->owner = 0;
+    m->contended = 0;
+    waitqueue_init(&m->waiters);
+}
+
+// Whether a caller whose interrupt state was flags may sleep
+static bool may_sleep(u32 flags) {
+    return (flags & EFLAGS_IF) && scheduler_can_block();
+}
+
+void mutex_lock(mutex_t *m) {
+    u32 flags = waitqueue_lock();
+
+    if (m->locked) m->contended++;
+    while (m->locked) {
+        if (may_sleep(flags)) {
+            waitqueue_wait(&m->waiters, WAIT_FOREVER);
+        } else {
+            waitqueue_unlock(flags);
+            __asm__ volatile ("pause");
+            flags = waitqueue_lock();
+        }
+    }
+
+    m->locked = 1;
+    m->owner = scheduler_get_current();
+    waitqueue_unlock(flags);
+}
+
+bool mutex_trylock(mutex_t *m) {
+    u32 flags = waitqueue_lock();
+    bool got = !m->locked;
+    if (got) {
+        m->locked = 1;
+        m->owner = scheduler_get_current();
+    }
+    waitqueue_unlock(flags);
+    return got;
+}
+
+static void mutex_unlock_locked(mutex_t *m) {
+    m->locked = 0;
+    m->owner = 0;
+    // The woken process re-checks the lock, so a running task may still
+    // take it first; that only costs the waiter another sleep
+    waitqueue_wake_one_locked(&m->waiters);
+}
+
+void mutex_unlock(mutex_t *m) {
+    u32 flags = waitqueue_lock();
+    mutex_unlock_locked(m);
+    waitqueue_unlock(flags);
+}
+
+void cond_init(condvar_t *cv) {
+    waitqueue_init(&cv->waiters);
+}
+
+bool cond_wait_timeout(condvar_t *cv, mutex_t *m, u32 timeout_ms) {
+    // Queue before anyone can see the mutex released, so a signal sent
+    // right after the unlock is not lost
+    u32 flags = waitqueue_lock();
+    mutex_unlock_locked(m);
+    bool woken = waitqueue_wait(&cv->waiters, timeout_ms);
+    waitqueue_unlock(flags);
+
+    mutex_lock(m);
+    return woken;
+}
+
+void cond_wait(condvar_t *cv, mutex_t *m) {
+    cond_wait_timeout(cv, m, WAIT_FOREVER);
+}
+
+void cond_signal(condvar_t *cv) {
+    waitqueue_wake_one(&cv->waiters);
+}
+
+void cond_broadcast(condvar_t *cv) {
+    waitqueue_wake_all(&cv->waiters);
+}
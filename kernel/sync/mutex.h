@@ -0,0 +1,40 @@
+#ifndef ICE_MUTEX_H
+#define ICE_MUTEX_H
+
+#include "../types.h"
+#include "waitqueue.h"
+#include "../proc/scheduler.h"
+
+// Sleeping lock for process context. Contended callers block instead of
+// spinning; callers that cannot block (boot, IRQs off) spin with
+// interrupts enabled so the owner can run. Not for interrupt handlers.
+typedef struct {
+    volatile u32 locked;
+    pcb_t *owner;
+    waitqueue_t waiters;
+    u32 contended;          // Acquisitions that had to wait
+} mutex_t;
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+// Condition variable used together with a mutex
+typedef struct {
+    waitqueue_t waiters;
+} condvar_t;
+
+void cond_init(condvar_t *cv);
+
+// Atomically release m and sleep until signalled, then re-acquire m.
+// Wakeups may be spurious, so callers re-check their condition in a loop.
+void cond_wait(condvar_t *cv, mutex_t *m);
+
+// As cond_wait, giving up after timeout_ms. Returns false on timeout.
+bool cond_wait_timeout(condvar_t *cv, mutex_t *m, u32 timeout_ms);
+
+void cond_signal(condvar_t *cv);
+void cond_broadcast(condvar_t *cv);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * ICE read-copy-update
+ *
+ * Each CPU counts its read-side nesting and how many outermost sections
+ * it has left. A grace period needs nothing from the CPUs themselves:
+ * the updater looks at every CPU once and waits only for those in a
+ * section, until that section has ended. Readers never touch another
+ * CPU's cache line.
+ */
+
+#include "rcu.h"
+#include "spinlock.h"
+#include "../cpu/smp.h"
+#include "../cpu/irqflags.h"
+#include "../proc/timer.h"
+#include "../proc/workqueue.h"
+
+typedef struct {
+    volatile u32 nesting;
+    volatile u32 completed;     // Outermost sections ended
+} __attribute__((aligned(64))) rcu_cpu_t;
+
+static rcu_cpu_t cpus[SMP_MAX_CPUS];
+
+// Callbacks waiting for the worker, oldest first
+static spinlock_t cb_lock;
+static rcu_head_t *cb_head = 0;
+static rcu_head_t *cb_tail = 0;
+static work_t cb_work;
+static bool ready = false;
+
+// Kicks the worker when no tick or idle loop comes by: a busy CPU with
+// nothing else to run is not ticked
+#define RCU_KICK_MS 10
+static ktimer_t kick_timer;
+
+static rcu_stats_t stats;
+
+void rcu_read_lock(void) {
+    // Interrupts off only so the count lands on the CPU we run on
+    u32 flags = irq_save();
+    rcu_cpu_t *c = &cpus[smp_cpu_id()];
+    // Locked: the reads in the section must not pass the increment,
+    // or an updater could see the CPU idle while we load an old pointer
+    __atomic_add_fetch(&c->nesting, 1, __ATOMIC_SEQ_CST);
+    irq_restore(flags);
+}
+
+void rcu_read_unlock(void) {
+    u32 flags = irq_save();
+    rcu_cpu_t *c = &cpus[smp_cpu_id()];
+    u32 n = c->nesting - 1;
+    if (!n) c->completed++;
+    __atomic_store_n(&c->nesting, n, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+bool rcu_read_lock_held(void) {
+    u32 flags = irq_save();
+    bool held = cpus[smp_cpu_id()].nesting != 0;
+    irq_restore(flags);
+    return held;
+}
+
+void synchronize_rcu(void) {
+    u64 start = timer_now_ms();
+
+    // The caller's unlink must be visible before we sample any CPU
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (u32 i = 0; i < SMP_MAX_CPUS; i++) {
+        rcu_cpu_t *c = &cpus[i];
+        u32 snap = c->completed;
+        // Out of a section, or left the one it was in: either way it
+        // cannot still hold what was unlinked. Sections are short and
+        // never preempted, so spinning is cheaper than sleeping.
+        while (c->nesting && c->completed == snap) {
+            __asm__ volatile ("pause" ::: "memory");
+        }
+    }
+
+    u32 waited = (u32)(timer_now_ms() - start);
+    spinlock_acquire(&cb_lock);
+    stats.grace_periods++;
+    if (waited > stats.max_wait_ms) stats.max_wait_ms = waited;
+    spinlock_release(&cb_lock);
+}
+
+static void run_callbacks(void *arg) {
+    (void)arg;
+
+    spinlock_acquire(&cb_lock);
+    rcu_head_t *list = cb_head;
+    cb_head = cb_tail = 0;
+    spinlock_release(&cb_lock);
+    if (!list) return;
+
+    // Everything taken here was queued before this grace period began
+    synchronize_rcu();
+
+    u32 ran = 0;
+    while (list) {
+        rcu_head_t *next = list->next;
+        list->func(list);
+        list = next;
+        ran++;
+    }
+
+    spinlock_acquire(&cb_lock);
+    stats.callbacks_run += ran;
+    spinlock_release(&cb_lock);
+}
+
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head)) {
+    head->func = func;
+    head->next = 0;
+
+    spinlock_acquire(&cb_lock);
+    bool first = !cb_head;
+    if (cb_tail) cb_tail->next = head; else cb_head = head;
+    cb_tail = head;
+    stats.callbacks_queued++;
+    spinlock_release(&cb_lock);
+    
+    if (first && ready) timer_add(&kick_timer, RCU_KICK_MS);
+}
+
+static void kick_expired(void *arg) {
+    (void)arg;
+    rcu_kick();
+}
+
+void rcu_kick(void) {
+    // Waking the worker takes the scheduler lock, which call_rcu's
+    // callers may hold; that is why queuing and kicking are separate
+    if (ready && cb_head && !cb_work.pending) queue_work(&cb_work);
+}
+
+void rcu_init(void) {
+    spinlock_init_named(&cb_lock, "rcu");
+    work_init(&cb_work, run_callbacks, 0);
+    timer_setup(&kick_timer, kick_expired, 0);
+    ready = workqueue_worker_pid() != 0;
+}
+
+void rcu_get_stats(rcu_stats_t *out) {
+    spinlock_acquire(&cb_lock);
+    *out = stats;
+    spinlock_release(&cb_lock);
+}
@@ -0,0 +1,63 @@
+#ifndef ICE_RCU_H
+#define ICE_RCU_H
+
+#include "../types.h"
+
+// Read-copy-update for read-mostly tables. Readers take no lock and
+// write no shared memory:
+//
+//     rcu_read_lock();
+//     for (p = rcu_dereference(head); p; p = rcu_dereference(p->next)) ...
+//     rcu_read_unlock();
+//
+// Writers serialise among themselves, publish a fully built object with
+// rcu_assign_pointer and unlink old ones the same way. An unlinked
+// object may still be in use by readers that found it earlier; it can
+// be freed after synchronize_rcu returns, or from a call_rcu callback.
+//
+// A read-side section is not preempted (the scheduler holds off until
+// it ends) and must not sleep, so a CPU outside one is in a quiescent
+// state: it holds no reference to anything unlinked earlier. A grace
+// period ends once every online CPU has been seen in one. Sections nest
+// and may be used in interrupt handlers.
+
+typedef struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+} rcu_head_t;
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+// Whether the calling CPU is inside a read-side section
+bool rcu_read_lock_held(void);
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// Wait until every reader that may have seen an unlinked object is
+// done. Process context, outside any read-side section.
+void synchronize_rcu(void);
+
+// Run func(head) after a grace period, from the kernel worker. Only
+// queues (and arms a timer), so it is safe with interrupts off and
+// under any lock but the timer wheel's; the scheduler tick, the idle
+// loop or that timer hand queued callbacks to the worker.
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head));
+
+// Called by the scheduler tick and the idle loop
+void rcu_kick(void);
+
+// Needs the workqueue
+void rcu_init(void);
+
+typedef struct {
+    u32 grace_periods;      // synchronize_rcu calls completed
+    u32 callbacks_queued;
+    u32 callbacks_run;
+    u32 max_wait_ms;        // Longest single grace period
+} rcu_stats_t;
+
+void rcu_get_stats(rcu_stats_t *stats);
+
+#endif
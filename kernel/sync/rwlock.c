@@ -0,0 +1,91 @@
+/*
+ * ICE reader-writer spinlocks
+ *
+ * One word: the low bits count readers, RW_WRITER marks the writer and
+ * RW_WAITING a writer spinning for the readers to drain. Readers back
+ * off while either bit is set.
+ */
+
+#include "rwlock.h"
+#include "../cpu/irqflags.h"
+
+#define RW_WRITER  0x80000000u
+#define RW_WAITING 0x40000000u
+#define RW_READERS 0x3FFFFFFFu
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+static inline bool cas(volatile u32 *ptr, u32 old, u32 val) {
+    return __atomic_compare_exchange_n(ptr, &old, val, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void rwlock_init(rwlock_t *lock) {
+    lock->count = 0;
+}
+
+bool read_trylock(rwlock_t *lock) {
+    u32 c = lock->count;
+    return !(c & (RW_WRITER | RW_WAITING)) && cas(&lock->count, c, c + 1);
+}
+
+void read_lock(rwlock_t *lock) {
+    while (!read_trylock(lock)) {
+        cpu_relax();
+    }
+}
+
+void read_unlock(rwlock_t *lock) {
+    __atomic_sub_fetch(&lock->count, 1, __ATOMIC_RELEASE);
+}
+
+bool write_trylock(rwlock_t *lock) {
+    u32 c = lock->count;
+    return !(c & ~RW_WAITING) && cas(&lock->count, c, RW_WRITER);
+}
+
+void write_lock(rwlock_t *lock) {
+    for (;;) {
+        u32 c = lock->count;
+        if (!(c & ~RW_WAITING)) {
+            // Taking the lock clears RW_WAITING; other waiting writers
+            // set it again on their next pass
+            if (cas(&lock->count, c, RW_WRITER)) return;
+        } else if (!(c & RW_WAITING)) {
+            cas(&lock->count, c, c | RW_WAITING);
+        }
+        cpu_relax();
+    }
+}
+
+void write_unlock(rwlock_t *lock) {
+    __atomic_and_fetch(&lock->count, ~RW_WRITER, __ATOMIC_RELEASE);
+}
+
+u32 read_lock_irqsave(rwlock_t *lock) {
+    u32 flags = irq_save_raw();
+    if (flags & EFLAGS_IF) trace_irqs_off_caller();
+    read_lock(lock);
+    return flags;
+}
+
+void read_unlock_irqrestore(rwlock_t *lock, u32 flags) {
+    read_unlock(lock);
+    if (flags & EFLAGS_IF) trace_irqs_on_caller();
+    irq_restore_raw(flags);
+}
+
+u32 write_lock_irqsave(rwlock_t *lock) {
+    u32 flags = irq_save_raw();
+    if (flags & EFLAGS_IF) trace_irqs_off_caller();
+    write_lock(lock);
+    return flags;
+}
+
+void write_unlock_irqrestore(rwlock_t *lock, u32 flags) {
+    write_unlock(lock);
+    if (flags & EFLAGS_IF) trace_irqs_on_caller();
+    irq_restore_raw(flags);
+}
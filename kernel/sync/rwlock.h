@@ -0,0 +1,33 @@
+#ifndef ICE_RWLOCK_H
+#define ICE_RWLOCK_H
+
+#include "../types.h"
+
+// Reader-writer spinlock. Any number of readers or one writer. A
+// waiting writer holds off new readers, so a steady stream of readers
+// cannot starve it. Not recursive: a reader must not re-take the lock
+// while a writer may be waiting.
+typedef struct {
+    volatile u32 count;     // Readers, plus RW_WRITER / RW_WAITING bits
+} rwlock_t;
+
+void rwlock_init(rwlock_t *lock);
+
+// The plain forms leave the interrupt flag alone; use them only where
+// the lock is never taken from an interrupt handler
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+
+// With interrupts off while held. Readers share the lock, so the saved
+// flags are returned instead of being kept in it.
+u32 read_lock_irqsave(rwlock_t *lock);
+void read_unlock_irqrestore(rwlock_t *lock, u32 flags);
+u32 write_lock_irqsave(rwlock_t *lock);
+void write_unlock_irqrestore(rwlock_t *lock, u32 flags);
+
+bool read_trylock(rwlock_t *lock);
+bool write_trylock(rwlock_t *lock);
+
+#endif
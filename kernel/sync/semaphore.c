@@ -0,0 +1,59 @@
+#include "semaphore.h"
+#include "../proc/scheduler.h"
+#include "../proc/timer.h"
+#include "../cpu/irqflags.h"
+
+void sem_init(semaphore_t *s, u32 count) {
+    s->count = count;
+    waitqueue_init(&s->waiters);
+}
+
+bool sem_down_timeout(semaphore_t *s, u32 timeout_ms) {
+    u32 flags = waitqueue_lock();
+    u64 deadline = timer_now_ms() + timeout_ms;
+
+    while (s->count == 0) {
+        u32 left = WAIT_FOREVER;
+        if (timeout_ms != WAIT_FOREVER) {
+            u64 now = timer_now_ms();
+            if (now >= deadline) {
+                waitqueue_unlock(flags);
+                return false;
+            }
+            left = (u32)(deadline - now);
+        }
+
+        if ((flags & EFLAGS_IF) && scheduler_can_block()) {
+            waitqueue_wait(&s->waiters, left);
+        } else {
+            // Nothing to switch to: let the interrupt that raises the
+            // count in, then look again
+            waitqueue_unlock(flags);
+            __asm__ volatile ("pause");
+            flags = waitqueue_lock();
+        }
+    }
+
+    s->count--;
+    waitqueue_unlock(flags);
+    return true;
+}
+
+void sem_down(semaphore_t *s) {
+    sem_down_timeout(s, WAIT_FOREVER);
+}
+
+bool sem_trydown(semaphore_t *s) {
+    u32 flags = waitqueue_lock();
+    bool got = s->count > 0;
+    if (got) s->count--;
+    waitqueue_unlock(flags);
+    return got;
+}
+
+void sem_up(semaphore_t *s) {
+    u32 flags = waitqueue_lock();
+    s->count++;
+    waitqueue_wake_one_locked(&s->waiters);
+    waitqueue_unlock(flags);
+}
@@ -0,0 +1,26 @@
+#ifndef ICE_SEMAPHORE_H
+#define ICE_SEMAPHORE_H
+
+#include "../types.h"
+#include "waitqueue.h"
+
+// Counting semaphore. sem_up is safe from interrupt handlers, which
+// makes it the usual way for an IRQ to hand completions to a process.
+typedef struct {
+    volatile u32 count;
+    waitqueue_t waiters;
+} semaphore_t;
+
+void sem_init(semaphore_t *s, u32 count);
+
+void sem_down(semaphore_t *s);
+
+// Returns false if the count stayed zero for timeout_ms
+bool sem_down_timeout(semaphore_t *s, u32 timeout_ms);
+
+// Take without waiting. Returns false if the count is zero.
+bool sem_trydown(semaphore_t *s);
+
+void sem_up(semaphore_t *s);
+
+#endif
@@ -0,0 +1,16 @@
+#include "seqlock.h"
+
+void seqlock_init_named(seqlock_t *sl, const char *name) {
+    sl->sequence = 0;
+    spinlock_init_named(&sl->lock, name);
+}
+
+void write_seqlock(seqlock_t *sl) {
+    spinlock_acquire(&sl->lock);
+    write_seqcount_begin(sl);
+}
+
+void write_sequnlock(seqlock_t *sl) {
+    write_seqcount_end(sl);
+    spinlock_release(&sl->lock);
+}
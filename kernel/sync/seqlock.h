@@ -0,0 +1,60 @@
+#ifndef ICE_SEQLOCK_H
+#define ICE_SEQLOCK_H
+
+#include "../types.h"
+#include "spinlock.h"
+
+// Sequence lock for small, hot, read-mostly data such as counters that
+// do not fit in one word. Writers serialise on the spinlock and bump
+// the sequence before and after the update; readers take no lock, they
+// retry if the sequence was odd or changed while they read:
+//
+//     u32 seq;
+//     do {
+//         seq = read_seqbegin(&sl);
+//         copy = data;
+//     } while (read_seqretry(&sl, seq));
+//
+// Readers must not follow pointers in the protected data, since they
+// may see it half written. Writers run with interrupts off, so readers
+// in interrupt handlers never spin on a writer they interrupted.
+typedef struct {
+    volatile u32 sequence;
+    spinlock_t lock;
+} seqlock_t;
+
+// The name labels the inner spinlock in lock statistics
+void seqlock_init_named(seqlock_t *sl, const char *name);
+#define seqlock_init(sl) seqlock_init_named((sl), #sl)
+
+static inline u32 read_seqbegin(const seqlock_t *sl) {
+    u32 seq;
+    while ((seq = sl->sequence) & 1) {
+        __asm__ volatile ("pause" ::: "memory");
+    }
+    __asm__ volatile ("" ::: "memory");
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, u32 start) {
+    __asm__ volatile ("" ::: "memory");
+    return sl->sequence != start;
+}
+
+// Disables interrupts until write_sequnlock
+void write_seqlock(seqlock_t *sl);
+void write_sequnlock(seqlock_t *sl);
+
+// Sequence only, for writers already serialised by a lock of their own
+// (and with interrupts off if interrupt handlers read)
+static inline void write_seqcount_begin(seqlock_t *sl) {
+    sl->sequence++;
+    __asm__ volatile ("" ::: "memory");
+}
+
+static inline void write_seqcount_end(seqlock_t *sl) {
+    __asm__ volatile ("" ::: "memory");
+    sl->sequence++;
+}
+
+#endif
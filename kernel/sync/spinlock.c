@@ -1,66 +1,226 @@
 #include "spinlock.h"
+#include "../cpu/irqflags.h"
 
-// Inline assembly helper to read EFLAGS
-static inline u32 read_eflags(void) {
-    u32 eflags;
-    asm volatile("pushf; pop %0" : "=r"(eflags));
-    return eflags;
+#define TICKET_ONE 0x10000     // Increment of the next field in the lock word
+
+// The lock as one word: owner in the low half, next in the high half
+static inline volatile u32 *lock_word(spinlock_t *lock) {
+    return (volatile u32*)&lock->owner;
+}
+
+// Atomically add to the lock word, returning its old value
+static inline u32 atomic_xadd(volatile u32 *ptr, u32 val) {
+    asm volatile("lock xaddl %0, %1"
+                 : "+r"(val), "+m"(*ptr)
+                 :
+                 : "memory");
+    return val;
+}
+
+static inline bool atomic_cmpxchg(volatile u32 *ptr, u32 old, u32 new_val) {
+    u32 prev;
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*ptr)
+                 : "r"(new_val), "0"(old)
+                 : "memory");
+    return prev == old;
+}
+
+#ifdef CONFIG_LOCKSTAT
+
+// Entry points take the caller's site; SITE_PARAM/SITE pass it down
+#define SPIN_FN(name) name##_at
+#define SITE_PARAM , const char *site
+#define SITE , site
+
+static lockstat_class_t classes[LOCKSTAT_MAX_CLASSES];
+static u32 class_count = 0;
+static volatile u32 classes_lock = 0;
+static lockstat_class_t overflow_class = {.name = "(other)"};
+
+static inline u64 rdtsc(void) {
+    u32 lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
 }
 
-// Inline assembly helper to disable interrupts (CLI)
-static inline void cli(void) {
-    asm volatile("cli");
+static bool same_name(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
 }
 
-// Inline assembly helper to restore interrupt state
-static inline void irq_restore(u32 flags) {
-    if (flags & 0x200) { // Check IF bit (0x200)
-        asm volatile("sti");
-    } else {
-        asm volatile("cli");
+// Test-and-set lock for the statistics themselves, which cannot use
+// spinlock_t without recording into themselves
+static inline u32 stat_lock(volatile u32 *busy) {
+    u32 flags = irq_save_raw();
+    while (__sync_lock_test_and_set(busy, 1)) {
+        asm volatile("pause" ::: "memory");
     }
+    return flags;
 }
 
-// Atomic exchange function
-static inline u32 atomic_xchg(volatile u32 *ptr, u32 new_val) {
-    u32 ret;
-    asm volatile("lock xchg %0, %1"
-                 : "+m"(*ptr), "=r"(ret)
-                 : "1"(new_val)
-                 : "memory");
-    return ret;
+static inline void stat_unlock(volatile u32 *busy, u32 flags) {
+    __sync_lock_release(busy);
+    irq_restore_raw(flags);
+}
+
+// Class for a name, created on first use
+static lockstat_class_t *class_for(const char *name) {
+    if (name[0] == '&') name++;
+    
+    u32 flags = stat_lock(&classes_lock);
+    lockstat_class_t *cls = &overflow_class;
+    for (u32 i = 0; i < class_count; i++) {
+        if (same_name(classes[i].name, name)) {
+            cls = &classes[i];
+            goto out;
+        }
+    }
+    if (class_count < LOCKSTAT_MAX_CLASSES) {
+        cls = &classes[class_count++];
+        cls->name = name;
+    }
+out:
+    stat_unlock(&classes_lock, flags);
+    return cls;
+}
+
+// Called by the new holder. The lock's own fields need nothing more, but
+// other locks of the same class may be updating it on other CPUs.
+static inline void stat_acquired(spinlock_t *lock, u64 spin, bool contended,
+                                 const char *site) {
+    if (!lock->cls) lock->cls = class_for(site);
+    lockstat_class_t *cls = lock->cls;
+    
+    u32 flags = stat_lock(&cls->busy);
+    cls->acquisitions++;
+    if (contended) {
+        cls->contended++;
+        cls->spin_cycles += spin;
+        if (spin > cls->max_spin) {
+            cls->max_spin = spin;
+            cls->max_spin_site = site;
+        }
+    }
+    stat_unlock(&cls->busy, flags);
+    lock->site = site;
+    lock->acquired_at = rdtsc();
+}
+
+static inline void stat_released(spinlock_t *lock) {
+    lockstat_class_t *cls = lock->cls;
+    if (!cls) return;
+    u64 held = rdtsc() - lock->acquired_at;
+    u32 flags = stat_lock(&cls->busy);
+    if (held > cls->max_hold) {
+        cls->max_hold = held;
+        cls->max_hold_site = lock->site;
+    }
+    stat_unlock(&cls->busy, flags);
+}
+
+u32 lockstat_class_count(void) {
+    return class_count;
+}
+
+bool lockstat_get(u32 idx, lockstat_class_t *out) {
+    if (idx >= class_count) return false;
+    lockstat_class_t *cls = &classes[idx];
+    u32 flags = stat_lock(&cls->busy);
+    *out = *cls;
+    stat_unlock(&cls->busy, flags);
+    out->busy = 0;
+    return true;
+}
+
+void lockstat_reset(void) {
+    for (u32 i = 0; i < class_count; i++) {
+        lockstat_class_t *cls = &classes[i];
+        u32 flags = stat_lock(&cls->busy);
+        cls->acquisitions = 0;
+        cls->contended = 0;
+        cls->spin_cycles = 0;
+        cls->max_spin = 0;
+        cls->max_hold = 0;
+        cls->max_spin_site = 0;
+        cls->max_hold_site = 0;
+        stat_unlock(&cls->busy, flags);
+    }
 }
 
+#else
+
+#define SPIN_FN(name) name
+#define SITE_PARAM
+#define SITE
+
+#endif
+
+// Take a ticket and wait for it to be served
+static inline void ticket_lock(spinlock_t *lock SITE_PARAM) {
+    u32 old = atomic_xadd(lock_word(lock), TICKET_ONE);
+    u16 ticket = (u16)(old >> 16);
+    
+#ifdef CONFIG_LOCKSTAT
+    u64 spin = 0;
+    if ((u16)old != ticket) {
+        u64 start = rdtsc();
+        while (lock->owner != ticket) {
+            asm volatile("pause" ::: "memory");
+        }
+        spin = rdtsc() - start;
+    }
+    stat_acquired(lock, spin, (u16)old != ticket, site);
+#else
+    if ((u16)old == ticket) return;
+    while (lock->owner != ticket) {
+        asm volatile("pause" ::: "memory");
+    }
+#endif
+}
+
+// Only the holder writes owner, so a plain 16-bit increment hands the
+// lock on without disturbing next
+static inline void ticket_unlock(spinlock_t *lock) {
+#ifdef CONFIG_LOCKSTAT
+    stat_released(lock);
+#endif
+    asm volatile("incw %0" : "+m"(lock->owner) : : "memory");
+}
+
+static inline bool ticket_trylock(spinlock_t *lock SITE_PARAM) {
+    u32 old = *lock_word(lock);
+    if ((u16)old != (u16)(old >> 16)) return false;
+    if (!atomic_cmpxchg(lock_word(lock), old, old + TICKET_ONE)) return false;
+#ifdef CONFIG_LOCKSTAT
+    stat_acquired(lock, 0, false, site);
+#endif
+    return true;
+}
+
+#ifdef CONFIG_LOCKSTAT
+void spinlock_init_named(spinlock_t *lock, const char *name) {
+    lock->owner = 0;
+    lock->next = 0;
+    lock->eflags = 0;
+    lock->cls = class_for(name);
+    lock->acquired_at = 0;
+    lock->site = 0;
+}
+#else
 void spinlock_init(spinlock_t *lock) {
-    lock->locked = 0;
+    lock->owner = 0;
+    lock->next = 0;
     lock->eflags = 0;
 }
+#endif
 
-void spinlock_acquire(spinlock_t *lock) {
-    // 1. Save interrupt state and disable interrupts
-    u32 flags = read_eflags();
-    cli();
-
-    // 2. Try to acquire the lock
-    // Simple test-and-set spinloop
-    while (atomic_xchg(&lock->locked, 1) == 1) {
-        // If we failed, paused interrupts are still disabled, which is good.
-        // But we should momentarily re-enable them? 
-        // NO, if we are single core, we CANNOT wait for a lock held by THIS cpu if IRQs are off.
-        // But if we are multi-core, other CPU releases it.
-        // Requirement says "single-CPU safety". On single CPU, a spinlock is just disable IRQ.
-        // If locked==1 on single CPU, it means WE hold it (deadlock) or ISR holds it (deadlock if we wait in ISR).
-        // For simplicity and "single-CPU safety", we just rely on CLI.
-        // However, to support future SMP, we do the atomic check.
-        
-        // Spin hint
-        asm volatile("pause");
-        
-        // If we are spinning, we shouldn't have interrupts disabled usually?
-        // But if we use spinlock as "irq save", we must keep them disabled to prevent
-        // the other thread (ISR) from running on THIS CPU.
-        // So we just spin.
-    }
+void SPIN_FN(spinlock_acquire)(spinlock_t *lock SITE_PARAM) {
+    // Interrupts go off before taking a ticket and stay off while
+    // waiting, so an IRQ on this CPU cannot deadlock against us
+    u32 flags = irq_save_raw();
+    if (flags & EFLAGS_IF) trace_irqs_off_caller();
+    ticket_lock(lock SITE);
     
     // We strictly store the flags from BEFORE we acquired.
     // NOTE: This basic implementation assumes non-recursive locks.
@@ -68,17 +228,39 @@ void spinlock_acquire(spinlock_t *lock) {
 }
 
 void spinlock_release(spinlock_t *lock) {
-    // 1. Get saved flags
     u32 flags = lock->eflags;
-    
-    // 2. Release lock
-    // Use simple store with barrier, but xchg is safer/easier to reason about order.
-    // atomic_xchg(&lock->locked, 0); 
-    // Just a release barrier and store is enough on x86. x86 stores are ordered.
-    // Compiler barrier:
-    asm volatile("" ::: "memory");
-    lock->locked = 0;
-    
-    // 3. Restore interrupts
-    irq_restore(flags);
+    ticket_unlock(lock);
+    if (flags & EFLAGS_IF) trace_irqs_on_caller();
+    irq_restore_raw(flags);
+}
+
+bool SPIN_FN(spinlock_try_acquire)(spinlock_t *lock SITE_PARAM) {
+    u32 flags = irq_save_raw();
+
+    if (!ticket_trylock(lock SITE)) {
+        irq_restore_raw(flags);
+        return false;
+    }
+
+    if (flags & EFLAGS_IF) trace_irqs_off_caller();
+    lock->eflags = flags;
+    return true;
+}
+
+void SPIN_FN(spinlock_acquire_raw)(spinlock_t *lock SITE_PARAM) {
+    ticket_lock(lock SITE);
+}
+
+void spinlock_release_raw(spinlock_t *lock) {
+    ticket_unlock(lock);
+}
+
+bool spinlock_is_locked(spinlock_t *lock) {
+    u32 word = *lock_word(lock);
+    return (u16)word != (u16)(word >> 16);
+}
+
+bool spinlock_is_contended(spinlock_t *lock) {
+    u32 word = *lock_word(lock);
+    return (u16)((word >> 16) - word) > 1;
 }
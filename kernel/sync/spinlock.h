@@ -3,18 +3,94 @@
 
 #include "../types.h"
 
+#ifdef CONFIG_LOCKSTAT
+struct lockstat_class;
+#endif
+
+// Ticket lock: acquirers take the next ticket and are served in order,
+// so a lock under contention is handed over FIFO instead of to whoever
+// wins the cache line. Waiters only read the lock word while spinning.
 typedef struct {
-    volatile u32 locked;
+    volatile u16 owner;     // Ticket being served
+    volatile u16 next;      // Next ticket to hand out
     u32 eflags; // To save interrupt state
+#ifdef CONFIG_LOCKSTAT
+    struct lockstat_class *cls;
+    u64 acquired_at;        // TSC when the holder got the lock
+    const char *site;       // Where the holder took it
+#endif
 } spinlock_t;
 
+#ifdef CONFIG_LOCKSTAT
+
+// Lock statistics (make LOCKSTAT=1). Locks with the same name share a
+// class; a lock never initialised is named after its first call site.
+// Each entry point records its caller's file:line. Locks embedded in
+// other objects should be given a name of their own with
+// spinlock_init_named, or every instance ends up as "x->lock".
+#define LOCKSTAT_MAX_CLASSES 64
+#define LOCKSTAT_STR(x) #x
+#define LOCKSTAT_XSTR(x) LOCKSTAT_STR(x)
+#define LOCKSTAT_SITE __FILE__ ":" LOCKSTAT_XSTR(__LINE__)
+
+typedef struct lockstat_class {
+    const char *name;
+    u32 acquisitions;
+    u32 contended;          // Acquisitions that had to wait
+    u64 spin_cycles;        // Total waiting
+    u64 max_spin;
+    u64 max_hold;
+    const char *max_spin_site;
+    const char *max_hold_site;
+    volatile u32 busy;      // Guards the counters: a class spans locks
+} lockstat_class_t;
+
+void spinlock_init_named(spinlock_t *lock, const char *name);
+void spinlock_acquire_at(spinlock_t *lock, const char *site);
+bool spinlock_try_acquire_at(spinlock_t *lock, const char *site);
+void spinlock_acquire_raw_at(spinlock_t *lock, const char *site);
+
+#define spinlock_init(lock)        spinlock_init_named((lock), #lock)
+#define spinlock_acquire(lock)     spinlock_acquire_at((lock), LOCKSTAT_SITE)
+#define spinlock_try_acquire(lock) spinlock_try_acquire_at((lock), LOCKSTAT_SITE)
+#define spinlock_acquire_raw(lock) spinlock_acquire_raw_at((lock), LOCKSTAT_SITE)
+
+u32 lockstat_class_count(void);
+
+// Copy of class idx; false past the last one
+bool lockstat_get(u32 idx, lockstat_class_t *out);
+
+// Zero every counter, keeping the classes
+void lockstat_reset(void);
+
+#else
+
 // Initialize a spinlock
 void spinlock_init(spinlock_t *lock);
 
+// As spinlock_init; the name is only kept by LOCKSTAT builds
+#define spinlock_init_named(lock, name) ((void)(name), spinlock_init(lock))
+
 // Acquire the lock (disables interrupts)
 void spinlock_acquire(spinlock_t *lock);
 
+// Acquire only if free; returns false without spinning otherwise
+bool spinlock_try_acquire(spinlock_t *lock);
+
+void spinlock_acquire_raw(spinlock_t *lock);
+
+#endif
+
 // Release the lock (restores interrupts)
 void spinlock_release(spinlock_t *lock);
 
+// The _raw forms take/drop the lock without touching the interrupt flag.
+// For callers that manage interrupts themselves, e.g. a lock held across
+// a context switch, where the saved flags belong to each side's own stack.
+void spinlock_release_raw(spinlock_t *lock);
+
+// Whether the lock is held / other CPUs are queued behind the holder
+bool spinlock_is_locked(spinlock_t *lock);
+bool spinlock_is_contended(spinlock_t *lock);
+
 #endif // ICE_SPINLOCK_H
@@ -0,0 +1,168 @@
+/*
+ * ICE wait queues
+ *
+ * A waiter links an entry from its own stack into the queue, marks
+ * itself blocked and yields. Wakers (usually IRQ handlers) dequeue the
+ * entry and hand the process back to the scheduler. Queue changes are
+ * made under wq_lock with interrupts off.
+ */
+
+#include "waitqueue.h"
+#include "spinlock.h"
+#include "../proc/scheduler.h"
+#include "../cpu/irqflags.h"
+#include "../errno.h"
+
+static spinlock_t wq_lock;
+
+static void wq_append(waitqueue_t *wq, wait_entry_t *e) {
+    e->wq = wq;
+    e->next = 0;
+    e->prev = wq->tail;
+    if (wq->tail) wq->tail->next = e;
+    else wq->head = e;
+    wq->tail = e;
+}
+
+static void wq_unlink(wait_entry_t *e) {
+    waitqueue_t *wq = e->wq;
+    if (!wq) return;
+
+    if (e->prev) e->prev->next = e->next;
+    else wq->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else wq->tail = e->prev;
+    e->next = e->prev = 0;
+    e->wq = 0;
+}
+
+u32 waitqueue_lock(void) {
+    u32 flags = irq_save();
+    spinlock_acquire_raw(&wq_lock);
+    return flags;
+}
+
+void waitqueue_unlock(u32 flags) {
+    spinlock_release_raw(&wq_lock);
+    irq_restore(flags);
+}
+
+static void wait_timeout(void *arg) {
+    wait_entry_t *e = (wait_entry_t*)arg;
+    u32 flags = waitqueue_lock();
+    // A waker may have dequeued the entry while this timer was firing
+    if (e->wq) {
+        wq_unlink(e);
+        scheduler_wake(e->proc);
+    }
+    waitqueue_unlock(flags);
+}
+
+void waitqueue_init(waitqueue_t *wq) {
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+bool waitqueue_can_sleep(void) {
+    return irqs_enabled() && scheduler_can_block();
+}
+
+// E_OK when woken, E_TIMEOUT when the time ran out or the caller
+// cannot block, E_KILLED when a kill ended a killable wait
+static int wait_on(waitqueue_t *wq, u32 timeout_ms, bool killable) {
+    if (killable && scheduler_killed()) return E_KILLED;
+    if (timeout_ms == 0 || !scheduler_can_block()) return E_TIMEOUT;
+
+    wait_entry_t entry;
+    entry.proc = scheduler_get_current();
+    entry.woken = false;
+    entry.timeout = 0;
+    wq_append(wq, &entry);
+
+    ktimer_t timer;
+    if (timeout_ms != WAIT_FOREVER) {
+        timer_setup(&timer, wait_timeout, &entry);
+        timer_add(&timer, timeout_ms);
+        entry.timeout = &timer;
+    }
+
+    bool blocked = scheduler_prepare_block(killable);
+    spinlock_release_raw(&wq_lock);
+    if (blocked) scheduler_block();
+
+    // The timeout may be firing on another CPU; it takes wq_lock
+    if (timeout_ms != WAIT_FOREVER) timer_cancel_sync(&timer);
+    spinlock_acquire_raw(&wq_lock);
+    wq_unlink(&entry);
+    if (entry.woken) return E_OK;
+    return killable && scheduler_killed() ? E_KILLED : E_TIMEOUT;
+}
+
+bool waitqueue_wait(waitqueue_t *wq, u32 timeout_ms) {
+    return wait_on(wq, timeout_ms, false) == E_OK;
+}
+
+int waitqueue_wait_killable(waitqueue_t *wq, u32 timeout_ms) {
+    return wait_on(wq, timeout_ms, true);
+}
+
+bool waitqueue_wait_until(waitqueue_t *wq, bool (*cond)(void *arg),
+                          void *arg, u32 timeout_ms) {
+    if (!waitqueue_can_sleep()) return cond(arg);
+
+    u32 flags = waitqueue_lock();
+    u64 deadline = timer_now_ms() + timeout_ms;
+    bool done;
+
+    while (!(done = cond(arg))) {
+        u32 left = WAIT_FOREVER;
+        if (timeout_ms != WAIT_FOREVER) {
+            u64 now = timer_now_ms();
+            if (now >= deadline) break;
+            left = (u32)(deadline - now);
+        }
+        waitqueue_wait(wq, left);
+    }
+
+    waitqueue_unlock(flags);
+    return done;
+}
+
+static bool wake_entry(waitqueue_t *wq) {
+    wait_entry_t *e = wq->head;
+    if (!e) return false;
+
+    // Leave nothing on the waiter's stack linked, so it can be killed
+    // before it gets to run again
+    wq_unlink(e);
+    if (e->timeout) {
+        timer_cancel(e->timeout);
+        e->timeout = 0;
+    }
+    e->woken = true;
+    scheduler_wake(e->proc);
+    return true;
+}
+
+u32 waitqueue_wake_one_locked(waitqueue_t *wq) {
+    return wake_entry(wq) ? 1 : 0;
+}
+
+u32 waitqueue_wake_one(waitqueue_t *wq) {
+    u32 flags = waitqueue_lock();
+    u32 n = wake_entry(wq) ? 1 : 0;
+    waitqueue_unlock(flags);
+    return n;
+}
+
+u32 waitqueue_wake_all(waitqueue_t *wq) {
+    u32 flags = waitqueue_lock();
+    u32 n = 0;
+    while (wake_entry(wq)) n++;
+    waitqueue_unlock(flags);
+    return n;
+}
+
+bool waitqueue_active(waitqueue_t *wq) {
+    return wq->head != 0;
+}
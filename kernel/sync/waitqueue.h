@@ -0,0 +1,70 @@
+#ifndef ICE_WAITQUEUE_H
+#define ICE_WAITQUEUE_H
+
+#include "../types.h"
+#include "../proc/timer.h"
+
+// scheduler.h includes this header for the PCB's exit queue
+struct pcb;
+
+#define WAIT_FOREVER 0xFFFFFFFFu
+
+// One sleeping process. Lives on the waiter's stack while it sleeps.
+typedef struct wait_entry {
+    struct pcb *proc;
+    struct wait_entry *next;
+    struct wait_entry *prev;
+    struct waitqueue *wq;   // Queue holding the entry, 0 once dequeued
+    ktimer_t *timeout;      // Armed timeout, cancelled by the waker
+    bool woken;
+} wait_entry_t;
+
+// FIFO of blocked processes waiting for an event
+typedef struct waitqueue {
+    wait_entry_t *head;
+    wait_entry_t *tail;
+} waitqueue_t;
+
+void waitqueue_init(waitqueue_t *wq);
+
+// Whether the caller may sleep on a wait queue: interrupts are on (so
+// a wakeup can arrive) and the scheduler has another context to run.
+// Drivers fall back to polling when this is false, e.g. during boot.
+bool waitqueue_can_sleep(void);
+
+// All wait queues share one IRQ-safe lock. Holding it while checking a
+// wait condition and queueing orders the check against the waker, which
+// takes it to dequeue; sync primitives also use it for their own state.
+u32 waitqueue_lock(void);
+void waitqueue_unlock(u32 flags);
+
+// Block on wq until woken or timeout_ms passes (WAIT_FOREVER for no
+// timeout). Called with waitqueue_lock held, after checking the wait
+// condition; the lock is dropped while asleep and held again on return.
+// Returns true if woken, false on timeout or when the caller cannot block.
+// A kill does not end the wait; the process exits once it is back at a
+// safe point (see scheduler_kill_process).
+bool waitqueue_wait(waitqueue_t *wq, u32 timeout_ms);
+
+// As waitqueue_wait, but a kill ends the sleep too. Returns E_OK when
+// woken, E_TIMEOUT on timeout and E_KILLED once the caller has been
+// killed, after which it should give up and return.
+int waitqueue_wait_killable(waitqueue_t *wq, u32 timeout_ms);
+
+// Sleep until cond(arg) is true or timeout_ms passes. cond is checked
+// under waitqueue_lock. Returns the final value of cond. When the caller
+// cannot sleep, cond is checked once and the caller should poll.
+bool waitqueue_wait_until(waitqueue_t *wq, bool (*cond)(void *arg),
+                          void *arg, u32 timeout_ms);
+
+// Wake the longest waiter / every waiter. Safe from interrupt handlers.
+// Return the number of processes woken.
+u32 waitqueue_wake_one(waitqueue_t *wq);
+u32 waitqueue_wake_all(waitqueue_t *wq);
+
+// waitqueue_wake_one for callers already holding waitqueue_lock
+u32 waitqueue_wake_one_locked(waitqueue_t *wq);
+
+bool waitqueue_active(waitqueue_t *wq);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "console.h"
 #include "../drivers/vga.h"
+#include "../mm/memacct.h"
 
  
 static console_t consoles[NUM_CONSOLES];
@@ -25,6 +26,7 @@ void console_init(void) {
     }
     
     current_console = 0;
+    memacct_static(MEM_TAG_TTY, "console back buffers", sizeof(consoles));
 }
 
 void console_switch(int num) {